@@ -1,7 +1,8 @@
 #!/bin/sh
 
-DISABLE_VARS="external|yes|FORCE_IN_TREE_DEPENDENCIES"
+DISABLE_VARS="external|yes|FORCE_IN_TREE_DEPENDENCIES coroutines|no|ENABLE_COROUTINES"
 DISABLE_FORCE_IN_TREE_DEPENDENCIES_DOC="force in-tree dependencies, even when a system library is available"
+DISABLE_ENABLE_COROUTINES_DOC="run splice-only plugins in a thread instead of a coroutine"
 
 for plugin in \
     brieflz \
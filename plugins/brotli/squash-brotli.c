@@ -37,7 +37,8 @@ enum SquashBrotliOptionIndex {
   SQUASH_BROTLI_OPT_LEVEL = 0,
   SQUASH_BROTLI_OPT_WINDOW_SIZE,
   SQUASH_BROTLI_OPT_BLOCK_SIZE,
-  SQUASH_BROTLI_OPT_MODE
+  SQUASH_BROTLI_OPT_MODE,
+  SQUASH_BROTLI_OPT_DICTIONARY
 };
 
 static SquashOptionInfo squash_brotli_options[] = {
@@ -70,6 +71,8 @@ static SquashOptionInfo squash_brotli_options[] = {
         { "font", BROTLI_MODE_FONT },
         { NULL, 0 } } },
     .default_value.int_value = BROTLI_MODE_GENERIC },
+  { "dictionary",
+    SQUASH_OPTION_TYPE_DICTIONARY, },
   { NULL, SQUASH_OPTION_TYPE_NONE, }
 };
 
@@ -97,12 +100,12 @@ static void                 squash_brotli_stream_destroy  (void* stream);
 
 static void*
 squash_brotli_malloc (void* opaque, size_t size) {
-  return squash_malloc (size);
+  return squash_allocator_malloc ((SquashAllocator*) opaque, size);
 }
 
 static void
 squash_brotli_free (void* opaque, void* ptr) {
-  squash_free (ptr);
+  squash_allocator_free ((SquashAllocator*) opaque, ptr);
 }
 
 static SquashBrotliStream*
@@ -127,15 +130,25 @@ squash_brotli_stream_init (SquashBrotliStream* s,
   SquashStream* stream = (SquashStream*) s;
   squash_stream_init (stream, codec, stream_type, (SquashOptions*) options, destroy_notify);
 
+  /* Brotli doesn't copy the dictionary, but the stream holds a
+     reference to the options, which hold one to the dictionary. */
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (options, codec, SQUASH_BROTLI_OPT_DICTIONARY);
+
   if (stream_type == SQUASH_STREAM_COMPRESS) {
-    s->ctx.encoder = BrotliEncoderCreateInstance(squash_brotli_malloc, squash_brotli_free, NULL);
+    s->ctx.encoder = BrotliEncoderCreateInstance(squash_brotli_malloc, squash_brotli_free, stream->allocator);
 
     BrotliEncoderSetParameter(s->ctx.encoder, BROTLI_PARAM_QUALITY, squash_options_get_int_at (options, codec, SQUASH_BROTLI_OPT_LEVEL));
     BrotliEncoderSetParameter(s->ctx.encoder, BROTLI_PARAM_LGWIN, squash_options_get_int_at (options, codec, SQUASH_BROTLI_OPT_WINDOW_SIZE));
     BrotliEncoderSetParameter(s->ctx.encoder, BROTLI_PARAM_LGBLOCK, squash_options_get_int_at (options, codec, SQUASH_BROTLI_OPT_BLOCK_SIZE));
     BrotliEncoderSetParameter(s->ctx.encoder, BROTLI_PARAM_MODE, squash_options_get_int_at (options, codec, SQUASH_BROTLI_OPT_MODE));
+
+    if (dictionary != NULL)
+      BrotliEncoderSetCustomDictionary(s->ctx.encoder, squash_dictionary_get_size (dictionary), squash_dictionary_get_data (dictionary));
   } else if (stream_type == SQUASH_STREAM_DECOMPRESS) {
-    s->ctx.decoder = BrotliCreateState(squash_brotli_malloc, squash_brotli_free, NULL);
+    s->ctx.decoder = BrotliCreateState(squash_brotli_malloc, squash_brotli_free, stream->allocator);
+
+    if (dictionary != NULL)
+      BrotliSetCustomDictionary(squash_dictionary_get_size (dictionary), squash_dictionary_get_data (dictionary), s->ctx.decoder);
   } else {
     squash_assert_unreachable();
   }
@@ -226,6 +239,39 @@ squash_brotli_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_s
   return BrotliEncoderMaxCompressedSize(uncompressed_size);
 }
 
+/* The one-shot buffer functions don't accept a custom dictionary, so
+   when one is set the buffer is run through a stream instead. */
+static SquashStatus
+squash_brotli_process_buffer_with_stream (SquashCodec* codec,
+                                          SquashStreamType stream_type,
+                                          size_t* output_size,
+                                          uint8_t output[SQUASH_ARRAY_PARAM(*output_size)],
+                                          size_t input_size,
+                                          const uint8_t input[SQUASH_ARRAY_PARAM(input_size)],
+                                          SquashOptions* options) {
+  SquashStatus res;
+  SquashStream* stream = (SquashStream*) squash_brotli_stream_new (codec, stream_type, options);
+
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  stream->next_in = input;
+  stream->avail_in = input_size;
+  stream->next_out = output;
+  stream->avail_out = *output_size;
+
+  do {
+    res = squash_stream_finish (stream);
+  } while (res == SQUASH_PROCESSING);
+
+  if (res == SQUASH_OK)
+    *output_size = stream->total_out;
+
+  squash_object_unref (stream);
+
+  return res;
+}
+
 static SquashStatus
 squash_brotli_compress_buffer (SquashCodec* codec,
                                size_t* compressed_size,
@@ -238,6 +284,12 @@ squash_brotli_compress_buffer (SquashCodec* codec,
   const BrotliEncoderMode mode = (BrotliEncoderMode)
     squash_options_get_int_at (options, codec, SQUASH_BROTLI_OPT_MODE);
 
+  if (squash_options_get_dictionary_at (options, codec, SQUASH_BROTLI_OPT_DICTIONARY) != NULL)
+    return squash_brotli_process_buffer_with_stream (codec, SQUASH_STREAM_COMPRESS,
+                                                     compressed_size, compressed,
+                                                     uncompressed_size, uncompressed,
+                                                     options);
+
   const int res = BrotliEncoderCompress (quality, lgwin, mode, uncompressed_size, uncompressed, compressed_size, compressed);
 
   return SQUASH_LIKELY(res == 1) ? SQUASH_OK : squash_error (SQUASH_BUFFER_FULL);
@@ -250,6 +302,12 @@ squash_brotli_decompress_buffer (SquashCodec* codec,
                                  size_t compressed_size,
                                  const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
                                  SquashOptions* options) {
+  if (squash_options_get_dictionary_at (options, codec, SQUASH_BROTLI_OPT_DICTIONARY) != NULL)
+    return squash_brotli_process_buffer_with_stream (codec, SQUASH_STREAM_DECOMPRESS,
+                                                     decompressed_size, decompressed,
+                                                     compressed_size, compressed,
+                                                     options);
+
   const BrotliResult res = BrotliDecompressBuffer(compressed_size, compressed, decompressed_size, decompressed);
 
   return SQUASH_LIKELY(res == BROTLI_RESULT_SUCCESS) ? SQUASH_OK : squash_error (SQUASH_BUFFER_FULL);
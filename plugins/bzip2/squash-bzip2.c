@@ -26,6 +26,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 
 #include <squash/squash.h>
@@ -76,24 +77,20 @@ static void              squash_bz2_stream_destroy  (void* stream);
 
 static void*
 squash_bz2_malloc (void* opaque, int a, int b) {
-  return squash_malloc (((size_t) a) * ((size_t) b));
+  return squash_allocator_malloc ((SquashAllocator*) opaque, ((size_t) a) * ((size_t) b));
 }
 
 static void
 squash_bz2_free (void* opaque, void* ptr) {
-  squash_free (ptr);
+  squash_allocator_free ((SquashAllocator*) opaque, ptr);
 }
 
-static SquashBZ2Stream*
-squash_bz2_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+static int
+squash_bz2_stream_setup (SquashBZ2Stream* stream) {
+  SquashCodec* codec = ((SquashStream*) stream)->codec;
+  SquashOptions* options = ((SquashStream*) stream)->options;
+  SquashStreamType stream_type = ((SquashStream*) stream)->stream_type;
   int bz2_e = 0;
-  SquashBZ2Stream* stream;
-
-  assert (codec != NULL);
-  assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
-
-  stream = squash_malloc (sizeof (SquashBZ2Stream));
-  squash_bz2_stream_init (stream, codec, stream_type, options, squash_bz2_stream_destroy);
 
   if (stream_type == SQUASH_STREAM_COMPRESS) {
     bz2_e = BZ2_bzCompressInit (&(stream->stream),
@@ -108,7 +105,20 @@ squash_bz2_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashO
     squash_assert_unreachable();
   }
 
-  if (bz2_e != BZ_OK) {
+  return bz2_e;
+}
+
+static SquashBZ2Stream*
+squash_bz2_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  SquashBZ2Stream* stream;
+
+  assert (codec != NULL);
+  assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
+
+  stream = squash_malloc (sizeof (SquashBZ2Stream));
+  squash_bz2_stream_init (stream, codec, stream_type, options, squash_bz2_stream_destroy);
+
+  if (squash_bz2_stream_setup (stream) != BZ_OK) {
     /* We validate the params so OOM is really the only time this
        should happen, and that really shouldn't be happening here. */
     stream = squash_object_unref (stream);
@@ -128,20 +138,25 @@ squash_bz2_stream_init (SquashBZ2Stream* stream,
   bz_stream tmp   = { 0, };
   tmp.bzalloc     = squash_bz2_malloc;
   tmp.bzfree      = squash_bz2_free;
-  tmp.opaque      = squash_codec_get_context (codec);
+  tmp.opaque      = ((SquashStream*) stream)->allocator;
   stream->stream  = tmp;
 }
 
 static void
-squash_bz2_stream_destroy (void* stream) {
+squash_bz2_stream_end (SquashBZ2Stream* stream) {
   switch (((SquashStream*) stream)->stream_type) {
     case SQUASH_STREAM_COMPRESS:
-      BZ2_bzCompressEnd (&(((SquashBZ2Stream*) stream)->stream));
+      BZ2_bzCompressEnd (&(stream->stream));
       break;
     case SQUASH_STREAM_DECOMPRESS:
-      BZ2_bzDecompressEnd (&(((SquashBZ2Stream*) stream)->stream));
+      BZ2_bzDecompressEnd (&(stream->stream));
       break;
   }
+}
+
+static void
+squash_bz2_stream_destroy (void* stream) {
+  squash_bz2_stream_end ((SquashBZ2Stream*) stream);
 
   squash_stream_destroy (stream);
 }
@@ -168,6 +183,23 @@ squash_bz2_status_to_squash_status (int status) {
   }
 }
 
+static SquashStatus
+squash_bz2_reset_stream (SquashStream* stream) {
+  SquashBZ2Stream* s = (SquashBZ2Stream*) stream;
+
+  /* libbzip2 has no reset function, but recycling the stream still
+     saves reallocating the SquashStream itself. */
+  squash_bz2_stream_end (s);
+
+  bz_stream tmp = { 0, };
+  tmp.bzalloc   = s->stream.bzalloc;
+  tmp.bzfree    = s->stream.bzfree;
+  tmp.opaque    = s->stream.opaque;
+  s->stream     = tmp;
+
+  return squash_bz2_status_to_squash_status (squash_bz2_stream_setup (s));
+}
+
 #define SQUASH_BZ2_STREAM_COPY_TO_BZ_STREAM(stream,bz2_stream) \
   bz2_stream->next_in = (char*) stream->next_in; \
   bz2_stream->avail_in = (unsigned int) stream->avail_in; \
@@ -281,6 +313,219 @@ squash_bz2_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_size
     600;
 }
 
+/* bzip2 blocks are independent, but they are not byte-aligned and
+   their size is not recorded anywhere, so the only way to find them is
+   to search for the 48-bit magic number which precedes each one.  A
+   block can then be decoded by shifting it into a stream of its own. */
+
+#define SQUASH_BZ2_BLOCK_MAGIC UINT64_C(0x314159265359)
+#define SQUASH_BZ2_EOS_MAGIC   UINT64_C(0x177245385090)
+#define SQUASH_BZ2_MAGIC_MASK  UINT64_C(0xffffffffffff)
+
+/* Read up to 56 bits starting at an arbitrary bit offset, padding
+   with zeros past the end of the buffer. */
+static uint64_t
+squash_bz2_read_bits (size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)], size_t bit, unsigned int n_bits) {
+  const size_t first = bit / 8;
+  uint64_t v = 0;
+
+  assert (n_bits <= 56);
+
+  /* Shifting a 64-bit value by 64 is undefined */
+  if (n_bits == 0)
+    return 0;
+
+  for (size_t i = 0 ; i < 8 ; i++)
+    v = (v << 8) | ((first + i < size) ? data[first + i] : 0);
+
+  return (v >> (64 - (bit % 8) - n_bits)) & ((UINT64_C(1) << n_bits) - 1);
+}
+
+typedef struct SquashBZ2BitWriter_ {
+  uint8_t* data;
+  size_t bit;
+} SquashBZ2BitWriter;
+
+static void
+squash_bz2_write_bits (SquashBZ2BitWriter* writer, uint64_t value, unsigned int n_bits) {
+  while (n_bits-- > 0) {
+    const uint8_t b = (uint8_t) ((value >> n_bits) & 1);
+    uint8_t* byte = writer->data + (writer->bit / 8);
+    if ((writer->bit % 8) == 0)
+      *byte = 0;
+    *byte |= (uint8_t) (b << (7 - (writer->bit % 8)));
+    writer->bit++;
+  }
+}
+
+static SquashStatus
+squash_bz2_split_frames (SquashCodec* codec,
+                         size_t compressed_size,
+                         const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                         size_t* n_frames,
+                         SquashFrame** frames) {
+  /* Which bit offsets a magic number could start at, given the value
+     of the byte two after the one it starts in.  That byte is entirely
+     inside the magic, so this rules out most positions cheaply. */
+  uint8_t block_candidates[256] = { 0, };
+  uint8_t eos_candidates[256] = { 0, };
+  size_t* starts = NULL;
+  size_t n_starts = 0, allocated = 0;
+  size_t eos = 0;
+
+  if (compressed_size < 14 || memcmp (compressed, "BZh", 3) != 0 ||
+      compressed[3] < '1' || compressed[3] > '9' ||
+      squash_bz2_read_bits (compressed_size, compressed, 32, 48) != SQUASH_BZ2_BLOCK_MAGIC)
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  for (unsigned int shift = 0 ; shift < 8 ; shift++) {
+    block_candidates[(SQUASH_BZ2_BLOCK_MAGIC >> (24 + shift)) & 0xff] |= (uint8_t) (1 << shift);
+    eos_candidates[(SQUASH_BZ2_EOS_MAGIC >> (24 + shift)) & 0xff] |= (uint8_t) (1 << shift);
+  }
+
+  for (size_t pos = 4 ; pos + 2 < compressed_size && eos == 0 ; pos++) {
+    const uint8_t b = compressed[pos + 2];
+    if ((block_candidates[b] | eos_candidates[b]) == 0)
+      continue;
+
+    for (unsigned int shift = 0 ; shift < 8 ; shift++) {
+      const size_t bit = (pos * 8) + shift;
+      if ((block_candidates[b] & (1 << shift)) != 0 &&
+          squash_bz2_read_bits (compressed_size, compressed, bit, 48) == SQUASH_BZ2_BLOCK_MAGIC) {
+        if (n_starts == allocated) {
+          allocated = (allocated == 0) ? 64 : allocated * 2;
+          size_t* tmp = squash_realloc (starts, allocated * sizeof (size_t));
+          if (tmp == NULL) {
+            squash_free (starts);
+            return squash_error (SQUASH_MEMORY);
+          }
+          starts = tmp;
+        }
+        starts[n_starts++] = bit;
+      } else if ((eos_candidates[b] & (1 << shift)) != 0 &&
+                 squash_bz2_read_bits (compressed_size, compressed, bit, 48) == SQUASH_BZ2_EOS_MAGIC) {
+        eos = bit;
+        break;
+      }
+    }
+  }
+
+  /* The stream must run to the end of the buffer, since the decoder
+     stops after the first one; and the combined CRC must match, which
+     rules out a magic number turning up by chance inside a block. */
+  uint32_t combined_crc = 0;
+  for (size_t i = 0 ; i < n_starts ; i++) {
+    const uint32_t block_crc = (uint32_t) squash_bz2_read_bits (compressed_size, compressed, starts[i] + 48, 32);
+    combined_crc = ((combined_crc << 1) | (combined_crc >> 31)) ^ block_crc;
+  }
+  if (eos == 0 || n_starts == 0 ||
+      ((eos + 48 + 32 + 7) / 8) != compressed_size ||
+      (uint32_t) squash_bz2_read_bits (compressed_size, compressed, eos + 48, 32) != combined_crc) {
+    squash_free (starts);
+    return squash_error (SQUASH_INVALID_BUFFER);
+  }
+
+  *frames = squash_calloc (n_starts, sizeof (SquashFrame));
+  if (*frames == NULL) {
+    squash_free (starts);
+    return squash_error (SQUASH_MEMORY);
+  }
+  *n_frames = n_starts;
+
+  /* codec_data holds the bit offset of the block within its first
+     byte, the number of unused bits in its last byte, and the block
+     size (level) from the stream header.  Blocks
+     hold up to 100k bytes per level, which run-length encoding can
+     only stretch; a little extra avoids decoding most blocks twice. */
+  for (size_t i = 0 ; i < n_starts ; i++) {
+    const size_t end = (i + 1 < n_starts) ? starts[i + 1] : eos;
+    SquashFrame* frame = &((*frames)[i]);
+
+    frame->offset = starts[i] / 8;
+    frame->size = ((end + 7) / 8) - frame->offset;
+    frame->decompressed_size_hint = (size_t) (compressed[3] - '0') * 100000 * 5 / 4;
+    frame->codec_data = 1 | ((starts[i] % 8) << 1) | ((((8 - (end % 8)) % 8)) << 4) | ((uint64_t) (compressed[3] - '0') << 7);
+  }
+
+  squash_free (starts);
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_bz2_decompress_frame (SquashCodec* codec,
+                             const SquashFrame* frame,
+                             size_t* decompressed_size,
+                             uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                             size_t compressed_size,
+                             const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                             SquashOptions* options) {
+  const unsigned int shift = (unsigned int) ((frame->codec_data >> 1) & 7);
+  const unsigned int unused = (unsigned int) ((frame->codec_data >> 4) & 7);
+  const size_t n_bits = (frame->size * 8) - shift - unused;
+  const uint8_t* src = compressed + frame->offset;
+  SquashStatus res;
+
+#if SIZE_MAX > UINT_MAX
+  if (SQUASH_UNLIKELY(frame->size > (UINT_MAX - 32)) || SQUASH_UNLIKELY(*decompressed_size > UINT_MAX))
+    return squash_error (SQUASH_RANGE);
+#endif
+
+  /* Stream header, the block, then an end of stream marker whose
+     combined CRC is just the block's CRC. */
+  const size_t stream_size = 4 + ((n_bits + 48 + 32 + 7) / 8);
+  uint8_t* stream = squash_malloc (stream_size);
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  memcpy (stream, "BZh", 3);
+  stream[3] = (uint8_t) ('0' + ((frame->codec_data >> 7) & 0xf));
+  const size_t whole_bytes = n_bits / 8;
+  if (shift == 0) {
+    memcpy (stream + 4, src, whole_bytes);
+  } else {
+    for (size_t i = 0 ; i < whole_bytes ; i++)
+      stream[4 + i] = (uint8_t) ((src[i] << shift) | (src[i + 1] >> (8 - shift)));
+  }
+
+  SquashBZ2BitWriter writer = { stream, (4 + whole_bytes) * 8 };
+  const size_t tail_bit = (frame->offset * 8) + shift + (whole_bytes * 8);
+  squash_bz2_write_bits (&writer, squash_bz2_read_bits (compressed_size, compressed, tail_bit, (unsigned int) (n_bits % 8)), (unsigned int) (n_bits % 8));
+  squash_bz2_write_bits (&writer, SQUASH_BZ2_EOS_MAGIC, 48);
+  squash_bz2_write_bits (&writer, squash_bz2_read_bits (compressed_size, compressed, (frame->offset * 8) + shift + 48, 32), 32);
+  if ((writer.bit % 8) != 0)
+    squash_bz2_write_bits (&writer, 0, 8 - (unsigned int) (writer.bit % 8));
+
+  bz_stream bz2_stream = { 0, };
+  bz2_stream.bzalloc = squash_bz2_malloc;
+  bz2_stream.bzfree = squash_bz2_free;
+  int bz2_res = BZ2_bzDecompressInit (&bz2_stream, 0, squash_options_get_bool_at (options, codec, SQUASH_BZ2_OPT_SMALL));
+  if (SQUASH_UNLIKELY(bz2_res != BZ_OK)) {
+    squash_free (stream);
+    return squash_bz2_status_to_squash_status (bz2_res);
+  }
+
+  bz2_stream.next_in = (char*) stream;
+  bz2_stream.avail_in = (unsigned int) stream_size;
+  bz2_stream.next_out = (char*) decompressed;
+  bz2_stream.avail_out = (unsigned int) *decompressed_size;
+
+  bz2_res = BZ2_bzDecompress (&bz2_stream);
+  if (bz2_res == BZ_STREAM_END) {
+    *decompressed_size -= bz2_stream.avail_out;
+    res = SQUASH_OK;
+  } else if (bz2_res == BZ_OK && bz2_stream.avail_out == 0) {
+    res = squash_error (SQUASH_BUFFER_FULL);
+  } else {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+  }
+
+  BZ2_bzDecompressEnd (&bz2_stream);
+  squash_free (stream);
+
+  return res;
+}
+
 SquashStatus
 squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   if (strcmp ("bzip2", squash_codec_get_name (codec)) == 0) {
@@ -289,7 +534,10 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
     impl->options = squash_bz2_options;
     impl->create_stream = squash_bz2_create_stream;
     impl->process_stream = squash_bz2_process_stream;
+    impl->reset_stream = squash_bz2_reset_stream;
     impl->get_max_compressed_size = squash_bz2_get_max_compressed_size;
+    impl->split_frames = squash_bz2_split_frames;
+    impl->decompress_frame = squash_bz2_decompress_frame;
   } else {
     return SQUASH_UNABLE_TO_LOAD;
   }
@@ -90,6 +90,11 @@ squash_copy_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
   return (SquashStream*) squash_copy_stream_new (codec, stream_type, options);
 }
 
+static SquashStatus
+squash_copy_reset_stream (SquashStream* stream) {
+  return SQUASH_OK;
+}
+
 static SquashStatus
 squash_copy_process_stream (SquashStream* stream, SquashOperation operation) {
   const size_t cp_size = stream->avail_in < stream->avail_out ? stream->avail_in : stream->avail_out;
@@ -142,13 +147,14 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
 
   if (SQUASH_LIKELY(strcmp ("copy", name) == 0)) {
-    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_PASSTHROUGH;
     impl->get_uncompressed_size = squash_copy_get_uncompressed_size;
     impl->get_max_compressed_size = squash_copy_get_max_compressed_size;
     impl->decompress_buffer = squash_copy_decompress_buffer;
     impl->compress_buffer = squash_copy_compress_buffer;
     impl->create_stream = squash_copy_create_stream;
     impl->process_stream = squash_copy_process_stream;
+    impl->reset_stream = squash_copy_reset_stream;
   } else {
     return squash_error (SQUASH_UNABLE_TO_LOAD);
   }
@@ -35,7 +35,8 @@
 #include <lz4hc.h>
 
 enum SquashLZ4OptIndex {
-  SQUASH_LZ4_OPT_LEVEL = 0
+  SQUASH_LZ4_OPT_LEVEL = 0,
+  SQUASH_LZ4_OPT_DICTIONARY
 };
 
 static SquashOptionInfo squash_lz4_options[] = {
@@ -45,6 +46,8 @@ static SquashOptionInfo squash_lz4_options[] = {
       .min = 1,
       .max = 14 },
     .default_value.int_value = 7 },
+  { "dictionary",
+    SQUASH_OPTION_TYPE_DICTIONARY, },
   { NULL, SQUASH_OPTION_TYPE_NONE, }
 };
 
@@ -71,10 +74,27 @@ squash_lz4_decompress_buffer (SquashCodec* codec,
     return squash_error (SQUASH_RANGE);
 #endif
 
-  int lz4_e = LZ4_decompress_safe ((char*) compressed,
-                                   (char*) decompressed,
-                                   (int) compressed_size,
-                                   (int) *decompressed_size);
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (options, codec, SQUASH_LZ4_OPT_DICTIONARY);
+  int lz4_e;
+
+  if (dictionary != NULL) {
+#if INT_MAX < SIZE_MAX
+    if (SQUASH_UNLIKELY(INT_MAX < squash_dictionary_get_size (dictionary)))
+      return squash_error (SQUASH_RANGE);
+#endif
+
+    lz4_e = LZ4_decompress_safe_usingDict ((const char*) compressed,
+                                           (char*) decompressed,
+                                           (int) compressed_size,
+                                           (int) *decompressed_size,
+                                           (const char*) squash_dictionary_get_data (dictionary),
+                                           (int) squash_dictionary_get_size (dictionary));
+  } else {
+    lz4_e = LZ4_decompress_safe ((char*) compressed,
+                                 (char*) decompressed,
+                                 (int) compressed_size,
+                                 (int) *decompressed_size);
+  }
 
   if (lz4_e < 0) {
     return SQUASH_FAILED;
@@ -130,6 +150,81 @@ squash_lz4_level_to_hc_level (const int level) {
   }
 }
 
+/* For the fast levels the dictionary is loaded into an LZ4_stream_t
+   once and cached on the dictionary; each compression starts from a
+   copy of it, which is much cheaper than hashing the dictionary
+   again.  The HC state is too large for that to pay off. */
+static void*
+squash_lz4_create_digest (SquashDictionary* dictionary, SquashCodec* codec, int key) {
+  LZ4_stream_t* stream = squash_malloc (sizeof (LZ4_stream_t));
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return NULL;
+
+  memset (stream, 0, sizeof (LZ4_stream_t));
+  LZ4_loadDict (stream,
+                (const char*) squash_dictionary_get_data (dictionary),
+                (int) squash_dictionary_get_size (dictionary));
+
+  return stream;
+}
+
+static SquashStatus
+squash_lz4_compress_buffer_with_dictionary (SquashCodec* codec,
+                                            size_t* compressed_size,
+                                            uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                            size_t uncompressed_size,
+                                            const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                            int level,
+                                            SquashDictionary* dictionary) {
+  int lz4_r;
+
+#if INT_MAX < SIZE_MAX
+  if (SQUASH_UNLIKELY(INT_MAX < squash_dictionary_get_size (dictionary)))
+    return squash_error (SQUASH_RANGE);
+#endif
+
+  if (level <= 7) {
+    const LZ4_stream_t* digest = squash_dictionary_get_digest (dictionary, codec, 0, squash_lz4_create_digest, squash_free);
+    if (SQUASH_UNLIKELY(digest == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    LZ4_stream_t* stream = squash_malloc (sizeof (LZ4_stream_t));
+    if (SQUASH_UNLIKELY(stream == NULL))
+      return squash_error (SQUASH_MEMORY);
+    memcpy (stream, digest, sizeof (LZ4_stream_t));
+
+    lz4_r = LZ4_compress_fast_continue (stream,
+                                        (const char*) uncompressed,
+                                        (char*) compressed,
+                                        (int) uncompressed_size,
+                                        (int) *compressed_size,
+                                        (level == 7) ? 1 : squash_lz4_level_to_fast_mode (level));
+
+    squash_free (stream);
+  } else {
+    LZ4_streamHC_t* stream = squash_malloc (sizeof (LZ4_streamHC_t));
+    if (SQUASH_UNLIKELY(stream == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    LZ4_resetStreamHC (stream, squash_lz4_level_to_hc_level (level));
+    LZ4_loadDictHC (stream,
+                    (const char*) squash_dictionary_get_data (dictionary),
+                    (int) squash_dictionary_get_size (dictionary));
+
+    lz4_r = LZ4_compress_HC_continue (stream,
+                                      (const char*) uncompressed,
+                                      (char*) compressed,
+                                      (int) uncompressed_size,
+                                      (int) *compressed_size);
+
+    squash_free (stream);
+  }
+
+  *compressed_size = (size_t) lz4_r;
+
+  return SQUASH_UNLIKELY(lz4_r == 0) ? squash_error (SQUASH_BUFFER_FULL) : SQUASH_OK;
+}
+
 static SquashStatus
 squash_lz4_compress_buffer (SquashCodec* codec,
                             size_t* compressed_size,
@@ -145,6 +240,13 @@ squash_lz4_compress_buffer (SquashCodec* codec,
     return squash_error (SQUASH_RANGE);
 #endif
 
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (options, codec, SQUASH_LZ4_OPT_DICTIONARY);
+  if (dictionary != NULL)
+    return squash_lz4_compress_buffer_with_dictionary (codec,
+                                                       compressed_size, compressed,
+                                                       uncompressed_size, uncompressed,
+                                                       level, dictionary);
+
   int lz4_r;
 
   if (level == 7) {
@@ -195,6 +297,13 @@ squash_lz4_compress_buffer_unsafe (SquashCodec* codec,
 
   assert (*compressed_size >= LZ4_COMPRESSBOUND(uncompressed_size));
 
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (options, codec, SQUASH_LZ4_OPT_DICTIONARY);
+  if (dictionary != NULL)
+    return squash_lz4_compress_buffer_with_dictionary (codec,
+                                                       compressed_size, compressed,
+                                                       uncompressed_size, uncompressed,
+                                                       level, dictionary);
+
   int lz4_r;
 
   if (level == 7) {
@@ -25,6 +25,7 @@
  */
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -454,16 +455,221 @@ squash_lz4f_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_siz
   return res;
 }
 
+/* The frame header may optionally contain the content size, but
+   nothing checks that it actually matches. */
+static size_t
+squash_lz4f_get_uncompressed_size (SquashCodec* codec,
+                                   size_t compressed_size,
+                                   const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  if (compressed_size < 15 ||
+      compressed[0] != 0x04 || compressed[1] != 0x22 || compressed[2] != 0x4d || compressed[3] != 0x18)
+    return 0;
+
+  /* FLG: version must be 01, bit 3 is the content size flag */
+  const uint8_t flg = compressed[4];
+  if ((flg >> 6) != 1 || (flg & 0x08) == 0)
+    return 0;
+
+  uint64_t content_size = 0;
+  for (int i = 7 ; i >= 0 ; i--)
+    content_size = (content_size << 8) | compressed[6 + i];
+
+  return (content_size <= SIZE_MAX) ? (size_t) content_size : 0;
+}
+
+/* codec_data for frames which are single blocks, rather than whole
+   LZ4 frames: the block type in the low bits, then the block size ID. */
+#define SQUASH_LZ4F_BLOCK_COMPRESSED 1
+#define SQUASH_LZ4F_BLOCK_STORED     2
+
+static uint32_t
+squash_lz4f_read_le32 (const uint8_t* data) {
+  return
+    ((uint32_t) data[0]) |
+    ((uint32_t) data[1] << 8) |
+    ((uint32_t) data[2] << 16) |
+    ((uint32_t) data[3] << 24);
+}
+
+static bool
+squash_lz4f_frames_append (size_t* n_frames, SquashFrame** frames, size_t* allocated, const SquashFrame* frame) {
+  if (*n_frames == *allocated) {
+    const size_t new_allocated = (*allocated == 0) ? 16 : *allocated * 2;
+    SquashFrame* tmp = squash_realloc (*frames, new_allocated * sizeof (SquashFrame));
+    if (tmp == NULL)
+      return false;
+    *frames = tmp;
+    *allocated = new_allocated;
+  }
+
+  (*frames)[(*n_frames)++] = *frame;
+  return true;
+}
+
+/* Concatenated LZ4 frames are independent, and so are the blocks of a
+   frame created with independent blocks.  Blocks can only be handed
+   out individually if there are no checksums, though, since those
+   cover data which would then be split between threads. */
+static SquashStatus
+squash_lz4f_split_frames (SquashCodec* codec,
+                          size_t compressed_size,
+                          const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                          size_t* n_frames,
+                          SquashFrame** frames) {
+  size_t allocated = 0;
+  size_t pos = 0;
+
+  *n_frames = 0;
+  *frames = NULL;
+
+  while (pos < compressed_size) {
+    const size_t remaining = compressed_size - pos;
+    const uint8_t* data = compressed + pos;
+
+    if (remaining < 8)
+      goto invalid;
+
+    const uint32_t magic = squash_lz4f_read_le32 (data);
+    if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+      const uint32_t skip = squash_lz4f_read_le32 (data + 4);
+      if (skip > remaining - 8)
+        goto invalid;
+      pos += 8 + (size_t) skip;
+      continue;
+    } else if (magic != 0x184D2204) {
+      goto invalid;
+    }
+
+    const uint8_t flg = data[4];
+    const uint8_t bd = data[5];
+    const bool independent = (flg & 0x20) != 0;
+    const bool block_checksum = (flg & 0x10) != 0;
+    const bool has_content_size = (flg & 0x08) != 0;
+    const bool content_checksum = (flg & 0x04) != 0;
+    const unsigned int block_size_id = (bd >> 4) & 7;
+    if ((flg >> 6) != 1 || (flg & 0x03) != 0 || block_size_id < 4)
+      goto invalid;
+
+    size_t header_size = 7 + (has_content_size ? 8 : 0);
+    if (header_size > remaining)
+      goto invalid;
+
+    uint64_t content_size = 0;
+    if (has_content_size) {
+      for (int i = 7 ; i >= 0 ; i--)
+        content_size = (content_size << 8) | data[6 + i];
+    }
+
+    const bool split_blocks = independent && !block_checksum && !content_checksum;
+    const size_t max_block_size = squash_lz4f_block_size_id_to_size ((LZ4F_blockSizeID_t) block_size_id);
+    size_t frame_pos = header_size;
+
+    while (true) {
+      if (remaining - frame_pos < 4)
+        goto invalid;
+
+      const uint32_t block_header = squash_lz4f_read_le32 (data + frame_pos);
+      frame_pos += 4;
+      if (block_header == 0)
+        break;
+
+      const size_t block_size = (size_t) (block_header & 0x7FFFFFFF);
+      const bool stored = (block_header & 0x80000000) != 0;
+      if (block_size > max_block_size || block_size > remaining - frame_pos)
+        goto invalid;
+
+      if (split_blocks) {
+        SquashFrame frame = { 0, };
+        frame.offset = pos + frame_pos;
+        frame.size = block_size;
+        frame.decompressed_size = stored ? block_size : 0;
+        frame.decompressed_size_hint = max_block_size;
+        frame.codec_data = (stored ? SQUASH_LZ4F_BLOCK_STORED : SQUASH_LZ4F_BLOCK_COMPRESSED) | (block_size_id << 2);
+        if (!squash_lz4f_frames_append (n_frames, frames, &allocated, &frame))
+          goto memory;
+      }
+
+      frame_pos += block_size + (block_checksum ? 4 : 0);
+      if (frame_pos > remaining)
+        goto invalid;
+    }
+
+    if (content_checksum) {
+      if (remaining - frame_pos < 4)
+        goto invalid;
+      frame_pos += 4;
+    }
+
+    if (!split_blocks) {
+      SquashFrame frame = { 0, };
+      frame.offset = pos;
+      frame.size = frame_pos;
+      frame.decompressed_size = (content_size <= SIZE_MAX) ? (size_t) content_size : 0;
+      if (!squash_lz4f_frames_append (n_frames, frames, &allocated, &frame))
+        goto memory;
+    }
+
+    pos += frame_pos;
+  }
+
+  return SQUASH_OK;
+
+ invalid:
+  squash_free (*frames);
+  *frames = NULL;
+  return squash_error (SQUASH_INVALID_BUFFER);
+
+ memory:
+  squash_free (*frames);
+  *frames = NULL;
+  return squash_error (SQUASH_MEMORY);
+}
+
+static SquashStatus
+squash_lz4f_decompress_frame (SquashCodec* codec,
+                              const SquashFrame* frame,
+                              size_t* decompressed_size,
+                              uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                              size_t compressed_size,
+                              const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                              SquashOptions* options) {
+  const uint8_t* src = compressed + frame->offset;
+
+  if ((frame->codec_data & 3) == SQUASH_LZ4F_BLOCK_STORED) {
+    if (frame->size > *decompressed_size)
+      return squash_error (SQUASH_BUFFER_FULL);
+    memcpy (decompressed, src, frame->size);
+    *decompressed_size = frame->size;
+    return SQUASH_OK;
+  }
+
+  const size_t max_block_size = squash_lz4f_block_size_id_to_size ((LZ4F_blockSizeID_t) (frame->codec_data >> 2));
+  const size_t capacity = (*decompressed_size < max_block_size) ? *decompressed_size : max_block_size;
+  const int res = LZ4_decompress_safe ((const char*) src, (char*) decompressed, (int) frame->size, (int) capacity);
+
+  if (res < 0) {
+    /* LZ4 can't tell us whether the output didn't fit or the input is
+       corrupt; a full-sized buffer rules out the former. */
+    return (capacity < max_block_size) ? squash_error (SQUASH_BUFFER_FULL) : squash_error (SQUASH_INVALID_BUFFER);
+  }
+
+  *decompressed_size = (size_t) res;
+  return SQUASH_OK;
+}
+
 SquashStatus
 squash_plugin_init_lz4f (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
 
   if (SQUASH_LIKELY(strcmp ("lz4", name) == 0)) {
-    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_SIZE_HINT;
     impl->options = squash_lz4f_options;
+    impl->get_uncompressed_size = squash_lz4f_get_uncompressed_size;
     impl->get_max_compressed_size = squash_lz4f_get_max_compressed_size;
     impl->create_stream = squash_lz4f_create_stream;
     impl->process_stream = squash_lz4f_process_stream;
+    impl->split_frames = squash_lz4f_split_frames;
+    impl->decompress_frame = squash_lz4f_decompress_frame;
   } else {
     return SQUASH_UNABLE_TO_LOAD;
   }
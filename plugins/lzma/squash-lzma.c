@@ -32,6 +32,14 @@
 
 #include <lzma.h>
 
+/* The multi-threaded encoder was added in 5.2, the decoder in 5.4. */
+#if LZMA_VERSION >= UINT32_C(50020002)
+#  define SQUASH_LZMA_HAVE_MT_ENCODER
+#endif
+#if LZMA_VERSION >= UINT32_C(50040002)
+#  define SQUASH_LZMA_HAVE_MT_DECODER
+#endif
+
 typedef enum SquashLZMAType_e {
   SQUASH_LZMA_TYPE_LZMA = 1,
   SQUASH_LZMA_TYPE_XZ,
@@ -45,6 +53,7 @@ typedef struct SquashLZMAStream_s {
   SquashLZMAType type;
   lzma_stream stream;
   lzma_allocator allocator;
+  lzma_action flush_action;
 } SquashLZMAStream;
 
 enum SquashLZMAOptIndex {
@@ -55,6 +64,8 @@ enum SquashLZMAOptIndex {
   SQUASH_LZMA_OPT_PB,
   SQUASH_LZMA_OPT_MEM_LIMIT,
   SQUASH_LZMA_OPT_CHECK,
+  SQUASH_LZMA_OPT_THREADS,
+  SQUASH_LZMA_OPT_BLOCK_SIZE,
 };
 
 static SquashOptionInfo squash_lzma_options[] = {
@@ -178,6 +189,18 @@ static SquashOptionInfo squash_lzma_xz_options[] = {
         { "sha256", LZMA_CHECK_SHA256 },
         { NULL, 0 } } },
     .default_value.int_value = LZMA_CHECK_CRC64 },
+  { "threads",
+    SQUASH_OPTION_TYPE_RANGE_INT,
+    .info.range_int = {
+      .min = 0,
+      .max = 16384 },
+    .default_value.int_value = 1 },
+  { "block-size",
+    SQUASH_OPTION_TYPE_RANGE_SIZE,
+    .info.range_size = {
+      .min = 0,
+      .max = SIZE_MAX },
+    .default_value.size_value = 0 },
   { NULL, SQUASH_OPTION_TYPE_NONE, }
 };
 
@@ -211,14 +234,11 @@ static SquashLZMAType squash_lzma_codec_to_type (SquashCodec* codec) {
 }
 
 static void* squash_lzma_calloc (void *opaque, size_t nmemb, size_t size) {
-  void* ptr = squash_malloc (nmemb * size);
-  if (SQUASH_UNLIKELY(ptr == NULL))
-    return ptr;
-  return memset (ptr, 0, nmemb * size);
+  return squash_allocator_calloc ((SquashAllocator*) opaque, nmemb, size);
 }
 
 static void squash_lzma_free (void *opaque, void* ptr) {
-  squash_free (ptr);
+  squash_allocator_free ((SquashAllocator*) opaque, ptr);
 }
 
 static void
@@ -230,7 +250,7 @@ squash_lzma_stream_init (SquashLZMAStream* stream,
                          SquashDestroyNotify destroy_notify) {
   squash_stream_init ((SquashStream*) stream, codec, stream_type, (SquashOptions*) options, destroy_notify);
 
-  stream->allocator.opaque = squash_codec_get_context (codec);
+  stream->allocator.opaque = ((SquashStream*) stream)->allocator;
   stream->allocator.alloc = squash_lzma_calloc;
   stream->allocator.free = squash_lzma_free;
 
@@ -239,6 +259,7 @@ squash_lzma_stream_init (SquashLZMAStream* stream,
 
   stream->stream = s;
   stream->type = type;
+  stream->flush_action = LZMA_SYNC_FLUSH;
 }
 
 static void
@@ -247,18 +268,31 @@ squash_lzma_stream_destroy (void* stream) {
   squash_stream_destroy (stream);
 }
 
-static SquashLZMAStream*
-squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+#if defined(SQUASH_LZMA_HAVE_MT_ENCODER)
+static uint32_t
+squash_lzma_get_threads (SquashOptions* options, SquashCodec* codec) {
+  uint32_t threads = (uint32_t) squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_THREADS);
+
+  if (threads == 0) {
+    threads = lzma_cputhreads ();
+    if (threads == 0)
+      threads = 1;
+  }
+
+  return threads;
+}
+#endif
+
+static lzma_ret
+squash_lzma_stream_setup (SquashLZMAStream* stream) {
+  SquashCodec* codec = ((SquashStream*) stream)->codec;
+  SquashOptions* options = ((SquashStream*) stream)->options;
+  SquashStreamType stream_type = ((SquashStream*) stream)->stream_type;
+  SquashLZMAType lzma_type = stream->type;
   lzma_ret lzma_e;
-  SquashLZMAStream* stream;
-  SquashLZMAType lzma_type;
   lzma_options_lzma lzma_options = { 0, };
   lzma_filter filters[2];
 
-  assert (codec != NULL);
-
-  lzma_type = squash_lzma_codec_to_type (codec);
-
   lzma_lzma_preset (&lzma_options, (uint32_t) squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_LEVEL));
   lzma_options.lc = squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_LC);
   lzma_options.lp = squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_LP);
@@ -280,12 +314,32 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
   filters[1].id = LZMA_VLI_UNKNOWN;
   filters[1].options = NULL;
 
-  stream = (SquashLZMAStream*) squash_malloc (sizeof (SquashLZMAStream));
-  squash_lzma_stream_init (stream, codec, lzma_type, stream_type, options, squash_lzma_stream_destroy);
-
+  /* If the lzma_stream has already been initialized, liblzma will
+     reuse the existing coder's memory where it can. */
   if (stream_type == SQUASH_STREAM_COMPRESS) {
     if (lzma_type == SQUASH_LZMA_TYPE_XZ) {
-      lzma_e = lzma_stream_encoder (&(stream->stream), filters, (lzma_check) squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_CHECK));
+      const lzma_check check = (lzma_check) squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_CHECK);
+#if defined(SQUASH_LZMA_HAVE_MT_ENCODER)
+      const uint32_t threads = squash_lzma_get_threads (options, codec);
+      const size_t block_size = squash_options_get_size_at (options, codec, SQUASH_LZMA_OPT_BLOCK_SIZE);
+      if (threads != 1 || block_size != 0) {
+        lzma_mt mt = { 0, };
+        mt.threads = threads;
+        mt.block_size = block_size;
+        mt.filters = filters;
+        mt.check = check;
+
+        /* Blocks are allocated by the worker threads, and stream
+           allocators are not synchronized, so stick to the global
+           one.  The MT encoder can't sync flush, but a full flush
+           (which starts a new block) makes all the data available
+           just the same. */
+        stream->allocator.opaque = NULL;
+        stream->flush_action = LZMA_FULL_FLUSH;
+        lzma_e = lzma_stream_encoder_mt (&(stream->stream), &mt);
+      } else
+#endif
+      lzma_e = lzma_stream_encoder (&(stream->stream), filters, check);
     } else if (lzma_type == SQUASH_LZMA_TYPE_LZMA) {
       lzma_e = lzma_alone_encoder (&(stream->stream), filters[0].options);
     } else if (lzma_type == SQUASH_LZMA_TYPE_LZMA1 ||
@@ -297,6 +351,18 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
   } else if (stream_type == SQUASH_STREAM_DECOMPRESS) {
     if (lzma_type == SQUASH_LZMA_TYPE_XZ) {
       const uint64_t memlimit = squash_options_get_size_at (options, codec, SQUASH_LZMA_OPT_MEM_LIMIT);
+#if defined(SQUASH_LZMA_HAVE_MT_DECODER)
+      const uint32_t threads = squash_lzma_get_threads (options, codec);
+      if (threads != 1) {
+        lzma_mt mt = { 0, };
+        mt.threads = threads;
+        mt.memlimit_threading = memlimit;
+        mt.memlimit_stop = memlimit;
+
+        stream->allocator.opaque = NULL;
+        lzma_e = lzma_stream_decoder_mt (&(stream->stream), &mt);
+      } else
+#endif
       lzma_e = lzma_stream_decoder(&(stream->stream), memlimit, 0);
     } else if (lzma_type == SQUASH_LZMA_TYPE_LZMA) {
       const uint64_t memlimit = squash_options_get_size_at (options, codec, SQUASH_LZMA_OPT_MEM_LIMIT);
@@ -312,7 +378,19 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
     squash_assert_unreachable();
   }
 
-  if (lzma_e != LZMA_OK) {
+  return lzma_e;
+}
+
+static SquashLZMAStream*
+squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  SquashLZMAStream* stream;
+
+  assert (codec != NULL);
+
+  stream = (SquashLZMAStream*) squash_malloc (sizeof (SquashLZMAStream));
+  squash_lzma_stream_init (stream, codec, squash_lzma_codec_to_type (codec), stream_type, options, squash_lzma_stream_destroy);
+
+  if (squash_lzma_stream_setup (stream) != LZMA_OK) {
     stream = squash_object_unref (stream);
   }
 
@@ -324,6 +402,18 @@ squash_lzma_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
   return (SquashStream*) squash_lzma_stream_new (codec, stream_type, options);
 }
 
+static SquashStatus
+squash_lzma_reset_stream (SquashStream* stream) {
+  const lzma_ret lzma_e = squash_lzma_stream_setup ((SquashLZMAStream*) stream);
+
+  if (lzma_e == LZMA_OK)
+    return SQUASH_OK;
+  else if (lzma_e == LZMA_MEM_ERROR)
+    return squash_error (SQUASH_MEMORY);
+  else
+    return squash_error (SQUASH_FAILED);
+}
+
 #define SQUASH_LZMA_STREAM_COPY_TO_LZMA_STREAM(stream,lzma_stream)  \
   lzma_stream->next_in =  stream->next_in;                          \
   lzma_stream->avail_in = stream->avail_in;                         \
@@ -350,7 +440,7 @@ squash_lzma_process_stream (SquashStream* stream, SquashOperation operation) {
       lzma_e = lzma_code (s, LZMA_RUN);
       break;
     case SQUASH_OPERATION_FLUSH:
-      lzma_e = lzma_code (s, LZMA_SYNC_FLUSH);
+      lzma_e = lzma_code (s, ((SquashLZMAStream*) stream)->flush_action);
       break;
     case SQUASH_OPERATION_FINISH:
       lzma_e = lzma_code (s, LZMA_FINISH);
@@ -366,7 +456,9 @@ squash_lzma_process_stream (SquashStream* stream, SquashOperation operation) {
         return (stream->avail_in == 0) ? SQUASH_OK : SQUASH_PROCESSING;
         break;
       case SQUASH_OPERATION_FLUSH:
-        return SQUASH_OK;
+        /* liblzma wants the same action until it returns
+           LZMA_STREAM_END. */
+        return SQUASH_PROCESSING;
         break;
       case SQUASH_OPERATION_FINISH:
         return SQUASH_PROCESSING;
@@ -402,6 +494,182 @@ squash_lzma_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_siz
   squash_assert_unreachable ();
 }
 
+/* The xz index records the exact uncompressed size of every block, so
+   walk the concatenated streams backwards from the end summing their
+   indices. */
+static size_t
+squash_lzma_xz_get_uncompressed_size (SquashCodec* codec,
+                                      size_t compressed_size,
+                                      const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  lzma_allocator allocator = { squash_lzma_calloc, squash_lzma_free, NULL };
+  uint64_t uncompressed_size = 0;
+  size_t pos = compressed_size;
+
+  while (pos > 0) {
+    lzma_stream_flags flags;
+    lzma_index* index = NULL;
+    uint64_t memlimit = UINT64_MAX;
+    size_t index_pos = 0;
+
+    /* Stream padding */
+    if (pos >= 4 && compressed[pos - 4] == 0 && compressed[pos - 3] == 0 &&
+        compressed[pos - 2] == 0 && compressed[pos - 1] == 0) {
+      pos -= 4;
+      continue;
+    }
+
+    if (pos < (LZMA_STREAM_HEADER_SIZE * 2) ||
+        lzma_stream_footer_decode (&flags, compressed + pos - LZMA_STREAM_HEADER_SIZE) != LZMA_OK ||
+        flags.backward_size > pos - (LZMA_STREAM_HEADER_SIZE * 2))
+      return 0;
+
+    const size_t index_offset = pos - LZMA_STREAM_HEADER_SIZE - (size_t) flags.backward_size;
+    if (lzma_index_buffer_decode (&index, &memlimit, &allocator,
+                                  compressed + index_offset, &index_pos, (size_t) flags.backward_size) != LZMA_OK)
+      return 0;
+
+    const lzma_vli stream_size = lzma_index_stream_size (index);
+    uncompressed_size += lzma_index_uncompressed_size (index);
+    lzma_index_end (index, &allocator);
+
+    if (stream_size > pos || uncompressed_size > SIZE_MAX)
+      return 0;
+    pos -= (size_t) stream_size;
+  }
+
+  return (size_t) uncompressed_size;
+}
+
+/* The .lzma header contains the uncompressed size, but it may be
+   unknown (all ones) and it is not verified by the decoder. */
+static size_t
+squash_lzma_alone_get_uncompressed_size (SquashCodec* codec,
+                                         size_t compressed_size,
+                                         const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  if (compressed_size < 13)
+    return 0;
+
+  uint64_t uncompressed_size = 0;
+  for (int i = 7 ; i >= 0 ; i--)
+    uncompressed_size = (uncompressed_size << 8) | compressed[5 + i];
+
+  if (uncompressed_size == UINT64_MAX || uncompressed_size > SIZE_MAX)
+    return 0;
+
+  return (size_t) uncompressed_size;
+}
+
+/* Each block of an xz stream can be decoded on its own, and the index
+   tells us where they are and how large they are once decoded.  Only
+   single-stream files are split, since that's all the decoder reads.
+   The check type is stored in the frame (plus one, so it's never 0). */
+static SquashStatus
+squash_lzma_xz_split_frames (SquashCodec* codec,
+                             size_t compressed_size,
+                             const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                             size_t* n_frames,
+                             SquashFrame** frames) {
+  lzma_allocator allocator = { squash_lzma_calloc, squash_lzma_free, NULL };
+  lzma_stream_flags header_flags, footer_flags;
+  lzma_index* index = NULL;
+  lzma_index_iter iter;
+  uint64_t memlimit = UINT64_MAX;
+  size_t index_pos = 0;
+  SquashStatus res = SQUASH_OK;
+
+  if (compressed_size < (LZMA_STREAM_HEADER_SIZE * 2) ||
+      lzma_stream_header_decode (&header_flags, compressed) != LZMA_OK ||
+      lzma_stream_footer_decode (&footer_flags, compressed + compressed_size - LZMA_STREAM_HEADER_SIZE) != LZMA_OK ||
+      lzma_stream_flags_compare (&header_flags, &footer_flags) != LZMA_OK ||
+      footer_flags.backward_size > compressed_size - (LZMA_STREAM_HEADER_SIZE * 2))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  const size_t index_offset = compressed_size - LZMA_STREAM_HEADER_SIZE - (size_t) footer_flags.backward_size;
+  if (lzma_index_buffer_decode (&index, &memlimit, &allocator,
+                                compressed + index_offset, &index_pos, (size_t) footer_flags.backward_size) != LZMA_OK)
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  if (lzma_index_stream_size (index) != compressed_size ||
+      lzma_index_block_count (index) > (SIZE_MAX / sizeof (SquashFrame))) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  *n_frames = (size_t) lzma_index_block_count (index);
+  *frames = squash_calloc (*n_frames == 0 ? 1 : *n_frames, sizeof (SquashFrame));
+  if (*frames == NULL) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
+  lzma_index_iter_init (&iter, index);
+  for (size_t i = 0 ; !lzma_index_iter_next (&iter, LZMA_INDEX_ITER_BLOCK) ; i++) {
+    if (iter.block.uncompressed_size > SIZE_MAX) {
+      res = squash_error (SQUASH_RANGE);
+      break;
+    }
+
+    (*frames)[i].offset = (size_t) iter.block.compressed_file_offset;
+    (*frames)[i].size = (size_t) iter.block.total_size;
+    (*frames)[i].decompressed_size = (size_t) iter.block.uncompressed_size;
+    (*frames)[i].codec_data = ((uint64_t) footer_flags.check) + 1;
+  }
+
+ cleanup:
+
+  lzma_index_end (index, &allocator);
+
+  return res;
+}
+
+static SquashStatus
+squash_lzma_xz_decompress_frame (SquashCodec* codec,
+                                 const SquashFrame* frame,
+                                 size_t* decompressed_size,
+                                 uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                 size_t compressed_size,
+                                 const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                 SquashOptions* options) {
+  lzma_allocator allocator = { squash_lzma_calloc, squash_lzma_free, NULL };
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  lzma_block block = { 0, };
+  SquashStatus res;
+
+  block.version = 0;
+  block.check = (lzma_check) (frame->codec_data - 1);
+  block.filters = filters;
+  block.header_size = lzma_block_header_size_decode (compressed[frame->offset]);
+  if (block.header_size > frame->size ||
+      lzma_block_header_decode (&block, &allocator, compressed + frame->offset) != LZMA_OK)
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  if (lzma_raw_decoder_memusage (filters) > squash_options_get_size_at (options, codec, SQUASH_LZMA_OPT_MEM_LIMIT)) {
+    res = squash_error (SQUASH_MEMORY);
+  } else {
+    size_t in_pos = frame->offset + block.header_size;
+    size_t out_pos = 0;
+
+    const lzma_ret lzma_e = lzma_block_buffer_decode (&block, &allocator,
+                                                      compressed, &in_pos, frame->offset + frame->size,
+                                                      decompressed, &out_pos, *decompressed_size);
+    if (lzma_e == LZMA_OK) {
+      *decompressed_size = out_pos;
+      res = (in_pos == frame->offset + frame->size) ? SQUASH_OK : squash_error (SQUASH_INVALID_BUFFER);
+    } else if (lzma_e == LZMA_BUF_ERROR) {
+      res = (out_pos == *decompressed_size) ? squash_error (SQUASH_BUFFER_FULL) : squash_error (SQUASH_INVALID_BUFFER);
+    } else if (lzma_e == LZMA_MEM_ERROR) {
+      res = squash_error (SQUASH_MEMORY);
+    } else {
+      res = squash_error (SQUASH_INVALID_BUFFER);
+    }
+  }
+
+  for (size_t i = 0 ; filters[i].id != LZMA_VLI_UNKNOWN ; i++)
+    squash_lzma_free (NULL, filters[i].options);
+
+  return res;
+}
+
 SquashStatus
 squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   impl->options = squash_lzma_options;
@@ -410,13 +678,18 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
     case SQUASH_LZMA_TYPE_XZ:
       impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
       impl->options = squash_lzma_xz_options;
+      impl->get_uncompressed_size = squash_lzma_xz_get_uncompressed_size;
+      impl->split_frames = squash_lzma_xz_split_frames;
+      impl->decompress_frame = squash_lzma_xz_decompress_frame;
       break;
     case SQUASH_LZMA_TYPE_LZMA2:
       impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
       impl->options = squash_lzma12_options;
       break;
     case SQUASH_LZMA_TYPE_LZMA:
+      impl->info = SQUASH_CODEC_INFO_SIZE_HINT;
       impl->options = squash_lzma_options;
+      impl->get_uncompressed_size = squash_lzma_alone_get_uncompressed_size;
       break;
     case SQUASH_LZMA_TYPE_LZMA1:
       impl->options = squash_lzma12_options;
@@ -425,6 +698,7 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
 
   impl->create_stream = squash_lzma_create_stream;
   impl->process_stream = squash_lzma_process_stream;
+  impl->reset_stream = squash_lzma_reset_stream;
   impl->get_max_compressed_size = squash_lzma_get_max_compressed_size;
 
   return SQUASH_OK;
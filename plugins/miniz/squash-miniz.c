@@ -112,12 +112,12 @@ static void               squash_miniz_stream_destroy (void* stream);
 
 static void*
 squash_zlib_malloc (void* opaque, size_t items, size_t size) {
-  return squash_malloc (items * size);
+  return squash_allocator_malloc ((SquashAllocator*) opaque, items * size);
 }
 
 static void
 squash_zlib_free (void* opaque, void* address) {
-  squash_free (address);
+  squash_allocator_free ((SquashAllocator*) opaque, address);
 }
 
 static SquashMinizType squash_miniz_codec_to_type (SquashCodec* codec) {
@@ -145,6 +145,7 @@ squash_miniz_stream_init (SquashMinizStream* stream,
   stream->stream = tmp;
   stream->stream.zalloc = squash_zlib_malloc;
   stream->stream.zfree  = squash_zlib_free;
+  stream->stream.opaque = ((SquashStream*) stream)->allocator;
 }
 
 static void
@@ -55,7 +55,8 @@ enum SquashZlibOptIndex {
   SQUASH_ZLIB_OPT_LEVEL = 0,
   SQUASH_ZLIB_OPT_WINDOW_BITS,
   SQUASH_ZLIB_OPT_MEM_LEVEL,
-  SQUASH_ZLIB_OPT_STRATEGY
+  SQUASH_ZLIB_OPT_STRATEGY,
+  SQUASH_ZLIB_OPT_DICTIONARY
 };
 
 static SquashOptionInfo squash_zlib_options[] = {
@@ -88,6 +89,8 @@ static SquashOptionInfo squash_zlib_options[] = {
         { "fixed", Z_FIXED },
         { NULL, 0 } } },
     .default_value.int_value = SQUASH_ZLIB_DEFAULT_STRATEGY },
+  { "dictionary",
+    SQUASH_OPTION_TYPE_DICTIONARY, },
   { NULL, SQUASH_OPTION_TYPE_NONE, }
 };
 
@@ -106,12 +109,12 @@ static void               squash_zlib_stream_destroy (void* stream);
 
 static voidpf
 squash_zlib_malloc (voidpf opaque, uInt items, uInt size) {
-  return (voidpf) squash_malloc (((size_t) items) * ((size_t) size));
+  return (voidpf) squash_allocator_malloc ((SquashAllocator*) opaque, ((size_t) items) * ((size_t) size));
 }
 
 static void
 squash_zlib_free (voidpf opaque, voidpf address) {
-  squash_free ((void*) address);
+  squash_allocator_free ((SquashAllocator*) opaque, (void*) address);
 }
 
 static SquashZlibType squash_zlib_codec_to_type (SquashCodec* codec) {
@@ -139,6 +142,7 @@ squash_zlib_stream_init (SquashZlibStream* stream,
   stream->stream = tmp;
   stream->stream.zalloc = squash_zlib_malloc;
   stream->stream.zfree  = squash_zlib_free;
+  stream->stream.opaque = ((SquashStream*) stream)->allocator;
 }
 
 static void
@@ -155,6 +159,48 @@ squash_zlib_stream_destroy (void* stream) {
   squash_stream_destroy (stream);
 }
 
+static SquashDictionary*
+squash_zlib_stream_get_dictionary (SquashZlibStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  return squash_options_get_dictionary_at (s->options, s->codec, SQUASH_ZLIB_OPT_DICTIONARY);
+}
+
+static int
+squash_zlib_stream_set_dictionary (SquashZlibStream* stream, SquashDictionary* dictionary) {
+#if UINT_MAX < SIZE_MAX
+  if (SQUASH_UNLIKELY(UINT_MAX < squash_dictionary_get_size (dictionary)))
+    return Z_STREAM_ERROR;
+#endif
+
+  if (((SquashStream*) stream)->stream_type == SQUASH_STREAM_COMPRESS) {
+    return deflateSetDictionary (&(stream->stream),
+                                 squash_dictionary_get_data (dictionary),
+                                 (uInt) squash_dictionary_get_size (dictionary));
+  } else {
+    return inflateSetDictionary (&(stream->stream),
+                                 squash_dictionary_get_data (dictionary),
+                                 (uInt) squash_dictionary_get_size (dictionary));
+  }
+}
+
+/* Compressors are primed immediately.  zlib decompressors ask for
+   the dictionary (Z_NEED_DICT) once they have read the header, but
+   raw deflate has no header so it must be provided up front.  gzip
+   has no way to signal a dictionary at all. */
+static int
+squash_zlib_stream_prime (SquashZlibStream* stream) {
+  SquashDictionary* dictionary = squash_zlib_stream_get_dictionary (stream);
+
+  if (dictionary == NULL)
+    return Z_OK;
+  else if (stream->type == SQUASH_ZLIB_TYPE_GZIP)
+    return Z_STREAM_ERROR;
+  else if (((SquashStream*) stream)->stream_type == SQUASH_STREAM_COMPRESS || stream->type == SQUASH_ZLIB_TYPE_DEFLATE)
+    return squash_zlib_stream_set_dictionary (stream, dictionary);
+  else
+    return Z_OK;
+}
+
 static SquashZlibStream*
 squash_zlib_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
   int zlib_e = 0;
@@ -189,6 +235,9 @@ squash_zlib_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
     squash_assert_unreachable();
   }
 
+  if (zlib_e == Z_OK)
+    zlib_e = squash_zlib_stream_prime (stream);
+
   if (zlib_e != Z_OK) {
     stream = squash_object_unref (stream);
   }
@@ -201,6 +250,23 @@ squash_zlib_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
   return (SquashStream*) squash_zlib_stream_new (codec, stream_type, options);
 }
 
+static SquashStatus
+squash_zlib_reset_stream (SquashStream* stream) {
+  z_stream* zlib_stream = &(((SquashZlibStream*) stream)->stream);
+  int zlib_e;
+
+  if (stream->stream_type == SQUASH_STREAM_COMPRESS) {
+    zlib_e = deflateReset (zlib_stream);
+  } else {
+    zlib_e = inflateReset (zlib_stream);
+  }
+
+  if (zlib_e == Z_OK)
+    zlib_e = squash_zlib_stream_prime ((SquashZlibStream*) stream);
+
+  return SQUASH_LIKELY(zlib_e == Z_OK) ? SQUASH_OK : squash_error (SQUASH_FAILED);
+}
+
 #define SQUASH_ZLIB_STREAM_COPY_TO_ZLIB_STREAM(stream,zlib_stream) \
   zlib_stream->next_in = (Bytef*) stream->next_in; \
   zlib_stream->avail_in = (uInt) stream->avail_in; \
@@ -251,6 +317,12 @@ squash_zlib_process_stream (SquashStream* stream, SquashOperation operation) {
     zlib_e = deflate (zlib_stream, squash_operation_to_zlib (operation));
   } else {
     zlib_e = inflate (zlib_stream, squash_operation_to_zlib (operation));
+
+    if (zlib_e == Z_NEED_DICT) {
+      SquashDictionary* dictionary = squash_zlib_stream_get_dictionary ((SquashZlibStream*) stream);
+      if (dictionary != NULL && squash_zlib_stream_set_dictionary ((SquashZlibStream*) stream, dictionary) == Z_OK)
+        zlib_e = inflate (zlib_stream, squash_operation_to_zlib (operation));
+    }
   }
 
 #if SIZE_MAX < UINT_MAX
@@ -354,6 +426,29 @@ squash_zlib_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_siz
   }
 }
 
+/* The gzip trailer stores the uncompressed size modulo 2^32 (ISIZE),
+   and a file may contain multiple members, so this is only a hint. */
+static size_t
+squash_zlib_get_uncompressed_size (SquashCodec* codec,
+                                   size_t compressed_size,
+                                   const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  if (compressed_size < 18 || compressed[0] != 0x1f || compressed[1] != 0x8b)
+    return 0;
+
+  const uint8_t* isize = compressed + compressed_size - 4;
+  const size_t uncompressed_size =
+    ((size_t) isize[0]) |
+    ((size_t) isize[1] <<  8) |
+    ((size_t) isize[2] << 16) |
+    ((size_t) isize[3] << 24);
+
+  /* Deflate can't do better than about 1032:1. */
+  if (uncompressed_size / 1032 > compressed_size)
+    return 0;
+
+  return uncompressed_size;
+}
+
 SquashStatus
 squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
@@ -365,7 +460,12 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
     impl->options = squash_zlib_options;
     impl->create_stream = squash_zlib_create_stream;
     impl->process_stream = squash_zlib_process_stream;
+    impl->reset_stream = squash_zlib_reset_stream;
     impl->get_max_compressed_size = squash_zlib_get_max_compressed_size;
+    if (strcmp ("gzip", name) == 0) {
+      impl->info |= SQUASH_CODEC_INFO_SIZE_HINT;
+      impl->get_uncompressed_size = squash_zlib_get_uncompressed_size;
+    }
   } else {
     return SQUASH_UNABLE_TO_LOAD;
   }
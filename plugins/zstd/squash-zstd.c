@@ -25,20 +25,41 @@
  */
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
 #include <squash/squash.h>
 
+#define ZSTD_STATIC_LINKING_ONLY
 #include "zstd.h"
+#include "zbuff.h"
 #include "error_public.h"
 
+typedef struct SquashZstdStream_s {
+  SquashStream base_object;
+
+  union {
+    ZBUFF_CCtx* comp;
+    ZBUFF_DCtx* decomp;
+  } ctx;
+} SquashZstdStream;
+
 SQUASH_PLUGIN_EXPORT
-SquashStatus squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl);
+SquashStatus              squash_plugin_init_codec   (SquashCodec* codec, SquashCodecImpl* impl);
+
+static void               squash_zstd_stream_init    (SquashZstdStream* stream,
+                                                      SquashCodec* codec,
+                                                      SquashStreamType stream_type,
+                                                      SquashOptions* options,
+                                                      SquashDestroyNotify destroy_notify);
+static SquashZstdStream*  squash_zstd_stream_new     (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options);
+static void               squash_zstd_stream_destroy (void* stream);
 
 enum SquashZstdOptIndex {
-  SQUASH_ZSTD_OPT_LEVEL = 0
+  SQUASH_ZSTD_OPT_LEVEL = 0,
+  SQUASH_ZSTD_OPT_DICTIONARY
 };
 
 static SquashOptionInfo squash_zstd_options[] = {
@@ -48,6 +69,8 @@ static SquashOptionInfo squash_zstd_options[] = {
       .min = 1,
       .max = 22 },
     .default_value.int_value = 9 },
+  { "dictionary",
+    SQUASH_OPTION_TYPE_DICTIONARY, },
   { NULL, SQUASH_OPTION_TYPE_NONE, }
 };
 
@@ -91,6 +114,299 @@ squash_zstd_status_from_zstd_error (size_t res) {
   squash_assert_unreachable ();
 }
 
+static void
+squash_zstd_stream_init (SquashZstdStream* stream,
+                         SquashCodec* codec,
+                         SquashStreamType stream_type,
+                         SquashOptions* options,
+                         SquashDestroyNotify destroy_notify) {
+  squash_stream_init ((SquashStream*) stream, codec, stream_type, (SquashOptions*) options, destroy_notify);
+
+  stream->ctx.comp = NULL;
+}
+
+static void
+squash_zstd_stream_destroy (void* stream) {
+  SquashZstdStream* s = (SquashZstdStream*) stream;
+
+  switch (((SquashStream*) stream)->stream_type) {
+    case SQUASH_STREAM_COMPRESS:
+      if (s->ctx.comp != NULL)
+        ZBUFF_freeCCtx (s->ctx.comp);
+      break;
+    case SQUASH_STREAM_DECOMPRESS:
+      if (s->ctx.decomp != NULL)
+        ZBUFF_freeDCtx (s->ctx.decomp);
+      break;
+  }
+
+  squash_stream_destroy (stream);
+}
+
+static size_t
+squash_zstd_stream_begin (SquashZstdStream* s) {
+  SquashStream* stream = (SquashStream*) s;
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (stream->options, stream->codec, SQUASH_ZSTD_OPT_DICTIONARY);
+
+  if (stream->stream_type == SQUASH_STREAM_COMPRESS) {
+    const int level = squash_options_get_int_at (stream->options, stream->codec, SQUASH_ZSTD_OPT_LEVEL);
+    if (dictionary != NULL)
+      return ZBUFF_compressInitDictionary (s->ctx.comp,
+                                           squash_dictionary_get_data (dictionary),
+                                           squash_dictionary_get_size (dictionary),
+                                           level);
+    else
+      return ZBUFF_compressInit (s->ctx.comp, level);
+  } else {
+    if (dictionary != NULL)
+      return ZBUFF_decompressInitDictionary (s->ctx.decomp,
+                                             squash_dictionary_get_data (dictionary),
+                                             squash_dictionary_get_size (dictionary));
+    else
+      return ZBUFF_decompressInit (s->ctx.decomp);
+  }
+}
+
+static SquashZstdStream*
+squash_zstd_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  SquashZstdStream* stream;
+  size_t zres;
+
+  assert (codec != NULL);
+  assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
+
+  stream = squash_malloc (sizeof (SquashZstdStream));
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return (squash_error (SQUASH_MEMORY), NULL);
+
+  squash_zstd_stream_init (stream, codec, stream_type, options, squash_zstd_stream_destroy);
+
+  if (stream_type == SQUASH_STREAM_COMPRESS) {
+    stream->ctx.comp = ZBUFF_createCCtx ();
+    if (SQUASH_UNLIKELY(stream->ctx.comp == NULL))
+      goto error;
+  } else {
+    stream->ctx.decomp = ZBUFF_createDCtx ();
+    if (SQUASH_UNLIKELY(stream->ctx.decomp == NULL))
+      goto error;
+  }
+
+  zres = squash_zstd_stream_begin (stream);
+  if (SQUASH_UNLIKELY(ZBUFF_isError (zres)))
+    goto error;
+
+  return stream;
+
+ error:
+  squash_object_unref (stream);
+  return (squash_error (SQUASH_FAILED), NULL);
+}
+
+static SquashStream*
+squash_zstd_create_stream (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  return (SquashStream*) squash_zstd_stream_new (codec, stream_type, options);
+}
+
+static SquashStatus
+squash_zstd_reset_stream (SquashStream* stream) {
+  return squash_zstd_status_from_zstd_error (squash_zstd_stream_begin ((SquashZstdStream*) stream));
+}
+
+static SquashStatus
+squash_zstd_compress_stream (SquashStream* stream, SquashOperation operation) {
+  SquashZstdStream* s = (SquashZstdStream*) stream;
+  size_t dst_len = stream->avail_out;
+  size_t src_len = stream->avail_in;
+  size_t zres;
+
+  switch (operation) {
+    case SQUASH_OPERATION_PROCESS:
+      zres = ZBUFF_compressContinue (s->ctx.comp, stream->next_out, &dst_len, stream->next_in, &src_len);
+      break;
+    case SQUASH_OPERATION_FLUSH:
+      /* Squash will have already fed us all the input, so all we
+         have to do is drain ZBUFF's internal buffer. */
+      assert (stream->avail_in == 0);
+      src_len = 0;
+      zres = ZBUFF_compressFlush (s->ctx.comp, stream->next_out, &dst_len);
+      break;
+    case SQUASH_OPERATION_FINISH:
+      assert (stream->avail_in == 0);
+      src_len = 0;
+      zres = ZBUFF_compressEnd (s->ctx.comp, stream->next_out, &dst_len);
+      break;
+    case SQUASH_OPERATION_TERMINATE:
+    default:
+      squash_assert_unreachable ();
+  }
+
+  if (SQUASH_UNLIKELY(ZBUFF_isError (zres)))
+    return squash_zstd_status_from_zstd_error (zres);
+
+  stream->next_in += src_len;
+  stream->avail_in -= src_len;
+  stream->next_out += dst_len;
+  stream->avail_out -= dst_len;
+
+  if (operation == SQUASH_OPERATION_PROCESS) {
+    return (stream->avail_in == 0) ? SQUASH_OK : SQUASH_PROCESSING;
+  } else {
+    /* For flush and end, the return value is the number of bytes
+       still waiting to be written. */
+    return (zres == 0) ? SQUASH_OK : SQUASH_PROCESSING;
+  }
+}
+
+static SquashStatus
+squash_zstd_decompress_stream (SquashStream* stream, SquashOperation operation) {
+  SquashZstdStream* s = (SquashZstdStream*) stream;
+
+  while (stream->avail_in != 0 || operation != SQUASH_OPERATION_PROCESS) {
+    size_t dst_len = stream->avail_out;
+    size_t src_len = stream->avail_in;
+    const size_t zres = ZBUFF_decompressContinue (s->ctx.decomp, stream->next_out, &dst_len, stream->next_in, &src_len);
+
+    if (SQUASH_UNLIKELY(ZBUFF_isError (zres)))
+      return squash_zstd_status_from_zstd_error (zres);
+
+    stream->next_in += src_len;
+    stream->avail_in -= src_len;
+    stream->next_out += dst_len;
+    stream->avail_out -= dst_len;
+
+    /* A hint of zero means the frame is complete and fully flushed. */
+    if (zres == 0)
+      return SQUASH_END_OF_STREAM;
+
+    if (stream->avail_out == 0)
+      return SQUASH_PROCESSING;
+
+    if (src_len == 0 && dst_len == 0)
+      break;
+  }
+
+  return (stream->avail_in == 0) ? SQUASH_OK : SQUASH_PROCESSING;
+}
+
+static SquashStatus
+squash_zstd_process_stream (SquashStream* stream, SquashOperation operation) {
+  switch (stream->stream_type) {
+    case SQUASH_STREAM_COMPRESS:
+      return squash_zstd_compress_stream (stream, operation);
+    case SQUASH_STREAM_DECOMPRESS:
+      return squash_zstd_decompress_stream (stream, operation);
+    default:
+      squash_assert_unreachable();
+  }
+}
+
+/* Digested dictionaries are cached on the SquashDictionary; the key
+   is the compression level for compression, 0 for decompression. */
+static void*
+squash_zstd_create_cdict (SquashDictionary* dictionary, SquashCodec* codec, int level) {
+  return ZSTD_createCDict (squash_dictionary_get_data (dictionary), squash_dictionary_get_size (dictionary), level);
+}
+
+static void
+squash_zstd_free_cdict (void* cdict) {
+  ZSTD_freeCDict ((ZSTD_CDict*) cdict);
+}
+
+static void*
+squash_zstd_create_ddict (SquashDictionary* dictionary, SquashCodec* codec, int key) {
+  return ZSTD_createDDict (squash_dictionary_get_data (dictionary), squash_dictionary_get_size (dictionary));
+}
+
+static void
+squash_zstd_free_ddict (void* ddict) {
+  ZSTD_freeDDict ((ZSTD_DDict*) ddict);
+}
+
+/* Contexts used with dictionaries are much more expensive to create
+   than the dictionary compression itself for small inputs, so a few
+   are kept for reuse.  Each slot is taken and refilled atomically;
+   if all of them are in use a context is simply created and freed. */
+
+#if !defined(SQUASH_ZSTD_CTX_POOL_SIZE)
+#  define SQUASH_ZSTD_CTX_POOL_SIZE 4
+#endif
+
+static void*
+squash_zstd_malloc (void* opaque, size_t size) {
+  return squash_malloc (size);
+}
+
+static void
+squash_zstd_free (void* opaque, void* ptr) {
+  squash_free (ptr);
+}
+
+static const ZSTD_customMem squash_zstd_mem = { squash_zstd_malloc, squash_zstd_free, NULL };
+
+static ZSTD_CCtx* squash_zstd_cctx_pool[SQUASH_ZSTD_CTX_POOL_SIZE] = { NULL, };
+static ZSTD_DCtx* squash_zstd_dctx_pool[SQUASH_ZSTD_CTX_POOL_SIZE] = { NULL, };
+
+#if defined(__GNUC__) || defined(__clang__) || defined(__INTEL_COMPILER)
+#  define squash_zstd_pool_take(slot) __atomic_exchange_n((slot), NULL, __ATOMIC_ACQUIRE)
+#  define squash_zstd_pool_put(slot, ctx) __sync_bool_compare_and_swap((slot), NULL, (ctx))
+#else
+#  define squash_zstd_pool_take(slot) NULL
+#  define squash_zstd_pool_put(slot, ctx) false
+#endif
+
+#if defined(__GNUC__)
+__attribute__((__destructor__))
+static void
+squash_zstd_ctx_pool_destroy (void) {
+  for (size_t i = 0 ; i < SQUASH_ZSTD_CTX_POOL_SIZE ; i++) {
+    ZSTD_freeCCtx (squash_zstd_cctx_pool[i]);
+    squash_zstd_cctx_pool[i] = NULL;
+    ZSTD_freeDCtx (squash_zstd_dctx_pool[i]);
+    squash_zstd_dctx_pool[i] = NULL;
+  }
+}
+#endif
+
+static ZSTD_CCtx*
+squash_zstd_cctx_acquire (void) {
+  for (size_t i = 0 ; i < SQUASH_ZSTD_CTX_POOL_SIZE ; i++) {
+    ZSTD_CCtx* cctx = squash_zstd_pool_take (&(squash_zstd_cctx_pool[i]));
+    if (cctx != NULL)
+      return cctx;
+  }
+
+  return ZSTD_createCCtx_advanced (squash_zstd_mem);
+}
+
+static void
+squash_zstd_cctx_release (ZSTD_CCtx* cctx) {
+  for (size_t i = 0 ; i < SQUASH_ZSTD_CTX_POOL_SIZE ; i++)
+    if (squash_zstd_pool_put (&(squash_zstd_cctx_pool[i]), cctx))
+      return;
+
+  ZSTD_freeCCtx (cctx);
+}
+
+static ZSTD_DCtx*
+squash_zstd_dctx_acquire (void) {
+  for (size_t i = 0 ; i < SQUASH_ZSTD_CTX_POOL_SIZE ; i++) {
+    ZSTD_DCtx* dctx = squash_zstd_pool_take (&(squash_zstd_dctx_pool[i]));
+    if (dctx != NULL)
+      return dctx;
+  }
+
+  return ZSTD_createDCtx_advanced (squash_zstd_mem);
+}
+
+static void
+squash_zstd_dctx_release (ZSTD_DCtx* dctx) {
+  for (size_t i = 0 ; i < SQUASH_ZSTD_CTX_POOL_SIZE ; i++)
+    if (squash_zstd_pool_put (&(squash_zstd_dctx_pool[i]), dctx))
+      return;
+
+  ZSTD_freeDCtx (dctx);
+}
+
 static SquashStatus
 squash_zstd_decompress_buffer (SquashCodec* codec,
                                size_t* decompressed_size,
@@ -98,6 +414,23 @@ squash_zstd_decompress_buffer (SquashCodec* codec,
                                size_t compressed_size,
                                const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
                                SquashOptions* options) {
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (options, codec, SQUASH_ZSTD_OPT_DICTIONARY);
+
+  if (dictionary != NULL) {
+    const ZSTD_DDict* ddict = squash_dictionary_get_digest (dictionary, codec, 0, squash_zstd_create_ddict, squash_zstd_free_ddict);
+    if (SQUASH_UNLIKELY(ddict == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    ZSTD_DCtx* dctx = squash_zstd_dctx_acquire ();
+    if (SQUASH_UNLIKELY(dctx == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    *decompressed_size = ZSTD_decompress_usingDDict (dctx, decompressed, *decompressed_size, compressed, compressed_size, ddict);
+    squash_zstd_dctx_release (dctx);
+
+    return squash_zstd_status_from_zstd_error (*decompressed_size);
+  }
+
   *decompressed_size = ZSTD_decompress (decompressed, *decompressed_size, compressed, compressed_size);
 
   return squash_zstd_status_from_zstd_error (*decompressed_size);
@@ -111,21 +444,182 @@ squash_zstd_compress_buffer (SquashCodec* codec,
                              const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
                              SquashOptions* options) {
   const int level = squash_options_get_int_at (options, codec, SQUASH_ZSTD_OPT_LEVEL);
+  SquashDictionary* dictionary = squash_options_get_dictionary_at (options, codec, SQUASH_ZSTD_OPT_DICTIONARY);
+
+  if (dictionary != NULL) {
+    const ZSTD_CDict* cdict = squash_dictionary_get_digest (dictionary, codec, level, squash_zstd_create_cdict, squash_zstd_free_cdict);
+    if (SQUASH_UNLIKELY(cdict == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    ZSTD_CCtx* cctx = squash_zstd_cctx_acquire ();
+    if (SQUASH_UNLIKELY(cctx == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    *compressed_size = ZSTD_compress_usingCDict (cctx, compressed, *compressed_size, uncompressed, uncompressed_size, cdict);
+    squash_zstd_cctx_release (cctx);
+
+    return squash_zstd_status_from_zstd_error (*compressed_size);
+  }
 
   *compressed_size = ZSTD_compress (compressed, *compressed_size, uncompressed, uncompressed_size, level);
 
   return squash_zstd_status_from_zstd_error (*compressed_size);
 }
 
+static size_t
+squash_zstd_get_uncompressed_size (SquashCodec* codec,
+                                   size_t compressed_size,
+                                   const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  const unsigned long long uncompressed_size = ZSTD_getDecompressedSize (compressed, compressed_size);
+
+  return (uncompressed_size <= SIZE_MAX) ? (size_t) uncompressed_size : 0;
+}
+
+static uint64_t
+squash_zstd_read_le (const uint8_t* data, size_t size) {
+  uint64_t v = 0;
+  for (size_t i = size ; i > 0 ; i--)
+    v = (v << 8) | data[i - 1];
+  return v;
+}
+
+/* Find the end of the frame starting at the beginning of @a data by
+   walking its block headers; returns 0 if it is malformed.  Stores
+   the frame's content size (or 0 if the header doesn't include it) in
+   @a content_size, and whether it is a skippable frame in
+   @a skippable. */
+static size_t
+squash_zstd_frame_size (size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)], size_t* content_size, bool* skippable) {
+  static const size_t dict_id_sizes[] = { 0, 1, 2, 4 };
+  static const size_t content_size_sizes[] = { 0, 2, 4, 8 };
+
+  *content_size = 0;
+  *skippable = false;
+
+  if (size < 8)
+    return 0;
+
+  const uint32_t magic = (uint32_t) squash_zstd_read_le (data, 4);
+  if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+    const uint64_t skip = squash_zstd_read_le (data + 4, 4);
+    *skippable = true;
+    return (skip <= size - 8) ? 8 + (size_t) skip : 0;
+  } else if (magic != 0xFD2FB528) {
+    return 0;
+  }
+
+  const uint8_t descriptor = data[4];
+  const bool single_segment = (descriptor & 0x20) != 0;
+  const bool has_checksum = (descriptor & 0x04) != 0;
+  size_t fcs_size = content_size_sizes[descriptor >> 6];
+  if (fcs_size == 0 && single_segment)
+    fcs_size = 1;
+  if ((descriptor & 0x08) != 0)
+    return 0;
+
+  size_t pos = 5 + (single_segment ? 0 : 1) + dict_id_sizes[descriptor & 3];
+  if (pos + fcs_size > size)
+    return 0;
+  if (fcs_size != 0) {
+    uint64_t fcs = squash_zstd_read_le (data + pos, fcs_size);
+    if (fcs_size == 2)
+      fcs += 256;
+    *content_size = (fcs <= SIZE_MAX) ? (size_t) fcs : 0;
+  }
+  pos += fcs_size;
+
+  while (true) {
+    if (size - pos < 3)
+      return 0;
+
+    const uint32_t header = (uint32_t) squash_zstd_read_le (data + pos, 3);
+    const bool last = (header & 1) != 0;
+    const unsigned int type = (header >> 1) & 3;
+    const size_t block_size = (type == 1) ? 1 : (size_t) (header >> 3);
+    pos += 3;
+
+    if (type == 3 || block_size > size - pos)
+      return 0;
+    pos += block_size;
+
+    if (last)
+      break;
+  }
+
+  if (has_checksum) {
+    if (size - pos < 4)
+      return 0;
+    pos += 4;
+  }
+
+  return pos;
+}
+
+/* Concatenated frames are decoded independently by ZSTD_decompress
+   anyway, so each one can go to a different thread. */
+static SquashStatus
+squash_zstd_split_frames (SquashCodec* codec,
+                          size_t compressed_size,
+                          const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                          size_t* n_frames,
+                          SquashFrame** frames) {
+  size_t allocated = 0;
+  size_t pos = 0;
+
+  *n_frames = 0;
+  *frames = NULL;
+
+  while (pos < compressed_size) {
+    size_t content_size;
+    bool skippable;
+    const size_t frame_size = squash_zstd_frame_size (compressed_size - pos, compressed + pos, &content_size, &skippable);
+    if (frame_size == 0) {
+      squash_free (*frames);
+      *frames = NULL;
+      return squash_error (SQUASH_INVALID_BUFFER);
+    }
+
+    if (!skippable) {
+      if (*n_frames == allocated) {
+        allocated = (allocated == 0) ? 16 : allocated * 2;
+        SquashFrame* tmp = squash_realloc (*frames, allocated * sizeof (SquashFrame));
+        if (tmp == NULL) {
+          squash_free (*frames);
+          *frames = NULL;
+          return squash_error (SQUASH_MEMORY);
+        }
+        *frames = tmp;
+      }
+
+      SquashFrame* frame = &((*frames)[(*n_frames)++]);
+      memset (frame, 0, sizeof (SquashFrame));
+      frame->offset = pos;
+      frame->size = frame_size;
+      frame->decompressed_size = content_size;
+    }
+
+    pos += frame_size;
+  }
+
+  return SQUASH_OK;
+}
+
 SquashStatus
 squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
 
   if (SQUASH_LIKELY(strcmp ("zstd", name) == 0)) {
+    /* Frames produced by the streaming API don't record the size. */
+    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_SIZE_HINT;
     impl->options = squash_zstd_options;
+    impl->get_uncompressed_size = squash_zstd_get_uncompressed_size;
     impl->get_max_compressed_size = squash_zstd_get_max_compressed_size;
     impl->decompress_buffer = squash_zstd_decompress_buffer;
     impl->compress_buffer_unsafe = squash_zstd_compress_buffer;
+    impl->create_stream = squash_zstd_create_stream;
+    impl->process_stream = squash_zstd_process_stream;
+    impl->reset_stream = squash_zstd_reset_stream;
+    impl->split_frames = squash_zstd_split_frames;
   } else {
     return squash_error (SQUASH_UNABLE_TO_LOAD);
   }
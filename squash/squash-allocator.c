@@ -0,0 +1,431 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @defgroup SquashAllocator SquashAllocator
+ * @brief Allocators which can be attached to individual streams
+ *
+ * ::squash_set_memory_functions replaces the allocator for the
+ * entire process.  A @ref SquashAllocator, on the other hand, is
+ * attached to a single stream when it is created (see
+ * ::squash_stream_new_with_allocator), and plugins route the
+ * allocations made by the underlying library for that stream through
+ * it.
+ *
+ * The most useful allocator is the arena returned by
+ * ::squash_allocator_new_arena.  Allocation is a pointer bump, free
+ * is (almost always) a no-op, and ::squash_allocator_reset releases
+ * everything at once, so a request-scoped stream never touches the
+ * global allocator once the arena has warmed up.  Custom allocators
+ * (for example a size-class pool) can be plugged in with
+ * ::squash_allocator_new.
+ *
+ * Allocators are not synchronized.  Streams sharing an allocator must
+ * not be used from different threads at the same time; the usual
+ * arrangement is one allocator per worker thread.
+ *
+ * Only the library state of plugins which let us supply allocation
+ * callbacks is affected.  The @ref SquashStream structure itself,
+ * buffers Squash allocates internally, and libraries without such
+ * callbacks continue to use the global allocator.
+ *
+ * @{
+ */
+
+/**
+ * @struct SquashAllocator_
+ * @extends SquashObject_
+ * @brief An allocator which can be attached to a stream
+ */
+
+/**
+ * @struct SquashAllocatorFuncs_
+ * @brief Callbacks implementing a @ref SquashAllocator
+ *
+ * @a malloc, @a realloc and @a free are required and behave like
+ * their standard counterparts.  @a reset is optional; if provided it
+ * should release every allocation at once.
+ *
+ * @var SquashAllocatorFuncs_::malloc
+ * @brief Allocate @a size bytes
+ * @var SquashAllocatorFuncs_::realloc
+ * @brief Resize an allocation, which may be *NULL*
+ * @var SquashAllocatorFuncs_::free
+ * @brief Release an allocation, which may be *NULL*
+ * @var SquashAllocatorFuncs_::reset
+ * @brief Release every allocation
+ */
+
+#define SQUASH_ARENA_ALIGNMENT ((size_t) 16)
+#define SQUASH_ARENA_ALIGN(size) \
+  (((size) + (SQUASH_ARENA_ALIGNMENT - 1)) & ~(SQUASH_ARENA_ALIGNMENT - 1))
+
+/* Each allocation is preceded by a header (padded to the alignment)
+   holding its size, which realloc needs. */
+#define SQUASH_ARENA_HEADER_SIZE SQUASH_ARENA_ALIGN(sizeof (size_t))
+
+typedef struct SquashArenaBlock_ {
+  struct SquashArenaBlock_* next;
+  uint8_t* data;
+  size_t size;
+  size_t used;
+} SquashArenaBlock;
+
+/* The global allocator may only guarantee alignment suitable for a
+   pointer, so leave room to align the data ourselves. */
+#define SQUASH_ARENA_BLOCK_HEADER_SIZE (sizeof (SquashArenaBlock) + SQUASH_ARENA_ALIGNMENT - 1)
+
+typedef struct SquashArena_ {
+  /* The current block comes first */
+  SquashArenaBlock* blocks;
+  size_t block_size;
+  /* Most recent allocation, which can be freed or grown in place */
+  uint8_t* last;
+  /* Other freed allocations, linked through their first bytes.  This
+     lets libraries without a reset function, which tear down and
+     recreate their state (with the same sizes) when a stream is
+     reset, reuse the memory instead of growing the arena. */
+  uint8_t* free_list;
+} SquashArena;
+
+static size_t
+squash_arena_allocation_size (const uint8_t* ptr) {
+  size_t size;
+  memcpy (&size, ptr - SQUASH_ARENA_HEADER_SIZE, sizeof (size_t));
+  return size;
+}
+
+static void*
+squash_arena_malloc (void* user_data, size_t size) {
+  SquashArena* arena = (SquashArena*) user_data;
+  SquashArenaBlock* block = arena->blocks;
+
+  if (SQUASH_UNLIKELY(size > (SIZE_MAX - SQUASH_ARENA_BLOCK_HEADER_SIZE - (SQUASH_ARENA_HEADER_SIZE * 2))))
+    return NULL;
+
+  const size_t needed = SQUASH_ARENA_HEADER_SIZE + SQUASH_ARENA_ALIGN(size);
+
+  for (uint8_t** link = &(arena->free_list) ; *link != NULL ; link = (uint8_t**) *link) {
+    uint8_t* ptr = *link;
+    if (SQUASH_ARENA_ALIGN(squash_arena_allocation_size (ptr)) == SQUASH_ARENA_ALIGN(size)) {
+      memcpy (link, ptr, sizeof (uint8_t*));
+      memcpy (ptr - SQUASH_ARENA_HEADER_SIZE, &size, sizeof (size_t));
+      return ptr;
+    }
+  }
+
+  if (block == NULL || (block->size - block->used) < needed) {
+    const size_t block_size = (needed > arena->block_size) ? needed : arena->block_size;
+
+    block = squash_malloc (SQUASH_ARENA_BLOCK_HEADER_SIZE + block_size);
+    if (SQUASH_UNLIKELY(block == NULL))
+      return NULL;
+
+    block->data = (uint8_t*) SQUASH_ARENA_ALIGN((uintptr_t) (block + 1));
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  uint8_t* ptr = block->data + block->used + SQUASH_ARENA_HEADER_SIZE;
+  memcpy (ptr - SQUASH_ARENA_HEADER_SIZE, &size, sizeof (size_t));
+  block->used += needed;
+  arena->last = ptr;
+
+  return ptr;
+}
+
+static void
+squash_arena_free (void* user_data, void* ptr) {
+  SquashArena* arena = (SquashArena*) user_data;
+
+  if (ptr == NULL)
+    return;
+
+  /* The most recent allocation can be given back to the block;
+     anything else large enough to hold a pointer goes on the free
+     list for an allocation of the same size to pick up. */
+  if (ptr == arena->last) {
+    arena->blocks->used -= SQUASH_ARENA_HEADER_SIZE + SQUASH_ARENA_ALIGN(squash_arena_allocation_size (ptr));
+    arena->last = NULL;
+  } else if (SQUASH_ARENA_ALIGN(squash_arena_allocation_size (ptr)) >= sizeof (uint8_t*)) {
+    memcpy (ptr, &(arena->free_list), sizeof (uint8_t*));
+    arena->free_list = (uint8_t*) ptr;
+  }
+}
+
+static void*
+squash_arena_realloc (void* user_data, void* ptr, size_t size) {
+  SquashArena* arena = (SquashArena*) user_data;
+
+  if (ptr == NULL)
+    return squash_arena_malloc (user_data, size);
+
+  const size_t old_size = squash_arena_allocation_size (ptr);
+
+  if (ptr == arena->last) {
+    SquashArenaBlock* block = arena->blocks;
+    const size_t start = (size_t) (((uint8_t*) ptr) - block->data);
+
+    if (size <= (block->size - start)) {
+      block->used = start + SQUASH_ARENA_ALIGN(size);
+      memcpy (((uint8_t*) ptr) - SQUASH_ARENA_HEADER_SIZE, &size, sizeof (size_t));
+      return ptr;
+    }
+  } else if (size <= old_size) {
+    return ptr;
+  }
+
+  void* new_ptr = squash_arena_malloc (user_data, size);
+  if (SQUASH_UNLIKELY(new_ptr == NULL))
+    return NULL;
+
+  memcpy (new_ptr, ptr, (old_size < size) ? old_size : size);
+  squash_arena_free (user_data, ptr);
+
+  return new_ptr;
+}
+
+static void
+squash_arena_reset (void* user_data) {
+  SquashArena* arena = (SquashArena*) user_data;
+  SquashArenaBlock* keep = NULL;
+  SquashArenaBlock* next;
+
+  /* Hang on to the largest block so the next round of allocations
+     doesn't have to go back to the global allocator. */
+  for (SquashArenaBlock* block = arena->blocks ; block != NULL ; block = next) {
+    next = block->next;
+    if (keep == NULL || block->size > keep->size) {
+      if (keep != NULL)
+        squash_free (keep);
+      keep = block;
+    } else {
+      squash_free (block);
+    }
+  }
+
+  if (keep != NULL) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+
+  arena->blocks = keep;
+  arena->last = NULL;
+  arena->free_list = NULL;
+}
+
+static void
+squash_arena_destroy (void* user_data) {
+  SquashArena* arena = (SquashArena*) user_data;
+  SquashArenaBlock* next;
+
+  for (SquashArenaBlock* block = arena->blocks ; block != NULL ; block = next) {
+    next = block->next;
+    squash_free (block);
+  }
+
+  squash_free (arena);
+}
+
+static const SquashAllocatorFuncs squash_arena_funcs = {
+  squash_arena_malloc,
+  squash_arena_realloc,
+  squash_arena_free,
+  squash_arena_reset
+};
+
+static void
+squash_allocator_destroy (void* obj) {
+  SquashAllocator* allocator = (SquashAllocator*) obj;
+
+  if (allocator->destroy_user_data != NULL)
+    allocator->destroy_user_data (allocator->user_data);
+
+  squash_object_destroy (obj);
+}
+
+/**
+ * @brief Create a new allocator from a set of callbacks
+ *
+ * @param funcs Callbacks implementing the allocator; copied, so they
+ *   need not remain valid after this function returns
+ * @param user_data Data to pass to the callbacks
+ * @param destroy_user_data Function to call on @a user_data when the
+ *   allocator is destroyed, or *NULL*
+ * @return A new (floating) allocator, or *NULL* on failure
+ */
+SquashAllocator*
+squash_allocator_new (const SquashAllocatorFuncs* funcs,
+                      void* user_data,
+                      SquashDestroyNotify destroy_user_data) {
+  assert (funcs != NULL);
+  assert (funcs->malloc != NULL);
+  assert (funcs->realloc != NULL);
+  assert (funcs->free != NULL);
+
+  SquashAllocator* allocator = squash_malloc (sizeof (SquashAllocator));
+  if (SQUASH_UNLIKELY(allocator == NULL))
+    return (squash_error (SQUASH_MEMORY), NULL);
+
+  squash_object_init (allocator, true, squash_allocator_destroy);
+  allocator->funcs = *funcs;
+  allocator->user_data = user_data;
+  allocator->destroy_user_data = destroy_user_data;
+
+  return allocator;
+}
+
+/**
+ * @brief Create a new arena allocator
+ *
+ * Memory is handed out from blocks of @a block_size bytes (larger
+ * requests get a block of their own).  Freeing the most recent
+ * allocation returns it to the block; other freed memory can only be
+ * reused by a later allocation of the same size, and is otherwise
+ * held until ::squash_allocator_reset is called or the arena is
+ * destroyed.
+ *
+ * @param block_size Size of each block, or 0 for a default of 1 MiB
+ * @return A new (floating) allocator, or *NULL* on failure
+ */
+SquashAllocator*
+squash_allocator_new_arena (size_t block_size) {
+  SquashArena* arena = squash_malloc (sizeof (SquashArena));
+  if (SQUASH_UNLIKELY(arena == NULL))
+    return (squash_error (SQUASH_MEMORY), NULL);
+
+  arena->blocks = NULL;
+  arena->block_size = SQUASH_ARENA_ALIGN((block_size != 0) ? block_size : (1024 * 1024));
+  arena->last = NULL;
+  arena->free_list = NULL;
+
+  SquashAllocator* allocator = squash_allocator_new (&squash_arena_funcs, arena, squash_arena_destroy);
+  if (SQUASH_UNLIKELY(allocator == NULL))
+    squash_arena_destroy (arena);
+
+  return allocator;
+}
+
+/**
+ * @brief Release everything allocated from an allocator
+ *
+ * This is a no-op for allocators without a reset callback.
+ *
+ * @warning Any stream using the allocator must have been destroyed
+ *   before resetting it.
+ *
+ * @param allocator The allocator
+ */
+void
+squash_allocator_reset (SquashAllocator* allocator) {
+  assert (allocator != NULL);
+
+  if (allocator->funcs.reset != NULL)
+    allocator->funcs.reset (allocator->user_data);
+}
+
+/**
+ * @brief Allocate memory from an allocator
+ *
+ * @param allocator The allocator, or *NULL* to use ::squash_malloc
+ * @param size Number of bytes to allocate
+ * @return The allocation, or *NULL* on failure
+ */
+void*
+squash_allocator_malloc (SquashAllocator* allocator, size_t size) {
+  if (allocator == NULL)
+    return squash_malloc (size);
+
+  return allocator->funcs.malloc (allocator->user_data, size);
+}
+
+/**
+ * @brief Allocate zeroed memory from an allocator
+ *
+ * @param allocator The allocator, or *NULL* to use ::squash_calloc
+ * @param nmemb Number of elements
+ * @param size Size of each element
+ * @return The allocation, or *NULL* on failure
+ */
+void*
+squash_allocator_calloc (SquashAllocator* allocator, size_t nmemb, size_t size) {
+  if (allocator == NULL)
+    return squash_calloc (nmemb, size);
+
+  if (SQUASH_UNLIKELY(size != 0 && nmemb > (SIZE_MAX / size)))
+    return NULL;
+
+  void* ptr = allocator->funcs.malloc (allocator->user_data, nmemb * size);
+  if (SQUASH_LIKELY(ptr != NULL))
+    memset (ptr, 0, nmemb * size);
+
+  return ptr;
+}
+
+/**
+ * @brief Resize memory allocated from an allocator
+ *
+ * @param allocator The allocator, or *NULL* to use ::squash_realloc
+ * @param ptr The allocation to resize, or *NULL*
+ * @param size New size
+ * @return The resized allocation, or *NULL* on failure
+ */
+void*
+squash_allocator_realloc (SquashAllocator* allocator, void* ptr, size_t size) {
+  if (allocator == NULL)
+    return squash_realloc (ptr, size);
+
+  return allocator->funcs.realloc (allocator->user_data, ptr, size);
+}
+
+/**
+ * @brief Release memory allocated from an allocator
+ *
+ * @param allocator The allocator, or *NULL* to use ::squash_free
+ * @param ptr The allocation, or *NULL*
+ */
+void
+squash_allocator_free (SquashAllocator* allocator, void* ptr) {
+  if (allocator == NULL) {
+    squash_free (ptr);
+    return;
+  }
+
+  allocator->funcs.free (allocator->user_data, ptr);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,66 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+/* IWYU pragma: private, include <squash/squash.h> */
+
+#ifndef SQUASH_ALLOCATOR_H
+#define SQUASH_ALLOCATOR_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stddef.h>
+
+SQUASH_BEGIN_DECLS
+
+typedef struct SquashAllocatorFuncs_ {
+  void* (* malloc)  (void* user_data, size_t size);
+  void* (* realloc) (void* user_data, void* ptr, size_t size);
+  void  (* free)    (void* user_data, void* ptr);
+  void  (* reset)   (void* user_data);
+} SquashAllocatorFuncs;
+
+SQUASH_NONNULL(1)
+SQUASH_API SquashAllocator* squash_allocator_new       (const SquashAllocatorFuncs* funcs,
+                                                        void* user_data,
+                                                        SquashDestroyNotify destroy_user_data);
+SQUASH_API SquashAllocator* squash_allocator_new_arena (size_t block_size);
+
+SQUASH_NONNULL(1)
+SQUASH_API void             squash_allocator_reset     (SquashAllocator* allocator);
+
+SQUASH_MALLOC
+SQUASH_API void*            squash_allocator_malloc    (SquashAllocator* allocator, size_t size);
+SQUASH_MALLOC
+SQUASH_API void*            squash_allocator_calloc    (SquashAllocator* allocator, size_t nmemb, size_t size);
+SQUASH_API void*            squash_allocator_realloc   (SquashAllocator* allocator, void* ptr, size_t size);
+SQUASH_API void             squash_allocator_free      (SquashAllocator* allocator, void* ptr);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_ALLOCATOR_H */
@@ -0,0 +1,227 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup SquashBatch Batch compression
+ * @brief Compress or decompress many small, independent buffers
+ *
+ * Compressing a large number of small buffers one at a time with
+ * ::squash_codec_compress_with_options spends a noticeable fraction
+ * of the time on per-call overhead: loading the codec
+ * implementation, taking a reference to the options, and (for codecs
+ * which only provide a streaming API) setting up a stream.  These
+ * functions do that work once for the whole batch, and can
+ * optionally spread the items across several threads.
+ *
+ * Each item is processed independently; a failure in one item does
+ * not prevent the others from being processed.  The result for each
+ * item is stored in SquashBatchItem_::status.
+ *
+ * @{
+ */
+
+/**
+ * @struct SquashBatchItem_
+ * @brief A single buffer in a batch operation
+ */
+
+/**
+ * @var SquashBatchItem_::input
+ * @brief The data to compress or decompress
+ */
+
+/**
+ * @var SquashBatchItem_::input_size
+ * @brief Size of SquashBatchItem_::input (in bytes)
+ */
+
+/**
+ * @var SquashBatchItem_::output
+ * @brief Buffer to write the result to
+ */
+
+/**
+ * @var SquashBatchItem_::output_size
+ * @brief Size of SquashBatchItem_::output on input, replaced with the
+ *   number of bytes written on output
+ */
+
+/**
+ * @var SquashBatchItem_::status
+ * @brief Result of processing this item
+ */
+
+#ifndef SQUASH_BATCH_CHUNK_SIZE
+#  define SQUASH_BATCH_CHUNK_SIZE 16
+#endif
+
+typedef struct SquashBatchData_ {
+  SquashCodec* codec;
+  SquashCodecImpl* impl;
+  SquashStreamType stream_type;
+  size_t n_items;
+  SquashBatchItem* items;
+  SquashOptions* options;
+} SquashBatchData;
+
+/* Items are handed out to the workers in chunks so that the cost of
+   taking the next item is amortized over several small buffers. */
+static SquashStatus
+squash_batch_process_chunk (size_t chunk, void* user_data) {
+  SquashBatchData* data = (SquashBatchData*) user_data;
+  const size_t first = chunk * SQUASH_BATCH_CHUNK_SIZE;
+  const size_t last = (data->n_items - first > SQUASH_BATCH_CHUNK_SIZE) ? first + SQUASH_BATCH_CHUNK_SIZE : data->n_items;
+
+  for (size_t i = first ; i < last ; i++) {
+    SquashBatchItem* item = &(data->items[i]);
+
+    if (SQUASH_UNLIKELY(item->input == NULL || item->output == NULL)) {
+      item->status = squash_error (SQUASH_BAD_PARAM);
+    } else if (data->stream_type == SQUASH_STREAM_COMPRESS) {
+      item->status = squash_codec_compress_internal (data->codec, data->impl,
+                                                     &(item->output_size), item->output,
+                                                     item->input_size, item->input,
+                                                     data->options);
+    } else {
+      item->status = squash_codec_decompress_internal (data->codec, data->impl,
+                                                       &(item->output_size), item->output,
+                                                       item->input_size, item->input,
+                                                       data->options);
+    }
+  }
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_codec_process_batch (SquashCodec* codec,
+                            SquashStreamType stream_type,
+                            size_t n_items,
+                            SquashBatchItem items[SQUASH_ARRAY_PARAM(n_items)],
+                            unsigned int threads,
+                            SquashOptions* options) {
+  SquashBatchData data;
+  SquashStatus res = SQUASH_OK;
+
+  assert (codec != NULL);
+  assert (items != NULL || n_items == 0);
+
+  squash_options_hold (options);
+
+  data.impl = squash_codec_get_impl (codec);
+  if (SQUASH_UNLIKELY(data.impl == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    for (size_t i = 0 ; i < n_items ; i++)
+      items[i].status = res;
+    goto cleanup;
+  }
+
+  data.codec = codec;
+  data.stream_type = stream_type;
+  data.n_items = n_items;
+  data.items = items;
+  data.options = options;
+
+  squash_parallel_for ((n_items / SQUASH_BATCH_CHUNK_SIZE) + (((n_items % SQUASH_BATCH_CHUNK_SIZE) != 0) ? 1 : 0),
+                       threads, squash_batch_process_chunk, &data);
+
+  for (size_t i = 0 ; i < n_items ; i++) {
+    if (SQUASH_UNLIKELY(items[i].status != SQUASH_OK)) {
+      res = items[i].status;
+      break;
+    }
+  }
+
+ cleanup:
+
+  squash_options_release (options);
+
+  return res;
+}
+
+/**
+ * @brief Compress a batch of independent buffers
+ *
+ * Each item's SquashBatchItem_::input is compressed into its
+ * SquashBatchItem_::output, exactly as if
+ * ::squash_codec_compress_with_options had been called on it, and
+ * SquashBatchItem_::output_size and SquashBatchItem_::status are
+ * updated accordingly.
+ *
+ * @param codec The codec to use
+ * @param n_items Number of items in @a items
+ * @param items The items to compress
+ * @param threads Maximum number of threads to use, 0 to use one per
+ *   CPU, or 1 to process every item on the calling thread
+ * @param options Compression options (or *NULL* to use the defaults)
+ * @return @ref SQUASH_OK if every item was compressed successfully,
+ *   otherwise the status of the first item which failed
+ */
+SquashStatus
+squash_codec_compress_batch (SquashCodec* codec,
+                             size_t n_items,
+                             SquashBatchItem items[SQUASH_ARRAY_PARAM(n_items)],
+                             unsigned int threads,
+                             SquashOptions* options) {
+  return squash_codec_process_batch (codec, SQUASH_STREAM_COMPRESS, n_items, items, threads, options);
+}
+
+/**
+ * @brief Decompress a batch of independent buffers
+ *
+ * Each item's SquashBatchItem_::input is decompressed into its
+ * SquashBatchItem_::output, exactly as if
+ * ::squash_codec_decompress_with_options had been called on it, and
+ * SquashBatchItem_::output_size and SquashBatchItem_::status are
+ * updated accordingly.
+ *
+ * @param codec The codec to use
+ * @param n_items Number of items in @a items
+ * @param items The items to decompress
+ * @param threads Maximum number of threads to use, 0 to use one per
+ *   CPU, or 1 to process every item on the calling thread
+ * @param options Decompression options (or *NULL* to use the
+ *   defaults)
+ * @return @ref SQUASH_OK if every item was decompressed
+ *   successfully, otherwise the status of the first item which failed
+ */
+SquashStatus
+squash_codec_decompress_batch (SquashCodec* codec,
+                               size_t n_items,
+                               SquashBatchItem items[SQUASH_ARRAY_PARAM(n_items)],
+                               unsigned int threads,
+                               SquashOptions* options) {
+  return squash_codec_process_batch (codec, SQUASH_STREAM_DECOMPRESS, n_items, items, threads, options);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,68 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+
+#ifndef SQUASH_BATCH_H
+#define SQUASH_BATCH_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stddef.h>
+#include <stdint.h>
+
+SQUASH_BEGIN_DECLS
+
+typedef struct SquashBatchItem_ SquashBatchItem;
+
+struct SquashBatchItem_ {
+  const uint8_t* input;
+  size_t input_size;
+
+  uint8_t* output;
+  size_t output_size;
+
+  SquashStatus status;
+};
+
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_codec_compress_batch   (SquashCodec* codec,
+                                                       size_t n_items,
+                                                       SquashBatchItem items[SQUASH_ARRAY_PARAM(n_items)],
+                                                       unsigned int threads,
+                                                       SquashOptions* options);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_codec_decompress_batch (SquashCodec* codec,
+                                                       size_t n_items,
+                                                       SquashBatchItem items[SQUASH_ARRAY_PARAM(n_items)],
+                                                       unsigned int threads,
+                                                       SquashOptions* options);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_BATCH_H */
@@ -67,6 +67,14 @@ squash_buffer_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squa
   return stream;
 }
 
+void
+squash_buffer_stream_reset (SquashBufferStream* stream) {
+  stream->input->size = 0;
+  squash_buffer_free (stream->output);
+  stream->output = NULL;
+  stream->output_pos = 0;
+}
+
 #ifndef MIN
 #  define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #endif
@@ -134,7 +142,9 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
         output->size = compressed_size;
       }
     } else {
-      size_t decompressed_size = squash_codec_get_uncompressed_size (codec, input->size, input->data);
+      const bool knows_uncompressed =
+        (squash_codec_get_info (codec) & SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE) == SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE;
+      size_t decompressed_size = knows_uncompressed ? squash_codec_get_uncompressed_size (codec, input->size, input->data) : 0;
       if (decompressed_size != 0) {
         /* We know the decompressed size. */
         if (s->avail_out >= decompressed_size) {
@@ -52,6 +52,28 @@ SquashStatus            squash_codec_decompress_to_buffer    (SquashCodec* codec
                                                               size_t compressed_size,
                                                               uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
                                                               SquashOptions* options);
+SQUASH_NONNULL(1, 2, 3, 4, 6) SQUASH_INTERNAL
+SquashStatus            squash_codec_compress_internal       (SquashCodec* codec,
+                                                              SquashCodecImpl* impl,
+                                                              size_t* compressed_size,
+                                                              uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                                              size_t uncompressed_size,
+                                                              const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                                              SquashOptions* options);
+SQUASH_NONNULL(1, 2, 3, 4, 6) SQUASH_INTERNAL
+SquashStatus            squash_codec_decompress_internal     (SquashCodec* codec,
+                                                              SquashCodecImpl* impl,
+                                                              size_t* decompressed_size,
+                                                              uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                                              size_t compressed_size,
+                                                              const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                                              SquashOptions* options);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+SquashStream*           squash_codec_acquire_stream          (SquashCodec* codec,
+                                                              SquashStreamType stream_type,
+                                                              SquashOptions* options);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+void                    squash_codec_release_stream          (SquashStream* stream);
 
 SQUASH_TREE_PROTOTYPES(SquashCodec_, tree)
 SQUASH_TREE_DEFINE(SquashCodec_, tree)
@@ -181,18 +181,83 @@
  */
 
 /**
- * @var SquashCodecImpl_::_reserved1
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::reset_stream
+ * @brief Reset a %SquashStream so it can be reused.
+ *
+ * Return the codec-specific state of a stream created by
+ * SquashCodecImpl_::create_stream to its initial state, keeping the
+ * original options.  Implementing this allows Squash to recycle
+ * streams instead of creating a new one for each buffer.
+ *
+ * @param stream The stream.
+ * @return A status code.
+ *
+ * @see squash_stream_reset
  */
 
 /**
- * @var SquashCodecImpl_::_reserved2
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::split_frames
+ * @brief Find the independently decodable frames in a buffer.
+ *
+ * Implementing this allows ::squash_codec_decompress_native_parallel
+ * to decode the frames concurrently.  Concatenating the output of
+ * every frame, in order, must produce exactly what decompressing the
+ * whole buffer would.
+ *
+ * @param codec The codec.
+ * @param compressed_size Size of the compressed data (in bytes).
+ * @param compressed Compressed data.
+ * @param n_frames Location to store the number of frames.
+ * @param frames Location to store the frames, allocated with
+ *   ::squash_malloc; the caller frees it with ::squash_free.
+ * @return A status code; anything other than @ref SQUASH_OK means
+ *   the data must be decompressed serially.
+ *
+ * @see SquashFrame_
  */
 
 /**
- * @var SquashCodecImpl_::_reserved3
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::decompress_frame
+ * @brief Decompress a single frame.
+ *
+ * Only called for frames with a non-zero SquashFrame_::codec_data;
+ * other frames are complete buffers in the codec's native format.
+ *
+ * Implementations must not read anything outside of the frame
+ * itself; anything else they need (such as parameters from a stream
+ * header) belongs in SquashFrame_::codec_data.  That allows callers
+ * to pass a buffer holding only the frame, with an offset of 0.
+ *
+ * @param codec The codec.
+ * @param frame The frame, as returned by
+ *   SquashCodecImpl_::split_frames.
+ * @param decompressed_size Size of @a decompressed on input, number
+ *   of bytes written on output.
+ * @param decompressed Buffer to write the decompressed frame to.
+ * @param compressed_size Size of @a compressed.
+ * @param compressed The compressed buffer passed to
+ *   SquashCodecImpl_::split_frames, or a copy of just the frame.
+ * @param options Decompression options.
+ * @return A status code.
+ */
+
+/**
+ * @struct SquashFrame_
+ * @brief A range of compressed data which can be decoded on its own
+ *
+ * @var SquashFrame_::offset
+ * @brief Offset of the frame in the compressed buffer
+ * @var SquashFrame_::size
+ * @brief Size of the frame (in bytes)
+ * @var SquashFrame_::decompressed_size
+ * @brief Exact size of the frame once decompressed, or 0 if unknown
+ * @var SquashFrame_::decompressed_size_hint
+ * @brief Likely size of the frame once decompressed if the exact size
+ *   is unknown, or 0; only used to size temporary buffers
+ * @var SquashFrame_::codec_data
+ * @brief 0 if the frame is a complete buffer in the codec's native
+ *   format, otherwise any value the codec needs to decode it with
+ *   SquashCodecImpl_::decompress_frame
  */
 
 /**
@@ -297,6 +362,30 @@ squash_codec_extension_compare (SquashCodec* a, SquashCodec* b) {
  * Squash plugins separately from Squash.
  */
 
+/**
+ * @var SquashCodecInfo::SQUASH_CODEC_INFO_SIZE_HINT
+ * @brief The uncompressed size reported by the codec is only a hint.
+ *
+ * Some formats can record the uncompressed size, but don't always do
+ * so (for example, when the data was compressed with a streaming
+ * API), or only record it modulo some value (gzip stores the size
+ * modulo 2³²).  Plugins for these formats may still implement
+ * SquashCodecImpl_::get_uncompressed_size, but must set this flag,
+ * in which case @ref SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE will
+ * not be set and Squash will only use the reported size as an
+ * initial guess.
+ */
+
+/**
+ * @var SquashCodecInfo::SQUASH_CODEC_INFO_PASSTHROUGH
+ * @brief The compressed data is identical to the uncompressed data.
+ *
+ * Set by the copy codec.  Squash uses it to let the kernel move the
+ * data directly between files when splicing (see @ref
+ * squash_splice_with_options), without it ever being copied to user
+ * space.
+ */
+
 /**
  * @var SquashCodecInfo::SQUASH_CODEC_INFO_AUTO_MASK
  * @brief Mask of flags which are automatically set based on which
@@ -415,96 +504,14 @@ squash_codec_get_impl (SquashCodec* codec) {
   return &(codec->impl);
 }
 
-static size_t
-squash_read_varuint64 (const uint8_t *p, size_t p_size, uint64_t *v) {
-  uint64_t n = 0;
-  size_t i;
-
-  for (i = 0; i < 8 && i < p_size && *p > 0x7F; ++i) {
-    n = (n << 7) | (*p++ & 0x7F);
-  }
-
-  if (i == p_size) {
-    return 0;
-  }
-  else if (i == 8) {
-    n = (n << 8) | *p;
-  }
-  else {
-    n = (n << 7) | *p;
-  }
-
-  *v = n;
-
-  return i + 1;
-}
-
-static size_t
-squash_write_varuint64 (uint8_t *p, size_t p_size, uint64_t v) {
-  uint8_t buf[10];
-  size_t i;
-  size_t j;
-
-  if (v & 0xFF00000000000000ULL) {
-    if (p_size < 9) {
-      return 0;
-    }
-
-    p[8] = (uint8_t) v;
-    v >>= 8;
-
-    i = 7;
-
-    for (j = 0; j < 8; ++j) {
-      p[i--] = (uint8_t) ((v & 0x7F) | 0x80);
-      v >>= 7;
-    }
-
-    return 9;
-  }
-
-  i = 0;
-
-  buf[i++] = (uint8_t) (v & 0x7F);
-  v >>= 7;
-
-  while (v > 0) {
-    buf[i++] = (uint8_t) ((v & 0x7F) | 0x80);
-    v >>= 7;
-  }
-
-  if (i > p_size) {
-    return 0;
-  }
-
-  for (j = 0; j < i; ++j) {
-    p[j] = buf[i - j - 1];
-  }
-
-  return i;
-}
-
-static size_t
-squash_size_varuint64 (const uint64_t value) {
-  if (value & 0xFF00000000000000ULL)
-    return 9;
-
-  size_t required = 1;
-
-  for (size_t s = 7 ; s < 64 ; s += 7, required++)
-    if (value < (UINT64_C(1) << s))
-      break;
-
-  return required;
-}
-
 /**
  * @brief Get the uncompressed size of the compressed buffer
  *
- * This function is only useful for codecs with the @ref
- * SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE flag set.  For situations
- * where the codec does not know the uncompressed size, *0* will be
- * returned.
+ * This function is only reliable for codecs with the @ref
+ * SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE flag set.  For codecs
+ * with the @ref SQUASH_CODEC_INFO_SIZE_HINT flag set the result is
+ * only a hint, which may be inaccurate.  For situations where the
+ * codec does not know the uncompressed size, *0* will be returned.
  *
  * @param codec The codec
  * @param compressed The compressed data
@@ -593,15 +600,27 @@ squash_codec_create_stream_with_options (SquashCodec* codec, SquashStreamType st
     return NULL;
   }
 
+  /* Anything allocated while creating the stream is charged to it;
+     squash_stream_init takes its own reference to the counter. */
+  SquashMemoryCounter* memory = squash_memory_counter_new ();
+  SquashMemoryScope scope = squash_memory_scope_enter (memory, &(codec->memory));
+  SquashStream* stream = NULL;
+
   if (impl->create_stream != NULL) {
-    return impl->create_stream (codec, stream_type, options);
-  } else {
-    if (impl->process_stream == NULL) {
-      return (SquashStream*) squash_buffer_stream_new (codec, stream_type, options);
-    } else {
-      return NULL;
-    }
+    stream = impl->create_stream (codec, stream_type, options);
+  } else if (impl->process_stream == NULL) {
+    stream = (SquashStream*) squash_buffer_stream_new (codec, stream_type, options);
+
+    /* Couldn't set up the coroutine or thread to run the splice
+       function in */
+    if (SQUASH_UNLIKELY(stream != NULL && impl->splice != NULL && stream->priv == NULL))
+      stream = squash_object_unref (stream);
   }
+
+  squash_memory_scope_leave (scope);
+  squash_memory_counter_unref (memory);
+
+  return stream;
 }
 
 /**
@@ -628,6 +647,85 @@ squash_codec_create_stream (SquashCodec* codec, SquashStreamType stream_type, ..
   return squash_codec_create_stream_with_options (codec, stream_type, options);
 }
 
+SQUASH_MTX_DEFINE(stream_pool)
+
+/**
+ * @brief Get a stream for internal use, reusing a pooled one if possible
+ * @private
+ *
+ * If the codec supports resetting streams, a previously released
+ * stream of the same type with equivalent options is returned
+ * instead of creating a new one.
+ *
+ * @param codec The codec
+ * @param stream_type The direction of the stream
+ * @param options The options for the stream, or *NULL* to use the
+ *     defaults
+ * @return A stream, or *NULL* on failure
+ */
+SquashStream*
+squash_codec_acquire_stream (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  SquashStream* stream = NULL;
+
+  if (SQUASH_UNLIKELY(impl == NULL))
+    return NULL;
+
+  if (impl->reset_stream != NULL) {
+    SQUASH_MTX_LOCK(stream_pool);
+    for (size_t i = codec->stream_pool_length ; i > 0 ; i--) {
+      SquashStream* candidate = codec->stream_pool[i - 1];
+      if (candidate->stream_type == stream_type &&
+          squash_options_equal (codec, candidate->options, options)) {
+        stream = candidate;
+        codec->stream_pool[i - 1] = codec->stream_pool[--(codec->stream_pool_length)];
+        break;
+      }
+    }
+    SQUASH_MTX_UNLOCK(stream_pool);
+
+    if (stream == NULL) {
+      /* The pool matches by value, so a pooled stream must not share
+         options the caller can still modify. */
+      SquashOptions* snapshot = squash_options_snapshot (options);
+      stream = squash_codec_create_stream_with_options (codec, stream_type, snapshot);
+      if (snapshot != NULL)
+        squash_object_unref (snapshot);
+    }
+  } else {
+    stream = squash_codec_create_stream_with_options (codec, stream_type, options);
+  }
+
+  return stream;
+}
+
+/**
+ * @brief Release a stream acquired with ::squash_codec_acquire_stream
+ * @private
+ *
+ * The stream is reset and returned to the codec's pool if there is
+ * room, otherwise it is destroyed.
+ *
+ * @param stream The stream
+ */
+void
+squash_codec_release_stream (SquashStream* stream) {
+  SquashCodec* codec = stream->codec;
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+
+  if (impl->reset_stream != NULL && squash_stream_reset (stream) == SQUASH_OK) {
+    SQUASH_MTX_LOCK(stream_pool);
+    if (codec->stream_pool_length < SQUASH_CODEC_STREAM_POOL_SIZE) {
+      codec->stream_pool[(codec->stream_pool_length)++] = stream;
+      stream = NULL;
+    }
+    SQUASH_MTX_UNLOCK(stream_pool);
+  }
+
+  if (stream != NULL)
+    squash_object_unref (stream);
+}
+
 struct SquashBufferSpliceData {
   SquashCodec* codec;
   SquashStreamType stream_type;
@@ -713,46 +811,24 @@ squash_buffer_splice (SquashCodec* codec,
   return res;
 }
 
-/**
- * @brief Compress a buffer with an existing @ref SquashOptions
- *
- * @param codec The codec to use
- * @param[out] compressed Location to store the compressed data
- * @param[in,out] compressed_size Location storing the size of the
- *   @a compressed buffer on input, replaced with the actual size of
- *   the compressed data
- * @param uncompressed The uncompressed data
- * @param uncompressed_size Size of the uncompressed data (in bytes)
- * @param options Compression options
- * @return A status code
- */
-SquashStatus
-squash_codec_compress_with_options (SquashCodec* codec,
-                                    size_t* compressed_size,
-                                    uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
-                                    size_t uncompressed_size,
-                                    const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
-                                    SquashOptions* options) {
+static SquashStatus
+squash_codec_compress_impl (SquashCodec* codec,
+                            SquashCodecImpl* impl,
+                            size_t* compressed_size,
+                            uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                            size_t uncompressed_size,
+                            const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                            SquashOptions* options) {
   SquashStatus res = SQUASH_OK;
-  SquashCodecImpl* impl = NULL;
 
   assert (codec != NULL);
+  assert (impl != NULL);
 
   assert (compressed != NULL);
   assert (uncompressed != NULL);
 
-  squash_object_ref (options);
-
-  impl = squash_codec_get_impl (codec);
-  if (SQUASH_UNLIKELY(impl == NULL)) {
-    res = squash_error (SQUASH_UNABLE_TO_LOAD);
-    goto cleanup;
-  }
-
-  if (SQUASH_UNLIKELY(compressed == uncompressed)) {
-    res = squash_error (SQUASH_INVALID_BUFFER);
-    goto cleanup;
-  }
+  if (SQUASH_UNLIKELY(compressed == uncompressed))
+    return squash_error (SQUASH_INVALID_BUFFER);
 
   if (impl->compress_buffer ||
       impl->compress_buffer_unsafe) {
@@ -762,10 +838,8 @@ squash_codec_compress_with_options (SquashCodec* codec,
 
     if (impl->info & SQUASH_CODEC_INFO_WRAP_SIZE) {
       const size_t encoded_size_length = squash_write_varuint64 (compressed, *compressed_size, uncompressed_size);
-      if (SQUASH_UNLIKELY(encoded_size_length == 0)) {
-        res = squash_error (SQUASH_BUFFER_FULL);
-        goto cleanup;
-      }
+      if (SQUASH_UNLIKELY(encoded_size_length == 0))
+        return squash_error (SQUASH_BUFFER_FULL);
 
       internal_compressed = compressed + encoded_size_length;
       internal_compressed_size = *compressed_size - encoded_size_length;
@@ -820,15 +894,12 @@ squash_codec_compress_with_options (SquashCodec* codec,
       *compressed_size = internal_compressed_size + (internal_compressed - compressed);
   } else if (impl->splice != NULL) {
     res = squash_buffer_splice (codec, SQUASH_STREAM_COMPRESS, compressed_size, compressed, uncompressed_size, uncompressed, options);
-    goto cleanup;
   } else {
     SquashStream* stream;
 
-    stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_COMPRESS, options);
-    if (SQUASH_UNLIKELY(stream == NULL)) {
-      res = squash_error (SQUASH_FAILED);
-      goto cleanup;
-    }
+    stream = squash_codec_acquire_stream (codec, SQUASH_STREAM_COMPRESS, options);
+    if (SQUASH_UNLIKELY(stream == NULL))
+      return squash_error (SQUASH_FAILED);
 
     stream->next_in = uncompressed;
     stream->avail_in = uncompressed_size;
@@ -839,31 +910,176 @@ squash_codec_compress_with_options (SquashCodec* codec,
       res = squash_stream_process (stream);
     } while (res == SQUASH_PROCESSING);
 
-    if (res != SQUASH_OK) {
-      squash_object_unref (stream);
-      goto cleanup;
+    if (res == SQUASH_OK) {
+      do {
+        res = squash_stream_finish (stream);
+      } while (res == SQUASH_PROCESSING);
+
+      if (res == SQUASH_OK)
+        *compressed_size = stream->total_out;
     }
 
-    do {
-      res = squash_stream_finish (stream);
-    } while (res == SQUASH_PROCESSING);
+    squash_codec_release_stream (stream);
+  }
 
-    if (res != SQUASH_OK) {
-      squash_object_unref (stream);
-      goto cleanup;
-    }
+  return res;
+}
 
-    *compressed_size = stream->total_out;
-    squash_object_unref (stream);
-    goto cleanup;
+/* With squash_options_set_store_incompressible, output is wrapped in
+   a minimal container: one of these, saying what follows, then the
+   payload.  See ::squash_codec_decompress_framed. */
+#define SQUASH_FRAME_COMPRESSED ((uint8_t) 0x00)
+#define SQUASH_FRAME_STORED     ((uint8_t) 0x01)
+
+static SquashStatus
+squash_codec_store (size_t* compressed_size,
+                    uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                    size_t uncompressed_size,
+                    const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)]) {
+  if (SQUASH_UNLIKELY(*compressed_size - 1 < uncompressed_size))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  compressed[0] = SQUASH_FRAME_STORED;
+  memcpy (compressed + 1, uncompressed, uncompressed_size);
+  *compressed_size = uncompressed_size + 1;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_codec_compress_framed (SquashCodec* codec,
+                              SquashCodecImpl* impl,
+                              size_t* compressed_size,
+                              uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                              size_t uncompressed_size,
+                              const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                              SquashOptions* options) {
+  if (SQUASH_UNLIKELY(*compressed_size < 1))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  if (squash_estimate_entropy (uncompressed_size, uncompressed) >= options->store_incompressible)
+    return squash_codec_store (compressed_size, compressed, uncompressed_size, uncompressed);
+
+  size_t payload_size = *compressed_size - 1;
+  SquashStatus res = squash_codec_compress_impl (codec, impl,
+                                                 &payload_size, compressed + 1,
+                                                 uncompressed_size, uncompressed,
+                                                 options);
+  if (SQUASH_LIKELY(res == SQUASH_OK)) {
+    compressed[0] = SQUASH_FRAME_COMPRESSED;
+    *compressed_size = payload_size + 1;
+  } else if (res == SQUASH_BUFFER_FULL && uncompressed_size < *compressed_size) {
+    /* The estimate missed, but storing still fits */
+    res = squash_codec_store (compressed_size, compressed, uncompressed_size, uncompressed);
+  }
+
+  return res;
+}
+
+/**
+ * @brief Compress a buffer with an already loaded codec
+ * @private
+ *
+ * This is the guts of ::squash_codec_compress_with_options, without
+ * loading the codec or taking a reference to @a options, so that
+ * callers compressing many buffers only need to do so once.
+ *
+ * @param codec The codec to use
+ * @param impl The codec's implementation
+ * @param[out] compressed Location to store the compressed data
+ * @param[in,out] compressed_size Location storing the size of the
+ *   @a compressed buffer on input, replaced with the actual size of
+ *   the compressed data
+ * @param uncompressed The uncompressed data
+ * @param uncompressed_size Size of the uncompressed data (in bytes)
+ * @param options Compression options; must not be floating
+ * @return A status code
+ */
+SquashStatus
+squash_codec_compress_internal (SquashCodec* codec,
+                                SquashCodecImpl* impl,
+                                size_t* compressed_size,
+                                uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                size_t uncompressed_size,
+                                const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                SquashOptions* options) {
+  SquashMemoryScope scope = squash_memory_scope_enter (NULL, &(codec->memory));
+  SquashStatus res;
+
+  if (SQUASH_LIKELY(options == NULL || options->store_incompressible == 0.0)) {
+    res = squash_codec_compress_impl (codec, impl,
+                                      compressed_size, compressed,
+                                      uncompressed_size, uncompressed,
+                                      options);
+  } else {
+    res = squash_codec_compress_framed (codec, impl,
+                                        compressed_size, compressed,
+                                        uncompressed_size, uncompressed,
+                                        options);
   }
 
- cleanup:
+  squash_memory_scope_leave (scope);
 
-  squash_object_unref (options);
   return res;
 }
 
+/**
+ * @brief Compress a buffer with an existing @ref SquashOptions
+ *
+ * @param codec The codec to use
+ * @param[out] compressed Location to store the compressed data
+ * @param[in,out] compressed_size Location storing the size of the
+ *   @a compressed buffer on input, replaced with the actual size of
+ *   the compressed data
+ * @param uncompressed The uncompressed data
+ * @param uncompressed_size Size of the uncompressed data (in bytes)
+ * @param options Compression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_compress_with_options (SquashCodec* codec,
+                                    size_t* compressed_size,
+                                    uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                    size_t uncompressed_size,
+                                    const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                    SquashOptions* options) {
+  SquashStatus res;
+  SquashCodecImpl* impl = NULL;
+
+  assert (codec != NULL);
+
+  squash_options_hold (options);
+
+  impl = squash_codec_get_impl (codec);
+  if (SQUASH_LIKELY(impl != NULL)) {
+    res = squash_codec_compress_internal (codec, impl,
+                                          compressed_size, compressed,
+                                          uncompressed_size, uncompressed,
+                                          options);
+  } else {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+  }
+
+  squash_options_release (options);
+  return res;
+}
+
+/* Options for the variadic compress/decompress functions.  Creating
+   (and later destroying) a full set of options just to get the
+   defaults is a significant part of the cost of compressing a tiny
+   buffer, so use NULL when no options were passed. */
+static SquashOptions*
+squash_codec_options_newv (SquashCodec* codec, va_list ap) {
+  va_list aq;
+  const char* first_key;
+
+  va_copy (aq, ap);
+  first_key = va_arg (aq, const char*);
+  va_end (aq);
+
+  return (first_key == NULL) ? NULL : squash_options_newv (codec, ap);
+}
+
 /**
  * @brief Compress a buffer
  *
@@ -890,7 +1106,7 @@ SquashStatus squash_codec_compress (SquashCodec* codec,
   assert (codec != NULL);
 
   va_start (ap, uncompressed);
-  options = squash_options_newv (codec, ap);
+  options = squash_codec_options_newv (codec, ap);
   va_end (ap);
 
   return squash_codec_compress_with_options (codec,
@@ -899,33 +1115,16 @@ SquashStatus squash_codec_compress (SquashCodec* codec,
                                              options);
 }
 
-/**
- * @brief Decompress a buffer with an existing @ref SquashOptions
- *
- * @param codec The codec to use
- * @param[out] decompressed Location to store the decompressed data
- * @param[in,out] decompressed_size Location storing the size of the
- *   @a decompressed buffer on input, replaced with the actual size of
- *   the decompressed data
- * @param compressed The compressed data
- * @param compressed_size Size of the compressed data (in bytes)
- * @param options Compression options
- * @return A status code
- */
-SquashStatus
-squash_codec_decompress_with_options (SquashCodec* codec,
-                                      size_t* decompressed_size,
-                                      uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
-                                      size_t compressed_size,
-                                      const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
-                                      SquashOptions* options) {
-  SquashCodecImpl* impl = NULL;
-
+static SquashStatus
+squash_codec_decompress_impl (SquashCodec* codec,
+                              SquashCodecImpl* impl,
+                              size_t* decompressed_size,
+                              uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                              size_t compressed_size,
+                              const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                              SquashOptions* options) {
   assert (codec != NULL);
-
-  impl = squash_codec_get_impl (codec);
-  if (SQUASH_UNLIKELY(impl == NULL))
-    return squash_error (SQUASH_UNABLE_TO_LOAD);
+  assert (impl != NULL);
 
   if (SQUASH_UNLIKELY(decompressed == compressed))
     return squash_error (SQUASH_INVALID_BUFFER);
@@ -959,8 +1158,7 @@ squash_codec_decompress_with_options (SquashCodec* codec,
       res = impl->decompress_buffer (codec,
                                      &internal_decompressed_size, decompressed,
                                      internal_compressed_size, internal_compressed,
-                                     squash_object_ref (options));
-      squash_object_unref (options);
+                                     options);
 
       if (SQUASH_LIKELY(res == SQUASH_OK) &&
           SQUASH_UNLIKELY(internal_decompressed_size != encoded_decompressed_size)) {
@@ -970,8 +1168,7 @@ squash_codec_decompress_with_options (SquashCodec* codec,
       res = impl->decompress_buffer (codec,
                                      decompressed_size, decompressed,
                                      compressed_size, compressed,
-                                     squash_object_ref (options));
-      squash_object_unref (options);
+                                     options);
     }
 
     return res;
@@ -979,9 +1176,7 @@ squash_codec_decompress_with_options (SquashCodec* codec,
     SquashStatus status;
     SquashStream* stream;
 
-    stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
-    if (stream == NULL)
-      exit(EXIT_FAILURE);
+    stream = squash_codec_acquire_stream (codec, SQUASH_STREAM_DECOMPRESS, options);
     if (SQUASH_UNLIKELY(stream == NULL))
       return squash_error (SQUASH_FAILED);
     stream->next_in = compressed;
@@ -1007,12 +1202,182 @@ squash_codec_decompress_with_options (SquashCodec* codec,
     }
 
     assert (stream->stream_type == SQUASH_STREAM_DECOMPRESS);
-    squash_object_unref (stream);
+    squash_codec_release_stream (stream);
 
     return status;
   }
 }
 
+static SquashStatus
+squash_codec_decompress_framed_internal (SquashCodec* codec,
+                                         SquashCodecImpl* impl,
+                                         size_t* decompressed_size,
+                                         uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                         size_t compressed_size,
+                                         const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                         SquashOptions* options) {
+  if (SQUASH_UNLIKELY(compressed_size < 1))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  switch (compressed[0]) {
+    case SQUASH_FRAME_STORED:
+      if (SQUASH_UNLIKELY(*decompressed_size < compressed_size - 1))
+        return squash_error (SQUASH_BUFFER_FULL);
+
+      memcpy (decompressed, compressed + 1, compressed_size - 1);
+      *decompressed_size = compressed_size - 1;
+      return SQUASH_OK;
+    case SQUASH_FRAME_COMPRESSED:
+      if (SQUASH_UNLIKELY(compressed_size < 2))
+        return squash_error (SQUASH_INVALID_BUFFER);
+
+      return squash_codec_decompress_impl (codec, impl,
+                                           decompressed_size, decompressed,
+                                           compressed_size - 1, compressed + 1,
+                                           options);
+    default:
+      return squash_error (SQUASH_INVALID_BUFFER);
+  }
+}
+
+/**
+ * @brief Decompress a buffer with an already loaded codec
+ * @private
+ *
+ * This is the guts of ::squash_codec_decompress_with_options,
+ * without loading the codec or taking a reference to @a options.
+ *
+ * @param codec The codec to use
+ * @param impl The codec's implementation
+ * @param[out] decompressed Location to store the decompressed data
+ * @param[in,out] decompressed_size Location storing the size of the
+ *   @a decompressed buffer on input, replaced with the actual size of
+ *   the decompressed data
+ * @param compressed The compressed data
+ * @param compressed_size Size of the compressed data (in bytes)
+ * @param options Decompression options; must not be floating
+ * @return A status code
+ */
+SquashStatus
+squash_codec_decompress_internal (SquashCodec* codec,
+                                  SquashCodecImpl* impl,
+                                  size_t* decompressed_size,
+                                  uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                  size_t compressed_size,
+                                  const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                  SquashOptions* options) {
+  SquashMemoryScope scope = squash_memory_scope_enter (NULL, &(codec->memory));
+  SquashStatus res;
+
+  if (SQUASH_LIKELY(options == NULL || options->store_incompressible == 0.0)) {
+    res = squash_codec_decompress_impl (codec, impl,
+                                        decompressed_size, decompressed,
+                                        compressed_size, compressed,
+                                        options);
+  } else {
+    res = squash_codec_decompress_framed_internal (codec, impl,
+                                                   decompressed_size, decompressed,
+                                                   compressed_size, compressed,
+                                                   options);
+  }
+
+  squash_memory_scope_leave (scope);
+
+  return res;
+}
+
+/**
+ * @brief Decompress a buffer produced with stored incompressible data
+ *
+ * Data compressed with options which have
+ * ::squash_options_set_store_incompressible set is not in the
+ * codec's native format; it is wrapped in a one byte header saying
+ * whether the rest was stored or compressed.  This function decodes
+ * that container no matter what @a options say, so the receiver
+ * doesn't need to know the sender's threshold.
+ *
+ * @param codec The codec to use
+ * @param[out] decompressed Location to store the decompressed data
+ * @param[in,out] decompressed_size Location storing the size of the
+ *   @a decompressed buffer on input, replaced with the actual size of
+ *   the decompressed data
+ * @param compressed The framed data
+ * @param compressed_size Size of the framed data (in bytes)
+ * @param options Decompression options, or *NULL*
+ * @return A status code
+ * @retval SQUASH_INVALID_BUFFER @a compressed is not a valid frame
+ */
+SquashStatus
+squash_codec_decompress_framed (SquashCodec* codec,
+                                size_t* decompressed_size,
+                                uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                size_t compressed_size,
+                                const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                SquashOptions* options) {
+  SquashStatus res;
+  SquashCodecImpl* impl = NULL;
+
+  assert (codec != NULL);
+
+  squash_options_hold (options);
+
+  impl = squash_codec_get_impl (codec);
+  if (SQUASH_LIKELY(impl != NULL)) {
+    SquashMemoryScope scope = squash_memory_scope_enter (NULL, &(codec->memory));
+    res = squash_codec_decompress_framed_internal (codec, impl,
+                                                   decompressed_size, decompressed,
+                                                   compressed_size, compressed,
+                                                   options);
+    squash_memory_scope_leave (scope);
+  } else {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+  }
+
+  squash_options_release (options);
+  return res;
+}
+
+/**
+ * @brief Decompress a buffer with an existing @ref SquashOptions
+ *
+ * @param codec The codec to use
+ * @param[out] decompressed Location to store the decompressed data
+ * @param[in,out] decompressed_size Location storing the size of the
+ *   @a decompressed buffer on input, replaced with the actual size of
+ *   the decompressed data
+ * @param compressed The compressed data
+ * @param compressed_size Size of the compressed data (in bytes)
+ * @param options Compression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_decompress_with_options (SquashCodec* codec,
+                                      size_t* decompressed_size,
+                                      uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                      size_t compressed_size,
+                                      const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                      SquashOptions* options) {
+  SquashStatus res;
+  SquashCodecImpl* impl = NULL;
+
+  assert (codec != NULL);
+
+  squash_options_hold (options);
+
+  impl = squash_codec_get_impl (codec);
+  if (SQUASH_LIKELY(impl != NULL)) {
+    res = squash_codec_decompress_internal (codec, impl,
+                                            decompressed_size, decompressed,
+                                            compressed_size, compressed,
+                                            options);
+  } else {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+  }
+
+  squash_options_release (options);
+  return res;
+}
+
 /**
  * @brief Decompress a buffer
  *
@@ -1041,7 +1406,7 @@ squash_codec_decompress (SquashCodec* codec,
   assert (codec != NULL);
 
   va_start (ap, compressed);
-  options = squash_options_newv (codec, ap);
+  options = squash_codec_options_newv (codec, ap);
   va_end (ap);
 
   res = squash_codec_decompress_with_options (codec,
@@ -1065,8 +1430,9 @@ squash_codec_new (SquashPlugin* plugin, const char* name) {
   SquashCodec codec = { 0, };
 
   codec.plugin = plugin;
-  codec.name = strdup (name);
+  codec.name = squash_strdup (name);
   codec.priority = 50;
+  codec.memory.ref_count = 1;
   SQUASH_TREE_ENTRY_INIT(codec.tree);
 
   *codecp = codec;
@@ -1088,7 +1454,7 @@ squash_codec_set_extension (SquashCodec* codec, const char* extension) {
   if (codec->extension != NULL)
     squash_free (codec->extension);
 
-  codec->extension = (extension != NULL) ? strdup (extension) : NULL;
+  codec->extension = (extension != NULL) ? squash_strdup (extension) : NULL;
 }
 
 /**
@@ -1125,6 +1491,25 @@ squash_codec_get_info (SquashCodec* codec) {
   return codec->impl.info;
 }
 
+/**
+ * @brief Get the amount of memory allocated by the codec
+ *
+ * This covers everything allocated on behalf of the codec, by
+ * buffer functions as well as by all of its streams.
+ *
+ * @param codec The codec
+ * @param[out] usage Location to store the usage
+ * @return A status code
+ * @retval SQUASH_STATE Accounting is not enabled (see
+ *   ::squash_memory_enable_accounting)
+ */
+SquashStatus
+squash_codec_get_memory_usage (SquashCodec* codec, SquashMemoryUsage* usage) {
+  assert (codec != NULL);
+
+  return squash_memory_counter_get_usage (&(codec->memory), usage);
+}
+
 /**
  * @brief Get a list of options applicable to the codec
  *
@@ -1137,6 +1522,21 @@ squash_codec_get_option_info (SquashCodec* codec) {
   return SQUASH_LIKELY(impl != NULL) ? impl->options : NULL;
 }
 
+static void
+squash_codec_steal_decompressed (SquashBuffer* buffer, size_t size, size_t allocated, uint8_t* data) {
+  /* Don't let an over-estimate pin memory for the life of the
+     buffer. */
+  if (size != 0 && size < allocated) {
+    uint8_t* shrunk = squash_realloc (data, size);
+    if (shrunk != NULL) {
+      data = shrunk;
+      allocated = size;
+    }
+  }
+
+  squash_buffer_steal (buffer, size, allocated, data);
+}
+
 SquashStatus
 squash_codec_decompress_to_buffer (SquashCodec* codec,
                                    SquashBuffer* decompressed,
@@ -1154,6 +1554,39 @@ squash_codec_decompress_to_buffer (SquashCodec* codec,
   size_t decompressed_alloc = compressed_npot_size << 3;
   size_t decompressed_size;
   bool try_smaller = false;
+
+  /* If the codec can tell us (or at least guess) how large the output
+     will be, try that first; if the guess is right we only have to
+     decompress once.  The hint comes from the (untrusted) input, so
+     ignore anything beyond a plausible compression ratio. */
+  size_t hint;
+  if (SQUASH_LIKELY(options == NULL || options->store_incompressible == 0.0))
+    hint = squash_codec_get_uncompressed_size (codec, compressed_size, compressed);
+  else if (compressed_size > 1 && compressed[0] == SQUASH_FRAME_STORED)
+    hint = compressed_size - 1;
+  else if (compressed_size > 1 && compressed[0] == SQUASH_FRAME_COMPRESSED)
+    hint = squash_codec_get_uncompressed_size (codec, compressed_size - 1, compressed + 1);
+  else
+    hint = 0;
+  if (hint / SQUASH_DECOMPRESS_HINT_MAX_RATIO > compressed_size)
+    hint = 0;
+  if (hint != 0 && (decompressed_data = squash_malloc (hint)) != NULL) {
+    decompressed_size = hint;
+    res = squash_codec_decompress_with_options(codec, &decompressed_size, decompressed_data, compressed_size, compressed, options);
+    if (SQUASH_LIKELY(res == SQUASH_OK)) {
+      squash_codec_steal_decompressed (decompressed, decompressed_size, hint, decompressed_data);
+      return res;
+    } else if (res != SQUASH_BUFFER_FULL && res != SQUASH_RANGE) {
+      squash_free (decompressed_data);
+      return res;
+    }
+
+    /* The hint was wrong; fall back on guessing, but don't bother
+       with sizes we already know are too small. */
+    while ((decompressed_alloc << 1) <= hint)
+      decompressed_alloc <<= 1;
+  }
+
   do {
     if (SQUASH_UNLIKELY(try_smaller))
       decompressed_alloc >>= 1;
@@ -1188,7 +1621,7 @@ squash_codec_decompress_to_buffer (SquashCodec* codec,
   } while (res == SQUASH_BUFFER_FULL);
 
   if (SQUASH_LIKELY(res == SQUASH_OK))
-    squash_buffer_steal (decompressed, decompressed_size, decompressed_alloc, decompressed_data);
+    squash_codec_steal_decompressed (decompressed, decompressed_size, decompressed_alloc, decompressed_data);
   else
     squash_free (decompressed_data);
 
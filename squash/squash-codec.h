@@ -42,6 +42,8 @@ typedef enum {
   SQUASH_CODEC_INFO_CAN_FLUSH               = 1 <<  0,
   SQUASH_CODEC_INFO_DECOMPRESS_UNSAFE       = 1 <<  1,
   SQUASH_CODEC_INFO_WRAP_SIZE               = 1 <<  2,
+  SQUASH_CODEC_INFO_SIZE_HINT               = 1 <<  3,
+  SQUASH_CODEC_INFO_PASSTHROUGH             = 1 <<  4,
 
   SQUASH_CODEC_INFO_AUTO_MASK               = 0x00ff0000,
   SQUASH_CODEC_INFO_VALID                   = 1 << 16,
@@ -60,6 +62,14 @@ typedef SquashStatus (*SquashWriteFunc) (size_t* data_size,
                                          const uint8_t data[SQUASH_ARRAY_PARAM(*data_size)],
                                          void* user_data);
 
+typedef struct SquashFrame_ {
+  size_t offset;
+  size_t size;
+  size_t decompressed_size;
+  size_t decompressed_size_hint;
+  uint64_t codec_data;
+} SquashFrame;
+
 struct SquashCodecImpl_ {
   SquashCodecInfo           info;
 
@@ -103,10 +113,24 @@ struct SquashCodecImpl_ {
                                                         const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]);
   size_t                  (* get_max_compressed_size)  (SquashCodec* codec, size_t uncompressed_size);
 
+  /* Streams */
+  SquashStatus            (* reset_stream)             (SquashStream* stream);
+
+  /* Parallel decompression */
+  SquashStatus            (* split_frames)             (SquashCodec* codec,
+                                                        size_t compressed_size,
+                                                        const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                                        size_t* n_frames,
+                                                        SquashFrame** frames);
+  SquashStatus            (* decompress_frame)         (SquashCodec* codec,
+                                                        const SquashFrame* frame,
+                                                        size_t* decompressed_size,
+                                                        uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                                        size_t compressed_size,
+                                                        const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                                        SquashOptions* options);
+
   /* Reserved */
-  void                    (* _reserved1)               (void);
-  void                    (* _reserved2)               (void);
-  void                    (* _reserved3)               (void);
   void                    (* _reserved4)               (void);
   void                    (* _reserved5)               (void);
   void                    (* _reserved6)               (void);
@@ -172,10 +196,20 @@ SQUASH_API SquashStatus            squash_codec_decompress_with_options      (Sq
                                                                               size_t compressed_size,
                                                                               const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
                                                                               SquashOptions* options);
+SQUASH_NONNULL(1, 2, 3, 5)
+SQUASH_API SquashStatus            squash_codec_decompress_framed            (SquashCodec* codec,
+                                                                              size_t* decompressed_size,
+                                                                              uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                                                              size_t compressed_size,
+                                                                              const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                                                              SquashOptions* options);
 SQUASH_NONNULL(1)
 SQUASH_API SquashCodecInfo         squash_codec_get_info                     (SquashCodec* codec);
 SQUASH_NONNULL(1)
 SQUASH_API const SquashOptionInfo* squash_codec_get_option_info              (SquashCodec* codec);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus            squash_codec_get_memory_usage             (SquashCodec* codec,
+                                                                              SquashMemoryUsage* usage);
 
 SQUASH_END_DECLS
 
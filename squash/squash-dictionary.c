@@ -0,0 +1,328 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @defgroup SquashDictionary SquashDictionary
+ * @brief Preset dictionaries shared between compression operations
+ *
+ * Many codecs can be primed with a dictionary of data which is
+ * likely to appear in the input.  For small inputs this can improve
+ * the compression ratio dramatically, since the codec doesn't have
+ * to learn the data from scratch for each message.  The same
+ * dictionary must be used for compression and decompression.
+ *
+ * A dictionary is passed to a codec through an option of type
+ * @ref SQUASH_OPTION_TYPE_DICTIONARY (usually named "dictionary").
+ * The dictionary is immutable once created, so a single instance may
+ * be shared between any number of @ref SquashOptions and threads.
+ *
+ * Several libraries can also preprocess ("digest") a dictionary into
+ * a form which is much faster to start from than the raw data.
+ * Plugins can use ::squash_dictionary_get_digest to build that form
+ * once and have it cached on the dictionary for everyone else.
+ *
+ * @{
+ */
+
+/**
+ * @struct SquashDictionary_
+ * @extends SquashObject_
+ * @brief A preset dictionary
+ */
+
+/**
+ * @typedef SquashDictionaryDigestFunc
+ * @brief Callback used to build a codec-specific digest of a dictionary
+ *
+ * @param dictionary The dictionary to digest
+ * @param codec The codec which requested the digest
+ * @param key Key passed to ::squash_dictionary_get_digest
+ * @return The digest, or *NULL* on failure
+ */
+
+/* Digests are only ever prepended to the list, and are not removed
+   until the dictionary is destroyed, so lookups can walk the list
+   without a lock.  New digests are published with a compare and
+   swap on the head. */
+
+#if defined(__GNUC__) || defined(__clang__) || defined(__INTEL_COMPILER)
+#  define squash_dictionary_digests_load(dictionary) __atomic_load_n(&((dictionary)->digests), __ATOMIC_ACQUIRE)
+#  define squash_dictionary_digests_cas(dictionary, orig, val) __sync_val_compare_and_swap(&((dictionary)->digests), orig, val)
+#else
+SQUASH_MTX_DEFINE(dictionary_digests)
+
+static SquashDictionaryDigest*
+squash_dictionary_digests_load (SquashDictionary* dictionary) {
+  SquashDictionaryDigest* res;
+
+  SQUASH_MTX_LOCK(dictionary_digests);
+  res = dictionary->digests;
+  SQUASH_MTX_UNLOCK(dictionary_digests);
+
+  return res;
+}
+
+static SquashDictionaryDigest*
+squash_dictionary_digests_cas (SquashDictionary* dictionary,
+                               SquashDictionaryDigest* orig,
+                               SquashDictionaryDigest* val) {
+  SquashDictionaryDigest* res;
+
+  SQUASH_MTX_LOCK(dictionary_digests);
+  res = dictionary->digests;
+  if (res == orig)
+    dictionary->digests = val;
+  SQUASH_MTX_UNLOCK(dictionary_digests);
+
+  return res;
+}
+#endif
+
+static SquashDictionaryDigest*
+squash_dictionary_find_digest (SquashDictionaryDigest* head, SquashCodec* codec, int key) {
+  for (SquashDictionaryDigest* d = head ; d != NULL ; d = d->next)
+    if (d->codec == codec && d->key == key)
+      return d;
+
+  return NULL;
+}
+
+static void
+squash_dictionary_destroy (void* obj) {
+  SquashDictionary* dictionary = (SquashDictionary*) obj;
+  SquashDictionaryDigest* next;
+
+  for (SquashDictionaryDigest* d = dictionary->digests ; d != NULL ; d = next) {
+    next = d->next;
+    if (d->destroy_notify != NULL)
+      d->destroy_notify (d->digest);
+    squash_free (d);
+  }
+
+  squash_free (dictionary->data);
+
+  squash_object_destroy (obj);
+}
+
+static SquashDictionary*
+squash_dictionary_create (size_t size) {
+  SquashDictionary* dictionary = squash_malloc (sizeof (SquashDictionary));
+  if (SQUASH_UNLIKELY(dictionary == NULL))
+    return NULL;
+
+  dictionary->data = squash_malloc (size != 0 ? size : 1);
+  if (SQUASH_UNLIKELY(dictionary->data == NULL)) {
+    squash_free (dictionary);
+    return NULL;
+  }
+
+  squash_object_init (dictionary, true, squash_dictionary_destroy);
+  dictionary->size = size;
+  dictionary->digests = NULL;
+
+  return dictionary;
+}
+
+/**
+ * @brief Create a new dictionary
+ *
+ * The data is copied, so @a data need not remain valid after this
+ * function returns.
+ *
+ * @param size Size of @a data (in bytes)
+ * @param data The dictionary contents
+ * @return A new (floating) dictionary, or *NULL* on failure
+ */
+SquashDictionary*
+squash_dictionary_new (size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)]) {
+  assert (data != NULL || size == 0);
+
+  SquashDictionary* dictionary = squash_dictionary_create (size);
+  if (SQUASH_LIKELY(dictionary != NULL) && size != 0)
+    memcpy (dictionary->data, data, size);
+
+  return dictionary;
+}
+
+/**
+ * @brief Create a new dictionary from the contents of a file
+ *
+ * @param filename Name of the file to read
+ * @return A new (floating) dictionary, or *NULL* on failure
+ */
+SquashDictionary*
+squash_dictionary_new_from_file (const char* filename) {
+  SquashDictionary* dictionary = NULL;
+  long size;
+
+  assert (filename != NULL);
+
+  FILE* fp = fopen (filename, "rb");
+  if (SQUASH_UNLIKELY(fp == NULL)) {
+    squash_error (SQUASH_IO);
+    return NULL;
+  }
+
+  if (SQUASH_UNLIKELY(fseek (fp, 0, SEEK_END) != 0) ||
+      SQUASH_UNLIKELY((size = ftell (fp)) < 0) ||
+      SQUASH_UNLIKELY(fseek (fp, 0, SEEK_SET) != 0)) {
+    squash_error (SQUASH_IO);
+    goto cleanup;
+  }
+
+  dictionary = squash_dictionary_create ((size_t) size);
+  if (SQUASH_UNLIKELY(dictionary == NULL)) {
+    squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
+  if (SQUASH_UNLIKELY(fread (dictionary->data, 1, (size_t) size, fp) != (size_t) size)) {
+    squash_object_unref (dictionary);
+    dictionary = NULL;
+    squash_error (SQUASH_IO);
+  }
+
+ cleanup:
+
+  fclose (fp);
+
+  return dictionary;
+}
+
+/**
+ * @brief Get the contents of a dictionary
+ *
+ * @param dictionary The dictionary
+ * @return The dictionary contents
+ */
+const uint8_t*
+squash_dictionary_get_data (SquashDictionary* dictionary) {
+  assert (dictionary != NULL);
+
+  return dictionary->data;
+}
+
+/**
+ * @brief Get the size of a dictionary
+ *
+ * @param dictionary The dictionary
+ * @return Size of the dictionary (in bytes)
+ */
+size_t
+squash_dictionary_get_size (SquashDictionary* dictionary) {
+  assert (dictionary != NULL);
+
+  return dictionary->size;
+}
+
+/**
+ * @brief Get a codec-specific digest of a dictionary
+ *
+ * If a digest has already been created for this @a codec and @a key
+ * it is returned, otherwise @a digest_func is invoked to create one,
+ * which is stored on the dictionary and destroyed (using @a
+ * destroy_notify) along with it.
+ *
+ * Digests are shared between every user of the dictionary, possibly
+ * on several threads at once, so they must not be modified after
+ * creation.  Looking up an existing digest doesn't take a lock.  If
+ * several threads request the same missing digest at once, @a
+ * digest_func may be invoked more than once; only one result is kept
+ * and the others are destroyed.
+ *
+ * @param dictionary The dictionary
+ * @param codec The codec requesting the digest
+ * @param key Codec-defined value distinguishing different digests of
+ *   the same dictionary, such as a compression level
+ * @param digest_func Function used to create the digest
+ * @param destroy_notify Function used to free the digest, or *NULL*
+ * @return The digest, or *NULL* if it could not be created
+ */
+void*
+squash_dictionary_get_digest (SquashDictionary* dictionary,
+                              SquashCodec* codec,
+                              int key,
+                              SquashDictionaryDigestFunc digest_func,
+                              SquashDestroyNotify destroy_notify) {
+  assert (dictionary != NULL);
+  assert (codec != NULL);
+  assert (digest_func != NULL);
+
+  SquashDictionaryDigest* head = squash_dictionary_digests_load (dictionary);
+  SquashDictionaryDigest* d = squash_dictionary_find_digest (head, codec, key);
+  if (SQUASH_LIKELY(d != NULL))
+    return d->digest;
+
+  /* Digesting can be expensive, so don't hold anything up while we
+     do it.  If another thread wins the race to publish the same
+     digest we throw ours away and use theirs. */
+  void* digest = digest_func (dictionary, codec, key);
+  if (SQUASH_UNLIKELY(digest == NULL))
+    return NULL;
+
+  d = squash_malloc (sizeof (SquashDictionaryDigest));
+  if (SQUASH_UNLIKELY(d == NULL)) {
+    if (destroy_notify != NULL)
+      destroy_notify (digest);
+    return NULL;
+  }
+
+  d->codec = codec;
+  d->key = key;
+  d->digest = digest;
+  d->destroy_notify = destroy_notify;
+
+  while (true) {
+    d->next = head;
+    SquashDictionaryDigest* prev = squash_dictionary_digests_cas (dictionary, head, d);
+    if (prev == head)
+      break;
+
+    SquashDictionaryDigest* existing = squash_dictionary_find_digest (prev, codec, key);
+    if (existing != NULL) {
+      if (destroy_notify != NULL)
+        destroy_notify (digest);
+      squash_free (d);
+      digest = existing->digest;
+      break;
+    }
+
+    head = prev;
+  }
+
+  return digest;
+}
+
+/**
+ * @}
+ */
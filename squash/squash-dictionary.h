@@ -0,0 +1,60 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+#ifndef SQUASH_DICTIONARY_H
+#define SQUASH_DICTIONARY_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stddef.h>
+#include <stdint.h>
+
+SQUASH_BEGIN_DECLS
+
+typedef void* (*SquashDictionaryDigestFunc) (SquashDictionary* dictionary, SquashCodec* codec, int key);
+
+SQUASH_API SquashDictionary* squash_dictionary_new           (size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)]);
+SQUASH_NONNULL(1)
+SQUASH_API SquashDictionary* squash_dictionary_new_from_file (const char* filename);
+
+SQUASH_NONNULL(1)
+SQUASH_API const uint8_t*    squash_dictionary_get_data      (SquashDictionary* dictionary);
+SQUASH_NONNULL(1)
+SQUASH_API size_t            squash_dictionary_get_size      (SquashDictionary* dictionary);
+
+SQUASH_NONNULL(1, 2, 4)
+SQUASH_API void*             squash_dictionary_get_digest    (SquashDictionary* dictionary,
+                                                              SquashCodec* codec,
+                                                              int key,
+                                                              SquashDictionaryDigestFunc digest_func,
+                                                              SquashDestroyNotify destroy_notify);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_DICTIONARY_H */
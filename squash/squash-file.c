@@ -43,12 +43,79 @@
 
 #include "squash/tinycthread/source/tinycthread.h"
 
-/* #define SQUASH_MMAP_IO */
+#if defined(_WIN32)
+#  define squash_fseeko(stream,offset,whence) _fseeki64(stream,offset,whence)
+#  define squash_ftello(stream) _ftelli64(stream)
+#else
+#  define squash_fseeko(stream,offset,whence) fseeko(stream,offset,whence)
+#  define squash_ftello(stream) ftello(stream)
+#endif
 
 /**
  * @cond INTERNAL
  */
 
+typedef enum {
+  /* Nothing has been looked for yet */
+  SQUASH_FILE_INDEX_UNKNOWN = 0,
+  /* The file isn't a seekable container, native frames haven't been
+     looked for yet */
+  SQUASH_FILE_INDEX_PROBED,
+  /* There is no index; seeking requires decompressing */
+  SQUASH_FILE_INDEX_NONE,
+  /* Blocks of a seekable container (see squash_codec_compress_seekable) */
+  SQUASH_FILE_INDEX_SEEKABLE,
+  /* Frames of the codec's native format */
+  SQUASH_FILE_INDEX_FRAMES
+} SquashFileIndexType;
+
+typedef struct SquashFileBlock_ {
+  uint64_t uncompressed_offset;
+  /* Relative to the start of the compressed data */
+  uint64_t offset;
+  size_t size;
+  /* Zero for frames which don't record their size until the frame
+     has been decompressed (see squash_file_index_extend) */
+  size_t decompressed_size;
+  size_t decompressed_size_hint;
+  uint64_t codec_data;
+  uint32_t crc;
+} SquashFileBlock;
+
+typedef struct SquashFileQueueChunk_ {
+  uint8_t* data;
+  size_t size;
+  size_t offset;
+  SquashStatus status;
+  SquashOperation operation;
+} SquashFileQueueChunk;
+
+/* Ring of buffers shared between the caller and a background thread,
+   used for both read-ahead and write-behind. */
+
+typedef struct SquashFileQueue_ {
+  thrd_t thread;
+  bool started;
+  mtx_t mtx;
+  cnd_t filled_cnd;
+  cnd_t drained_cnd;
+
+  /* Protected by mtx */
+  bool stop;
+  bool done;
+  SquashStatus status;
+  size_t head;
+  size_t count;
+
+  /* For read-ahead, the position of the consumer, which trails
+     file->position by whatever is in the ring */
+  uint64_t position;
+
+  size_t chunk_size;
+  size_t n_chunks;
+  SquashFileQueueChunk chunks[];
+} SquashFileQueue;
+
 struct SquashFile_ {
   FILE* fp;
   mtx_t mtx;
@@ -57,9 +124,42 @@ struct SquashFile_ {
   SquashStatus last_status;
   SquashCodec* codec;
   SquashOptions* options;
-  uint8_t buf[SQUASH_FILE_BUF_SIZE];
-#if defined(SQUASH_MMAP_IO)
-  SquashMappedFile map;
+
+  /* Offset of the compressed data in fp, or -1 if fp isn't seekable */
+  int64_t start;
+  /* Offset in the uncompressed data */
+  uint64_t position;
+
+  SquashFileIndexType index_type;
+  /* Whether reads are served from the index instead of the stream */
+  bool indexed;
+  /* Only valid once every block has been sized */
+  uint64_t uncompressed_size;
+  size_t n_blocks;
+  /* Number of leading blocks whose uncompressed_offset and
+     decompressed_size are known */
+  size_t n_sized;
+  SquashFileBlock* blocks;
+  uint8_t* block_data;
+  size_t block_data_size;
+  /* Most recently decompressed block, for reads which don't cover a
+     whole one */
+  uint8_t* block_cache;
+  size_t block_cache_size;
+  size_t cached_block;
+
+  /* NULL unless read-ahead or write-behind are enabled */
+  SquashFileQueue* read_ahead;
+  SquashFileQueue* write_behind;
+
+  /* Allocated on first use, see squash_file_set_buffer */
+  uint8_t* buf;
+  size_t buf_size;
+  size_t buf_alignment;
+#if !defined(_WIN32)
+  /* Compressed input, when SQUASH_MMAP_IO=yes */
+  SquashMappedWindow map;
+  bool map_failed;
 #endif
 };
 
@@ -251,6 +351,9 @@ squash_file_steal (SquashCodec* codec, FILE* fp, ...) {
   return squash_file_steal_with_options (codec, fp, options);
 }
 
+static void squash_file_buffer_pool_enter (void);
+static void squash_file_buffer_pool_leave (void);
+
 /**
  * @brief Open an existing stdio file with the specified options
  *
@@ -280,17 +383,842 @@ squash_file_steal_with_options (SquashCodec* codec, FILE* fp, SquashOptions* opt
   file->last_status = SQUASH_OK;
   file->codec = codec;
   file->options = (options != NULL) ? squash_object_ref (options) : NULL;
-#if defined(SQUASH_MMAP_IO)
-  file->map = squash_mapped_file_empty;
+  file->start = (int64_t) squash_ftello (fp);
+  file->position = 0;
+  file->index_type = SQUASH_FILE_INDEX_UNKNOWN;
+  file->indexed = false;
+  file->uncompressed_size = 0;
+  file->n_blocks = 0;
+  file->n_sized = 0;
+  file->blocks = NULL;
+  file->block_data = NULL;
+  file->block_data_size = 0;
+  file->block_cache = NULL;
+  file->block_cache_size = 0;
+  file->cached_block = SIZE_MAX;
+  file->read_ahead = NULL;
+  file->write_behind = NULL;
+  file->buf = NULL;
+  file->buf_size = SQUASH_FILE_BUF_SIZE;
+  file->buf_alignment = 0;
+#if !defined(_WIN32)
+  file->map = squash_mapped_window_empty;
+  file->map_failed = false;
 #endif
 
   mtx_init (&(file->mtx), mtx_recursive);
 
   SQUASH_FLOCKFILE(fp);
 
+  squash_file_buffer_pool_enter ();
+
   return file;
 }
 
+static SquashStatus squash_file_read_stream (SquashFile* file,
+                                            size_t* decompressed_size,
+                                            uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)]);
+
+static bool
+squash_file_read_at (SquashFile* file, uint64_t offset, size_t size, uint8_t* data) {
+  if (SQUASH_UNLIKELY(offset > (uint64_t) (INT64_MAX - file->start)))
+    return false;
+
+  if (squash_fseeko (file->fp, file->start + (int64_t) offset, SEEK_SET) != 0)
+    return false;
+
+  return SQUASH_FREAD_UNLOCKED(data, 1, size, file->fp) == size;
+}
+
+static bool
+squash_file_index_append (SquashFile* file, size_t* allocated, const SquashFileBlock* block) {
+  if (file->n_blocks == *allocated) {
+    const size_t n = (*allocated == 0) ? 64 : (*allocated * 2);
+    SquashFileBlock* blocks = squash_realloc (file->blocks, n * sizeof (SquashFileBlock));
+    if (SQUASH_UNLIKELY(blocks == NULL))
+      return false;
+    file->blocks = blocks;
+    *allocated = n;
+  }
+
+  file->blocks[file->n_blocks++] = *block;
+  return true;
+}
+
+static void
+squash_file_index_clear (SquashFile* file) {
+  squash_free (file->blocks);
+  file->blocks = NULL;
+  file->n_blocks = 0;
+  file->n_sized = 0;
+  file->uncompressed_size = 0;
+}
+
+/* Read the footer and index of a seekable container. */
+static bool
+squash_file_index_seekable (SquashFile* file, uint64_t compressed_size) {
+  uint8_t footer_data[SQUASH_SEEKABLE_FOOTER_SIZE];
+  uint8_t magic[SQUASH_SEEKABLE_MAGIC_SIZE];
+  SquashSeekableFooter footer;
+  uint8_t* index = NULL;
+  bool res = false;
+
+  if (compressed_size < SQUASH_SEEKABLE_MAGIC_SIZE + SQUASH_SEEKABLE_FOOTER_SIZE ||
+      !squash_file_read_at (file, compressed_size - SQUASH_SEEKABLE_FOOTER_SIZE, sizeof (footer_data), footer_data) ||
+      !squash_seekable_parse_footer (&footer, compressed_size, footer_data) ||
+      !squash_file_read_at (file, 0, sizeof (magic), magic) ||
+      !squash_seekable_check_magic (magic))
+    return false;
+
+  const size_t index_size = (size_t) footer.n_blocks * SQUASH_SEEKABLE_ENTRY_SIZE;
+  index = squash_malloc (index_size == 0 ? 1 : index_size);
+  if (SQUASH_UNLIKELY(index == NULL) ||
+      !squash_file_read_at (file, footer.index_offset, index_size, index) ||
+      squash_crc32c (0, index_size, index) != footer.index_crc)
+    goto cleanup;
+
+  file->blocks = squash_calloc (footer.n_blocks == 0 ? 1 : (size_t) footer.n_blocks, sizeof (SquashFileBlock));
+  if (SQUASH_UNLIKELY(file->blocks == NULL))
+    goto cleanup;
+
+  for (size_t i = 0 ; i < (size_t) footer.n_blocks ; i++) {
+    SquashSeekableEntry entry;
+    SquashFileBlock* block = &(file->blocks[i]);
+
+    if (!squash_seekable_parse_entry (&entry, &footer, i, index + (i * SQUASH_SEEKABLE_ENTRY_SIZE)))
+      goto cleanup;
+
+    const uint64_t remaining = footer.uncompressed_size - entry.uncompressed_offset;
+
+    block->uncompressed_offset = entry.uncompressed_offset;
+    block->offset = entry.compressed_offset;
+    block->size = (size_t) entry.compressed_size;
+    block->decompressed_size = (size_t) ((remaining < footer.block_size) ? remaining : footer.block_size);
+    block->crc = entry.crc;
+  }
+
+  file->n_blocks = (size_t) footer.n_blocks;
+  file->n_sized = file->n_blocks;
+  file->uncompressed_size = footer.uncompressed_size;
+  res = true;
+
+ cleanup:
+
+  if (!res)
+    squash_file_index_clear (file);
+  squash_free (index);
+
+  return res;
+}
+
+static SquashStatus
+squash_file_decompress_frame (SquashFile* file,
+                              SquashCodecImpl* impl,
+                              const SquashFrame* frame,
+                              size_t* decompressed_size,
+                              uint8_t* decompressed,
+                              size_t compressed_size,
+                              const uint8_t* compressed) {
+  if (frame->codec_data == 0)
+    return squash_codec_decompress_with_options (file->codec, decompressed_size, decompressed,
+                                                 frame->size, compressed + frame->offset, file->options);
+
+  SquashMemoryScope scope = squash_memory_scope_enter (NULL, &(file->codec->memory));
+  const SquashStatus res = impl->decompress_frame (file->codec, frame, decompressed_size, decompressed,
+                                                   compressed_size, compressed, file->options);
+  squash_memory_scope_leave (scope);
+
+  return res;
+}
+
+/* Split the file into the codec's native frames.  Codecs need to see
+   all of the compressed data to find the boundaries, so it is mapped
+   if possible instead of being read into memory (which is only done
+   for files up to SQUASH_FILE_INDEX_READ_MAX bytes).  Frames which
+   don't record their own size aren't decompressed here; that is
+   deferred until a read actually needs to get past them. */
+static bool
+squash_file_index_frames (SquashFile* file, uint64_t compressed_size) {
+  SquashCodecImpl* impl = squash_codec_get_impl (file->codec);
+  SquashFrame* frames = NULL;
+  size_t n_frames = 0, allocated = 0;
+  uint8_t* compressed = NULL;
+  uint8_t* buffer = NULL;
+  uint64_t uncompressed_offset = 0;
+  bool sized = true;
+  bool res = false;
+#if !defined(_WIN32)
+  SquashMappedFile mapped = squash_mapped_file_empty;
+#endif
+
+  if (impl == NULL || impl->split_frames == NULL ||
+      squash_options_get_store_incompressible (file->options) != 0.0 ||
+      compressed_size == 0 || compressed_size > SIZE_MAX)
+    return false;
+
+#if !defined(_WIN32)
+  if (squash_fseeko (file->fp, file->start, SEEK_SET) == 0 &&
+      squash_mapped_file_init_full (&mapped, file->fp, (size_t) compressed_size, false, false))
+    compressed = mapped.data;
+#endif
+
+  if (compressed == NULL) {
+    if (compressed_size > SQUASH_FILE_INDEX_READ_MAX)
+      return false;
+
+    buffer = squash_malloc ((size_t) compressed_size);
+    if (SQUASH_UNLIKELY(buffer == NULL) ||
+        !squash_file_read_at (file, 0, (size_t) compressed_size, buffer))
+      goto cleanup;
+    compressed = buffer;
+  }
+
+  if (impl->split_frames (file->codec, (size_t) compressed_size, compressed, &n_frames, &frames) != SQUASH_OK)
+    goto cleanup;
+
+  for (size_t i = 0 ; i < n_frames ; i++) {
+    const SquashFrame* frame = &(frames[i]);
+    const SquashFileBlock block = {
+      uncompressed_offset,
+      (uint64_t) frame->offset,
+      frame->size,
+      frame->decompressed_size,
+      frame->decompressed_size_hint,
+      frame->codec_data,
+      0
+    };
+    if (SQUASH_UNLIKELY(!squash_file_index_append (file, &allocated, &block)))
+      goto cleanup;
+
+    if (sized && frame->decompressed_size != 0) {
+      uncompressed_offset += frame->decompressed_size;
+      file->n_sized++;
+    } else {
+      sized = false;
+    }
+  }
+
+  if (file->n_sized == file->n_blocks)
+    file->uncompressed_size = uncompressed_offset;
+  res = (file->n_blocks != 0);
+
+ cleanup:
+
+  if (!res)
+    squash_file_index_clear (file);
+  squash_free (frames);
+  squash_free (buffer);
+#if !defined(_WIN32)
+  squash_mapped_file_destroy (&mapped, false);
+#endif
+
+  return res;
+}
+
+/* Look for an index.  Checking for a seekable container only requires
+   reading the footer, so it's done when the file is first read;
+   splitting native frames requires looking at the whole file, so it
+   is only done when random access actually requires it. */
+static void
+squash_file_index_init (SquashFile* file, bool scan) {
+  if (file->index_type >= SQUASH_FILE_INDEX_NONE ||
+      (file->index_type == SQUASH_FILE_INDEX_PROBED && !scan))
+    return;
+
+  if (file->start < 0) {
+    file->index_type = SQUASH_FILE_INDEX_NONE;
+    return;
+  }
+
+  const int64_t pos = squash_ftello (file->fp);
+  if (pos < 0 || squash_fseeko (file->fp, 0, SEEK_END) != 0) {
+    file->index_type = SQUASH_FILE_INDEX_NONE;
+    return;
+  }
+
+  const int64_t end = squash_ftello (file->fp);
+  if (end >= file->start) {
+    const uint64_t compressed_size = (uint64_t) (end - file->start);
+
+    if (file->index_type == SQUASH_FILE_INDEX_UNKNOWN) {
+      file->index_type = squash_file_index_seekable (file, compressed_size) ?
+        SQUASH_FILE_INDEX_SEEKABLE : SQUASH_FILE_INDEX_PROBED;
+    }
+
+    if (file->index_type == SQUASH_FILE_INDEX_PROBED && scan) {
+      file->index_type = squash_file_index_frames (file, compressed_size) ?
+        SQUASH_FILE_INDEX_FRAMES : SQUASH_FILE_INDEX_NONE;
+    }
+  } else {
+    file->index_type = SQUASH_FILE_INDEX_NONE;
+  }
+
+  squash_fseeko (file->fp, pos, SEEK_SET);
+}
+
+/* Read a block's compressed data into file->block_data. */
+static SquashStatus
+squash_file_read_block (SquashFile* file, size_t index) {
+  const SquashFileBlock* block = &(file->blocks[index]);
+
+  if (file->block_data_size < block->size) {
+    squash_free (file->block_data);
+    file->block_data = squash_malloc (block->size);
+    file->block_data_size = (file->block_data != NULL) ? block->size : 0;
+    if (SQUASH_UNLIKELY(file->block_data == NULL))
+      return squash_error (SQUASH_MEMORY);
+  }
+
+  if (SQUASH_UNLIKELY(!squash_file_read_at (file, block->offset, block->size, file->block_data)))
+    return squash_error (SQUASH_IO);
+
+  if (file->index_type == SQUASH_FILE_INDEX_SEEKABLE &&
+      SQUASH_UNLIKELY(squash_crc32c (0, block->size, file->block_data) != block->crc))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  return SQUASH_OK;
+}
+
+/* Decompress the block previously loaded by squash_file_read_block. */
+static SquashStatus
+squash_file_decode_block (SquashFile* file, size_t index, size_t* decompressed_size, uint8_t* decompressed) {
+  const SquashFileBlock* block = &(file->blocks[index]);
+
+  if (file->index_type == SQUASH_FILE_INDEX_SEEKABLE)
+    return squash_codec_decompress_with_options (file->codec, decompressed_size, decompressed,
+                                                 block->size, file->block_data, file->options);
+
+  /* Frames only read their own data, so they can be decoded without
+     the rest of the file. */
+  const SquashFrame frame = { 0, block->size, block->decompressed_size, 0, block->codec_data };
+  return squash_file_decompress_frame (file, squash_codec_get_impl (file->codec), &frame,
+                                       decompressed_size, decompressed, block->size, file->block_data);
+}
+
+static SquashStatus
+squash_file_decompress_block (SquashFile* file, size_t index, uint8_t* decompressed) {
+  const SquashFileBlock* block = &(file->blocks[index]);
+  size_t decompressed_size = block->decompressed_size;
+
+  SquashStatus res = squash_file_read_block (file, index);
+  if (SQUASH_LIKELY(res == SQUASH_OK))
+    res = squash_file_decode_block (file, index, &decompressed_size, decompressed);
+
+  if (SQUASH_LIKELY(res == SQUASH_OK) && SQUASH_UNLIKELY(decompressed_size != block->decompressed_size))
+    res = squash_error (SQUASH_INVALID_BUFFER);
+
+  return res;
+}
+
+/* Decompress a frame which doesn't record its size into the block
+   cache, growing the cache until it fits, to find out how large it
+   is.  The result stays cached, since the caller is usually about to
+   read from it. */
+static SquashStatus
+squash_file_measure_block (SquashFile* file, size_t index) {
+  SquashFileBlock* block = &(file->blocks[index]);
+  size_t cache_size = file->block_cache_size;
+  SquashStatus res;
+
+  if (cache_size == 0)
+    cache_size = (block->decompressed_size_hint != 0) ? block->decompressed_size_hint : SQUASH_FILE_BUF_SIZE;
+
+  file->cached_block = SIZE_MAX;
+
+  res = squash_file_read_block (file, index);
+  if (SQUASH_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  do {
+    if (file->block_cache_size < cache_size) {
+      squash_free (file->block_cache);
+      file->block_cache = squash_malloc (cache_size);
+      file->block_cache_size = (file->block_cache != NULL) ? cache_size : 0;
+      if (SQUASH_UNLIKELY(file->block_cache == NULL))
+        return squash_error (SQUASH_MEMORY);
+    }
+
+    size_t decompressed_size = file->block_cache_size;
+    res = squash_file_decode_block (file, index, &decompressed_size, file->block_cache);
+    if (res == SQUASH_OK) {
+      block->decompressed_size = decompressed_size;
+      file->cached_block = index;
+    } else if (res == SQUASH_BUFFER_FULL) {
+      if (SQUASH_UNLIKELY(cache_size > (SIZE_MAX / 2)))
+        return squash_error (SQUASH_MEMORY);
+      cache_size *= 2;
+    }
+  } while (res == SQUASH_BUFFER_FULL);
+
+  return res;
+}
+
+/* Size blocks until the one containing offset is known, or all of
+   them are if offset is past the end of the data. */
+static SquashStatus
+squash_file_index_extend (SquashFile* file, uint64_t offset) {
+  while (file->n_sized < file->n_blocks) {
+    SquashFileBlock* block = &(file->blocks[file->n_sized]);
+    uint64_t block_offset = 0;
+
+    if (file->n_sized != 0) {
+      const SquashFileBlock* prev = &(file->blocks[file->n_sized - 1]);
+      block_offset = prev->uncompressed_offset + prev->decompressed_size;
+      if (block_offset > offset)
+        break;
+    }
+
+    if (block->decompressed_size == 0) {
+      const SquashStatus res = squash_file_measure_block (file, file->n_sized);
+      if (SQUASH_UNLIKELY(res != SQUASH_OK))
+        return res;
+    }
+
+    block->uncompressed_offset = block_offset;
+    if (++(file->n_sized) == file->n_blocks)
+      file->uncompressed_size = block_offset + block->decompressed_size;
+  }
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_file_pread_indexed (SquashFile* file,
+                           uint64_t offset,
+                           size_t* decompressed_size,
+                           uint8_t* decompressed) {
+  SquashStatus res = SQUASH_OK;
+  size_t lo = 0, hi, pos = 0;
+  size_t length = *decompressed_size;
+
+  const int64_t saved = squash_ftello (file->fp);
+  if (SQUASH_UNLIKELY(saved < 0))
+    return squash_error (SQUASH_IO);
+
+  res = squash_file_index_extend (file, offset);
+  if (SQUASH_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+
+  if (file->n_sized == file->n_blocks) {
+    const uint64_t remaining = (offset < file->uncompressed_size) ? (file->uncompressed_size - offset) : 0;
+    if (remaining < length)
+      length = (size_t) remaining;
+  }
+
+  /* Last block starting at or before offset */
+  hi = file->n_sized;
+  while (hi - lo > 1) {
+    const size_t mid = lo + ((hi - lo) / 2);
+    if (file->blocks[mid].uncompressed_offset <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  for (size_t i = lo ; pos < length ; i++) {
+    if (i >= file->n_sized) {
+      res = squash_file_index_extend (file, offset + pos);
+      if (SQUASH_UNLIKELY(res != SQUASH_OK))
+        break;
+    }
+
+    /* End of the data */
+    if (i >= file->n_sized)
+      break;
+
+    const SquashFileBlock* block = &(file->blocks[i]);
+    const size_t skip = (size_t) ((offset + pos) - block->uncompressed_offset);
+    if (skip >= block->decompressed_size)
+      continue;
+    const size_t wanted = ((block->decompressed_size - skip) < (length - pos)) ? (block->decompressed_size - skip) : (length - pos);
+
+    if (skip == 0 && wanted == block->decompressed_size && i != file->cached_block) {
+      res = squash_file_decompress_block (file, i, decompressed + pos);
+    } else {
+      if (i != file->cached_block) {
+        if (file->block_cache_size < block->decompressed_size) {
+          squash_free (file->block_cache);
+          file->block_cache = squash_malloc (block->decompressed_size);
+          file->block_cache_size = (file->block_cache != NULL) ? block->decompressed_size : 0;
+          if (SQUASH_UNLIKELY(file->block_cache == NULL)) {
+            res = squash_error (SQUASH_MEMORY);
+            break;
+          }
+        }
+
+        file->cached_block = SIZE_MAX;
+        res = squash_file_decompress_block (file, i, file->block_cache);
+        if (SQUASH_LIKELY(res == SQUASH_OK))
+          file->cached_block = i;
+      }
+
+      if (SQUASH_LIKELY(res == SQUASH_OK))
+        memcpy (decompressed + pos, file->block_cache + skip, wanted);
+    }
+
+    if (SQUASH_UNLIKELY(res != SQUASH_OK))
+      break;
+
+    pos += wanted;
+  }
+
+ cleanup:
+
+  if (SQUASH_UNLIKELY(squash_fseeko (file->fp, saved, SEEK_SET) != 0) && res == SQUASH_OK)
+    res = squash_error (SQUASH_IO);
+
+  *decompressed_size = (res == SQUASH_OK) ? pos : 0;
+
+  return res;
+}
+
+static SquashStatus
+squash_file_read_direct (SquashFile* file,
+                         size_t* decompressed_size,
+                         uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)]) {
+  if (SQUASH_UNLIKELY(file->last_status < 0)) {
+    *decompressed_size = 0;
+    return file->last_status;
+  }
+
+  if (file->stream == NULL && file->index_type == SQUASH_FILE_INDEX_UNKNOWN) {
+    squash_file_index_init (file, false);
+    file->indexed = (file->index_type == SQUASH_FILE_INDEX_SEEKABLE);
+  }
+
+  if (file->indexed) {
+    SquashStatus res = squash_file_pread_indexed (file, file->position, decompressed_size, decompressed);
+    if (SQUASH_UNLIKELY(res < 0))
+      return file->last_status = res;
+
+    file->position += *decompressed_size;
+    return (*decompressed_size == 0) ? SQUASH_END_OF_STREAM : SQUASH_OK;
+  }
+
+  SquashStatus res = squash_file_read_stream (file, decompressed_size, decompressed);
+  file->position += *decompressed_size;
+
+  return res;
+}
+
+SQUASH_MTX_DEFINE(file_buffer_pool)
+
+typedef struct SquashFileBufferPoolEntry_ {
+  uint8_t* data;
+  size_t size;
+  size_t alignment;
+} SquashFileBufferPoolEntry;
+
+static SquashFileBufferPoolEntry squash_file_buffer_pool[SQUASH_FILE_BUF_POOL_SIZE];
+static size_t squash_file_buffer_pool_length = 0;
+/* Number of open files; the pool is emptied when the last one is
+   freed so idle buffers don't outlive the files which used them. */
+static size_t squash_file_buffer_pool_users = 0;
+
+static void
+squash_file_buffer_destroy (uint8_t* data, size_t alignment) {
+  if (alignment != 0)
+    squash_aligned_free (data);
+  else
+    squash_free (data);
+}
+
+#if defined(__GNUC__)
+__attribute__((__destructor__))
+static void
+squash_file_buffer_pool_destroy (void) {
+  for (size_t i = 0 ; i < squash_file_buffer_pool_length ; i++)
+    squash_file_buffer_destroy (squash_file_buffer_pool[i].data, squash_file_buffer_pool[i].alignment);
+  squash_file_buffer_pool_length = 0;
+}
+#endif
+
+static void
+squash_file_buffer_pool_enter (void) {
+  SQUASH_MTX_LOCK(file_buffer_pool);
+  squash_file_buffer_pool_users++;
+  SQUASH_MTX_UNLOCK(file_buffer_pool);
+}
+
+static void
+squash_file_buffer_pool_leave (void) {
+  SquashFileBufferPoolEntry idle[SQUASH_FILE_BUF_POOL_SIZE];
+  size_t n_idle = 0;
+
+  SQUASH_MTX_LOCK(file_buffer_pool);
+  if (--squash_file_buffer_pool_users == 0) {
+    n_idle = squash_file_buffer_pool_length;
+    memcpy (idle, squash_file_buffer_pool, n_idle * sizeof (SquashFileBufferPoolEntry));
+    squash_file_buffer_pool_length = 0;
+  }
+  SQUASH_MTX_UNLOCK(file_buffer_pool);
+
+  for (size_t i = 0 ; i < n_idle ; i++)
+    squash_file_buffer_destroy (idle[i].data, idle[i].alignment);
+}
+
+/* Buffers are shared between all files through a small pool, so
+   applications which open and close lots of files don't spend their
+   time in malloc/free (and page faults) for them.  The pool only
+   holds on to buffers while at least one file is open. */
+static uint8_t*
+squash_file_buffer_acquire (size_t size, size_t alignment) {
+  uint8_t* data = NULL;
+
+  SQUASH_MTX_LOCK(file_buffer_pool);
+  for (size_t i = squash_file_buffer_pool_length ; i > 0 ; i--) {
+    const SquashFileBufferPoolEntry* entry = &(squash_file_buffer_pool[i - 1]);
+    if (entry->size == size && entry->alignment == alignment) {
+      data = entry->data;
+      squash_file_buffer_pool[i - 1] = squash_file_buffer_pool[--squash_file_buffer_pool_length];
+      break;
+    }
+  }
+  SQUASH_MTX_UNLOCK(file_buffer_pool);
+
+  if (data == NULL)
+    data = (alignment != 0) ? squash_aligned_alloc (alignment, size) : squash_malloc (size);
+
+  return data;
+}
+
+static void
+squash_file_buffer_release (uint8_t* data, size_t size, size_t alignment) {
+  if (data == NULL)
+    return;
+
+  SQUASH_MTX_LOCK(file_buffer_pool);
+  if (squash_file_buffer_pool_length < SQUASH_FILE_BUF_POOL_SIZE) {
+    const SquashFileBufferPoolEntry entry = { data, size, alignment };
+    squash_file_buffer_pool[squash_file_buffer_pool_length++] = entry;
+    data = NULL;
+  }
+  SQUASH_MTX_UNLOCK(file_buffer_pool);
+
+  if (data != NULL)
+    squash_file_buffer_destroy (data, alignment);
+}
+
+static bool
+squash_file_buffer_init (SquashFile* file) {
+  if (file->buf == NULL)
+    file->buf = squash_file_buffer_acquire (file->buf_size, file->buf_alignment);
+
+  return file->buf != NULL;
+}
+
+static void squash_file_queue_free (SquashFileQueue* queue);
+
+static SquashFileQueue*
+squash_file_queue_new (size_t n_chunks, size_t chunk_size) {
+  if (SQUASH_UNLIKELY(n_chunks > ((SIZE_MAX - sizeof (SquashFileQueue)) / sizeof (SquashFileQueueChunk))))
+    return NULL;
+
+  SquashFileQueue* queue = squash_calloc (1, sizeof (SquashFileQueue) + (n_chunks * sizeof (SquashFileQueueChunk)));
+  if (SQUASH_UNLIKELY(queue == NULL))
+    return NULL;
+
+  if (SQUASH_UNLIKELY(mtx_init (&(queue->mtx), mtx_plain) != thrd_success)) {
+    squash_free (queue);
+    return NULL;
+  }
+  cnd_init (&(queue->filled_cnd));
+  cnd_init (&(queue->drained_cnd));
+  queue->status = SQUASH_OK;
+  queue->chunk_size = chunk_size;
+  queue->n_chunks = n_chunks;
+
+  for (size_t i = 0 ; i < n_chunks ; i++) {
+    queue->chunks[i].data = squash_file_buffer_acquire (chunk_size, 0);
+    if (SQUASH_UNLIKELY(queue->chunks[i].data == NULL)) {
+      squash_file_queue_free (queue);
+      return NULL;
+    }
+  }
+
+  return queue;
+}
+
+static void
+squash_file_queue_free (SquashFileQueue* queue) {
+  assert (!queue->started);
+
+  for (size_t i = 0 ; i < queue->n_chunks ; i++)
+    squash_file_buffer_release (queue->chunks[i].data, queue->chunk_size, 0);
+  cnd_destroy (&(queue->drained_cnd));
+  cnd_destroy (&(queue->filled_cnd));
+  mtx_destroy (&(queue->mtx));
+  squash_free (queue);
+}
+
+/* While the thread is running it holds the stdio lock, and owns
+   file->fp, file->stream, file->position and everything else used to
+   read or write directly.  The caller only touches the ring, under
+   queue->mtx. */
+static SquashStatus
+squash_file_queue_start (SquashFile* file, SquashFileQueue* queue, thrd_start_t func) {
+  assert (!queue->started);
+
+  SQUASH_FUNLOCKFILE(file->fp);
+  if (SQUASH_UNLIKELY(thrd_create (&(queue->thread), func, file) != thrd_success)) {
+    SQUASH_FLOCKFILE(file->fp);
+    return squash_error (SQUASH_FAILED);
+  }
+  queue->started = true;
+
+  return SQUASH_OK;
+}
+
+/* Stop the thread and wait for it to exit; anything still in the
+   ring is left there. */
+static void
+squash_file_queue_stop (SquashFile* file, SquashFileQueue* queue) {
+  if (!queue->started)
+    return;
+
+  mtx_lock (&(queue->mtx));
+  queue->stop = true;
+  cnd_broadcast (&(queue->filled_cnd));
+  cnd_broadcast (&(queue->drained_cnd));
+  mtx_unlock (&(queue->mtx));
+
+  thrd_join (queue->thread, NULL);
+  queue->started = false;
+  queue->stop = false;
+
+  SQUASH_FLOCKFILE(file->fp);
+}
+
+static int
+squash_file_read_ahead_worker (void* user_data) {
+  SquashFile* file = user_data;
+  SquashFileQueue* ra = file->read_ahead;
+
+  SQUASH_FLOCKFILE(file->fp);
+
+  mtx_lock (&(ra->mtx));
+  while (!ra->stop) {
+    if (ra->count == ra->n_chunks) {
+      cnd_wait (&(ra->drained_cnd), &(ra->mtx));
+      continue;
+    }
+
+    SquashFileQueueChunk* chunk = &(ra->chunks[(ra->head + ra->count) % ra->n_chunks]);
+    mtx_unlock (&(ra->mtx));
+
+    /* Nobody else looks at a chunk until it is counted. */
+    chunk->size = ra->chunk_size;
+    chunk->status = squash_file_read_direct (file, &(chunk->size), chunk->data);
+    chunk->offset = 0;
+
+    mtx_lock (&(ra->mtx));
+    ra->count++;
+    cnd_signal (&(ra->filled_cnd));
+
+    if (chunk->status < 0 || chunk->status == SQUASH_END_OF_STREAM) {
+      ra->status = chunk->status;
+      ra->done = true;
+      break;
+    }
+  }
+  cnd_signal (&(ra->filled_cnd));
+  mtx_unlock (&(ra->mtx));
+
+  SQUASH_FUNLOCKFILE(file->fp);
+
+  return 0;
+}
+
+/* Stop the read-ahead thread.  Anything already in the ring is kept,
+   and reading will start the thread again once it has been
+   consumed. */
+static void
+squash_file_read_ahead_pause (SquashFile* file) {
+  if (file->read_ahead != NULL)
+    squash_file_queue_stop (file, file->read_ahead);
+}
+
+/* Pause, and throw away the buffered data; afterwards file->position
+   is where the consumer will be reading from. */
+static void
+squash_file_read_ahead_discard (SquashFile* file) {
+  SquashFileQueue* ra = file->read_ahead;
+
+  if (ra == NULL)
+    return;
+
+  squash_file_read_ahead_pause (file);
+  ra->head = 0;
+  ra->count = 0;
+  ra->done = false;
+}
+
+static void
+squash_file_read_ahead_free (SquashFile* file) {
+  if (file->read_ahead == NULL)
+    return;
+
+  squash_file_read_ahead_pause (file);
+  squash_file_queue_free (file->read_ahead);
+  file->read_ahead = NULL;
+}
+
+static SquashStatus
+squash_file_read_ahead_read (SquashFile* file,
+                             size_t* decompressed_size,
+                             uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)]) {
+  SquashFileQueue* ra = file->read_ahead;
+  SquashStatus res = SQUASH_OK;
+  size_t pos = 0;
+
+  mtx_lock (&(ra->mtx));
+
+  while (pos < *decompressed_size) {
+    if (ra->count == 0) {
+      if (ra->done)
+        break;
+
+      if (!ra->started) {
+        mtx_unlock (&(ra->mtx));
+        res = squash_file_queue_start (file, ra, squash_file_read_ahead_worker);
+        mtx_lock (&(ra->mtx));
+        if (SQUASH_UNLIKELY(res < 0))
+          break;
+      } else {
+        cnd_wait (&(ra->filled_cnd), &(ra->mtx));
+      }
+
+      continue;
+    }
+
+    SquashFileQueueChunk* chunk = &(ra->chunks[ra->head]);
+    const size_t available = chunk->size - chunk->offset;
+    const size_t length = (available < (*decompressed_size - pos)) ? available : (*decompressed_size - pos);
+
+    memcpy (decompressed + pos, chunk->data + chunk->offset, length);
+    chunk->offset += length;
+    pos += length;
+
+    if (chunk->offset == chunk->size) {
+      ra->head = (ra->head + 1) % ra->n_chunks;
+      ra->count--;
+      cnd_signal (&(ra->drained_cnd));
+    }
+  }
+
+  if (ra->count == 0 && ra->done)
+    res = ra->status;
+  else if (res > 0)
+    res = SQUASH_OK;
+  ra->position += pos;
+
+  mtx_unlock (&(ra->mtx));
+
+  *decompressed_size = pos;
+
+  return res;
+}
+
 /**
  * @brief Read from a compressed file
  *
@@ -357,9 +1285,18 @@ squash_file_read_unlocked (SquashFile* file,
   assert (decompressed_size != NULL);
   assert (decompressed != NULL);
 
-  if (SQUASH_UNLIKELY(file->last_status < 0))
-    return file->last_status;
+  if (SQUASH_UNLIKELY(file->write_behind != NULL))
+    return squash_error (SQUASH_INVALID_OPERATION);
+  else if (file->read_ahead != NULL)
+    return squash_file_read_ahead_read (file, decompressed_size, decompressed);
 
+  return squash_file_read_direct (file, decompressed_size, decompressed);
+}
+
+static SquashStatus
+squash_file_read_stream (SquashFile* file,
+                         size_t* decompressed_size,
+                         uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)]) {
   if (file->stream == NULL) {
     file->stream = squash_codec_create_stream_with_options (file->codec, SQUASH_STREAM_DECOMPRESS, file->options);
     if (SQUASH_UNLIKELY(file->stream == NULL)) {
@@ -399,18 +1336,37 @@ squash_file_read_unlocked (SquashFile* file,
 
     assert (file->last_status == SQUASH_OK);
 
-#if defined(SQUASH_MMAP_IO)
-    if (file->map.data != MAP_FAILED)
-      squash_mapped_file_destroy (&(file->map), true);
+#if !defined(_WIN32)
+    uint8_t* chunk = NULL;
+    size_t chunk_size = 0;
+
+    if (file->map.fp == NULL && !file->map_failed)
+      file->map_failed = !squash_mapped_window_init (&(file->map), file->fp, false);
+
+    if (file->map.fp != NULL) {
+      if (squash_mapped_window_acquire (&(file->map), &chunk, &chunk_size) && chunk_size != 0) {
+        squash_mapped_window_release (&(file->map), chunk_size);
+      } else {
+        /* Let stdio take it from here, so feof and ferror work. */
+        squash_mapped_window_destroy (&(file->map), true);
+        file->map_failed = true;
+        chunk = NULL;
+      }
+    }
 
-    if (squash_mapped_file_init_full(&(file->map), file->fp, SQUASH_FILE_BUF_SIZE, true, false)) {
-      stream->next_in = file->map.data;
-      stream->avail_in = file->map.size;
+    if (chunk != NULL) {
+      stream->next_in = chunk;
+      stream->avail_in = chunk_size;
     } else
 #endif
     {
+      if (SQUASH_UNLIKELY(!squash_file_buffer_init (file))) {
+        file->last_status = squash_error (SQUASH_MEMORY);
+        break;
+      }
+
       stream->next_in = file->buf;
-      stream->avail_in = SQUASH_FREAD_UNLOCKED(file->buf, 1, SQUASH_FILE_BUF_SIZE, file->fp);
+      stream->avail_in = SQUASH_FREAD_UNLOCKED(file->buf, 1, file->buf_size, file->fp);
     }
 
     if (stream->avail_in == 0) {
@@ -445,6 +1401,9 @@ squash_file_write_internal (SquashFile* file,
   if (SQUASH_UNLIKELY(file->last_status < 0))
     return file->last_status;
 
+  if (SQUASH_UNLIKELY(file->read_ahead != NULL))
+    return squash_error (SQUASH_INVALID_OPERATION);
+
   if (file->stream == NULL) {
     file->stream = squash_codec_create_stream_with_options (file->codec, SQUASH_STREAM_COMPRESS, file->options);
     if (SQUASH_UNLIKELY(file->stream == NULL)) {
@@ -453,6 +1412,11 @@ squash_file_write_internal (SquashFile* file,
     }
   }
 
+  if (SQUASH_UNLIKELY(!squash_file_buffer_init (file))) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
   assert (file->stream->next_in == NULL);
   assert (file->stream->avail_in == 0);
   assert (file->stream->next_out == NULL);
@@ -463,7 +1427,7 @@ squash_file_write_internal (SquashFile* file,
 
   do {
     file->stream->next_out = file->buf;
-    file->stream->avail_out = SQUASH_FILE_BUF_SIZE;
+    file->stream->avail_out = file->buf_size;
 
     switch (operation) {
       case SQUASH_OPERATION_PROCESS:
@@ -480,25 +1444,159 @@ squash_file_write_internal (SquashFile* file,
         break;
     }
 
-    if (res > 0 && file->stream->avail_out != SQUASH_FILE_BUF_SIZE) {
-      size_t bytes_written = SQUASH_FWRITE_UNLOCKED(file->buf, 1, SQUASH_FILE_BUF_SIZE - file->stream->avail_out, file->fp);
-      if (bytes_written != SQUASH_FILE_BUF_SIZE - file->stream->avail_out) {
+    if (res > 0 && file->stream->avail_out != file->buf_size) {
+      size_t bytes_written = SQUASH_FWRITE_UNLOCKED(file->buf, 1, file->buf_size - file->stream->avail_out, file->fp);
+      if (bytes_written != file->buf_size - file->stream->avail_out) {
         res = SQUASH_IO;
         goto cleanup;
       }
     }
-  } while (res == SQUASH_PROCESSING);
+  } while (res == SQUASH_PROCESSING);
+
+ cleanup:
+
+  if (file->stream != NULL) {
+    file->stream->next_in = NULL;
+    file->stream->avail_in = 0;
+    file->stream->next_out = NULL;
+    file->stream->avail_out = 0;
+  }
+
+  return file->last_status = res;
+}
+
+/* Chunks stay in the ring until they have been written, so once the
+   ring is empty everything has been passed to the FILE*. */
+static int
+squash_file_write_behind_worker (void* user_data) {
+  SquashFile* file = user_data;
+  SquashFileQueue* wb = file->write_behind;
+
+  SQUASH_FLOCKFILE(file->fp);
+
+  mtx_lock (&(wb->mtx));
+  while (wb->count != 0 || !wb->stop) {
+    if (wb->count == 0) {
+      cnd_wait (&(wb->filled_cnd), &(wb->mtx));
+      continue;
+    }
+
+    SquashFileQueueChunk* chunk = &(wb->chunks[wb->head]);
+    mtx_unlock (&(wb->mtx));
+
+    SquashStatus res = SQUASH_OK;
+    if (chunk->size != 0)
+      res = squash_file_write_internal (file, chunk->size, chunk->data, SQUASH_OPERATION_PROCESS);
+    if (res > 0 && chunk->operation == SQUASH_OPERATION_FLUSH) {
+      res = squash_file_write_internal (file, 0, NULL, SQUASH_OPERATION_FLUSH);
+      SQUASH_FFLUSH_UNLOCKED(file->fp);
+    }
+    chunk->size = 0;
+
+    mtx_lock (&(wb->mtx));
+    if (res < 0 && wb->status > 0)
+      wb->status = res;
+    wb->head = (wb->head + 1) % wb->n_chunks;
+    wb->count--;
+    cnd_broadcast (&(wb->drained_cnd));
+  }
+  mtx_unlock (&(wb->mtx));
+
+  SQUASH_FUNLOCKFILE(file->fp);
+
+  return 0;
+}
+
+/* Hand the partially filled chunk, if any, to the worker.  Must be
+   called with wb->mtx held. */
+static void
+squash_file_write_behind_submit (SquashFileQueue* wb, SquashOperation operation) {
+  assert (wb->count < wb->n_chunks);
+
+  SquashFileQueueChunk* chunk = &(wb->chunks[(wb->head + wb->count) % wb->n_chunks]);
+  if (chunk->size == 0 && operation == SQUASH_OPERATION_PROCESS)
+    return;
+
+  chunk->operation = operation;
+  wb->count++;
+  cnd_signal (&(wb->filled_cnd));
+}
+
+/* Copy the data into the ring, blocking only if the worker has
+   fallen behind by more than the whole ring.  For a flush, wait
+   until everything queued has been written.  Errors from the worker
+   are reported by whichever call comes next. */
+static SquashStatus
+squash_file_write_behind_write (SquashFile* file,
+                                size_t uncompressed_size,
+                                const uint8_t* uncompressed,
+                                SquashOperation operation) {
+  SquashFileQueue* wb = file->write_behind;
+  SquashStatus res;
+
+  if (!wb->started) {
+    res = squash_file_queue_start (file, wb, squash_file_write_behind_worker);
+    if (SQUASH_UNLIKELY(res < 0))
+      return res;
+  }
+
+  mtx_lock (&(wb->mtx));
+
+  while (wb->status > 0 && (uncompressed_size != 0 || operation == SQUASH_OPERATION_FLUSH)) {
+    if (wb->count == wb->n_chunks) {
+      cnd_wait (&(wb->drained_cnd), &(wb->mtx));
+      continue;
+    }
+
+    /* Nobody else looks at a chunk until it is counted. */
+    SquashFileQueueChunk* chunk = &(wb->chunks[(wb->head + wb->count) % wb->n_chunks]);
+    const size_t length = ((wb->chunk_size - chunk->size) < uncompressed_size) ? (wb->chunk_size - chunk->size) : uncompressed_size;
+
+    mtx_unlock (&(wb->mtx));
+    memcpy (chunk->data + chunk->size, uncompressed, length);
+    mtx_lock (&(wb->mtx));
+
+    chunk->size += length;
+    uncompressed += length;
+    uncompressed_size -= length;
+
+    if (uncompressed_size == 0 && operation == SQUASH_OPERATION_FLUSH) {
+      squash_file_write_behind_submit (wb, operation);
+      while (wb->count != 0)
+        cnd_wait (&(wb->drained_cnd), &(wb->mtx));
+      break;
+    } else if (chunk->size == wb->chunk_size) {
+      squash_file_write_behind_submit (wb, SQUASH_OPERATION_PROCESS);
+    }
+  }
 
- cleanup:
+  res = wb->status;
 
-  if (file->stream != NULL) {
-    file->stream->next_in = NULL;
-    file->stream->avail_in = 0;
-    file->stream->next_out = NULL;
-    file->stream->avail_out = 0;
+  mtx_unlock (&(wb->mtx));
+
+  return res;
+}
+
+/* Write out anything still queued, stop the worker, and release the
+   ring.  Any error is left in file->last_status. */
+static void
+squash_file_write_behind_free (SquashFile* file) {
+  SquashFileQueue* wb = file->write_behind;
+
+  if (wb == NULL)
+    return;
+
+  if (wb->started) {
+    mtx_lock (&(wb->mtx));
+    if (wb->count < wb->n_chunks)
+      squash_file_write_behind_submit (wb, SQUASH_OPERATION_PROCESS);
+    mtx_unlock (&(wb->mtx));
+
+    squash_file_queue_stop (file, wb);
   }
 
-  return file->last_status = res;
+  squash_file_queue_free (wb);
+  file->write_behind = NULL;
 }
 
 /**
@@ -729,7 +1827,17 @@ SquashStatus
 squash_file_write_unlocked (SquashFile* file,
                             size_t uncompressed_size,
                             const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)]) {
-  return squash_file_write_internal (file, uncompressed_size, uncompressed, SQUASH_OPERATION_PROCESS);
+  SquashStatus res;
+
+  if (file->write_behind != NULL)
+    res = squash_file_write_behind_write (file, uncompressed_size, uncompressed, SQUASH_OPERATION_PROCESS);
+  else
+    res = squash_file_write_internal (file, uncompressed_size, uncompressed, SQUASH_OPERATION_PROCESS);
+
+  if (SQUASH_LIKELY(res > 0))
+    file->position += uncompressed_size;
+
+  return res;
 }
 
 /**
@@ -739,6 +1847,10 @@ squash_file_write_unlocked (SquashFile* file,
  * (see the @ref SQUASH_CODEC_INFO_CAN_FLUSH flag in the return value
  * of @ref squash_codec_get_info).
  *
+ * If write-behind is enabled (see @ref squash_file_set_write_behind),
+ * this will also wait until all previously written data has been
+ * compressed and written.
+ *
  * @param file file to flush
  * @returns *TRUE* if flushing succeeeded, *FALSE* if flushing is not
  *   supported or there was another error.
@@ -771,11 +1883,515 @@ squash_file_flush (SquashFile* file) {
  */
 SquashStatus
 squash_file_flush_unlocked (SquashFile* file) {
+  if (file->write_behind != NULL)
+    return squash_file_write_behind_write (file, 0, NULL, SQUASH_OPERATION_FLUSH);
+
   SquashStatus res = squash_file_write_internal (file, 0, NULL, SQUASH_OPERATION_FLUSH);
   SQUASH_FFLUSH_UNLOCKED(file->fp);
   return res;
 }
 
+struct SquashFilePreadData {
+  FILE* fp;
+  uint64_t skip;
+  size_t size;
+  size_t written;
+  uint8_t* data;
+};
+
+static SquashStatus
+squash_file_pread_write (size_t* data_size, const uint8_t data[SQUASH_ARRAY_PARAM(*data_size)], void* user_data) {
+  struct SquashFilePreadData* ctx = user_data;
+  size_t length = *data_size;
+
+  if (ctx->skip != 0) {
+    const size_t skip = (ctx->skip < length) ? (size_t) ctx->skip : length;
+    ctx->skip -= skip;
+    data += skip;
+    length -= skip;
+  }
+
+  if (length > (ctx->size - ctx->written))
+    length = ctx->size - ctx->written;
+
+  memcpy (ctx->data + ctx->written, data, length);
+  ctx->written += length;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_file_pread_read (size_t* data_size, uint8_t data[SQUASH_ARRAY_PARAM(*data_size)], void* user_data) {
+  struct SquashFilePreadData* ctx = user_data;
+
+  *data_size = SQUASH_FREAD_UNLOCKED(data, 1, *data_size, ctx->fp);
+  if (*data_size == 0)
+    return feof (ctx->fp) ? SQUASH_END_OF_STREAM : squash_error (SQUASH_IO);
+
+  return SQUASH_OK;
+}
+
+/* Without an index the only option is to decompress everything up to
+   the requested range, using a separate stream so the sequential
+   position is undisturbed. */
+static SquashStatus
+squash_file_pread_stream (SquashFile* file,
+                          uint64_t offset,
+                          size_t* decompressed_size,
+                          uint8_t* decompressed) {
+  struct SquashFilePreadData ctx = { file->fp, offset, *decompressed_size, 0, decompressed };
+  SquashStatus res;
+
+  if (SQUASH_UNLIKELY(file->start < 0))
+    return squash_error (SQUASH_INVALID_OPERATION);
+  if (SQUASH_UNLIKELY(offset > (uint64_t) (SIZE_MAX - *decompressed_size)))
+    return squash_error (SQUASH_RANGE);
+
+  const int64_t saved = squash_ftello (file->fp);
+  if (SQUASH_UNLIKELY(saved < 0) || SQUASH_UNLIKELY(squash_fseeko (file->fp, file->start, SEEK_SET) != 0))
+    return squash_error (SQUASH_IO);
+
+  res = squash_splice_custom_with_options (file->codec, SQUASH_STREAM_DECOMPRESS,
+                                           squash_file_pread_write, squash_file_pread_read, &ctx,
+                                           (size_t) offset + *decompressed_size, file->options);
+
+  if (SQUASH_UNLIKELY(squash_fseeko (file->fp, saved, SEEK_SET) != 0) && res > 0)
+    res = squash_error (SQUASH_IO);
+
+  *decompressed_size = (res > 0) ? ctx.written : 0;
+
+  return (res > 0) ? SQUASH_OK : res;
+}
+
+/**
+ * @brief Read decompressed data from an arbitrary offset
+ *
+ * Read up to @a decompressed_size bytes of decompressed data starting
+ * at @a offset in the decompressed stream, without changing the
+ * position used by @ref squash_file_read.
+ *
+ * If the file is a seekable container (see @ref SquashSeekable), or
+ * the codec is able to split its native format into independent
+ * frames, only the blocks overlapping the requested range are
+ * decompressed.  The index used to find them is built the first time
+ * it is needed and kept for the lifetime of @a file; building it
+ * maps the compressed data instead of reading it into memory, and
+ * frames which don't record their decompressed size are only
+ * decompressed once a read needs to get past them.  Otherwise the
+ * data before @a offset must be decompressed and discarded.
+ *
+ * @param file the file to read from
+ * @param offset offset in the decompressed data to start reading at
+ * @param[in,out] decompressed_size on input, the maximum number of
+ *   bytes to read; on output, the number of bytes actually read,
+ *   which will be less than requested if the end of the file is
+ *   reached
+ * @param decompressed buffer to write the decompressed data to
+ * @return the result of the operation
+ * @retval SQUASH_OK successfully read the data
+ * @retval SQUASH_INVALID_OPERATION the file isn't seekable
+ */
+SquashStatus
+squash_file_pread (SquashFile* file,
+                   uint64_t offset,
+                   size_t* decompressed_size,
+                   uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)]) {
+  SquashStatus res;
+
+  assert (file != NULL);
+  assert (decompressed_size != NULL);
+  assert (decompressed != NULL);
+
+  squash_file_lock (file);
+
+  squash_file_read_ahead_pause (file);
+
+  if (file->write_behind != NULL ||
+      (file->stream != NULL && file->stream->stream_type == SQUASH_STREAM_COMPRESS)) {
+    res = squash_error (SQUASH_INVALID_OPERATION);
+  } else {
+    squash_file_index_init (file, true);
+
+    if (file->index_type == SQUASH_FILE_INDEX_NONE)
+      res = squash_file_pread_stream (file, offset, decompressed_size, decompressed);
+    else
+      res = squash_file_pread_indexed (file, offset, decompressed_size, decompressed);
+  }
+
+  if (res < 0)
+    *decompressed_size = 0;
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/* Advance the stream to position, decompressing and discarding any
+   data in between. */
+static SquashStatus
+squash_file_skip (SquashFile* file, uint64_t position) {
+  SquashStatus res = SQUASH_OK;
+  uint8_t* discard = NULL;
+
+  if (file->position < position) {
+    discard = squash_file_buffer_acquire (file->buf_size, 0);
+    if (SQUASH_UNLIKELY(discard == NULL))
+      return squash_error (SQUASH_MEMORY);
+  }
+
+  while (file->position < position) {
+    const uint64_t remaining = position - file->position;
+    size_t length = (remaining < file->buf_size) ? (size_t) remaining : file->buf_size;
+
+    res = squash_file_read_direct (file, &length, discard);
+    if (res < 0 || res == SQUASH_END_OF_STREAM || length == 0)
+      break;
+  }
+
+  squash_file_buffer_release (discard, file->buf_size, 0);
+
+  return (res < 0) ? res : SQUASH_OK;
+}
+
+/* Apply @a offset to @a base, failing if the result would be
+   negative or overflow. */
+static bool
+squash_file_seek_target (uint64_t base, int64_t offset, uint64_t* position) {
+  if ((offset < 0 && (uint64_t) -(offset + 1) >= base) ||
+      (offset > 0 && (uint64_t) offset > (UINT64_MAX - base)))
+    return false;
+
+  *position = (offset < 0) ? (base - ((uint64_t) -(offset + 1) + 1)) : (base + (uint64_t) offset);
+
+  return true;
+}
+
+/**
+ * @brief Set the position in the decompressed data
+ *
+ * Reposition @a file so the next call to @ref squash_file_read will
+ * return data starting at the requested offset in the decompressed
+ * stream.
+ *
+ * When possible an index of independently decompressible blocks is
+ * used (see @ref squash_file_pread), making seeking cheap.  Otherwise
+ * seeking forward requires decompressing and discarding the data in
+ * between, and seeking backwards requires starting again from the
+ * beginning of the file, which is only possible if the underlying
+ * *FILE* is seekable.  Seeking to the current position, or forwards,
+ * never scans the file for native frames; only seeking backwards or
+ * relative to the end does.
+ *
+ * Seeking to a position past the end of the data is not an error;
+ * subsequent reads will simply return @ref SQUASH_END_OF_STREAM.
+ *
+ * @param file the file to seek
+ * @param offset offset, relative to @a whence
+ * @param whence one of *SEEK_SET*, *SEEK_CUR*, or *SEEK_END*
+ * @return the result of the operation
+ * @retval SQUASH_OK the position was updated
+ * @retval SQUASH_INVALID_OPERATION the file is open for writing, or
+ *   can not be rewound
+ * @retval SQUASH_BAD_PARAM the resulting position would be negative
+ */
+SquashStatus
+squash_file_seek (SquashFile* file, int64_t offset, int whence) {
+  SquashStatus res = SQUASH_OK;
+  bool discarded = false;
+  uint64_t position = 0;
+
+  assert (file != NULL);
+
+  squash_file_lock (file);
+
+  if (file->write_behind != NULL ||
+      (file->stream != NULL && file->stream->stream_type == SQUASH_STREAM_COMPRESS)) {
+    res = squash_error (SQUASH_INVALID_OPERATION);
+    goto cleanup;
+  }
+
+  if (SQUASH_UNLIKELY(file->last_status < 0)) {
+    res = file->last_status;
+    goto cleanup;
+  }
+
+  /* Check what we can before throwing away anything which was read
+     ahead, so a seek which fails leaves the file alone. */
+  switch (whence) {
+    case SEEK_SET:
+    case SEEK_CUR:
+      {
+        const uint64_t current = (file->read_ahead != NULL) ? file->read_ahead->position : file->position;
+        if (SQUASH_UNLIKELY(!squash_file_seek_target ((whence == SEEK_CUR) ? current : 0, offset, &position))) {
+          res = squash_error (SQUASH_BAD_PARAM);
+          goto cleanup;
+        }
+      }
+      break;
+    case SEEK_END:
+      break;
+    default:
+      res = squash_error (SQUASH_BAD_PARAM);
+      goto cleanup;
+  }
+
+  squash_file_read_ahead_discard (file);
+  discarded = true;
+
+  squash_file_index_init (file, false);
+
+  if (whence == SEEK_END) {
+    uint64_t base;
+
+    /* Finding the end means decompressing everything anyway; with an
+       index only frames which don't record their size are. */
+    squash_file_index_init (file, true);
+    if (file->index_type == SQUASH_FILE_INDEX_NONE) {
+      res = squash_file_skip (file, UINT64_MAX);
+      if (res < 0)
+        goto cleanup;
+      base = file->position;
+    } else {
+      const int64_t saved = squash_ftello (file->fp);
+      res = squash_file_index_extend (file, UINT64_MAX);
+      if (SQUASH_UNLIKELY(saved < 0 || squash_fseeko (file->fp, saved, SEEK_SET) != 0) && res == SQUASH_OK)
+        res = squash_error (SQUASH_IO);
+      if (res < 0)
+        goto cleanup;
+      base = file->uncompressed_size;
+    }
+
+    if (SQUASH_UNLIKELY(!squash_file_seek_target (base, offset, &position))) {
+      res = squash_error (SQUASH_BAD_PARAM);
+      goto cleanup;
+    }
+  }
+
+  /* Going forwards the stream can just skip ahead, so native frames
+     are only worth finding to avoid starting over. */
+  if (file->index_type == SQUASH_FILE_INDEX_PROBED && position < file->position)
+    squash_file_index_init (file, true);
+
+  if (file->index_type == SQUASH_FILE_INDEX_SEEKABLE || file->index_type == SQUASH_FILE_INDEX_FRAMES) {
+    if (!file->indexed) {
+      squash_object_unref (file->stream);
+      file->stream = NULL;
+      file->indexed = true;
+    }
+    file->position = position;
+  } else {
+    if (position < file->position) {
+      if (SQUASH_UNLIKELY(file->start < 0)) {
+        res = squash_error (SQUASH_INVALID_OPERATION);
+        goto cleanup;
+      }
+
+#if !defined(_WIN32)
+      squash_mapped_window_destroy (&(file->map), false);
+      file->map_failed = false;
+#endif
+      if (SQUASH_UNLIKELY(squash_fseeko (file->fp, file->start, SEEK_SET) != 0)) {
+        res = squash_error (SQUASH_IO);
+        goto cleanup;
+      }
+
+      squash_object_unref (file->stream);
+      file->stream = NULL;
+      file->last_status = SQUASH_OK;
+      file->position = 0;
+    }
+
+    res = squash_file_skip (file, position);
+  }
+
+ cleanup:
+
+  if (discarded && file->read_ahead != NULL)
+    file->read_ahead->position = file->position;
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Decompress ahead of reads on a background thread
+ *
+ * Once enabled, a background thread reads and decompresses data into
+ * a ring of @a buffers buffers (each the size of the file's own
+ * buffer, see @ref squash_file_set_buffer) while the caller is busy
+ * with the data it has already received, so I/O and decompression
+ * overlap with whatever the consumer is doing.  The thread is started
+ * by the first read.
+ *
+ * Read-ahead must be enabled before anything is read from or written
+ * to @a file, and a file with read-ahead enabled can not be written
+ * to.  @ref squash_file_seek discards any data which has been read
+ * ahead; @ref squash_file_pread keeps it.
+ *
+ * @param file the file to read from
+ * @param buffers number of buffers to decompress ahead, or 0 to do
+ *   all work in the calling thread (the default)
+ * @return the result of the operation
+ * @retval SQUASH_OK read-ahead was configured
+ * @retval SQUASH_STATE the file has already been used
+ */
+SquashStatus
+squash_file_set_read_ahead (SquashFile* file, size_t buffers) {
+  SquashStatus res = SQUASH_OK;
+
+  assert (file != NULL);
+
+  squash_file_lock (file);
+
+  if (file->stream != NULL || file->read_ahead != NULL || file->write_behind != NULL || file->position != 0) {
+    res = squash_error (SQUASH_STATE);
+    goto cleanup;
+  }
+
+  if (buffers == 0)
+    goto cleanup;
+
+  file->read_ahead = squash_file_queue_new (buffers, file->buf_size);
+  if (SQUASH_UNLIKELY(file->read_ahead == NULL))
+    res = squash_error (SQUASH_MEMORY);
+
+ cleanup:
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Compress and write on a background thread
+ *
+ * Once enabled, @ref squash_file_write only copies the data into a
+ * ring of @a buffers buffers (each the size of the file's own buffer,
+ * see @ref squash_file_set_buffer), and a background thread
+ * compresses it and writes it to the underlying *FILE*.  Writes only
+ * block if the ring is full.
+ *
+ * @ref squash_file_flush, @ref squash_file_close and @ref
+ * squash_file_free wait until everything written so far has been
+ * processed.  If compressing or writing fails, the error is returned
+ * by the next call to write, flush or close.
+ *
+ * Write-behind must be enabled before anything is read from or
+ * written to @a file, and a file with write-behind enabled can not be
+ * read from.
+ *
+ * @param file the file to write to
+ * @param buffers number of buffers to queue, or 0 to do all work in
+ *   the calling thread (the default)
+ * @return the result of the operation
+ * @retval SQUASH_OK write-behind was configured
+ * @retval SQUASH_STATE the file has already been used
+ */
+SquashStatus
+squash_file_set_write_behind (SquashFile* file, size_t buffers) {
+  SquashStatus res = SQUASH_OK;
+
+  assert (file != NULL);
+
+  squash_file_lock (file);
+
+  if (file->stream != NULL || file->read_ahead != NULL || file->write_behind != NULL || file->position != 0) {
+    res = squash_error (SQUASH_STATE);
+    goto cleanup;
+  }
+
+  if (buffers == 0)
+    goto cleanup;
+
+  file->write_behind = squash_file_queue_new (buffers, file->buf_size);
+  if (SQUASH_UNLIKELY(file->write_behind == NULL))
+    res = squash_error (SQUASH_MEMORY);
+
+ cleanup:
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Configure the buffer used for compressed data
+ *
+ * By default each file uses a 1 MiB buffer, which isn't allocated
+ * until the first read or write and is returned to a process-wide
+ * pool when the file is freed.  Applications which open many small
+ * files may want a smaller buffer, and ones which hand the buffer to
+ * I/O requiring a particular alignment (such as files opened with
+ * *O_DIRECT*) can request one here.  The size is rounded up to a
+ * multiple of the alignment.
+ *
+ * This also determines the size of the read-ahead and write-behind
+ * buffers, so it must be called before @ref
+ * squash_file_set_read_ahead or @ref squash_file_set_write_behind,
+ * and before anything is read from or written to @a file.
+ *
+ * @param file the file to configure
+ * @param size size of the buffer, in bytes, or 0 for the default
+ * @param alignment alignment of the buffer, in bytes, or 0 for no
+ *   particular alignment; must be a power of two which is at least
+ *   `sizeof(void*)`
+ * @return the result of the operation
+ * @retval SQUASH_OK the buffer was configured
+ * @retval SQUASH_BAD_PARAM invalid alignment
+ * @retval SQUASH_STATE the file has already been used
+ */
+SquashStatus
+squash_file_set_buffer (SquashFile* file, size_t size, size_t alignment) {
+  SquashStatus res = SQUASH_OK;
+
+  assert (file != NULL);
+
+  if (alignment != 0 && (alignment < sizeof (void*) || (alignment & (alignment - 1)) != 0))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  if (size == 0)
+    size = SQUASH_FILE_BUF_SIZE;
+  if (alignment != 0)
+    size = (size + (alignment - 1)) & ~(alignment - 1);
+
+  squash_file_lock (file);
+
+  if (file->buf != NULL || file->stream != NULL || file->read_ahead != NULL || file->write_behind != NULL || file->position != 0) {
+    res = squash_error (SQUASH_STATE);
+    goto cleanup;
+  }
+
+  file->buf_size = size;
+  file->buf_alignment = alignment;
+
+ cleanup:
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Get the position in the decompressed data
+ *
+ * @param file the file to examine
+ * @return the offset in the decompressed data of the next byte
+ *   @ref squash_file_read will return, or (when writing) the number
+ *   of uncompressed bytes written so far
+ */
+int64_t
+squash_file_tell (SquashFile* file) {
+  assert (file != NULL);
+
+  squash_file_lock (file);
+  const uint64_t position = (file->read_ahead != NULL) ? file->read_ahead->position : file->position;
+  const int64_t res = (position > INT64_MAX) ? INT64_MAX : (int64_t) position;
+  squash_file_unlock (file);
+
+  return res;
+}
+
 /**
  * @brief Determine whether the file has reached the end of file
  *
@@ -784,7 +2400,35 @@ squash_file_flush_unlocked (SquashFile* file) {
  */
 bool
 squash_file_eof (SquashFile* file) {
-  return (file->stream->state == SQUASH_STREAM_STATE_FINISHED) && (feof (file->fp));
+  SquashFileQueue* ra = file->read_ahead;
+
+  if (file->write_behind != NULL)
+    return false;
+
+  if (ra != NULL) {
+    mtx_lock (&(ra->mtx));
+    const bool buffered = (ra->count != 0) || (ra->started && !ra->done);
+    const bool done = ra->done && ra->status == SQUASH_END_OF_STREAM;
+    mtx_unlock (&(ra->mtx));
+
+    if (buffered)
+      return false;
+    else if (done)
+      return true;
+  }
+
+  if (file->indexed)
+    return file->n_sized == file->n_blocks && file->position >= file->uncompressed_size;
+
+  if (file->stream == NULL || file->stream->state != SQUASH_STREAM_STATE_FINISHED)
+    return false;
+
+#if !defined(_WIN32)
+  if (file->map.fp != NULL)
+    return file->map.pos >= file->map.end;
+#endif
+
+  return feof (file->fp);
 }
 
 /**
@@ -867,11 +2511,14 @@ squash_file_free (SquashFile* file, FILE** fp) {
 
   squash_file_lock (file);
 
+  squash_file_read_ahead_free (file);
+  squash_file_write_behind_free (file);
+
   if (file->stream != NULL && file->stream->stream_type == SQUASH_STREAM_COMPRESS)
     res = squash_file_write_internal (file, 0, NULL, SQUASH_OPERATION_FINISH);
 
-#if defined(SQUASH_MMAP_IO)
-  squash_mapped_file_destroy (&(file->map), false);
+#if !defined(_WIN32)
+  squash_mapped_window_destroy (&(file->map), true);
 #endif
 
   if (fp != NULL)
@@ -882,12 +2529,19 @@ squash_file_free (SquashFile* file, FILE** fp) {
   squash_object_unref (file->stream);
   squash_object_unref (file->options);
 
+  squash_free (file->blocks);
+  squash_free (file->block_data);
+  squash_free (file->block_cache);
+  squash_file_buffer_release (file->buf, file->buf_size, file->buf_alignment);
+
   squash_file_unlock (file);
 
   mtx_destroy (&(file->mtx));
 
   squash_free (file);
 
+  squash_file_buffer_pool_leave ();
+
   return res;
 }
 
@@ -86,6 +86,27 @@ SQUASH_API SquashStatus squash_file_vprintf                  (SquashFile* file,
 SQUASH_NONNULL(1)
 SQUASH_API SquashStatus squash_file_flush                    (SquashFile* file);
 SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_file_seek                     (SquashFile* file,
+                                                              int64_t offset,
+                                                              int whence);
+SQUASH_NONNULL(1)
+SQUASH_API int64_t      squash_file_tell                     (SquashFile* file);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_file_set_buffer               (SquashFile* file,
+                                                              size_t size,
+                                                              size_t alignment);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_file_set_read_ahead           (SquashFile* file,
+                                                              size_t buffers);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_file_set_write_behind         (SquashFile* file,
+                                                              size_t buffers);
+SQUASH_NONNULL(1, 3, 4)
+SQUASH_API SquashStatus squash_file_pread                    (SquashFile* file,
+                                                              uint64_t offset,
+                                                              size_t* decompressed_size,
+                                                              uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)]);
+SQUASH_NONNULL(1)
 SQUASH_API SquashStatus squash_file_close                    (SquashFile* file);
 SQUASH_API SquashStatus squash_file_free                     (SquashFile* file,
                                                               FILE** fp);
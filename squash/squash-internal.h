@@ -44,6 +44,34 @@
 #  define SQUASH_FILE_BUF_SIZE ((size_t) (1024 * 1024))
 #endif
 
+#ifndef SQUASH_FILE_BUF_POOL_SIZE
+#  define SQUASH_FILE_BUF_POOL_SIZE 16
+#endif
+
+#ifndef SQUASH_FILE_INDEX_READ_MAX
+#  define SQUASH_FILE_INDEX_READ_MAX ((size_t) (64 * 1024 * 1024))
+#endif
+
+#ifndef SQUASH_MMAP_IO_WINDOW_SIZE
+#  define SQUASH_MMAP_IO_WINDOW_SIZE ((size_t) (64 * 1024 * 1024))
+#endif
+
+#ifndef SQUASH_DECOMPRESS_HINT_MAX_RATIO
+#  define SQUASH_DECOMPRESS_HINT_MAX_RATIO ((size_t) 1024)
+#endif
+
+#ifndef SQUASH_SPLICE_FD_BUF_SIZE
+#  define SQUASH_SPLICE_FD_BUF_SIZE ((size_t) (256 * 1024))
+#endif
+
+#ifndef SQUASH_SPLICE_FD_QUEUE_DEPTH
+#  define SQUASH_SPLICE_FD_QUEUE_DEPTH 4
+#endif
+
+#ifndef SQUASH_SPLICE_FD_RING_POOL_SIZE
+#  define SQUASH_SPLICE_FD_RING_POOL_SIZE 2
+#endif
+
 #include <squash.h>
 
 #include <squash/squash-config.h>
@@ -54,6 +82,7 @@
 #include <squash/squash-context-internal.h>
 #include <squash/squash-plugin-internal.h>
 #include <squash/squash-codec-internal.h>
+#include <squash/squash-options-internal.h>
 #include <squash/squash-slist-internal.h>
 #include <squash/squash-buffer-internal.h>
 #include <squash/squash-buffer-stream-internal.h>
@@ -61,8 +90,11 @@
 #include <squash/squash-mtx-internal.h>
 #include <squash/squash-stream-internal.h>
 #include <squash/squash-util-internal.h>
+#include <squash/squash-parallel-internal.h>
+#include <squash/squash-seekable-internal.h>
 #if !defined(_WIN32)
 #  include <squash/squash-mapped-file-internal.h>
+#  include <squash/squash-uring-internal.h>
 #endif
 
 #if defined(_MSC_VER)
@@ -0,0 +1,390 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+
+/**
+ * @defgroup SquashIOVec Scatter/gather I/O
+ * @brief Compress or decompress data which isn't contiguous in memory
+ *
+ * These functions work like ::squash_codec_compress_with_options and
+ * ::squash_codec_decompress_with_options, except both the input and
+ * the output are described by an array of segments (a @c struct @c
+ * iovec on POSIX systems) instead of a single buffer.
+ *
+ * For codecs with a native streaming API the segments are fed
+ * directly to a @ref SquashStream, so the data is never copied into
+ * a contiguous buffer.  Codecs which only support the buffer API
+ * still require contiguous buffers, so for them any side which has
+ * more than one segment is gathered into (or scattered from) a
+ * temporary buffer.
+ *
+ * @{
+ */
+
+/**
+ * @typedef SquashIOVec
+ * @brief A segment of a scatter/gather array
+ *
+ * On POSIX systems this is simply a @c struct @c iovec, so existing
+ * arrays can be passed directly.  On Windows a compatible structure
+ * with the same member names is provided.
+ */
+
+static size_t
+squash_iovec_count_segments (size_t iovcnt, const SquashIOVec iov[SQUASH_ARRAY_PARAM(iovcnt)], size_t* total, const SquashIOVec** last) {
+  size_t segments = 0;
+
+  *total = 0;
+  *last = NULL;
+
+  for (size_t i = 0 ; i < iovcnt ; i++) {
+    if (iov[i].iov_len != 0) {
+      *total += iov[i].iov_len;
+      *last = &(iov[i]);
+      segments++;
+    }
+  }
+
+  return segments;
+}
+
+static SquashStatus
+squash_iovec_process_stream (SquashCodec* codec,
+                             SquashStreamType stream_type,
+                             size_t* output_size,
+                             size_t output_iovcnt,
+                             const SquashIOVec output[SQUASH_ARRAY_PARAM(output_iovcnt)],
+                             size_t input_iovcnt,
+                             const SquashIOVec input[SQUASH_ARRAY_PARAM(input_iovcnt)],
+                             SquashOptions* options) {
+  SquashStatus res;
+  size_t input_pos = 0;
+  size_t output_pos = 0;
+
+  SquashStream* stream = squash_codec_acquire_stream (codec, stream_type, options);
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_FAILED);
+
+  do {
+    while (stream->avail_in == 0 && input_pos < input_iovcnt) {
+      stream->next_in = input[input_pos].iov_base;
+      stream->avail_in = input[input_pos].iov_len;
+      input_pos++;
+    }
+
+    /* If we run out of segments the stream will detect whether the
+       output actually needed more space. */
+    while (stream->avail_out == 0 && output_pos < output_iovcnt) {
+      stream->next_out = output[output_pos].iov_base;
+      stream->avail_out = output[output_pos].iov_len;
+      output_pos++;
+    }
+
+    if (stream->avail_in != 0) {
+      res = squash_stream_process (stream);
+      if (res == SQUASH_OK)
+        res = SQUASH_PROCESSING;
+    } else {
+      res = squash_stream_finish (stream);
+    }
+  } while (res == SQUASH_PROCESSING);
+
+  if (res == SQUASH_END_OF_STREAM)
+    res = SQUASH_OK;
+
+  if (res == SQUASH_OK)
+    *output_size = stream->total_out;
+
+  squash_codec_release_stream (stream);
+
+  return res;
+}
+
+static SquashStatus
+squash_iovec_process_buffer (SquashCodec* codec,
+                             SquashCodecImpl* impl,
+                             SquashStreamType stream_type,
+                             size_t* output_size,
+                             size_t output_iovcnt,
+                             const SquashIOVec output[SQUASH_ARRAY_PARAM(output_iovcnt)],
+                             size_t input_iovcnt,
+                             const SquashIOVec input[SQUASH_ARRAY_PARAM(input_iovcnt)],
+                             SquashOptions* options) {
+  SquashStatus res;
+  size_t input_size, output_capacity;
+  const SquashIOVec* input_last;
+  const SquashIOVec* output_last;
+  const size_t input_segments = squash_iovec_count_segments (input_iovcnt, input, &input_size, &input_last);
+  const size_t output_segments = squash_iovec_count_segments (output_iovcnt, output, &output_capacity, &output_last);
+  static const uint8_t empty = 0;
+  uint8_t* gathered = NULL;
+  uint8_t* scattered = NULL;
+  const uint8_t* in;
+  uint8_t* out;
+  size_t out_size;
+
+  if (SQUASH_UNLIKELY(output_segments == 0))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  if (input_segments == 0) {
+    in = &empty;
+  } else if (input_segments == 1) {
+    in = input_last->iov_base;
+  } else {
+    gathered = squash_malloc (input_size);
+    if (SQUASH_UNLIKELY(gathered == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+    size_t pos = 0;
+    for (size_t i = 0 ; i < input_iovcnt ; i++) {
+      memcpy (gathered + pos, input[i].iov_base, input[i].iov_len);
+      pos += input[i].iov_len;
+    }
+    in = gathered;
+  }
+
+  if (output_segments == 1) {
+    out = output_last->iov_base;
+    out_size = output_capacity;
+  } else {
+    out_size = output_capacity;
+    if (stream_type == SQUASH_STREAM_COMPRESS) {
+      const size_t max_compressed_size = squash_codec_get_max_compressed_size (codec, input_size);
+      if (max_compressed_size != 0 && max_compressed_size < out_size)
+        out_size = max_compressed_size;
+    }
+
+    out = scattered = squash_malloc (out_size);
+    if (SQUASH_UNLIKELY(scattered == NULL)) {
+      squash_free (gathered);
+      return squash_error (SQUASH_MEMORY);
+    }
+  }
+
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    res = squash_codec_compress_internal (codec, impl, &out_size, out, input_size, in, options);
+  else
+    res = squash_codec_decompress_internal (codec, impl, &out_size, out, input_size, in, options);
+
+  if (res == SQUASH_OK) {
+    *output_size = out_size;
+
+    if (scattered != NULL) {
+      const uint8_t* src = scattered;
+      for (size_t i = 0 ; i < output_iovcnt && out_size != 0 ; i++) {
+        const size_t l = (output[i].iov_len < out_size) ? output[i].iov_len : out_size;
+        memcpy (output[i].iov_base, src, l);
+        src += l;
+        out_size -= l;
+      }
+    }
+  }
+
+  squash_free (scattered);
+  squash_free (gathered);
+
+  return res;
+}
+
+static SquashStatus
+squash_codec_processv (SquashCodec* codec,
+                       SquashStreamType stream_type,
+                       size_t* output_size,
+                       size_t output_iovcnt,
+                       const SquashIOVec output[SQUASH_ARRAY_PARAM(output_iovcnt)],
+                       size_t input_iovcnt,
+                       const SquashIOVec input[SQUASH_ARRAY_PARAM(input_iovcnt)],
+                       SquashOptions* options) {
+  SquashStatus res;
+
+  assert (codec != NULL);
+  assert (output_size != NULL);
+  assert (output != NULL || output_iovcnt == 0);
+  assert (input != NULL || input_iovcnt == 0);
+
+  squash_options_hold (options);
+
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  if (SQUASH_UNLIKELY(impl == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+  } else if ((impl->info & SQUASH_CODEC_INFO_NATIVE_STREAMING) == SQUASH_CODEC_INFO_NATIVE_STREAMING &&
+             (input_iovcnt > 1 || output_iovcnt > 1)) {
+    res = squash_iovec_process_stream (codec, stream_type, output_size, output_iovcnt, output, input_iovcnt, input, options);
+  } else {
+    res = squash_iovec_process_buffer (codec, impl, stream_type, output_size, output_iovcnt, output, input_iovcnt, input, options);
+  }
+
+  squash_options_release (options);
+
+  return res;
+}
+
+/**
+ * @brief Compress scattered data with an existing @ref SquashOptions
+ *
+ * @param codec The codec to use
+ * @param[out] compressed_size Location to store the total number of
+ *   bytes written to @a compressed
+ * @param compressed_iovcnt Number of segments in @a compressed
+ * @param compressed Segments to write the compressed data to, in
+ *   order
+ * @param uncompressed_iovcnt Number of segments in @a uncompressed
+ * @param uncompressed Segments containing the data to compress
+ * @param options Compression options (or *NULL* to use the defaults)
+ * @return A status code
+ * @retval SQUASH_BUFFER_FULL @a compressed is not large enough to
+ *   hold the compressed data
+ */
+SquashStatus
+squash_codec_compressv_with_options (SquashCodec* codec,
+                                     size_t* compressed_size,
+                                     size_t compressed_iovcnt,
+                                     const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                                     size_t uncompressed_iovcnt,
+                                     const SquashIOVec uncompressed[SQUASH_ARRAY_PARAM(uncompressed_iovcnt)],
+                                     SquashOptions* options) {
+  return squash_codec_processv (codec, SQUASH_STREAM_COMPRESS,
+                                compressed_size, compressed_iovcnt, compressed,
+                                uncompressed_iovcnt, uncompressed,
+                                options);
+}
+
+/**
+ * @brief Compress scattered data
+ *
+ * @param codec The codec to use
+ * @param[out] compressed_size Location to store the total number of
+ *   bytes written to @a compressed
+ * @param compressed_iovcnt Number of segments in @a compressed
+ * @param compressed Segments to write the compressed data to, in
+ *   order
+ * @param uncompressed_iovcnt Number of segments in @a uncompressed
+ * @param uncompressed Segments containing the data to compress
+ * @param ... A variadic list of key/value option pairs, followed by
+ *   *NULL*
+ * @return A status code
+ */
+SquashStatus
+squash_codec_compressv (SquashCodec* codec,
+                        size_t* compressed_size,
+                        size_t compressed_iovcnt,
+                        const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                        size_t uncompressed_iovcnt,
+                        const SquashIOVec uncompressed[SQUASH_ARRAY_PARAM(uncompressed_iovcnt)],
+                        ...) {
+  SquashOptions* options;
+  va_list ap;
+
+  assert (codec != NULL);
+
+  va_start (ap, uncompressed);
+  options = squash_options_newv (codec, ap);
+  va_end (ap);
+
+  return squash_codec_compressv_with_options (codec,
+                                              compressed_size, compressed_iovcnt, compressed,
+                                              uncompressed_iovcnt, uncompressed,
+                                              options);
+}
+
+/**
+ * @brief Decompress scattered data with an existing @ref SquashOptions
+ *
+ * @param codec The codec to use
+ * @param[out] decompressed_size Location to store the total number of
+ *   bytes written to @a decompressed
+ * @param decompressed_iovcnt Number of segments in @a decompressed
+ * @param decompressed Segments to write the decompressed data to, in
+ *   order
+ * @param compressed_iovcnt Number of segments in @a compressed
+ * @param compressed Segments containing the data to decompress
+ * @param options Decompression options (or *NULL* to use the
+ *   defaults)
+ * @return A status code
+ * @retval SQUASH_BUFFER_FULL @a decompressed is not large enough to
+ *   hold the decompressed data
+ */
+SquashStatus
+squash_codec_decompressv_with_options (SquashCodec* codec,
+                                       size_t* decompressed_size,
+                                       size_t decompressed_iovcnt,
+                                       const SquashIOVec decompressed[SQUASH_ARRAY_PARAM(decompressed_iovcnt)],
+                                       size_t compressed_iovcnt,
+                                       const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                                       SquashOptions* options) {
+  return squash_codec_processv (codec, SQUASH_STREAM_DECOMPRESS,
+                                decompressed_size, decompressed_iovcnt, decompressed,
+                                compressed_iovcnt, compressed,
+                                options);
+}
+
+/**
+ * @brief Decompress scattered data
+ *
+ * @param codec The codec to use
+ * @param[out] decompressed_size Location to store the total number of
+ *   bytes written to @a decompressed
+ * @param decompressed_iovcnt Number of segments in @a decompressed
+ * @param decompressed Segments to write the decompressed data to, in
+ *   order
+ * @param compressed_iovcnt Number of segments in @a compressed
+ * @param compressed Segments containing the data to decompress
+ * @param ... A variadic list of key/value option pairs, followed by
+ *   *NULL*
+ * @return A status code
+ */
+SquashStatus
+squash_codec_decompressv (SquashCodec* codec,
+                          size_t* decompressed_size,
+                          size_t decompressed_iovcnt,
+                          const SquashIOVec decompressed[SQUASH_ARRAY_PARAM(decompressed_iovcnt)],
+                          size_t compressed_iovcnt,
+                          const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                          ...) {
+  SquashOptions* options;
+  va_list ap;
+
+  assert (codec != NULL);
+
+  va_start (ap, compressed);
+  options = squash_options_newv (codec, ap);
+  va_end (ap);
+
+  return squash_codec_decompressv_with_options (codec,
+                                                decompressed_size, decompressed_iovcnt, decompressed,
+                                                compressed_iovcnt, compressed,
+                                                options);
+}
+
+/**
+ * @}
+ */
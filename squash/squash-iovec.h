@@ -0,0 +1,88 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+#ifndef SQUASH_IOVEC_H
+#define SQUASH_IOVEC_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(_WIN32)
+#  include <sys/uio.h>
+#endif
+
+SQUASH_BEGIN_DECLS
+
+#if !defined(_WIN32)
+typedef struct iovec SquashIOVec;
+#else
+typedef struct SquashIOVec_ {
+  void* iov_base;
+  size_t iov_len;
+} SquashIOVec;
+#endif
+
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus squash_codec_compressv                (SquashCodec* codec,
+                                                               size_t* compressed_size,
+                                                               size_t compressed_iovcnt,
+                                                               const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                                                               size_t uncompressed_iovcnt,
+                                                               const SquashIOVec uncompressed[SQUASH_ARRAY_PARAM(uncompressed_iovcnt)],
+                                                               ...);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus squash_codec_compressv_with_options   (SquashCodec* codec,
+                                                               size_t* compressed_size,
+                                                               size_t compressed_iovcnt,
+                                                               const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                                                               size_t uncompressed_iovcnt,
+                                                               const SquashIOVec uncompressed[SQUASH_ARRAY_PARAM(uncompressed_iovcnt)],
+                                                               SquashOptions* options);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus squash_codec_decompressv              (SquashCodec* codec,
+                                                               size_t* decompressed_size,
+                                                               size_t decompressed_iovcnt,
+                                                               const SquashIOVec decompressed[SQUASH_ARRAY_PARAM(decompressed_iovcnt)],
+                                                               size_t compressed_iovcnt,
+                                                               const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                                                               ...);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus squash_codec_decompressv_with_options (SquashCodec* codec,
+                                                               size_t* decompressed_size,
+                                                               size_t decompressed_iovcnt,
+                                                               const SquashIOVec decompressed[SQUASH_ARRAY_PARAM(decompressed_iovcnt)],
+                                                               size_t compressed_iovcnt,
+                                                               const SquashIOVec compressed[SQUASH_ARRAY_PARAM(compressed_iovcnt)],
+                                                               SquashOptions* options);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_IOVEC_H */
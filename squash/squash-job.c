@@ -0,0 +1,550 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(HAVE_EVENTFD)
+#  include <sys/eventfd.h>
+#  include <unistd.h>
+#elif !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "tinycthread/source/tinycthread.h"
+
+/**
+ * @defgroup SquashJob Asynchronous jobs
+ * @brief Submit buffer operations to a worker pool without blocking
+ *
+ * A @ref SquashJobQueue owns a pool of worker threads.  Callers
+ * describe a compression or decompression operation with a @ref
+ * SquashJob, hand it to ::squash_job_queue_submit, and later collect
+ * it with ::squash_job_queue_reap once the workers are done.  Each
+ * job is processed exactly as if
+ * ::squash_codec_compress_with_options (or
+ * ::squash_codec_decompress_with_options) had been called on it.
+ *
+ * The queue is bounded: at most @a capacity jobs may be in flight
+ * (submitted but not yet reaped) at a time.  Once the limit is
+ * reached, ::squash_job_queue_submit either blocks or fails with
+ * @ref SQUASH_BUFFER_FULL, so a producer which outpaces the workers
+ * is pushed back instead of queueing unbounded amounts of work.
+ *
+ * Event loops can wait on the descriptor returned by
+ * ::squash_job_queue_get_fd instead of blocking in
+ * ::squash_job_queue_reap; it is readable whenever there are
+ * completed jobs waiting to be reaped.
+ *
+ * Jobs are owned by the caller, and must remain valid (along with
+ * their buffers) until they have been reaped.
+ *
+ * @{
+ */
+
+/**
+ * @struct SquashJob_
+ * @brief A single buffer operation for a @ref SquashJobQueue
+ *
+ * Zero the structure, then fill in the public fields before
+ * submitting it.  A job may be submitted again once it has been
+ * reaped.
+ */
+
+/**
+ * @var SquashJob_::codec
+ * @brief The codec to use
+ */
+
+/**
+ * @var SquashJob_::stream_type
+ * @brief Whether to compress or decompress
+ */
+
+/**
+ * @var SquashJob_::options
+ * @brief Options to use, or *NULL* for the defaults
+ */
+
+/**
+ * @var SquashJob_::input
+ * @brief The data to compress or decompress
+ */
+
+/**
+ * @var SquashJob_::input_size
+ * @brief Size of SquashJob_::input (in bytes)
+ */
+
+/**
+ * @var SquashJob_::output
+ * @brief Buffer to write the result to
+ */
+
+/**
+ * @var SquashJob_::output_size
+ * @brief Size of SquashJob_::output on submission, replaced with the
+ *   number of bytes written once the job is complete
+ */
+
+/**
+ * @var SquashJob_::status
+ * @brief @ref SQUASH_PROCESSING while the job is in flight, then the
+ *   result of the operation
+ */
+
+/**
+ * @var SquashJob_::user_data
+ * @brief Ignored by Squash; use it to find your way back from a
+ *   reaped job
+ */
+
+/**
+ * @struct SquashJobQueue_
+ * @extends SquashObject_
+ * @brief A pool of worker threads processing @ref SquashJob "jobs"
+ */
+
+#define SQUASH_JOB_QUEUE_DEFAULT_CAPACITY ((size_t) 256)
+
+enum {
+  SQUASH_JOB_STATE_IDLE = 0,
+  SQUASH_JOB_STATE_PENDING,
+  SQUASH_JOB_STATE_RUNNING,
+  SQUASH_JOB_STATE_COMPLETE
+};
+
+typedef struct SquashJobRing_ {
+  SquashJob** jobs;
+  size_t head;
+  size_t length;
+} SquashJobRing;
+
+struct SquashJobQueue_ {
+  SquashObject base_object;
+
+  mtx_t mtx;
+  /* Signalled when a job is submitted, or on shutdown */
+  cnd_t pending_cnd;
+  /* Signalled when a job completes */
+  cnd_t complete_cnd;
+  /* Signalled when a job is reaped, making room for another */
+  cnd_t space_cnd;
+
+  size_t capacity;
+  /* Submitted but not yet reaped; never exceeds capacity, so neither
+     ring can overflow. */
+  size_t in_flight;
+  SquashJobRing pending;
+  SquashJobRing complete;
+  bool shutdown;
+
+  thrd_t* workers;
+  unsigned int n_workers;
+
+  /* Readable while complete.length != 0.  With eventfd both are the
+     same descriptor; with a pipe fd[0] is the read end. */
+  int fd[2];
+};
+
+static void
+squash_job_ring_push (SquashJobRing* ring, size_t capacity, SquashJob* job) {
+  assert (ring->length < capacity);
+  ring->jobs[(ring->head + ring->length++) % capacity] = job;
+}
+
+static SquashJob*
+squash_job_ring_pop (SquashJobRing* ring, size_t capacity) {
+  assert (ring->length != 0);
+  SquashJob* job = ring->jobs[ring->head];
+  ring->head = (ring->head + 1) % capacity;
+  ring->length--;
+  return job;
+}
+
+static bool
+squash_job_ring_remove (SquashJobRing* ring, size_t capacity, SquashJob* job) {
+  for (size_t i = 0 ; i < ring->length ; i++) {
+    if (ring->jobs[(ring->head + i) % capacity] == job) {
+      for ( ; i + 1 < ring->length ; i++)
+        ring->jobs[(ring->head + i) % capacity] = ring->jobs[(ring->head + i + 1) % capacity];
+      ring->length--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Both of these must be called with the lock held. */
+
+static void
+squash_job_queue_signal_fd (SquashJobQueue* queue) {
+#if defined(HAVE_EVENTFD)
+  if (queue->fd[1] != -1) {
+    const uint64_t one = 1;
+    SQUASH_POSSIBLY_UNUSED ssize_t r = write (queue->fd[1], &one, sizeof (one));
+  }
+#elif !defined(_WIN32)
+  if (queue->fd[1] != -1) {
+    const uint8_t one = 1;
+    SQUASH_POSSIBLY_UNUSED ssize_t r = write (queue->fd[1], &one, sizeof (one));
+  }
+#else
+  (void) queue;
+#endif
+}
+
+static void
+squash_job_queue_drain_fd (SquashJobQueue* queue) {
+#if defined(HAVE_EVENTFD)
+  if (queue->fd[0] != -1) {
+    uint64_t count;
+    SQUASH_POSSIBLY_UNUSED ssize_t r = read (queue->fd[0], &count, sizeof (count));
+  }
+#elif !defined(_WIN32)
+  if (queue->fd[0] != -1) {
+    uint8_t byte;
+    SQUASH_POSSIBLY_UNUSED ssize_t r = read (queue->fd[0], &byte, sizeof (byte));
+  }
+#else
+  (void) queue;
+#endif
+}
+
+static void
+squash_job_queue_complete (SquashJobQueue* queue, SquashJob* job) {
+  squash_options_release (job->options);
+
+  job->state = SQUASH_JOB_STATE_COMPLETE;
+  squash_job_ring_push (&(queue->complete), queue->capacity, job);
+  if (queue->complete.length == 1)
+    squash_job_queue_signal_fd (queue);
+  cnd_signal (&(queue->complete_cnd));
+}
+
+static void
+squash_job_process (SquashJob* job) {
+  SquashCodecImpl* impl = squash_codec_get_impl (job->codec);
+
+  if (SQUASH_UNLIKELY(impl == NULL)) {
+    job->status = squash_error (SQUASH_UNABLE_TO_LOAD);
+  } else if (job->stream_type == SQUASH_STREAM_COMPRESS) {
+    job->status = squash_codec_compress_internal (job->codec, impl,
+                                                  &(job->output_size), job->output,
+                                                  job->input_size, job->input,
+                                                  job->options);
+  } else {
+    job->status = squash_codec_decompress_internal (job->codec, impl,
+                                                    &(job->output_size), job->output,
+                                                    job->input_size, job->input,
+                                                    job->options);
+  }
+}
+
+static int
+squash_job_queue_worker (void* user_data) {
+  SquashJobQueue* queue = (SquashJobQueue*) user_data;
+
+  mtx_lock (&(queue->mtx));
+  while (true) {
+    while (!queue->shutdown && queue->pending.length == 0)
+      cnd_wait (&(queue->pending_cnd), &(queue->mtx));
+    if (queue->shutdown)
+      break;
+
+    SquashJob* job = squash_job_ring_pop (&(queue->pending), queue->capacity);
+    job->state = SQUASH_JOB_STATE_RUNNING;
+    mtx_unlock (&(queue->mtx));
+
+    squash_job_process (job);
+
+    mtx_lock (&(queue->mtx));
+    squash_job_queue_complete (queue, job);
+  }
+  mtx_unlock (&(queue->mtx));
+
+  return 0;
+}
+
+static void
+squash_job_queue_destroy (void* obj) {
+  SquashJobQueue* queue = (SquashJobQueue*) obj;
+
+  /* Jobs which haven't started are dropped; running jobs are allowed
+     to finish, since their callers' buffers are still valid. */
+  mtx_lock (&(queue->mtx));
+  queue->shutdown = true;
+  while (queue->pending.length != 0)
+    squash_options_release (squash_job_ring_pop (&(queue->pending), queue->capacity)->options);
+  cnd_broadcast (&(queue->pending_cnd));
+  mtx_unlock (&(queue->mtx));
+
+  for (unsigned int i = 0 ; i < queue->n_workers ; i++)
+    thrd_join (queue->workers[i], NULL);
+
+#if !defined(_WIN32)
+  if (queue->fd[0] != -1)
+    close (queue->fd[0]);
+  if (queue->fd[1] != -1 && queue->fd[1] != queue->fd[0])
+    close (queue->fd[1]);
+#endif
+
+  cnd_destroy (&(queue->space_cnd));
+  cnd_destroy (&(queue->complete_cnd));
+  cnd_destroy (&(queue->pending_cnd));
+  mtx_destroy (&(queue->mtx));
+
+  squash_free (queue->workers);
+  squash_free (queue->pending.jobs);
+  squash_free (queue->complete.jobs);
+
+  squash_object_destroy (obj);
+}
+
+/**
+ * @brief Create a new job queue
+ *
+ * @param threads Number of worker threads, or 0 to use one per CPU
+ * @param capacity Maximum number of jobs in flight, or 0 for a
+ *   default of 256
+ * @return A new (floating) job queue, or *NULL* on failure
+ */
+SquashJobQueue*
+squash_job_queue_new (unsigned int threads, size_t capacity) {
+  if (threads == 0)
+    threads = squash_get_cpu_count ();
+  if (capacity == 0)
+    capacity = SQUASH_JOB_QUEUE_DEFAULT_CAPACITY;
+
+  SquashJobQueue* queue = squash_malloc (sizeof (SquashJobQueue));
+  if (SQUASH_UNLIKELY(queue == NULL))
+    return (squash_error (SQUASH_MEMORY), NULL);
+
+  memset (queue, 0, sizeof (SquashJobQueue));
+  squash_object_init (queue, true, squash_job_queue_destroy);
+  queue->capacity = capacity;
+  queue->fd[0] = queue->fd[1] = -1;
+
+  queue->pending.jobs = squash_calloc (capacity, sizeof (SquashJob*));
+  queue->complete.jobs = squash_calloc (capacity, sizeof (SquashJob*));
+  queue->workers = squash_calloc (threads, sizeof (thrd_t));
+  if (SQUASH_UNLIKELY(queue->pending.jobs == NULL || queue->complete.jobs == NULL || queue->workers == NULL))
+    goto error;
+
+  if (SQUASH_UNLIKELY(mtx_init (&(queue->mtx), mtx_plain) != thrd_success))
+    goto error;
+  cnd_init (&(queue->pending_cnd));
+  cnd_init (&(queue->complete_cnd));
+  cnd_init (&(queue->space_cnd));
+
+  /* Carry on with fewer workers if some can't be created */
+  for ( ; queue->n_workers < threads ; queue->n_workers++) {
+    if (SQUASH_UNLIKELY(thrd_create (&(queue->workers[queue->n_workers]), squash_job_queue_worker, queue) != thrd_success))
+      break;
+  }
+  if (SQUASH_UNLIKELY(queue->n_workers == 0)) {
+    squash_job_queue_destroy (queue);
+    squash_free (queue);
+    return (squash_error (SQUASH_FAILED), NULL);
+  }
+
+  return queue;
+
+ error:
+
+  squash_free (queue->workers);
+  squash_free (queue->pending.jobs);
+  squash_free (queue->complete.jobs);
+  squash_free (queue);
+
+  return (squash_error (SQUASH_MEMORY), NULL);
+}
+
+/**
+ * @brief Submit a job to a queue
+ *
+ * On success the job is owned by the queue until it is returned by
+ * ::squash_job_queue_reap; neither the job nor its buffers may be
+ * touched in the meantime.  A reference to SquashJob_::options is
+ * held while the job is in flight.
+ *
+ * @param queue The queue
+ * @param job The job
+ * @param wait Whether to block until there is room in the queue
+ * @return A status code
+ * @retval SQUASH_OK The job was queued
+ * @retval SQUASH_BUFFER_FULL The queue is full and @a wait is false
+ * @retval SQUASH_BAD_PARAM The job is missing its codec or buffers
+ */
+SquashStatus
+squash_job_queue_submit (SquashJobQueue* queue, SquashJob* job, bool wait) {
+  assert (queue != NULL);
+  assert (job != NULL);
+
+  if (SQUASH_UNLIKELY(job->codec == NULL || job->input == NULL || job->output == NULL))
+    return squash_error (SQUASH_BAD_PARAM);
+  if (SQUASH_UNLIKELY(job->stream_type != SQUASH_STREAM_COMPRESS && job->stream_type != SQUASH_STREAM_DECOMPRESS))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  mtx_lock (&(queue->mtx));
+  while (queue->in_flight >= queue->capacity) {
+    if (!wait) {
+      mtx_unlock (&(queue->mtx));
+      return squash_error (SQUASH_BUFFER_FULL);
+    }
+    cnd_wait (&(queue->space_cnd), &(queue->mtx));
+  }
+
+  squash_options_hold (job->options);
+  job->status = SQUASH_PROCESSING;
+  job->state = SQUASH_JOB_STATE_PENDING;
+  squash_job_ring_push (&(queue->pending), queue->capacity, job);
+  queue->in_flight++;
+  cnd_signal (&(queue->pending_cnd));
+  mtx_unlock (&(queue->mtx));
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Retrieve a completed job
+ *
+ * Jobs are returned in the order they complete, which is not
+ * necessarily the order they were submitted in.
+ *
+ * @param queue The queue
+ * @param wait Whether to block until a job completes.  If no jobs
+ *   are in flight this returns *NULL* immediately regardless.
+ * @return A completed job, or *NULL* if none is available
+ */
+SquashJob*
+squash_job_queue_reap (SquashJobQueue* queue, bool wait) {
+  SquashJob* job = NULL;
+
+  assert (queue != NULL);
+
+  mtx_lock (&(queue->mtx));
+  while (wait && queue->complete.length == 0 && queue->in_flight != 0)
+    cnd_wait (&(queue->complete_cnd), &(queue->mtx));
+
+  if (queue->complete.length != 0) {
+    job = squash_job_ring_pop (&(queue->complete), queue->capacity);
+    job->state = SQUASH_JOB_STATE_IDLE;
+    queue->in_flight--;
+    if (queue->complete.length == 0)
+      squash_job_queue_drain_fd (queue);
+    cnd_signal (&(queue->space_cnd));
+  }
+  mtx_unlock (&(queue->mtx));
+
+  return job;
+}
+
+/**
+ * @brief Cancel a job which has not yet started
+ *
+ * The job is moved straight to the completion queue with a status of
+ * @ref SQUASH_CANCELLED; it must still be reaped.  Jobs which a
+ * worker has already picked up cannot be cancelled.
+ *
+ * @param queue The queue the job was submitted to
+ * @param job The job
+ * @return A status code
+ * @retval SQUASH_OK The job was cancelled
+ * @retval SQUASH_STATE The job is running or has already completed
+ */
+SquashStatus
+squash_job_queue_cancel (SquashJobQueue* queue, SquashJob* job) {
+  SquashStatus res = SQUASH_OK;
+
+  assert (queue != NULL);
+  assert (job != NULL);
+
+  mtx_lock (&(queue->mtx));
+  if (job->state == SQUASH_JOB_STATE_PENDING && squash_job_ring_remove (&(queue->pending), queue->capacity, job)) {
+    job->status = SQUASH_CANCELLED;
+    squash_job_queue_complete (queue, job);
+  } else {
+    res = squash_error (SQUASH_STATE);
+  }
+  mtx_unlock (&(queue->mtx));
+
+  return res;
+}
+
+/**
+ * @brief Get a file descriptor signalling completed jobs
+ *
+ * The descriptor polls as readable whenever at least one completed job
+ * is waiting to be reaped.  It is owned by the queue; don't read from
+ * it or close it, just wait for it to become readable and then call
+ * ::squash_job_queue_reap until it returns *NULL*.
+ *
+ * The descriptor is an eventfd where available, and a pipe
+ * elsewhere.  It is created the first time this function is called.
+ *
+ * @param queue The queue
+ * @return The descriptor, or -1 if it could not be created or the
+ *   platform doesn't support it
+ */
+int
+squash_job_queue_get_fd (SquashJobQueue* queue) {
+  int fd;
+
+  assert (queue != NULL);
+
+  mtx_lock (&(queue->mtx));
+  if (queue->fd[0] == -1) {
+#if defined(HAVE_EVENTFD)
+    queue->fd[0] = queue->fd[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    if (pipe (queue->fd) == 0) {
+      for (int i = 0 ; i < 2 ; i++) {
+        fcntl (queue->fd[i], F_SETFL, fcntl (queue->fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl (queue->fd[i], F_SETFD, FD_CLOEXEC);
+      }
+    } else {
+      queue->fd[0] = queue->fd[1] = -1;
+    }
+#endif
+    if (queue->fd[0] != -1 && queue->complete.length != 0)
+      squash_job_queue_signal_fd (queue);
+  }
+  fd = queue->fd[0];
+  mtx_unlock (&(queue->mtx));
+
+  return fd;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,75 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+
+#ifndef SQUASH_JOB_H
+#define SQUASH_JOB_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+SQUASH_BEGIN_DECLS
+
+typedef struct SquashJob_ SquashJob;
+typedef struct SquashJobQueue_ SquashJobQueue;
+
+struct SquashJob_ {
+  SquashCodec* codec;
+  SquashStreamType stream_type;
+  SquashOptions* options;
+
+  const uint8_t* input;
+  size_t input_size;
+
+  uint8_t* output;
+  size_t output_size;
+
+  SquashStatus status;
+  void* user_data;
+
+  /*< private >*/
+  unsigned int state;
+};
+
+SQUASH_API SquashJobQueue* squash_job_queue_new    (unsigned int threads, size_t capacity);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus    squash_job_queue_submit (SquashJobQueue* queue, SquashJob* job, bool wait);
+SQUASH_NONNULL(1)
+SQUASH_API SquashJob*      squash_job_queue_reap   (SquashJobQueue* queue, bool wait);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus    squash_job_queue_cancel (SquashJobQueue* queue, SquashJob* job);
+SQUASH_NONNULL(1)
+SQUASH_API int             squash_job_queue_get_fd (SquashJobQueue* queue);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_JOB_H */
@@ -43,10 +43,41 @@ typedef struct SquashMappedFile_s {
   size_t window_offset;
   FILE* fp;
   bool writable;
+  /* Size of the file before it was first mapped; output is never
+     truncated below this */
+  uint64_t original_size;
 } SquashMappedFile;
 
 static const SquashMappedFile squash_mapped_file_empty = { MAP_FAILED, 0 };
 
+/* Sequential access to a file through a window which slides along it,
+   so we never need to map (or, for output, reserve) the whole thing
+   at once.  Inactive unless fp is non-NULL. */
+typedef struct SquashMappedWindow_s {
+  FILE* fp;
+  int fd;
+  bool writable;
+
+  /* Mappings start at page-aligned (absolute) offsets.  The next
+     window is mapped once we're half way through the current one. */
+  uint8_t* data;
+  uint64_t offset;
+  size_t size;
+  uint8_t* next_data;
+  uint64_t next_offset;
+  size_t next_size;
+
+  /* Position of the next byte to hand out */
+  uint64_t pos;
+  /* Input: size of the file.  Output: how far it has been extended. */
+  uint64_t end;
+  /* Size of the file before we started; output is never truncated
+     below this */
+  uint64_t original_size;
+} SquashMappedWindow;
+
+static const SquashMappedWindow squash_mapped_window_empty = { NULL, -1, false, NULL, 0, 0, NULL, 0, 0, 0, 0, 0 };
+
 SQUASH_NONNULL(1, 2) SQUASH_INTERNAL
 bool squash_mapped_file_init_full (SquashMappedFile* mapped,
                                    FILE* fp,
@@ -62,6 +93,21 @@ SQUASH_NONNULL(1) SQUASH_INTERNAL
 bool squash_mapped_file_destroy   (SquashMappedFile* mapped,
                                    bool success);
 
+SQUASH_NONNULL(1, 2) SQUASH_INTERNAL
+bool squash_mapped_window_init    (SquashMappedWindow* window,
+                                   FILE* fp,
+                                   bool writable);
+SQUASH_NONNULL(1, 2, 3) SQUASH_INTERNAL
+bool squash_mapped_window_acquire (SquashMappedWindow* window,
+                                   uint8_t** data,
+                                   size_t* size);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+void squash_mapped_window_release (SquashMappedWindow* window,
+                                   size_t size);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+bool squash_mapped_window_destroy (SquashMappedWindow* window,
+                                   bool success);
+
 SQUASH_END_DECLS
 
 #endif /* SQUASH_FILE_INTERNAL_H */
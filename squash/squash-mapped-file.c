@@ -26,12 +26,16 @@
 
 #define _FILE_OFFSET_BITS 64
 #define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
 
 #include <assert.h>
 #include "squash-internal.h"
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -42,8 +46,11 @@ squash_mapped_file_init_full (SquashMappedFile* mapped, FILE* fp, size_t size, b
   assert (mapped != NULL);
   assert (fp != NULL);
 
-  if (mapped->data != MAP_FAILED)
-    munmap (mapped->data - mapped->window_offset, mapped->size + mapped->window_offset);
+  const bool remap = (mapped->data != MAP_FAILED);
+  if (remap) {
+    munmap (mapped->data - mapped->window_offset, mapped->map_size);
+    mapped->data = MAP_FAILED;
+  }
 
   int fd = fileno (fp);
   if (fd == -1)
@@ -60,10 +67,29 @@ squash_mapped_file_init_full (SquashMappedFile* mapped, FILE* fp, size_t size, b
   if (offset < 0)
     return false;
 
+  /* Codecs are free to use all of the output buffer as scratch space,
+     so never hand them existing data past the current position. */
+  if (writable && !remap && offset < fp_stat.st_size)
+    return false;
+
+  if (!remap)
+    mapped->original_size = (uint64_t) fp_stat.st_size;
+  mapped->fp = fp;
+  mapped->writable = writable;
+
   if (writable) {
-    ires = ftruncate (fd, offset + (off_t) size);
-    if (ires == -1)
-      return false;
+    /* Allocate the space now, so running out of it is an error here
+       (and the caller falls back on stdio) instead of a SIGBUS when
+       writing to the map. */
+    if (offset + (off_t) size > fp_stat.st_size) {
+#if defined(HAVE_POSIX_FALLOCATE)
+      ires = posix_fallocate (fd, fp_stat.st_size, (offset + (off_t) size) - fp_stat.st_size);
+#else
+      ires = ftruncate (fd, offset + (off_t) size);
+#endif
+      if (ires != 0)
+        return false;
+    }
   } else {
     const size_t remaining = fp_stat.st_size - (size_t) offset;
     if (remaining > 0) {
@@ -102,8 +128,6 @@ squash_mapped_file_init_full (SquashMappedFile* mapped, FILE* fp, size_t size, b
     return false;
 
   mapped->data += mapped->window_offset;
-  mapped->fp = fp;
-  mapped->writable = writable;
 
   return true;
 }
@@ -115,27 +139,282 @@ squash_mapped_file_init (SquashMappedFile* mapped, FILE* fp, size_t size, bool w
 
 bool
 squash_mapped_file_destroy (SquashMappedFile* mapped, bool success) {
+  bool res = true;
+  uint64_t keep;
+
+  if (mapped->fp == NULL)
+    return true;
+
+  keep = mapped->original_size;
+
   if (mapped->data != MAP_FAILED) {
-    munmap (mapped->data - mapped->window_offset, mapped->size + mapped->window_offset);
+    munmap (mapped->data - mapped->window_offset, mapped->map_size);
     mapped->data = MAP_FAILED;
 
     if (success) {
       const int sres = fseeko (mapped->fp, mapped->size, SEEK_CUR);
-      if (SQUASH_LIKELY(sres != -1)) {
-        if (mapped->writable) {
-          const off_t pos = ftello (mapped->fp);
-          if (SQUASH_LIKELY(pos != -1)) {
-            const int tr = ftruncate (fileno (mapped->fp), pos);
-            return SQUASH_LIKELY(tr != -1) ? true : false;
-          } else {
-            return false;
-          }
-        }
+      const off_t pos = (sres != -1) ? ftello (mapped->fp) : -1;
+      if (SQUASH_LIKELY(pos != -1)) {
+        if ((uint64_t) pos > keep)
+          keep = (uint64_t) pos;
       } else {
+        res = false;
+      }
+    }
+  }
+
+  /* Output is truncated to what was written, but only what the
+     mapping itself added is ever trimmed. */
+  if (mapped->writable && ftruncate (fileno (mapped->fp), (off_t) keep) == -1)
+    res = false;
+
+  mapped->fp = NULL;
+
+  return res;
+}
+
+/**
+ * @brief Prepare to access a file through a sliding window
+ *
+ * Nothing is mapped until the first call to @ref
+ * squash_mapped_window_acquire.  This is only used if the
+ * `SQUASH_MMAP_IO` environment variable is set to "yes".
+ *
+ * @param window the window to initialize
+ * @param fp file to read from (or write to), starting at its current
+ *   position
+ * @param writable whether the data will be written instead of read
+ * @return true on success, false if the file can't (or shouldn't) be
+ *   mapped, in which case @a window is unchanged
+ * @private
+ */
+bool
+squash_mapped_window_init (SquashMappedWindow* window, FILE* fp, bool writable) {
+  struct stat fp_stat;
+
+  assert (window != NULL);
+  assert (window->fp == NULL);
+  assert (fp != NULL);
+
+  const char* ev = getenv ("SQUASH_MMAP_IO");
+  if (ev == NULL || strcmp (ev, "yes") != 0)
+    return false;
+
+  const int fd = fileno (fp);
+  if (fd == -1 || fstat (fd, &fp_stat) == -1 || !S_ISREG(fp_stat.st_mode))
+    return false;
+
+  /* Shared writable mappings need the descriptor to be readable too,
+     and can't honour O_APPEND */
+  const int flags = fcntl (fd, F_GETFL);
+  if (flags == -1 || (flags & O_ACCMODE) == O_WRONLY || (writable && ((flags & O_ACCMODE) != O_RDWR || (flags & O_APPEND) != 0)))
+    return false;
+
+  /* Flushing may change the size, too */
+  if (writable && (SQUASH_FFLUSH_UNLOCKED(fp) != 0 || fstat (fd, &fp_stat) == -1))
+    return false;
+
+  /* Codecs may use all of the space they're given as scratch, so
+     existing data past the current position can't be exposed to
+     them; only map output which extends the file. */
+  const off_t pos = ftello (fp);
+  if (pos < 0 || (writable && pos < fp_stat.st_size))
+    return false;
+
+  *window = squash_mapped_window_empty;
+  window->fp = fp;
+  window->fd = fd;
+  window->writable = writable;
+  window->pos = (uint64_t) pos;
+  window->end = (uint64_t) fp_stat.st_size;
+  window->original_size = (uint64_t) fp_stat.st_size;
+  if (window->end < window->pos && writable)
+    window->end = window->pos;
+
+  return true;
+}
+
+static bool
+squash_mapped_window_map (SquashMappedWindow* window, uint64_t offset, uint8_t** data, size_t* size, bool ahead) {
+  size_t length = SQUASH_MMAP_IO_WINDOW_SIZE;
+  int map_flags = MAP_SHARED;
+
+  if (window->writable) {
+    /* No MAP_POPULATE here; it would just fill the page cache with
+       zeros which we then overwrite (or, at the end, truncate away).
+
+       Space is actually allocated for the new part of the window so
+       running out of it is an error here, where the caller can fall
+       back on stdio, instead of a SIGBUS when writing to the map. */
+    if (offset + length > window->end) {
+      const uint64_t old_end = window->end;
+      window->end = offset + length;
+#if defined(HAVE_POSIX_FALLOCATE)
+      if (posix_fallocate (window->fd, (off_t) old_end, (off_t) (window->end - old_end)) != 0)
+        return false;
+#else
+      if (ftruncate (window->fd, (off_t) window->end) == -1)
+        return false;
+#endif
+    }
+  } else {
+    if (offset >= window->end)
+      return false;
+    if (window->end - offset < length)
+      length = (size_t) (window->end - offset);
+
+#if defined(MAP_POPULATE)
+    /* The next window is mapped while the caller is still busy with
+       the current one, so fault it all in now instead of one page at
+       a time later. */
+    if (ahead)
+      map_flags |= MAP_POPULATE;
+#endif
+  }
+
+  void* res = mmap (NULL, length,
+                    window->writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                    map_flags, window->fd, (off_t) offset);
+  if (res == MAP_FAILED)
+    return false;
+
+#if defined(MADV_SEQUENTIAL)
+  madvise (res, length, MADV_SEQUENTIAL);
+#endif
+#if defined(MADV_WILLNEED)
+  /* Asynchronous read-ahead of the whole window */
+  if (!window->writable)
+    madvise (res, length, MADV_WILLNEED);
+#endif
+
+  *data = (uint8_t*) res;
+  *size = length;
+
+  return true;
+}
+
+/**
+ * @brief Get the next part of the file
+ *
+ * The data remains valid until the next call to @ref
+ * squash_mapped_window_acquire or @ref squash_mapped_window_destroy.
+ * Each window is handed out in two halves; when the caller comes
+ * back for the second the next window is mapped, so it is ready by
+ * the time the caller gets to it.
+ *
+ * @param window the window
+ * @param data location to store a pointer to the data
+ * @param size location to store the number of bytes available; for
+ *   input, 0 means the end of the file has been reached
+ * @return true on success, false on failure
+ * @private
+ */
+bool
+squash_mapped_window_acquire (SquashMappedWindow* window, uint8_t** data, size_t* size) {
+  assert (window != NULL);
+  assert (window->fp != NULL);
+  assert (data != NULL);
+  assert (size != NULL);
+
+  if (!window->writable && window->pos >= window->end) {
+    *data = NULL;
+    *size = 0;
+    return true;
+  }
+
+  if (window->data == NULL || window->pos >= window->offset + window->size) {
+    if (window->data != NULL)
+      munmap (window->data, window->size);
+
+    if (window->next_data != NULL && window->pos >= window->next_offset && window->pos < window->next_offset + window->next_size) {
+      window->data = window->next_data;
+      window->offset = window->next_offset;
+      window->size = window->next_size;
+    } else {
+      if (window->next_data != NULL)
+        munmap (window->next_data, window->next_size);
+
+      const uint64_t page_size = (uint64_t) squash_get_page_size ();
+      window->offset = window->pos - (window->pos % page_size);
+      if (!squash_mapped_window_map (window, window->offset, &(window->data), &(window->size), false)) {
+        window->data = NULL;
         return false;
       }
     }
+    window->next_data = NULL;
+  }
+
+  /* Start on the next window once we're half way through this one. */
+  if (window->next_data == NULL &&
+      (window->pos - window->offset) >= (window->size / 2) &&
+      (window->writable || (window->offset + window->size) < window->end)) {
+    window->next_offset = window->offset + window->size;
+    if (!squash_mapped_window_map (window, window->next_offset, &(window->next_data), &(window->next_size), true))
+      window->next_data = NULL;
   }
 
+  const uint64_t half = window->offset + (window->size / 2);
+  const uint64_t limit = (window->pos < half) ? half : (window->offset + window->size);
+
+  *data = window->data + (window->pos - window->offset);
+  *size = (size_t) (limit - window->pos);
+
   return true;
 }
+
+/**
+ * @brief Mark data returned by @ref squash_mapped_window_acquire as used
+ *
+ * @param window the window
+ * @param size number of bytes consumed (or written)
+ * @private
+ */
+void
+squash_mapped_window_release (SquashMappedWindow* window, size_t size) {
+  assert (window != NULL);
+  assert (window->data != NULL);
+  assert (window->pos + size <= window->offset + window->size);
+
+  window->pos += size;
+}
+
+/**
+ * @brief Unmap a window
+ *
+ * Output files are truncated to the data actually written, but never
+ * below the size they had when @a window was initialized.
+ *
+ * @param window the window
+ * @param success whether to move the file's position past the data
+ *   which was consumed (or written)
+ * @return true on success, false on failure
+ * @private
+ */
+bool
+squash_mapped_window_destroy (SquashMappedWindow* window, bool success) {
+  bool res = true;
+
+  assert (window != NULL);
+
+  if (window->fp == NULL)
+    return true;
+
+  if (window->data != NULL)
+    munmap (window->data, window->size);
+  if (window->next_data != NULL)
+    munmap (window->next_data, window->next_size);
+
+  if (window->writable) {
+    /* Only trim what the window itself added */
+    const uint64_t keep = (window->pos > window->original_size) ? window->pos : window->original_size;
+    if (window->end > keep && ftruncate (window->fd, (off_t) keep) == -1)
+      res = false;
+  }
+
+  if (success && fseeko (window->fp, (off_t) window->pos, SEEK_SET) == -1)
+    res = false;
+
+  *window = squash_mapped_window_empty;
+
+  return res;
+}
@@ -37,6 +37,24 @@ SQUASH_BEGIN_DECLS
 SQUASH_INTERNAL
 void squash_get_memory_functions (SquashMemoryFuncs* memfns);
 
+typedef struct SquashMemoryScope_ {
+  SquashMemoryCounter* stream;
+  SquashMemoryCounter* codec;
+} SquashMemoryScope;
+
+SQUASH_INTERNAL SquashMemoryCounter* squash_memory_counter_new       (void);
+SQUASH_INTERNAL SquashMemoryCounter* squash_memory_counter_ref       (SquashMemoryCounter* counter);
+SQUASH_INTERNAL void                 squash_memory_counter_unref     (SquashMemoryCounter* counter);
+SQUASH_INTERNAL SquashStatus         squash_memory_counter_get_usage (SquashMemoryCounter* counter,
+                                                                      SquashMemoryUsage* usage);
+
+SQUASH_INTERNAL SquashMemoryScope    squash_memory_scope_enter       (SquashMemoryCounter* stream,
+                                                                      SquashMemoryCounter* codec);
+SQUASH_INTERNAL void                 squash_memory_scope_leave       (SquashMemoryScope previous);
+SQUASH_INTERNAL SquashMemoryCounter* squash_memory_scope_get_stream  (void);
+
+SQUASH_INTERNAL char*                squash_strdup                   (const char* str);
+
 SQUASH_END_DECLS
 
 #endif /* SQUASH_SLIST_INTERNAL_H */
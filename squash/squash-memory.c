@@ -155,53 +155,369 @@ squash_set_memory_functions (SquashMemoryFuncs memfn) {
   squash_memfns = memfn;
 }
 
+/* Memory accounting.  When enabled, every allocation is prefixed with
+   a header recording its size and the counters it was charged to, so
+   that it can be credited back to the same counters when freed no
+   matter which thread or stream frees it. */
+
+#if defined(__GNUC__) || defined(__clang__) || defined(__INTEL_COMPILER)
+#  define squash_memory_atomic_add(var, val) __sync_fetch_and_add(var, val)
+#  define squash_memory_atomic_sub(var, val) __sync_fetch_and_sub(var, val)
+#  define squash_memory_atomic_cas(var, orig, val) __sync_val_compare_and_swap(var, orig, val)
+#else
+SQUASH_MTX_DEFINE(memory_accounting)
+
+static size_t
+squash_memory_atomic_add (volatile size_t* var, size_t val) {
+  size_t res;
+
+  SQUASH_MTX_LOCK(memory_accounting);
+  res = *var;
+  *var = res + val;
+  SQUASH_MTX_UNLOCK(memory_accounting);
+
+  return res;
+}
+
+static size_t
+squash_memory_atomic_sub (volatile size_t* var, size_t val) {
+  size_t res;
+
+  SQUASH_MTX_LOCK(memory_accounting);
+  res = *var;
+  *var = res - val;
+  SQUASH_MTX_UNLOCK(memory_accounting);
+
+  return res;
+}
+
+static size_t
+squash_memory_atomic_cas (volatile size_t* var, size_t orig, size_t val) {
+  size_t res;
+
+  SQUASH_MTX_LOCK(memory_accounting);
+  res = *var;
+  if (res == orig)
+    *var = val;
+  SQUASH_MTX_UNLOCK(memory_accounting);
+
+  return res;
+}
+#endif
+
+typedef struct SquashMemoryHeader_ {
+  size_t size;
+  /* Distance from the start of the underlying allocation */
+  size_t offset;
+  SquashMemoryCounter* stream;
+  SquashMemoryCounter* codec;
+} SquashMemoryHeader;
+
+#define SQUASH_MEMORY_HEADER_SIZE ((sizeof (SquashMemoryHeader) + 15) & ~((size_t) 15))
+
+static bool squash_memory_accounting = false;
+static SquashMemoryCounter squash_memory_total = { 1, 0, 0, 0 };
+static SQUASH_THREAD_LOCAL SquashMemoryScope squash_memory_scope = { NULL, NULL };
+
+static SquashMemoryHeader*
+squash_memory_get_header (void* ptr) {
+  return (SquashMemoryHeader*) (((uint8_t*) ptr) - SQUASH_MEMORY_HEADER_SIZE);
+}
+
+static void
+squash_memory_counter_resize (SquashMemoryCounter* counter, size_t old_size, size_t new_size) {
+  if (new_size < old_size) {
+    squash_memory_atomic_sub (&(counter->current), old_size - new_size);
+  } else {
+    const size_t current = squash_memory_atomic_add (&(counter->current), new_size - old_size) + (new_size - old_size);
+
+    size_t peak = counter->peak;
+    while (current > peak) {
+      const size_t prev = squash_memory_atomic_cas (&(counter->peak), peak, current);
+      if (prev == peak)
+        break;
+      peak = prev;
+    }
+  }
+}
+
+static void
+squash_memory_counter_charge (SquashMemoryCounter* counter, size_t size) {
+  if (counter == NULL)
+    return;
+
+  squash_memory_atomic_add (&(counter->ref_count), 1);
+  squash_memory_atomic_add (&(counter->allocations), 1);
+  squash_memory_counter_resize (counter, 0, size);
+}
+
+static void
+squash_memory_counter_credit (SquashMemoryCounter* counter, size_t size) {
+  if (counter == NULL)
+    return;
+
+  squash_memory_atomic_sub (&(counter->current), size);
+  squash_memory_counter_unref (counter);
+}
+
+static void*
+squash_memory_record (void* real, size_t offset, size_t size) {
+  if (SQUASH_UNLIKELY(real == NULL))
+    return NULL;
+
+  void* ptr = ((uint8_t*) real) + offset;
+  SquashMemoryHeader* header = squash_memory_get_header (ptr);
+
+  header->size = size;
+  header->offset = offset;
+  header->stream = squash_memory_scope.stream;
+  header->codec = squash_memory_scope.codec;
+
+  squash_memory_counter_charge (&squash_memory_total, size);
+  squash_memory_counter_charge (header->stream, size);
+  squash_memory_counter_charge (header->codec, size);
+
+  return ptr;
+}
+
+static void*
+squash_memory_forget (void* ptr) {
+  SquashMemoryHeader* header = squash_memory_get_header (ptr);
+
+  squash_memory_counter_credit (&squash_memory_total, header->size);
+  squash_memory_counter_credit (header->stream, header->size);
+  squash_memory_counter_credit (header->codec, header->size);
+
+  return ((uint8_t*) ptr) - header->offset;
+}
+
+/**
+ * @brief Create a counter for a stream
+ * @private
+ *
+ * @return A new counter with a single reference, or *NULL* if
+ *   accounting is disabled
+ */
+SquashMemoryCounter*
+squash_memory_counter_new (void) {
+  if (!squash_memory_accounting)
+    return NULL;
+
+  /* Counters are not accounted for themselves */
+  SquashMemoryCounter* counter = squash_memfns.malloc (sizeof (SquashMemoryCounter));
+  if (SQUASH_LIKELY(counter != NULL)) {
+    counter->ref_count = 1;
+    counter->current = 0;
+    counter->peak = 0;
+    counter->allocations = 0;
+  }
+
+  return counter;
+}
+
+/**
+ * @brief Add a reference to a counter
+ * @private
+ *
+ * @param counter The counter, or *NULL*
+ * @return @a counter
+ */
+SquashMemoryCounter*
+squash_memory_counter_ref (SquashMemoryCounter* counter) {
+  if (counter != NULL)
+    squash_memory_atomic_add (&(counter->ref_count), 1);
+
+  return counter;
+}
+
+/**
+ * @brief Release a reference to a counter
+ * @private
+ *
+ * Each live allocation charged to a counter holds a reference, so
+ * the counter outlives its stream if the stream's memory does.
+ *
+ * @param counter The counter, or *NULL*
+ */
+void
+squash_memory_counter_unref (SquashMemoryCounter* counter) {
+  if (counter != NULL && squash_memory_atomic_sub (&(counter->ref_count), 1) == 1)
+    squash_memfns.free (counter);
+}
+
+/**
+ * @brief Copy a counter's values to a @ref SquashMemoryUsage
+ * @private
+ *
+ * @param counter The counter
+ * @param usage Location to store the usage
+ * @return A status code
+ * @retval SQUASH_STATE Accounting is not enabled
+ */
+SquashStatus
+squash_memory_counter_get_usage (SquashMemoryCounter* counter, SquashMemoryUsage* usage) {
+  assert (usage != NULL);
+
+  if (SQUASH_UNLIKELY(!squash_memory_accounting || counter == NULL))
+    return squash_error (SQUASH_STATE);
+
+  usage->current = counter->current;
+  usage->peak = counter->peak;
+  usage->allocations = counter->allocations;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Charge allocations on this thread to a stream and codec
+ * @private
+ *
+ * @param stream Counter for the stream, or *NULL*
+ * @param codec Counter for the codec, or *NULL*
+ * @return The previous scope, to be passed to
+ *   ::squash_memory_scope_leave
+ */
+SquashMemoryScope
+squash_memory_scope_enter (SquashMemoryCounter* stream, SquashMemoryCounter* codec) {
+  SquashMemoryScope previous = { NULL, NULL };
+
+  if (squash_memory_accounting) {
+    previous = squash_memory_scope;
+    squash_memory_scope.stream = stream;
+    squash_memory_scope.codec = codec;
+  }
+
+  return previous;
+}
+
+/**
+ * @brief Restore the scope replaced by ::squash_memory_scope_enter
+ * @private
+ *
+ * @param previous Value returned by ::squash_memory_scope_enter
+ */
+void
+squash_memory_scope_leave (SquashMemoryScope previous) {
+  if (squash_memory_accounting)
+    squash_memory_scope = previous;
+}
+
+/**
+ * @brief Get the stream counter of the current scope
+ * @private
+ *
+ * @return The counter, or *NULL*
+ */
+SquashMemoryCounter*
+squash_memory_scope_get_stream (void) {
+  return squash_memory_accounting ? squash_memory_scope.stream : NULL;
+}
+
+/**
+ * @struct SquashMemoryUsage_
+ * @brief Memory usage reported by the accounting functions
+ *
+ * @var SquashMemoryUsage_::current
+ * @brief Bytes currently allocated
+ * @var SquashMemoryUsage_::peak
+ * @brief Largest value @a current has reached
+ * @var SquashMemoryUsage_::allocations
+ * @brief Number of allocations made so far
+ */
+
+/**
+ * @brief Enable memory accounting
+ *
+ * Once enabled, Squash keeps track of how much memory is allocated
+ * through it in total (::squash_memory_get_usage), by each codec
+ * (::squash_codec_get_memory_usage) and by each stream
+ * (::squash_stream_get_memory_usage).  This includes memory
+ * allocated by plugins and the libraries they use, as long as it
+ * goes through Squash's memory functions.
+ *
+ * Accounting adds a small header to each allocation and a few atomic
+ * operations to each allocation and deallocation.
+ *
+ * @note Like ::squash_set_memory_functions, this must be called
+ * before *any* other function in Squash.
+ */
+void
+squash_memory_enable_accounting (void) {
+  squash_memory_accounting = true;
+}
+
+/**
+ * @brief Get the total amount of memory allocated through Squash
+ *
+ * @param[out] usage Location to store the usage
+ * @return A status code
+ * @retval SQUASH_STATE Accounting is not enabled
+ */
+SquashStatus
+squash_memory_get_usage (SquashMemoryUsage* usage) {
+  return squash_memory_counter_get_usage (&squash_memory_total, usage);
+}
+
 void*
 squash_malloc (size_t size) {
-  return squash_memfns.malloc (size);
+  if (SQUASH_LIKELY(!squash_memory_accounting))
+    return squash_memfns.malloc (size);
+
+  if (SQUASH_UNLIKELY(size > SIZE_MAX - SQUASH_MEMORY_HEADER_SIZE))
+    return NULL;
+
+  return squash_memory_record (squash_memfns.malloc (SQUASH_MEMORY_HEADER_SIZE + size), SQUASH_MEMORY_HEADER_SIZE, size);
 }
 
 void*
 squash_calloc (size_t nmemb, size_t size) {
-  return squash_memfns.calloc (nmemb, size);
+  if (SQUASH_LIKELY(!squash_memory_accounting))
+    return squash_memfns.calloc (nmemb, size);
+
+  if (SQUASH_UNLIKELY(size != 0 && nmemb > ((SIZE_MAX - SQUASH_MEMORY_HEADER_SIZE) / size)))
+    return NULL;
+
+  return squash_memory_record (squash_memfns.calloc (1, SQUASH_MEMORY_HEADER_SIZE + (nmemb * size)), SQUASH_MEMORY_HEADER_SIZE, nmemb * size);
 }
 
 void*
 squash_realloc (void* ptr, size_t size) {
-  return squash_memfns.realloc (ptr, size);
+  if (SQUASH_LIKELY(!squash_memory_accounting))
+    return squash_memfns.realloc (ptr, size);
+
+  if (ptr == NULL)
+    return squash_malloc (size);
+
+  if (SQUASH_UNLIKELY(size > SIZE_MAX - SQUASH_MEMORY_HEADER_SIZE))
+    return NULL;
+
+  SquashMemoryHeader header = *squash_memory_get_header (ptr);
+  uint8_t* real = squash_memfns.realloc (((uint8_t*) ptr) - SQUASH_MEMORY_HEADER_SIZE, SQUASH_MEMORY_HEADER_SIZE + size);
+  if (SQUASH_UNLIKELY(real == NULL))
+    return NULL;
+
+  /* The memory stays charged to whoever allocated it */
+  ptr = real + SQUASH_MEMORY_HEADER_SIZE;
+  squash_memory_get_header (ptr)->size = size;
+  squash_memory_counter_resize (&squash_memory_total, header.size, size);
+  if (header.stream != NULL)
+    squash_memory_counter_resize (header.stream, header.size, size);
+  if (header.codec != NULL)
+    squash_memory_counter_resize (header.codec, header.size, size);
+
+  return ptr;
 }
 
 void
 squash_free (void* ptr) {
+  if (SQUASH_UNLIKELY(squash_memory_accounting) && ptr != NULL)
+    ptr = squash_memory_forget (ptr);
+
   squash_memfns.free (ptr);
 }
 
-/**
- * Allocate an aligned buffer
- *
- * Memory allocated with this function is assumed not to support
- * reallocation.  In reality, assuming nobody has installed thick
- * wrappers it should be possible to @ref squash_realloc the buffer,
- * but the result is not constrained to the alignment requirements
- * presented to the initial buffer.
- *
- * The value returned by this function must be freed with @ref
- * squash_aligned_free; While some implementations (such as C11's
- * aligned_alloc and the POSIX posix_memalign function) allow values
- * returned by @ref squash_aligned_alloc to be passed directly to
- * @ref squash_free, others (such as Windows' _aligned_malloc) do not.
- * Passing the result of this function to @ref squash_free is
- * considered undefined behavior.
- *
- * @note Values supported for the @a alignment parameter are
- * implementation defined, but a fair assumption is that they must be
- * a power of two and multiple of `sizeof(void*)`.
- *
- * @param ctx The context
- * @param alignment Alignment of the buffer
- * @param size Number of bytes to allocate
- */
-void*
-squash_aligned_alloc (size_t alignment, size_t size) {
+static void*
+squash_aligned_alloc_raw (size_t alignment, size_t size) {
   if (squash_memfns.aligned_alloc != NULL) {
     return squash_memfns.aligned_alloc (alignment, size);
   } else {
@@ -236,6 +552,75 @@ squash_aligned_alloc (size_t alignment, size_t size) {
   squash_assert_unreachable ();
 }
 
+static void
+squash_aligned_free_raw (void* ptr) {
+  if (squash_memfns.aligned_free != NULL) {
+    squash_memfns.aligned_free (ptr);
+  } else if (ptr != NULL) {
+    void* real;
+    memcpy (&real, (void*) (((uintptr_t) ptr) - sizeof(void*)), sizeof(void*));
+    squash_memfns.free (real);
+  }
+}
+
+/**
+ * @brief Duplicate a string
+ * @private
+ *
+ * Like `strdup`, but the copy is allocated with ::squash_malloc so it
+ * must be released with ::squash_free.
+ *
+ * @param str The string to copy
+ * @return The copy, or *NULL* on failure
+ */
+char*
+squash_strdup (const char* str) {
+  const size_t length = strlen (str);
+  char* res = squash_malloc (length + 1);
+  if (SQUASH_LIKELY(res != NULL))
+    memcpy (res, str, length + 1);
+  return res;
+}
+
+/**
+ * Allocate an aligned buffer
+ *
+ * Memory allocated with this function is assumed not to support
+ * reallocation.  In reality, assuming nobody has installed thick
+ * wrappers it should be possible to @ref squash_realloc the buffer,
+ * but the result is not constrained to the alignment requirements
+ * presented to the initial buffer.
+ *
+ * The value returned by this function must be freed with @ref
+ * squash_aligned_free; While some implementations (such as C11's
+ * aligned_alloc and the POSIX posix_memalign function) allow values
+ * returned by @ref squash_aligned_alloc to be passed directly to
+ * @ref squash_free, others (such as Windows' _aligned_malloc) do not.
+ * Passing the result of this function to @ref squash_free is
+ * considered undefined behavior.
+ *
+ * @note Values supported for the @a alignment parameter are
+ * implementation defined, but a fair assumption is that they must be
+ * a power of two and multiple of `sizeof(void*)`.
+ *
+ * @param ctx The context
+ * @param alignment Alignment of the buffer
+ * @param size Number of bytes to allocate
+ */
+void*
+squash_aligned_alloc (size_t alignment, size_t size) {
+  if (SQUASH_LIKELY(!squash_memory_accounting))
+    return squash_aligned_alloc_raw (alignment, size);
+
+  /* Keep the header immediately before the buffer without breaking
+     its alignment */
+  const size_t offset = ((SQUASH_MEMORY_HEADER_SIZE + alignment - 1) / alignment) * alignment;
+  if (SQUASH_UNLIKELY(size > SIZE_MAX - offset))
+    return NULL;
+
+  return squash_memory_record (squash_aligned_alloc_raw (alignment, offset + size), offset, size);
+}
+
 /**
  * Deallocate an aligned buffer
  *
@@ -243,11 +628,10 @@ squash_aligned_alloc (size_t alignment, size_t size) {
  * @param ptr Buffer to deallocate
  */
 void squash_aligned_free (void* ptr) {
-  if (squash_memfns.aligned_free != NULL) {
-    squash_memfns.aligned_free (ptr);
-  } else if (ptr != NULL) {
-    squash_memfns.free ((void*) (((uintptr_t) ptr) - sizeof(void*)));
-  }
+  if (SQUASH_UNLIKELY(squash_memory_accounting) && ptr != NULL)
+    ptr = squash_memory_forget (ptr);
+
+  squash_aligned_free_raw (ptr);
 }
 
 /**
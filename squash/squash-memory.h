@@ -50,8 +50,18 @@ typedef struct SquashMemoryFuncs_ {
   void  (* aligned_free)          (void* ptr);
 } SquashMemoryFuncs;
 
+struct SquashMemoryUsage_ {
+  size_t current;
+  size_t peak;
+  size_t allocations;
+};
+
 SQUASH_API void  squash_set_memory_functions (SquashMemoryFuncs memfn);
 
+SQUASH_API void         squash_memory_enable_accounting (void);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_memory_get_usage         (SquashMemoryUsage* usage);
+
 SQUASH_MALLOC
 SQUASH_API void* squash_malloc               (size_t size);
 SQUASH_API void* squash_realloc              (void* ptr, size_t size);
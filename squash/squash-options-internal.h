@@ -0,0 +1,63 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include "squash-internal.h" */
+#ifndef SQUASH_OPTIONS_INTERNAL_H
+#define SQUASH_OPTIONS_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+SQUASH_BEGIN_DECLS
+
+SQUASH_INTERNAL
+SquashOptions*          squash_options_snapshot              (SquashOptions* options);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+bool                    squash_options_equal                 (SquashCodec* codec, SquashOptions* a, SquashOptions* b);
+
+#if defined(_MSC_VER)
+#define inline __inline
+#endif
+
+/* Take a reference to options for the duration of a call.  Frozen
+   options are never floating and the caller is responsible for
+   keeping them alive, so the atomics can be skipped. */
+static inline SquashOptions*
+squash_options_hold (SquashOptions* options) {
+  if (options != NULL && !options->frozen)
+    squash_object_ref (options);
+  return options;
+}
+
+static inline void
+squash_options_release (SquashOptions* options) {
+  if (options != NULL && !options->frozen)
+    squash_object_unref (options);
+}
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_OPTIONS_INTERNAL_H */
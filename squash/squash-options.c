@@ -24,7 +24,7 @@
  *   Evan Nemerson <evan@nemerson.com>
  */
 
-/* For strdup */
+/* For strcasecmp */
 #define _POSIX_C_SOURCE 200809L
 
 #include <assert.h>
@@ -50,10 +50,29 @@
  * @brief Codec.
  */
 
+/**
+ * @var SquashOptions_::frozen
+ * @brief Whether the options have been frozen.
+ */
+
+/**
+ * @var SquashOptions_::store_incompressible
+ * @brief Minimum estimated entropy (in bits per byte) at which the
+ *   buffer API stores data instead of compressing it, or 0.
+ */
+
 /**
  * @defgroup SquashOptions SquashOptions
  * @brief A set of compression/decompression options.
  *
+ * Options are parsed and validated when they are set, and stored by
+ * index, so looking one up is cheap.  Creating options is not: avoid
+ * the variadic compress/decompress functions in hot paths, create
+ * the options once instead, and consider freezing them with
+ * ::squash_options_freeze.  Frozen options are immutable, can be
+ * shared by any number of threads, and skip the atomic reference
+ * counting otherwise done on every buffer operation.
+ *
  * @{
  */
 
@@ -140,6 +159,8 @@
  * @brief the value as a boolean
  * @var SquashOptionValue_::size_value
  * @brief the value as a size
+ * @var SquashOptionValue_::dictionary_value
+ * @brief the value as a dictionary
  */
 
 /**
@@ -277,6 +298,28 @@ squash_options_get_size (SquashOptions* options, SquashCodec* codec, const char*
   return squash_options_get_size_at (options, codec, option_n);
 }
 
+/**
+ * Retrieve the value of a dictionary option
+ *
+ * @param options the options to retrieve the value from
+ * @param key name of the option to retrieve the value from
+ * @returns the value, or *NULL* if no dictionary is set
+ */
+SquashDictionary*
+squash_options_get_dictionary (SquashOptions* options, SquashCodec* codec, const char* key) {
+  if (codec == NULL) {
+    if (SQUASH_UNLIKELY(options == NULL))
+      return NULL;
+    codec = options->codec;
+  }
+
+  const ptrdiff_t option_n = squash_options_find (options, codec, key);
+  if (option_n < 0)
+    return NULL;
+
+  return squash_options_get_dictionary_at (options, codec, option_n);
+}
+
 static const SquashOptionValue*
 squash_options_get_value_at (SquashOptions* options, SquashCodec* codec, const SquashOptionInfo** info, SquashOptionType* type, size_t idx) {
   const SquashOptionInfo* ci = squash_codec_get_option_info (codec);
@@ -439,6 +482,39 @@ squash_options_get_size_at (SquashOptions* options, SquashCodec* codec, size_t i
   squash_assert_unreachable ();
 }
 
+/**
+ * Retrieve the value of a dictionary option
+ *
+ * @note It is undefined behavior to specify an index greater than
+ * the number of options.
+ *
+ * @param options the options to retrieve the value from
+ * @param idx the index of the desired option
+ * @returns the value, or *NULL* if no dictionary is set
+ */
+SquashDictionary*
+squash_options_get_dictionary_at (SquashOptions* options, SquashCodec* codec, size_t idx) {
+  if (codec == NULL) {
+    if (SQUASH_UNLIKELY(options == NULL))
+      return NULL;
+    codec = options->codec;
+  }
+
+  SquashOptionType type;
+  const SquashOptionValue* val = squash_options_get_value_at (options, codec, NULL, &type, idx);
+  if (SQUASH_UNLIKELY(val == NULL))
+    return NULL;
+
+  switch ((int) type) {
+    case SQUASH_OPTION_TYPE_DICTIONARY:
+      return val->dictionary_value;
+    default:
+      return NULL;
+  }
+
+  squash_assert_unreachable ();
+}
+
 /**
  * @brief Set the value of a string option
  *
@@ -531,6 +607,33 @@ squash_options_set_size (SquashOptions* options, const char* key, size_t value)
   return squash_options_set_size_at (options, option_n, value);
 }
 
+/**
+ * @brief Set the value of a dictionary option
+ *
+ * A reference to @a value is taken (sinking it if it is floating),
+ * and released when the option is changed or @a options is
+ * destroyed.
+ *
+ * @param options the options on which to set the value
+ * @param key name of the option to set
+ * @param value new value to be set, or *NULL* to unset it
+ * @return A status code.
+ * @retval SQUASH_OK Option set successfully.
+ * @retval SQUASH_BAD_PARAM Invalid @a key
+ * @retval SQUASH_BAD_VALUE Option is not a dictionary
+ */
+SquashStatus
+squash_options_set_dictionary (SquashOptions* options, const char* key, SquashDictionary* value) {
+  assert (options != NULL);
+  assert (key != NULL);
+
+  const ptrdiff_t option_n = squash_options_find (options, options->codec, key);
+  if (option_n < 0)
+    return squash_error (SQUASH_BAD_PARAM);
+
+  return squash_options_set_dictionary_at (options, option_n, value);
+}
+
 /**
  * @brief Set the value of a string option at the given index
  *
@@ -541,12 +644,16 @@ squash_options_set_size (SquashOptions* options, const char* key, size_t value)
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE @a options is frozen
  */
 SquashStatus
 squash_options_set_string_at (SquashOptions* options, size_t idx, const char* value) {
   assert (options != NULL);
   assert (value != NULL);
 
+  if (SQUASH_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -557,7 +664,7 @@ squash_options_set_string_at (SquashOptions* options, size_t idx, const char* va
 
   switch ((int) info->type) {
     case SQUASH_OPTION_TYPE_STRING:
-      val->string_value = strdup (value);
+      val->string_value = squash_strdup (value);
       return SQUASH_OK;
     case SQUASH_OPTION_TYPE_ENUM_STRING:
       for (ptrdiff_t i = 0 ; info->info.enum_string.values[i].name != NULL ; i++) {
@@ -584,11 +691,15 @@ squash_options_set_string_at (SquashOptions* options, size_t idx, const char* va
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE @a options is frozen
  */
 SquashStatus
 squash_options_set_bool_at (SquashOptions* options, size_t idx, bool value) {
   assert (options != NULL);
 
+  if (SQUASH_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -618,11 +729,15 @@ squash_options_set_bool_at (SquashOptions* options, size_t idx, bool value) {
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE @a options is frozen
  */
 SquashStatus
 squash_options_set_int_at (SquashOptions* options, size_t idx, int value) {
   assert (options != NULL);
 
+  if (SQUASH_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -658,11 +773,15 @@ squash_options_set_int_at (SquashOptions* options, size_t idx, int value) {
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE @a options is frozen
  */
 SquashStatus
 squash_options_set_size_at (SquashOptions* options, size_t idx, size_t value) {
   assert (options != NULL);
 
+  if (SQUASH_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -692,6 +811,48 @@ squash_options_set_size_at (SquashOptions* options, size_t idx, size_t value) {
   squash_assert_unreachable ();
 }
 
+/**
+ * @brief Set the value of a dictionary option at the given index
+ *
+ * @param options the options on which to set the value
+ * @param idx the index of the option to change
+ * @param value new value to be set, or *NULL* to unset it
+ * @return A status code.
+ * @retval SQUASH_OK Option set successfully.
+ * @retval SQUASH_BAD_PARAM Invalid @a key
+ * @retval SQUASH_BAD_VALUE Option is not a dictionary
+ * @retval SQUASH_STATE @a options is frozen
+ */
+SquashStatus
+squash_options_set_dictionary_at (SquashOptions* options, size_t idx, SquashDictionary* value) {
+  assert (options != NULL);
+
+  if (SQUASH_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
+  if (info == NULL)
+    return squash_error (SQUASH_BAD_PARAM);
+
+  info += idx;
+  assert (options->values != NULL);
+  SquashOptionValue* val = options->values + idx;
+
+  switch ((int) info->type) {
+    case SQUASH_OPTION_TYPE_DICTIONARY:
+      if (value != NULL)
+        squash_object_ref (value);
+      if (val->dictionary_value != NULL)
+        squash_object_unref (val->dictionary_value);
+      val->dictionary_value = value;
+      return SQUASH_OK;
+    default:
+      return squash_error (SQUASH_BAD_VALUE);
+  }
+
+  squash_assert_unreachable ();
+}
+
 /**
  * @brief Parse a single option.
  *
@@ -805,6 +966,15 @@ squash_options_parse_option (SquashOptions* options, const char* key, const char
       }
       break;
 
+    case SQUASH_OPTION_TYPE_DICTIONARY: {
+        /* The value is the name of a file containing the dictionary. */
+        SquashDictionary* dictionary = squash_dictionary_new_from_file (value);
+        if (SQUASH_UNLIKELY(dictionary == NULL))
+          return squash_error (SQUASH_BAD_VALUE);
+        return squash_options_set_dictionary_at (options, option_n, dictionary);
+      }
+      break;
+
     case SQUASH_OPTION_TYPE_BOOL: {
         bool res;
         if (strcasecmp (value, "true") == 0 ||
@@ -981,6 +1151,109 @@ squash_options_newa (SquashCodec* codec, const char* const* keys, const char* co
   return opts;
 }
 
+/**
+ * @brief Make a group of options immutable.
+ *
+ * Once frozen, any attempt to change an option fails with
+ * @ref SQUASH_STATE, so the options can be shared between threads
+ * without locking.  The buffer API (::squash_codec_compress_with_options
+ * and friends) also stops taking and releasing a reference to frozen
+ * options for each call; the caller must therefore keep its own
+ * reference until every operation using them has returned.
+ *
+ * If @a options is floating, the floating reference is sunk and
+ * becomes the caller's.  Freezing should be done before the options
+ * are shared, and cannot be undone.
+ *
+ * @param options The options to freeze
+ * @return @a options
+ */
+SquashOptions*
+squash_options_freeze (SquashOptions* options) {
+  assert (options != NULL);
+
+  if (options->base_object.is_floating)
+    squash_object_ref (options);
+  options->frozen = true;
+
+  return options;
+}
+
+/**
+ * @brief Check whether a group of options is frozen.
+ *
+ * @param options The options to check
+ * @return *true* if @a options has been frozen, *false* otherwise
+ */
+bool
+squash_options_is_frozen (SquashOptions* options) {
+  return (options != NULL) ? options->frozen : false;
+}
+
+/**
+ * @brief Store incompressible data instead of compressing it
+ *
+ * When set, the buffer functions (::squash_codec_compress_with_options
+ * and everything built on it, including the batch, parallel and iovec
+ * APIs) estimate the entropy of a sample of the input before
+ * compressing it.  If the estimate is at least @a min_entropy bits
+ * per byte, the data is stored as-is instead of being run through
+ * the codec.  Already-compressed data (JPEGs, video, the output of
+ * another codec) usually estimates at over 7.9 bits per byte, while
+ * text is usually well under 6.
+ *
+ * To tell the two apart, the output is wrapped in a separate
+ * container: a single byte saying whether the rest is compressed or
+ * stored, followed by the payload.  This is *not* the codec's native
+ * format, and the header can't be told apart from native data, so
+ * the receiver must know which it is getting.  Decode it with
+ * ::squash_codec_decompress_framed, which works whatever the
+ * receiver's options, or with ::squash_codec_decompress_with_options
+ * and options which also have this set (to any non-zero value).
+ * Stored data is one byte larger than the input; if the compressed
+ * data does not fit in the output buffer the data is stored instead,
+ * so a buffer of ::squash_codec_get_max_compressed_size bytes is
+ * sufficient for almost all codecs.
+ *
+ * The container only exists for the buffer functions.  Streams for
+ * codecs without native streaming support are built on the buffer
+ * functions and use it as well; other streams ignore this setting.
+ * Splicing with options which have it set fails with @ref
+ * SQUASH_BAD_PARAM.
+ *
+ * @param options The options
+ * @param min_entropy Entropy threshold in bits per byte (0 < x <= 8),
+ *   or 0 to disable
+ * @return A status code
+ * @retval SQUASH_STATE The options are frozen
+ * @retval SQUASH_RANGE @a min_entropy is out of range
+ */
+SquashStatus
+squash_options_set_store_incompressible (SquashOptions* options, double min_entropy) {
+  assert (options != NULL);
+
+  if (SQUASH_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
+  if (SQUASH_UNLIKELY(!(min_entropy >= 0.0 && min_entropy <= 8.0)))
+    return squash_error (SQUASH_RANGE);
+
+  options->store_incompressible = min_entropy;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the threshold set by ::squash_options_set_store_incompressible
+ *
+ * @param options The options, or *NULL*
+ * @return The threshold in bits per byte, or 0 if disabled
+ */
+double
+squash_options_get_store_incompressible (SquashOptions* options) {
+  return (options != NULL) ? options->store_incompressible : 0.0;
+}
+
 /**
  * @brief Initialize a new %SquashOptions instance.
  *
@@ -1005,6 +1278,9 @@ squash_options_init (void* options,
 
   squash_object_init (o, true, destroy_notify);
   o->codec = codec;
+  o->values = NULL;
+  o->frozen = false;
+  o->store_incompressible = 0.0;
 
   const SquashOptionInfo* info = squash_codec_get_option_info (codec);
   if (info != NULL) {
@@ -1032,7 +1308,12 @@ squash_options_init (void* options,
           o->values[c_option].size_value = info[c_option].default_value.size_value;
           break;
         case SQUASH_OPTION_TYPE_STRING:
-          o->values[c_option].string_value = strdup (info[c_option].default_value.string_value);
+          o->values[c_option].string_value = squash_strdup (info[c_option].default_value.string_value);
+          break;
+        case SQUASH_OPTION_TYPE_DICTIONARY:
+          o->values[c_option].dictionary_value = info[c_option].default_value.dictionary_value;
+          if (o->values[c_option].dictionary_value != NULL)
+            squash_object_ref (o->values[c_option].dictionary_value);
           break;
         case SQUASH_OPTION_TYPE_NONE:
         default:
@@ -1066,6 +1347,8 @@ squash_options_destroy (void* options) {
     for (int i = 0 ; info[i].name != NULL ; i++)
       if (info[i].type == SQUASH_OPTION_TYPE_STRING)
         squash_free (values[i].string_value);
+      else if (info[i].type == SQUASH_OPTION_TYPE_DICTIONARY && values[i].dictionary_value != NULL)
+        squash_object_unref (values[i].dictionary_value);
 
     squash_free (values);
   }
@@ -1073,6 +1356,104 @@ squash_options_destroy (void* options) {
   squash_object_destroy (o);
 }
 
+/**
+ * @brief Take an immutable copy of a group of options
+ * @private
+ *
+ * Even frozen options are copied, so whatever holds on to the
+ * snapshot (e.g., a pooled stream) doesn't keep the caller's
+ * instance alive.
+ *
+ * @param options The options to copy (or *NULL*)
+ * @return A frozen copy of @a options owned by the caller, or *NULL*
+ *   if @a options is *NULL*
+ */
+SquashOptions*
+squash_options_snapshot (SquashOptions* options) {
+  if (options == NULL)
+    return NULL;
+
+  SquashOptions* copy = squash_options_create (options->codec);
+  copy->store_incompressible = options->store_incompressible;
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
+  for (size_t i = 0 ; info != NULL && info[i].name != NULL ; i++) {
+    if (info[i].type == SQUASH_OPTION_TYPE_STRING) {
+      squash_free (copy->values[i].string_value);
+      copy->values[i].string_value = (options->values[i].string_value != NULL) ? squash_strdup (options->values[i].string_value) : NULL;
+    } else if (info[i].type == SQUASH_OPTION_TYPE_DICTIONARY) {
+      if (copy->values[i].dictionary_value != NULL)
+        squash_object_unref (copy->values[i].dictionary_value);
+      copy->values[i].dictionary_value = options->values[i].dictionary_value;
+      if (copy->values[i].dictionary_value != NULL)
+        squash_object_ref (copy->values[i].dictionary_value);
+    } else {
+      copy->values[i] = options->values[i];
+    }
+  }
+
+  return squash_options_freeze (copy);
+}
+
+/**
+ * @brief Determine whether two sets of options are equivalent
+ * @private
+ *
+ * Options are compared by value, so two distinct instances with the
+ * same settings are considered equal, and *NULL* is equal to an
+ * instance where every option is set to its default.
+ *
+ * @param codec The codec the options belong to
+ * @param a First set of options (or *NULL*)
+ * @param b Second set of options (or *NULL*)
+ * @return true if the options are equivalent, false otherwise
+ */
+bool
+squash_options_equal (SquashCodec* codec, SquashOptions* a, SquashOptions* b) {
+  assert (codec != NULL);
+
+  if (a == b)
+    return true;
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  if (info == NULL)
+    return true;
+
+  for (size_t i = 0 ; info[i].name != NULL ; i++) {
+    SquashOptionType type;
+    const SquashOptionValue* va = squash_options_get_value_at (a, codec, NULL, &type, i);
+    const SquashOptionValue* vb = squash_options_get_value_at (b, codec, NULL, NULL, i);
+
+    switch ((int) type) {
+      case SQUASH_OPTION_TYPE_BOOL:
+        if (va->bool_value != vb->bool_value)
+          return false;
+        break;
+      case SQUASH_OPTION_TYPE_STRING:
+        if (va->string_value != vb->string_value &&
+            (va->string_value == NULL || vb->string_value == NULL ||
+             strcmp (va->string_value, vb->string_value) != 0))
+          return false;
+        break;
+      case SQUASH_OPTION_TYPE_SIZE:
+      case SQUASH_OPTION_TYPE_RANGE_SIZE:
+        if (va->size_value != vb->size_value)
+          return false;
+        break;
+      case SQUASH_OPTION_TYPE_DICTIONARY:
+        if (va->dictionary_value != vb->dictionary_value)
+          return false;
+        break;
+      default:
+        if (va->int_value != vb->int_value)
+          return false;
+        break;
+    }
+  }
+
+  return true;
+}
+
 #if defined(SQUASH_ENABLE_WIDE_CHAR_API)
 /**
  * @brief Parse a single option with wide character strings.
@@ -53,6 +53,9 @@ struct SquashOptions_ {
   SquashCodec* codec;
 
   SquashOptionValue* values;
+
+  bool frozen;
+  double store_incompressible;
 };
 
 typedef enum {
@@ -61,6 +64,7 @@ typedef enum {
   SQUASH_OPTION_TYPE_STRING      = 2,
   SQUASH_OPTION_TYPE_INT         = 3,
   SQUASH_OPTION_TYPE_SIZE        = 4,
+  SQUASH_OPTION_TYPE_DICTIONARY  = 5,
 
   SQUASH_OPTION_TYPE_ENUM_STRING = (16 | SQUASH_OPTION_TYPE_STRING),
   SQUASH_OPTION_TYPE_ENUM_INT    = (16 | SQUASH_OPTION_TYPE_INT),
@@ -102,6 +106,7 @@ union SquashOptionValue_ {
   int int_value;
   bool bool_value;
   size_t size_value;
+  SquashDictionary* dictionary_value;
 };
 
 struct SquashOptionInfo_ {
@@ -128,11 +133,13 @@ SQUASH_API const char*    squash_options_get_string    (SquashOptions* options,
 SQUASH_API bool           squash_options_get_bool      (SquashOptions* options, SquashCodec* codec, const char* key);
 SQUASH_API int            squash_options_get_int       (SquashOptions* options, SquashCodec* codec, const char* key);
 SQUASH_API size_t         squash_options_get_size      (SquashOptions* options, SquashCodec* codec, const char* key);
+SQUASH_API SquashDictionary* squash_options_get_dictionary (SquashOptions* options, SquashCodec* codec, const char* key);
 
 SQUASH_API const char*    squash_options_get_string_at (SquashOptions* options, SquashCodec* codec, size_t index);
 SQUASH_API bool           squash_options_get_bool_at   (SquashOptions* options, SquashCodec* codec, size_t index);
 SQUASH_API int            squash_options_get_int_at    (SquashOptions* options, SquashCodec* codec, size_t index);
 SQUASH_API size_t         squash_options_get_size_at   (SquashOptions* options, SquashCodec* codec, size_t index);
+SQUASH_API SquashDictionary* squash_options_get_dictionary_at (SquashOptions* options, SquashCodec* codec, size_t index);
 
 SQUASH_NONNULL(1, 2, 3)
 SQUASH_API SquashStatus   squash_options_set_string    (SquashOptions* options, const char* key, const char* value);
@@ -142,6 +149,8 @@ SQUASH_NONNULL(1, 2)
 SQUASH_API SquashStatus   squash_options_set_int       (SquashOptions* options, const char* key, int value);
 SQUASH_NONNULL(1, 2)
 SQUASH_API SquashStatus   squash_options_set_size      (SquashOptions* options, const char* key, size_t value);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus   squash_options_set_dictionary (SquashOptions* options, const char* key, SquashDictionary* value);
 
 SQUASH_NONNULL(1, 3)
 SQUASH_API SquashStatus   squash_options_set_string_at (SquashOptions* options, size_t index, const char* value);
@@ -151,6 +160,8 @@ SQUASH_NONNULL(1)
 SQUASH_API SquashStatus   squash_options_set_int_at    (SquashOptions* options, size_t index, int value);
 SQUASH_NONNULL(1)
 SQUASH_API SquashStatus   squash_options_set_size_at   (SquashOptions* options, size_t index, size_t value);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus   squash_options_set_dictionary_at (SquashOptions* options, size_t index, SquashDictionary* value);
 
 SQUASH_SENTINEL
 SQUASH_NONNULL(1)
@@ -163,6 +174,14 @@ SQUASH_API SquashStatus   squash_options_parsea        (SquashOptions* options,
 SQUASH_NONNULL(1, 2, 3)
 SQUASH_API SquashStatus   squash_options_parse_option  (SquashOptions* options, const char* key, const char* value);
 
+SQUASH_NONNULL(1)
+SQUASH_API SquashOptions* squash_options_freeze        (SquashOptions* options);
+SQUASH_API bool           squash_options_is_frozen     (SquashOptions* options);
+
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus   squash_options_set_store_incompressible (SquashOptions* options, double min_entropy);
+SQUASH_API double         squash_options_get_store_incompressible (SquashOptions* options);
+
 SQUASH_NONNULL(1, 2)
 SQUASH_API void           squash_options_init          (void* options, SquashCodec* codec, SquashDestroyNotify destroy_notify);
 SQUASH_NONNULL(1)
@@ -0,0 +1,44 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_PARALLEL_INTERNAL_H
+#define SQUASH_PARALLEL_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+SQUASH_BEGIN_DECLS
+
+typedef SquashStatus (*SquashParallelFunc) (size_t index, void* user_data);
+
+SQUASH_NONNULL(3) SQUASH_INTERNAL
+SquashStatus squash_parallel_for (size_t n_items, unsigned int threads, SquashParallelFunc func, void* user_data);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_PARALLEL_INTERNAL_H */
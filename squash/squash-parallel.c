@@ -0,0 +1,863 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tinycthread/source/tinycthread.h"
+
+/**
+ * @defgroup SquashParallel Parallel compression
+ * @brief Block-parallel compression for any codec
+ *
+ * These functions split the input into independent blocks, compress
+ * (or decompress) each block on a pool of worker threads, and wrap
+ * the result in a small self-describing container.  Since the blocks
+ * are independent, any codec can be used, including those which only
+ * implement the all-in-one buffer API.
+ *
+ * The container is not compatible with the native format of the
+ * codec; data compressed with @ref squash_codec_compress_parallel
+ * must be decompressed with @ref squash_codec_decompress_parallel.
+ *
+ * The layout of the container is:
+ *
+ *  - a four byte magic number (`Sq`, `P`, and a version byte),
+ *  - the total uncompressed size (as a varint),
+ *  - the block size (as a varint),
+ *  - the compressed size of each block (as varints), and
+ *  - the compressed blocks, one after the other.
+ *
+ * Data in a codec's native format can also be decompressed in
+ * parallel with ::squash_codec_decompress_native_parallel, provided
+ * the codec can find independently decodable frames in it (for
+ * example the blocks of an xz or bzip2 stream, or concatenated zstd
+ * or LZ4 frames).
+ *
+ * @{
+ */
+
+static const uint8_t squash_parallel_magic[4] = { 'S', 'q', 'P', 0x01 };
+
+#define SQUASH_PARALLEL_HEADER_MAX_SIZE (sizeof (squash_parallel_magic) + 9 + 9)
+
+typedef struct SquashParallelJob_ {
+  mtx_t mtx;
+  size_t next;
+  size_t n_items;
+  SquashStatus res;
+
+  SquashParallelFunc func;
+  void* user_data;
+} SquashParallelJob;
+
+static int
+squash_parallel_worker (void* user_data) {
+  SquashParallelJob* job = (SquashParallelJob*) user_data;
+
+  while (true) {
+    size_t index;
+    SquashStatus res;
+
+    mtx_lock (&(job->mtx));
+    if (job->next >= job->n_items || job->res != SQUASH_OK) {
+      mtx_unlock (&(job->mtx));
+      break;
+    }
+    index = job->next++;
+    mtx_unlock (&(job->mtx));
+
+    res = job->func (index, job->user_data);
+
+    if (SQUASH_UNLIKELY(res < 0)) {
+      mtx_lock (&(job->mtx));
+      if (job->res == SQUASH_OK)
+        job->res = res;
+      mtx_unlock (&(job->mtx));
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Run a function for each index in [0, n_items) on a set of
+ *   worker threads
+ * @private
+ *
+ * The calling thread participates in the work, so at most @a threads
+ * - 1 additional threads are created.  If thread creation fails we
+ * simply continue with fewer threads.
+ *
+ * @param n_items Number of items
+ * @param threads Maximum number of threads to use, or 0 to use one
+ *   per CPU
+ * @param func Function to call for each item
+ * @param user_data Data to pass to @a func
+ * @return The first error returned by @a func, or @ref SQUASH_OK
+ */
+SquashStatus
+squash_parallel_for (size_t n_items, unsigned int threads, SquashParallelFunc func, void* user_data) {
+  SquashParallelJob job;
+  thrd_t* workers = NULL;
+  unsigned int n_workers = 0;
+
+  assert (func != NULL);
+
+  if (threads == 0)
+    threads = squash_get_cpu_count ();
+  if (threads > n_items)
+    threads = (unsigned int) n_items;
+
+  if (threads <= 1) {
+    for (size_t i = 0 ; i < n_items ; i++) {
+      const SquashStatus res = func (i, user_data);
+      if (SQUASH_UNLIKELY(res < 0))
+        return res;
+    }
+
+    return SQUASH_OK;
+  }
+
+  if (SQUASH_UNLIKELY(mtx_init (&(job.mtx), mtx_plain) != thrd_success))
+    return squash_error (SQUASH_FAILED);
+  job.next = 0;
+  job.n_items = n_items;
+  job.res = SQUASH_OK;
+  job.func = func;
+  job.user_data = user_data;
+
+  workers = squash_calloc (threads - 1, sizeof (thrd_t));
+  if (SQUASH_LIKELY(workers != NULL)) {
+    for ( ; n_workers < threads - 1 ; n_workers++) {
+      if (SQUASH_UNLIKELY(thrd_create (&(workers[n_workers]), squash_parallel_worker, &job) != thrd_success))
+        break;
+    }
+  }
+
+  squash_parallel_worker (&job);
+
+  for (unsigned int i = 0 ; i < n_workers ; i++)
+    thrd_join (workers[i], NULL);
+
+  squash_free (workers);
+  mtx_destroy (&(job.mtx));
+
+  return job.res;
+}
+
+static size_t
+squash_parallel_n_blocks (size_t uncompressed_size, size_t block_size) {
+  return (uncompressed_size / block_size) + (((uncompressed_size % block_size) != 0) ? 1 : 0);
+}
+
+/* Each block is compressed into its own fixed-size slot; this is the
+   offset of the first slot, leaving enough room in front for the
+   largest possible header and block table. */
+static size_t
+squash_parallel_slots_offset (size_t n_blocks) {
+  return SQUASH_PARALLEL_HEADER_MAX_SIZE + (n_blocks * 9);
+}
+
+/**
+ * @brief Get the maximum buffer size necessary to store parallel
+ *   compressed data
+ *
+ * @param codec The codec
+ * @param uncompressed_size Size of the uncompressed data in bytes
+ * @param block_size Block size (in bytes), or 0 to use @ref
+ *   SQUASH_PARALLEL_DEFAULT_BLOCK_SIZE
+ * @return The maximum size required, or *0* on failure
+ */
+size_t
+squash_codec_get_max_compressed_size_parallel (SquashCodec* codec, size_t uncompressed_size, size_t block_size) {
+  size_t n_blocks, slot_size;
+
+  assert (codec != NULL);
+
+  if (block_size == 0)
+    block_size = SQUASH_PARALLEL_DEFAULT_BLOCK_SIZE;
+
+  n_blocks = squash_parallel_n_blocks (uncompressed_size, block_size);
+  if (n_blocks == 0)
+    return squash_parallel_slots_offset (0);
+
+  slot_size = squash_codec_get_max_compressed_size (codec, (uncompressed_size < block_size) ? uncompressed_size : block_size);
+  if (SQUASH_UNLIKELY(slot_size == 0))
+    return 0;
+
+  if (SQUASH_UNLIKELY(((SIZE_MAX - squash_parallel_slots_offset (n_blocks)) / n_blocks) < slot_size))
+    return (squash_error (SQUASH_RANGE), 0);
+
+  return squash_parallel_slots_offset (n_blocks) + (n_blocks * slot_size);
+}
+
+/**
+ * @brief Get the uncompressed size of parallel compressed data
+ *
+ * @param codec The codec
+ * @param compressed_size Size of the compressed data
+ * @param compressed The compressed data
+ * @return The uncompressed size, or *0* if the data is not a valid
+ *   parallel container
+ */
+size_t
+squash_codec_get_uncompressed_size_parallel (SquashCodec* codec,
+                                             size_t compressed_size,
+                                             const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  uint64_t v = 0;
+
+  assert (compressed != NULL);
+
+  if (compressed_size < sizeof (squash_parallel_magic) ||
+      memcmp (compressed, squash_parallel_magic, sizeof (squash_parallel_magic)) != 0)
+    return 0;
+
+  if (squash_read_varuint64 (compressed + sizeof (squash_parallel_magic), compressed_size - sizeof (squash_parallel_magic), &v) == 0)
+    return 0;
+
+#if SIZE_MAX < UINT64_MAX
+  if (SQUASH_UNLIKELY(SIZE_MAX < v))
+    return 0;
+#endif
+
+  return (size_t) v;
+}
+
+typedef struct SquashParallelData_ {
+  SquashCodec* codec;
+  SquashOptions* options;
+
+  size_t block_size;
+  size_t uncompressed_size;
+
+  const uint8_t* input;
+  uint8_t* output;
+
+  size_t slot_size;
+  size_t* block_sizes;
+  size_t* block_offsets;
+} SquashParallelData;
+
+static SquashStatus
+squash_parallel_compress_block (size_t index, void* user_data) {
+  SquashParallelData* data = (SquashParallelData*) user_data;
+  const size_t offset = index * data->block_size;
+  const size_t remaining = data->uncompressed_size - offset;
+  const size_t block_size = (remaining < data->block_size) ? remaining : data->block_size;
+
+  data->block_sizes[index] = data->slot_size;
+  return squash_codec_compress_with_options (data->codec,
+                                             &(data->block_sizes[index]), data->output + (index * data->slot_size),
+                                             block_size, data->input + offset,
+                                             data->options);
+}
+
+/**
+ * @brief Compress a buffer using multiple threads
+ *
+ * The input is split into blocks of @a block_size bytes which are
+ * compressed independently and in parallel.  The output must be
+ * decompressed with @ref squash_codec_decompress_parallel.
+ *
+ * For the best performance @a compressed should be at least @ref
+ * squash_codec_get_max_compressed_size_parallel bytes; otherwise a
+ * temporary buffer of that size will be used.
+ *
+ * @param codec The codec to use
+ * @param[in,out] compressed_size Location storing the size of the
+ *   @a compressed buffer on input, replaced with the actual size of
+ *   the compressed data
+ * @param[out] compressed Location to store the compressed data
+ * @param uncompressed_size Size of the uncompressed data (in bytes)
+ * @param uncompressed The uncompressed data
+ * @param block_size Block size (in bytes), or 0 to use @ref
+ *   SQUASH_PARALLEL_DEFAULT_BLOCK_SIZE
+ * @param threads Maximum number of threads to use, or 0 to use one
+ *   per CPU
+ * @param options Compression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_compress_parallel (SquashCodec* codec,
+                                size_t* compressed_size,
+                                uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                size_t uncompressed_size,
+                                const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                size_t block_size,
+                                unsigned int threads,
+                                SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+  SquashParallelData data = { 0, };
+  size_t n_blocks, max_compressed_size, pos;
+  uint8_t* work = NULL;
+
+  assert (codec != NULL);
+  assert (compressed_size != NULL);
+  assert (compressed != NULL);
+  assert (uncompressed != NULL);
+
+  squash_options_hold (options);
+
+  if (SQUASH_UNLIKELY(squash_codec_get_impl (codec) == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    goto cleanup;
+  }
+
+  if (SQUASH_UNLIKELY(compressed == uncompressed)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  if (block_size == 0)
+    block_size = SQUASH_PARALLEL_DEFAULT_BLOCK_SIZE;
+
+  n_blocks = squash_parallel_n_blocks (uncompressed_size, block_size);
+  max_compressed_size = squash_codec_get_max_compressed_size_parallel (codec, uncompressed_size, block_size);
+  if (SQUASH_UNLIKELY(max_compressed_size == 0)) {
+    res = squash_error (SQUASH_RANGE);
+    goto cleanup;
+  }
+
+  if (*compressed_size >= max_compressed_size) {
+    work = compressed;
+  } else {
+    work = squash_malloc (max_compressed_size);
+    if (SQUASH_UNLIKELY(work == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+  }
+
+  if (n_blocks != 0) {
+    data.block_sizes = squash_calloc (n_blocks, sizeof (size_t));
+    if (SQUASH_UNLIKELY(data.block_sizes == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+
+    data.codec = codec;
+    data.options = options;
+    data.block_size = block_size;
+    data.uncompressed_size = uncompressed_size;
+    data.input = uncompressed;
+    data.output = work + squash_parallel_slots_offset (n_blocks);
+    data.slot_size = (max_compressed_size - squash_parallel_slots_offset (n_blocks)) / n_blocks;
+
+    res = squash_parallel_for (n_blocks, threads, squash_parallel_compress_block, &data);
+    if (SQUASH_UNLIKELY(res != SQUASH_OK))
+      goto cleanup;
+  }
+
+  /* Write the header and block table, then pack the blocks down
+     behind them.  Since the header is never larger than the space
+     reserved for it, and each block is never larger than its slot,
+     every block moves towards the beginning of the buffer, so
+     processing them in order never overwrites unread data. */
+  memcpy (work, squash_parallel_magic, sizeof (squash_parallel_magic));
+  pos = sizeof (squash_parallel_magic);
+  pos += squash_write_varuint64 (work + pos, max_compressed_size - pos, uncompressed_size);
+  pos += squash_write_varuint64 (work + pos, max_compressed_size - pos, block_size);
+  for (size_t i = 0 ; i < n_blocks ; i++)
+    pos += squash_write_varuint64 (work + pos, max_compressed_size - pos, data.block_sizes[i]);
+
+  for (size_t i = 0 ; i < n_blocks ; i++) {
+    memmove (work + pos, data.output + (i * data.slot_size), data.block_sizes[i]);
+    pos += data.block_sizes[i];
+  }
+
+  if (work != compressed) {
+    if (SQUASH_UNLIKELY(pos > *compressed_size)) {
+      res = squash_error (SQUASH_BUFFER_FULL);
+      goto cleanup;
+    }
+
+    memcpy (compressed, work, pos);
+  }
+
+  *compressed_size = pos;
+
+ cleanup:
+
+  if (work != compressed)
+    squash_free (work);
+  squash_free (data.block_sizes);
+  squash_options_release (options);
+
+  return res;
+}
+
+static SquashStatus
+squash_parallel_decompress_block (size_t index, void* user_data) {
+  SquashParallelData* data = (SquashParallelData*) user_data;
+  const size_t offset = index * data->block_size;
+  const size_t remaining = data->uncompressed_size - offset;
+  const size_t block_size = (remaining < data->block_size) ? remaining : data->block_size;
+  size_t decompressed_size = block_size;
+  SquashStatus res;
+
+  res = squash_codec_decompress_with_options (data->codec,
+                                              &decompressed_size, data->output + offset,
+                                              data->block_sizes[index], data->input + data->block_offsets[index],
+                                              data->options);
+  if (SQUASH_LIKELY(res == SQUASH_OK) && SQUASH_UNLIKELY(decompressed_size != block_size))
+    res = squash_error (SQUASH_INVALID_BUFFER);
+
+  return res;
+}
+
+/**
+ * @brief Decompress a buffer created with @ref
+ *   squash_codec_compress_parallel using multiple threads
+ *
+ * @param codec The codec to use
+ * @param[in,out] decompressed_size Location storing the size of the
+ *   @a decompressed buffer on input, replaced with the actual size of
+ *   the decompressed data
+ * @param[out] decompressed Location to store the decompressed data
+ * @param compressed_size Size of the compressed data (in bytes)
+ * @param compressed The compressed data
+ * @param threads Maximum number of threads to use, or 0 to use one
+ *   per CPU
+ * @param options Decompression options
+ * @return A status code
+ * @retval SQUASH_INVALID_BUFFER The compressed data is not a valid
+ *   parallel container
+ * @retval SQUASH_BUFFER_FULL @a decompressed is too small
+ */
+SquashStatus
+squash_codec_decompress_parallel (SquashCodec* codec,
+                                  size_t* decompressed_size,
+                                  uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                  size_t compressed_size,
+                                  const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                  unsigned int threads,
+                                  SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+  SquashParallelData data = { 0, };
+  uint64_t uncompressed_size, block_size;
+  size_t n_blocks, pos, l;
+
+  assert (codec != NULL);
+  assert (decompressed_size != NULL);
+  assert (decompressed != NULL);
+  assert (compressed != NULL);
+
+  squash_options_hold (options);
+
+  if (SQUASH_UNLIKELY(squash_codec_get_impl (codec) == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    goto cleanup;
+  }
+
+  if (SQUASH_UNLIKELY(compressed_size < sizeof (squash_parallel_magic)) ||
+      SQUASH_UNLIKELY(memcmp (compressed, squash_parallel_magic, sizeof (squash_parallel_magic)) != 0)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+  pos = sizeof (squash_parallel_magic);
+
+  if (SQUASH_UNLIKELY((l = squash_read_varuint64 (compressed + pos, compressed_size - pos, &uncompressed_size)) == 0)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+  pos += l;
+
+  if (SQUASH_UNLIKELY((l = squash_read_varuint64 (compressed + pos, compressed_size - pos, &block_size)) == 0) ||
+      SQUASH_UNLIKELY(block_size == 0)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+  pos += l;
+
+#if SIZE_MAX < UINT64_MAX
+  if (SQUASH_UNLIKELY(SIZE_MAX < uncompressed_size) ||
+      SQUASH_UNLIKELY(SIZE_MAX < block_size)) {
+    res = squash_error (SQUASH_RANGE);
+    goto cleanup;
+  }
+#endif
+
+  if (SQUASH_UNLIKELY(*decompressed_size < uncompressed_size)) {
+    res = squash_error (SQUASH_BUFFER_FULL);
+    goto cleanup;
+  }
+
+  n_blocks = squash_parallel_n_blocks ((size_t) uncompressed_size, (size_t) block_size);
+
+  /* Every block needs at least one byte in the block table. */
+  if (SQUASH_UNLIKELY(n_blocks > (compressed_size - pos))) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  if (n_blocks != 0) {
+    data.block_sizes = squash_calloc (n_blocks, sizeof (size_t));
+    data.block_offsets = squash_calloc (n_blocks, sizeof (size_t));
+    if (SQUASH_UNLIKELY(data.block_sizes == NULL || data.block_offsets == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+
+    for (size_t i = 0 ; i < n_blocks ; i++) {
+      uint64_t v;
+
+      if (SQUASH_UNLIKELY((l = squash_read_varuint64 (compressed + pos, compressed_size - pos, &v)) == 0)) {
+        res = squash_error (SQUASH_INVALID_BUFFER);
+        goto cleanup;
+      }
+      pos += l;
+
+      data.block_sizes[i] = (size_t) v;
+    }
+
+    for (size_t i = 0 ; i < n_blocks ; i++) {
+      if (SQUASH_UNLIKELY(data.block_sizes[i] > (compressed_size - pos))) {
+        res = squash_error (SQUASH_INVALID_BUFFER);
+        goto cleanup;
+      }
+
+      data.block_offsets[i] = pos;
+      pos += data.block_sizes[i];
+    }
+
+    data.codec = codec;
+    data.options = options;
+    data.block_size = (size_t) block_size;
+    data.uncompressed_size = (size_t) uncompressed_size;
+    data.input = compressed;
+    data.output = decompressed;
+
+    res = squash_parallel_for (n_blocks, threads, squash_parallel_decompress_block, &data);
+    if (SQUASH_UNLIKELY(res != SQUASH_OK))
+      goto cleanup;
+  }
+
+  *decompressed_size = (size_t) uncompressed_size;
+
+ cleanup:
+
+  squash_free (data.block_sizes);
+  squash_free (data.block_offsets);
+  squash_options_release (options);
+
+  return res;
+}
+
+/* Output buffers for frames whose decompressed size isn't known start
+   at the codec's hint or this many times the compressed size, and
+   double from there. */
+#define SQUASH_PARALLEL_FRAME_EXPANSION 4
+#define SQUASH_PARALLEL_FRAME_MIN_BUFFER ((size_t) (64 * 1024))
+
+typedef struct SquashParallelFrameData_ {
+  SquashCodec* codec;
+  SquashCodecImpl* impl;
+  SquashOptions* options;
+
+  const uint8_t* input;
+  size_t input_size;
+  size_t n_frames;
+  SquashFrame* frames;
+
+  /* If every frame's size is known they are decoded straight into
+     the output at these offsets... */
+  uint8_t* output;
+  size_t* output_offsets;
+  /* ...otherwise each frame gets a buffer of its own.  Together
+     they may not use more than output_size bytes; budget is what's
+     left. */
+  size_t output_size;
+  uint8_t** buffers;
+  size_t* buffer_sizes;
+  mtx_t budget_mtx;
+  size_t budget;
+} SquashParallelFrameData;
+
+static bool
+squash_parallel_frame_reserve (SquashParallelFrameData* data, size_t size) {
+  mtx_lock (&(data->budget_mtx));
+  const bool ok = size <= data->budget;
+  if (ok)
+    data->budget -= size;
+  mtx_unlock (&(data->budget_mtx));
+
+  return ok;
+}
+
+static void
+squash_parallel_frame_unreserve (SquashParallelFrameData* data, size_t size) {
+  mtx_lock (&(data->budget_mtx));
+  data->budget += size;
+  mtx_unlock (&(data->budget_mtx));
+}
+
+static SquashStatus
+squash_parallel_decompress_frame_to (SquashParallelFrameData* data,
+                                     const SquashFrame* frame,
+                                     size_t* decompressed_size,
+                                     uint8_t* decompressed) {
+  if (frame->codec_data == 0) {
+    return squash_codec_decompress_internal (data->codec, data->impl,
+                                             decompressed_size, decompressed,
+                                             frame->size, data->input + frame->offset,
+                                             data->options);
+  } else {
+    SquashMemoryScope scope = squash_memory_scope_enter (NULL, &(data->codec->memory));
+    const SquashStatus res = data->impl->decompress_frame (data->codec, frame,
+                                                           decompressed_size, decompressed,
+                                                           data->input_size, data->input,
+                                                           data->options);
+    squash_memory_scope_leave (scope);
+    return res;
+  }
+}
+
+static SquashStatus
+squash_parallel_decompress_frame (size_t index, void* user_data) {
+  SquashParallelFrameData* data = (SquashParallelFrameData*) user_data;
+  const SquashFrame* frame = &(data->frames[index]);
+  SquashStatus res;
+
+  if (data->buffers == NULL) {
+    size_t decompressed_size = frame->decompressed_size;
+    res = squash_parallel_decompress_frame_to (data, frame, &decompressed_size, data->output + data->output_offsets[index]);
+    if (SQUASH_LIKELY(res == SQUASH_OK) && SQUASH_UNLIKELY(decompressed_size != frame->decompressed_size))
+      res = squash_error (SQUASH_INVALID_BUFFER);
+    return res;
+  }
+
+  size_t allocated = frame->decompressed_size;
+  if (allocated == 0)
+    allocated = frame->decompressed_size_hint;
+  if (allocated == 0) {
+    allocated = (frame->size < (data->output_size / SQUASH_PARALLEL_FRAME_EXPANSION)) ?
+      frame->size * SQUASH_PARALLEL_FRAME_EXPANSION : data->output_size;
+    if (allocated < SQUASH_PARALLEL_FRAME_MIN_BUFFER)
+      allocated = SQUASH_PARALLEL_FRAME_MIN_BUFFER;
+  }
+  if (allocated > data->output_size)
+    allocated = data->output_size;
+
+  while (true) {
+    /* Running out of budget makes the caller fall back on the serial
+       decoder, which needs no extra memory. */
+    if (!squash_parallel_frame_reserve (data, allocated))
+      return squash_error (SQUASH_MEMORY);
+
+    uint8_t* buffer = squash_malloc (allocated == 0 ? 1 : allocated);
+    if (SQUASH_UNLIKELY(buffer == NULL)) {
+      squash_parallel_frame_unreserve (data, allocated);
+      return squash_error (SQUASH_MEMORY);
+    }
+
+    size_t decompressed_size = allocated;
+    res = squash_parallel_decompress_frame_to (data, frame, &decompressed_size, buffer);
+    if (res == SQUASH_OK) {
+      /* Give the slack back so other frames can use it. */
+      if (decompressed_size != 0 && decompressed_size < allocated) {
+        uint8_t* shrunk = squash_realloc (buffer, decompressed_size);
+        if (shrunk != NULL) {
+          buffer = shrunk;
+          squash_parallel_frame_unreserve (data, allocated - decompressed_size);
+        }
+      }
+      data->buffers[index] = buffer;
+      data->buffer_sizes[index] = decompressed_size;
+      return res;
+    }
+
+    squash_free (buffer);
+    squash_parallel_frame_unreserve (data, allocated);
+    if (res != SQUASH_BUFFER_FULL || allocated == data->output_size)
+      return res;
+
+    allocated = (allocated < (data->output_size / 2)) ? allocated * 2 : data->output_size;
+  }
+}
+
+/**
+ * @brief Decompress data in a codec's native format on several threads
+ *
+ * If the codec can split @a compressed into frames which can be
+ * decoded independently (see SquashCodecImpl_::split_frames), they
+ * are decompressed concurrently.  Otherwise, or if parallel decoding
+ * fails for any reason, this is equivalent to
+ * ::squash_codec_decompress_with_options, so it is always safe to
+ * call; the result is the same either way.
+ *
+ * When the codec records the decompressed size of every frame, each
+ * one is written straight to @a decompressed.  Otherwise frames are
+ * decoded into temporary buffers and copied.  Those buffers are sized
+ * from hints and guesses, but never use more than @a
+ * decompressed_size bytes between them; if that isn't enough the
+ * data is decompressed serially instead.
+ *
+ * @param codec The codec
+ * @param decompressed_size Size of @a decompressed on input, number
+ *   of bytes written on output
+ * @param decompressed Buffer to write the decompressed data to
+ * @param compressed_size Size of @a compressed
+ * @param compressed The compressed data
+ * @param threads Maximum number of threads to use, or 0 to use one
+ *   per CPU
+ * @param options Decompression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_decompress_native_parallel (SquashCodec* codec,
+                                         size_t* decompressed_size,
+                                         uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                         size_t compressed_size,
+                                         const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                         unsigned int threads,
+                                         SquashOptions* options) {
+  SquashStatus res = SQUASH_FAILED;
+  SquashParallelFrameData data = { 0, };
+  bool sizes_known = true;
+  bool budget_mtx_init = false;
+  size_t total = 0;
+
+  assert (codec != NULL);
+  assert (decompressed_size != NULL);
+  assert (decompressed != NULL);
+  assert (compressed != NULL);
+
+  squash_options_hold (options);
+
+  data.impl = squash_codec_get_impl (codec);
+  if (SQUASH_UNLIKELY(data.impl == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    goto cleanup;
+  }
+
+  if (threads == 1 || data.impl->split_frames == NULL ||
+      squash_options_get_store_incompressible (options) != 0.0)
+    goto serial;
+
+  if (data.impl->split_frames (codec, compressed_size, compressed, &(data.n_frames), &(data.frames)) != SQUASH_OK ||
+      data.n_frames < 2)
+    goto serial;
+
+  data.codec = codec;
+  data.options = options;
+  data.input = compressed;
+  data.input_size = compressed_size;
+  data.output = decompressed;
+  data.output_size = *decompressed_size;
+
+  for (size_t i = 0 ; i < data.n_frames ; i++) {
+    const SquashFrame* frame = &(data.frames[i]);
+
+    if (SQUASH_UNLIKELY(frame->offset > compressed_size || frame->size > compressed_size - frame->offset) ||
+        SQUASH_UNLIKELY(frame->codec_data != 0 && data.impl->decompress_frame == NULL))
+      goto serial;
+
+    if (frame->decompressed_size == 0) {
+      sizes_known = false;
+    } else if (total <= *decompressed_size) {
+      total = (frame->decompressed_size <= *decompressed_size - total) ? total + frame->decompressed_size : SIZE_MAX;
+    }
+  }
+
+  if (sizes_known) {
+    if (SQUASH_UNLIKELY(total > *decompressed_size)) {
+      res = squash_error (SQUASH_BUFFER_FULL);
+      goto cleanup;
+    }
+
+    data.output_offsets = squash_calloc (data.n_frames, sizeof (size_t));
+    if (SQUASH_UNLIKELY(data.output_offsets == NULL))
+      goto serial;
+    for (size_t i = 1 ; i < data.n_frames ; i++)
+      data.output_offsets[i] = data.output_offsets[i - 1] + data.frames[i - 1].decompressed_size;
+  } else {
+    data.buffers = squash_calloc (data.n_frames, sizeof (uint8_t*));
+    data.buffer_sizes = squash_calloc (data.n_frames, sizeof (size_t));
+    if (SQUASH_UNLIKELY(data.buffers == NULL || data.buffer_sizes == NULL))
+      goto serial;
+    if (SQUASH_UNLIKELY(mtx_init (&(data.budget_mtx), mtx_plain) != thrd_success))
+      goto serial;
+    budget_mtx_init = true;
+    data.budget = data.output_size;
+  }
+
+  if (squash_parallel_for (data.n_frames, threads, squash_parallel_decompress_frame, &data) != SQUASH_OK)
+    goto serial;
+
+  if (sizes_known) {
+    *decompressed_size = total;
+    res = SQUASH_OK;
+    goto cleanup;
+  }
+
+  total = 0;
+  for (size_t i = 0 ; i < data.n_frames ; i++) {
+    if (SQUASH_UNLIKELY(data.buffer_sizes[i] > *decompressed_size - total)) {
+      res = squash_error (SQUASH_BUFFER_FULL);
+      goto cleanup;
+    }
+    memcpy (decompressed + total, data.buffers[i], data.buffer_sizes[i]);
+    total += data.buffer_sizes[i];
+  }
+  *decompressed_size = total;
+  res = SQUASH_OK;
+  goto cleanup;
+
+ serial:
+
+  /* Corrupt data, a split which turned out to be wrong, running out
+     of memory...  In every case the serial decoder has the final
+     word. */
+  res = squash_codec_decompress_internal (codec, data.impl,
+                                          decompressed_size, decompressed,
+                                          compressed_size, compressed,
+                                          options);
+
+ cleanup:
+
+  if (data.buffers != NULL) {
+    for (size_t i = 0 ; i < data.n_frames ; i++)
+      squash_free (data.buffers[i]);
+  }
+  squash_free (data.buffers);
+  squash_free (data.buffer_sizes);
+  squash_free (data.output_offsets);
+  if (budget_mtx_init)
+    mtx_destroy (&(data.budget_mtx));
+  squash_free (data.frames);
+  squash_options_release (options);
+
+  return res;
+}
+
+/**
+ * @}
+ */
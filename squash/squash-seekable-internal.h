@@ -0,0 +1,72 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_SEEKABLE_INTERNAL_H
+#define SQUASH_SEEKABLE_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+SQUASH_BEGIN_DECLS
+
+#define SQUASH_SEEKABLE_MAGIC_SIZE ((size_t) 4)
+#define SQUASH_SEEKABLE_ENTRY_SIZE ((size_t) 28)
+#define SQUASH_SEEKABLE_FOOTER_SIZE ((size_t) 32)
+
+typedef struct SquashSeekableFooter_ {
+  uint64_t uncompressed_size;
+  uint64_t block_size;
+  uint64_t n_blocks;
+  uint32_t index_crc;
+
+  /* Offset of the index from the start of the container */
+  uint64_t index_offset;
+} SquashSeekableFooter;
+
+typedef struct SquashSeekableEntry_ {
+  uint64_t uncompressed_offset;
+  uint64_t compressed_offset;
+  uint64_t compressed_size;
+  uint32_t crc;
+} SquashSeekableEntry;
+
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+bool squash_seekable_check_magic  (const uint8_t data[SQUASH_SEEKABLE_MAGIC_SIZE]);
+SQUASH_NONNULL(1, 3) SQUASH_INTERNAL
+bool squash_seekable_parse_footer (SquashSeekableFooter* footer,
+                                   uint64_t container_size,
+                                   const uint8_t data[SQUASH_SEEKABLE_FOOTER_SIZE]);
+SQUASH_NONNULL(1, 2, 4) SQUASH_INTERNAL
+bool squash_seekable_parse_entry  (SquashSeekableEntry* entry,
+                                   const SquashSeekableFooter* footer,
+                                   uint64_t index,
+                                   const uint8_t data[SQUASH_SEEKABLE_ENTRY_SIZE]);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_SEEKABLE_INTERNAL_H */
@@ -0,0 +1,592 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @defgroup SquashSeekable Seekable compression
+ * @brief Compressed containers which support random access
+ *
+ * Decompressing byte *N* of a regular compressed stream requires
+ * decompressing every byte before it.  The seekable container splits
+ * the input into fixed-size blocks which are compressed independently
+ * (with any codec), and appends an index describing where each block
+ * lives, so ::squash_codec_decompress_range only has to decode the
+ * blocks which overlap the requested range.
+ *
+ * As with @ref SquashParallel, the codec is not recorded in the
+ * container; the caller must use the same codec for both compression
+ * and decompression.
+ *
+ * All integers are little-endian, and the layout is:
+ *
+ *  - a four byte magic number (`Sq`, `S`, and a version byte),
+ *  - the compressed blocks, one after the other,
+ *  - the index, one 28-byte entry per block containing the offset of
+ *    the block in the uncompressed data (64 bits), the offset of the
+ *    compressed block (64 bits), the size of the compressed block (64
+ *    bits), and the CRC-32C of the compressed block (32 bits), and
+ *  - a 32-byte footer containing the total uncompressed size (64
+ *    bits), the block size (64 bits), the number of blocks (64 bits),
+ *    the CRC-32C of the index (32 bits), and the magic number again.
+ *
+ * Since the index and footer are fixed-size and at the end, a reader
+ * can locate any block by reading the footer and a single index
+ * entry.  Each block's checksum is verified before it is handed to
+ * the codec.
+ *
+ * @{
+ */
+
+static const uint8_t squash_seekable_magic[4] = { 'S', 'q', 'S', 0x01 };
+
+static uint64_t
+squash_seekable_read_le (const uint8_t* p, size_t size) {
+  uint64_t v = 0;
+
+  for (size_t i = size ; i > 0 ; i--)
+    v = (v << 8) | p[i - 1];
+
+  return v;
+}
+
+static void
+squash_seekable_write_le (uint8_t* p, size_t size, uint64_t v) {
+  for (size_t i = 0 ; i < size ; i++, v >>= 8)
+    p[i] = (uint8_t) v;
+}
+
+static uint64_t
+squash_seekable_n_blocks (uint64_t uncompressed_size, uint64_t block_size) {
+  return (uncompressed_size / block_size) + (((uncompressed_size % block_size) != 0) ? 1 : 0);
+}
+
+/**
+ * @brief Check for the seekable container magic number
+ * @private
+ *
+ * @param data The first (or last) four bytes of the container
+ * @return Whether @a data is the magic number
+ */
+bool
+squash_seekable_check_magic (const uint8_t data[SQUASH_SEEKABLE_MAGIC_SIZE]) {
+  return memcmp (data, squash_seekable_magic, sizeof (squash_seekable_magic)) == 0;
+}
+
+/**
+ * @brief Parse and validate the footer of a seekable container
+ * @private
+ *
+ * @param[out] footer Location to store the footer
+ * @param container_size Size of the entire container
+ * @param data The last @ref SQUASH_SEEKABLE_FOOTER_SIZE bytes of the
+ *   container
+ * @return Whether the footer is valid
+ */
+bool
+squash_seekable_parse_footer (SquashSeekableFooter* footer,
+                              uint64_t container_size,
+                              const uint8_t data[SQUASH_SEEKABLE_FOOTER_SIZE]) {
+  const uint64_t min_size = SQUASH_SEEKABLE_MAGIC_SIZE + SQUASH_SEEKABLE_FOOTER_SIZE;
+
+  if (container_size < min_size ||
+      !squash_seekable_check_magic (data + SQUASH_SEEKABLE_FOOTER_SIZE - SQUASH_SEEKABLE_MAGIC_SIZE))
+    return false;
+
+  footer->uncompressed_size = squash_seekable_read_le (data, 8);
+  footer->block_size = squash_seekable_read_le (data + 8, 8);
+  footer->n_blocks = squash_seekable_read_le (data + 16, 8);
+  footer->index_crc = (uint32_t) squash_seekable_read_le (data + 24, 4);
+
+  if (footer->block_size == 0 ||
+      footer->block_size > SQUASH_SEEKABLE_MAX_BLOCK_SIZE ||
+      footer->n_blocks != squash_seekable_n_blocks (footer->uncompressed_size, footer->block_size) ||
+      footer->n_blocks > ((container_size - min_size) / SQUASH_SEEKABLE_ENTRY_SIZE))
+    return false;
+
+  footer->index_offset = container_size - SQUASH_SEEKABLE_FOOTER_SIZE - (footer->n_blocks * SQUASH_SEEKABLE_ENTRY_SIZE);
+
+  return true;
+}
+
+/**
+ * @brief Parse and validate an entry in the index of a seekable
+ *   container
+ * @private
+ *
+ * @param[out] entry Location to store the entry
+ * @param footer The container's footer
+ * @param index Index of the entry
+ * @param data The @ref SQUASH_SEEKABLE_ENTRY_SIZE bytes of the entry
+ * @return Whether the entry is valid
+ */
+bool
+squash_seekable_parse_entry (SquashSeekableEntry* entry,
+                             const SquashSeekableFooter* footer,
+                             uint64_t index,
+                             const uint8_t data[SQUASH_SEEKABLE_ENTRY_SIZE]) {
+  entry->uncompressed_offset = squash_seekable_read_le (data, 8);
+  entry->compressed_offset = squash_seekable_read_le (data + 8, 8);
+  entry->compressed_size = squash_seekable_read_le (data + 16, 8);
+  entry->crc = (uint32_t) squash_seekable_read_le (data + 24, 4);
+
+#if SIZE_MAX < UINT64_MAX
+  if (entry->compressed_size > SIZE_MAX)
+    return false;
+#endif
+
+  return
+    entry->uncompressed_offset == index * footer->block_size &&
+    entry->compressed_offset >= SQUASH_SEEKABLE_MAGIC_SIZE &&
+    entry->compressed_offset <= footer->index_offset &&
+    entry->compressed_size <= footer->index_offset - entry->compressed_offset;
+}
+
+static bool
+squash_seekable_read_footer (SquashSeekableFooter* footer,
+                             size_t compressed_size,
+                             const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  if (compressed_size < SQUASH_SEEKABLE_MAGIC_SIZE + SQUASH_SEEKABLE_FOOTER_SIZE ||
+      !squash_seekable_check_magic (compressed))
+    return false;
+
+  if (!squash_seekable_parse_footer (footer, compressed_size, compressed + compressed_size - SQUASH_SEEKABLE_FOOTER_SIZE))
+    return false;
+
+#if SIZE_MAX < UINT64_MAX
+  if (footer->uncompressed_size > SIZE_MAX)
+    return false;
+#endif
+
+  return true;
+}
+
+static bool
+squash_seekable_read_entry (SquashSeekableEntry* entry,
+                            const SquashSeekableFooter* footer,
+                            size_t index,
+                            const uint8_t* compressed) {
+  return squash_seekable_parse_entry (entry, footer, index,
+                                      compressed + (size_t) footer->index_offset + (index * SQUASH_SEEKABLE_ENTRY_SIZE));
+}
+
+/**
+ * @brief Get the maximum buffer size necessary to store seekable
+ *   compressed data
+ *
+ * @param codec The codec
+ * @param uncompressed_size Size of the uncompressed data in bytes
+ * @param block_size Block size (in bytes), or 0 to use @ref
+ *   SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE; at most @ref
+ *   SQUASH_SEEKABLE_MAX_BLOCK_SIZE
+ * @return The maximum size required, or *0* on failure
+ */
+size_t
+squash_codec_get_max_compressed_size_seekable (SquashCodec* codec, size_t uncompressed_size, size_t block_size) {
+  const size_t overhead = sizeof (squash_seekable_magic) + SQUASH_SEEKABLE_FOOTER_SIZE;
+  size_t n_blocks, slot_size;
+
+  assert (codec != NULL);
+
+  if (block_size == 0)
+    block_size = SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE;
+  else if (SQUASH_UNLIKELY(block_size > SQUASH_SEEKABLE_MAX_BLOCK_SIZE))
+    return (squash_error (SQUASH_BAD_PARAM), 0);
+
+  n_blocks = (size_t) squash_seekable_n_blocks (uncompressed_size, block_size);
+  if (n_blocks == 0)
+    return overhead;
+
+  slot_size = squash_codec_get_max_compressed_size (codec, (uncompressed_size < block_size) ? uncompressed_size : block_size);
+  if (SQUASH_UNLIKELY(slot_size == 0))
+    return 0;
+
+  if (SQUASH_UNLIKELY(((SIZE_MAX - overhead) / n_blocks) < (slot_size + SQUASH_SEEKABLE_ENTRY_SIZE)))
+    return (squash_error (SQUASH_RANGE), 0);
+
+  return overhead + (n_blocks * (slot_size + SQUASH_SEEKABLE_ENTRY_SIZE));
+}
+
+/**
+ * @brief Get the uncompressed size of seekable compressed data
+ *
+ * @param codec The codec
+ * @param compressed_size Size of the compressed data
+ * @param compressed The compressed data
+ * @return The uncompressed size, or *0* if the data is not a valid
+ *   seekable container
+ */
+size_t
+squash_codec_get_uncompressed_size_seekable (SquashCodec* codec,
+                                             size_t compressed_size,
+                                             const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]) {
+  SquashSeekableFooter footer;
+
+  assert (compressed != NULL);
+
+  if (!squash_seekable_read_footer (&footer, compressed_size, compressed))
+    return 0;
+
+  return (size_t) footer.uncompressed_size;
+}
+
+typedef struct SquashSeekableData_ {
+  SquashCodec* codec;
+  SquashOptions* options;
+
+  size_t block_size;
+  size_t uncompressed_size;
+
+  const uint8_t* input;
+  uint8_t* output;
+
+  size_t slot_size;
+  size_t* block_sizes;
+  uint32_t* block_crcs;
+} SquashSeekableData;
+
+static SquashStatus
+squash_seekable_compress_block (size_t index, void* user_data) {
+  SquashSeekableData* data = (SquashSeekableData*) user_data;
+  const size_t offset = index * data->block_size;
+  const size_t remaining = data->uncompressed_size - offset;
+  const size_t block_size = (remaining < data->block_size) ? remaining : data->block_size;
+  uint8_t* slot = data->output + (index * data->slot_size);
+  SquashStatus res;
+
+  data->block_sizes[index] = data->slot_size;
+  res = squash_codec_compress_with_options (data->codec,
+                                            &(data->block_sizes[index]), slot,
+                                            block_size, data->input + offset,
+                                            data->options);
+  if (SQUASH_LIKELY(res == SQUASH_OK))
+    data->block_crcs[index] = squash_crc32c (0, data->block_sizes[index], slot);
+
+  return res;
+}
+
+/**
+ * @brief Compress a buffer into a seekable container
+ *
+ * The input is split into blocks of @a block_size bytes which are
+ * compressed independently (using up to @a threads threads).  Any
+ * range of the output can then be decompressed with
+ * ::squash_codec_decompress_range; smaller blocks make random access
+ * cheaper, larger ones compress better.
+ *
+ * For the best performance @a compressed should be at least @ref
+ * squash_codec_get_max_compressed_size_seekable bytes; otherwise a
+ * temporary buffer of that size will be used.
+ *
+ * @param codec The codec to use
+ * @param[in,out] compressed_size Location storing the size of the
+ *   @a compressed buffer on input, replaced with the actual size of
+ *   the compressed data
+ * @param[out] compressed Location to store the compressed data
+ * @param uncompressed_size Size of the uncompressed data (in bytes)
+ * @param uncompressed The uncompressed data
+ * @param block_size Block size (in bytes), or 0 to use @ref
+ *   SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE; at most @ref
+ *   SQUASH_SEEKABLE_MAX_BLOCK_SIZE, so readers can bound the memory
+ *   needed for a block
+ * @param threads Maximum number of threads to use, or 0 to use one
+ *   per CPU
+ * @param options Compression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_compress_seekable (SquashCodec* codec,
+                                size_t* compressed_size,
+                                uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                size_t uncompressed_size,
+                                const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                size_t block_size,
+                                unsigned int threads,
+                                SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+  SquashSeekableData data = { 0, };
+  size_t n_blocks, max_compressed_size, pos;
+  size_t* block_offsets = NULL;
+  uint8_t* work = NULL;
+
+  assert (codec != NULL);
+  assert (compressed_size != NULL);
+  assert (compressed != NULL);
+  assert (uncompressed != NULL);
+
+  squash_options_hold (options);
+
+  if (SQUASH_UNLIKELY(squash_codec_get_impl (codec) == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    goto cleanup;
+  }
+
+  if (SQUASH_UNLIKELY(compressed == uncompressed)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  if (block_size == 0) {
+    block_size = SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE;
+  } else if (SQUASH_UNLIKELY(block_size > SQUASH_SEEKABLE_MAX_BLOCK_SIZE)) {
+    res = squash_error (SQUASH_BAD_PARAM);
+    goto cleanup;
+  }
+
+  n_blocks = (size_t) squash_seekable_n_blocks (uncompressed_size, block_size);
+  max_compressed_size = squash_codec_get_max_compressed_size_seekable (codec, uncompressed_size, block_size);
+  if (SQUASH_UNLIKELY(max_compressed_size == 0)) {
+    res = squash_error (SQUASH_RANGE);
+    goto cleanup;
+  }
+
+  if (*compressed_size >= max_compressed_size) {
+    work = compressed;
+  } else {
+    work = squash_malloc (max_compressed_size);
+    if (SQUASH_UNLIKELY(work == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+  }
+
+  if (n_blocks != 0) {
+    data.block_sizes = squash_calloc (n_blocks, sizeof (size_t));
+    data.block_crcs = squash_calloc (n_blocks, sizeof (uint32_t));
+    block_offsets = squash_calloc (n_blocks, sizeof (size_t));
+    if (SQUASH_UNLIKELY(data.block_sizes == NULL || data.block_crcs == NULL || block_offsets == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+
+    data.codec = codec;
+    data.options = options;
+    data.block_size = block_size;
+    data.uncompressed_size = uncompressed_size;
+    data.input = uncompressed;
+    data.output = work + sizeof (squash_seekable_magic);
+    data.slot_size = (max_compressed_size - sizeof (squash_seekable_magic) - SQUASH_SEEKABLE_FOOTER_SIZE) / n_blocks - SQUASH_SEEKABLE_ENTRY_SIZE;
+
+    res = squash_parallel_for (n_blocks, threads, squash_seekable_compress_block, &data);
+    if (SQUASH_UNLIKELY(res != SQUASH_OK))
+      goto cleanup;
+  }
+
+  /* Pack the blocks down behind the magic number; each one only ever
+     moves towards the beginning of the buffer.  The index and footer
+     go after the last block, in the space reserved for them. */
+  memcpy (work, squash_seekable_magic, sizeof (squash_seekable_magic));
+  pos = sizeof (squash_seekable_magic);
+  for (size_t i = 0 ; i < n_blocks ; i++) {
+    memmove (work + pos, data.output + (i * data.slot_size), data.block_sizes[i]);
+    block_offsets[i] = pos;
+    pos += data.block_sizes[i];
+  }
+
+  const size_t index_offset = pos;
+  for (size_t i = 0 ; i < n_blocks ; i++) {
+    squash_seekable_write_le (work + pos, 8, (uint64_t) i * block_size);
+    squash_seekable_write_le (work + pos + 8, 8, block_offsets[i]);
+    squash_seekable_write_le (work + pos + 16, 8, data.block_sizes[i]);
+    squash_seekable_write_le (work + pos + 24, 4, data.block_crcs[i]);
+    pos += SQUASH_SEEKABLE_ENTRY_SIZE;
+  }
+
+  squash_seekable_write_le (work + pos, 8, uncompressed_size);
+  squash_seekable_write_le (work + pos + 8, 8, block_size);
+  squash_seekable_write_le (work + pos + 16, 8, n_blocks);
+  squash_seekable_write_le (work + pos + 24, 4, squash_crc32c (0, pos - index_offset, work + index_offset));
+  memcpy (work + pos + 28, squash_seekable_magic, sizeof (squash_seekable_magic));
+  pos += SQUASH_SEEKABLE_FOOTER_SIZE;
+
+  if (work != compressed) {
+    if (SQUASH_UNLIKELY(pos > *compressed_size)) {
+      res = squash_error (SQUASH_BUFFER_FULL);
+      goto cleanup;
+    }
+
+    memcpy (compressed, work, pos);
+  }
+
+  *compressed_size = pos;
+
+ cleanup:
+
+  if (work != compressed)
+    squash_free (work);
+  squash_free (data.block_sizes);
+  squash_free (data.block_crcs);
+  squash_free (block_offsets);
+  squash_options_release (options);
+
+  return res;
+}
+
+static SquashStatus
+squash_seekable_decompress_block (SquashCodec* codec,
+                                  const SquashSeekableFooter* footer,
+                                  size_t index,
+                                  uint8_t* decompressed,
+                                  size_t decompressed_size,
+                                  const uint8_t* compressed,
+                                  SquashOptions* options) {
+  SquashSeekableEntry entry;
+  size_t size = decompressed_size;
+  SquashStatus res;
+
+  if (SQUASH_UNLIKELY(!squash_seekable_read_entry (&entry, footer, index, compressed)))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  const uint8_t* block = compressed + (size_t) entry.compressed_offset;
+  if (SQUASH_UNLIKELY(squash_crc32c (0, (size_t) entry.compressed_size, block) != entry.crc))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  res = squash_codec_decompress_with_options (codec, &size, decompressed, (size_t) entry.compressed_size, block, options);
+  if (SQUASH_LIKELY(res == SQUASH_OK) && SQUASH_UNLIKELY(size != decompressed_size))
+    res = squash_error (SQUASH_INVALID_BUFFER);
+
+  return res;
+}
+
+/**
+ * @brief Decompress part of a seekable container
+ *
+ * Only the blocks which overlap the requested range are decoded, so
+ * the cost of a call depends on the size of the range and the block
+ * size, not on @a offset.  Only the parts of the index which are
+ * needed are read; the index checksum is not verified, but the
+ * checksum of each block is checked before it is decompressed.
+ *
+ * Like `pread`, reading past the end of the data is not an error: at
+ * most the remaining data is decompressed, and @a decompressed_size
+ * is set to zero if @a offset is at or beyond the end.
+ *
+ * @param codec The codec used to create the container
+ * @param offset Offset in the uncompressed data of the first byte to
+ *   decompress
+ * @param[in,out] decompressed_size Number of bytes to decompress on
+ *   input, replaced with the number of bytes actually decompressed
+ * @param[out] decompressed Location to store the decompressed data
+ * @param compressed_size Size of the compressed data (in bytes)
+ * @param compressed The compressed data
+ * @param options Decompression options
+ * @return A status code
+ * @retval SQUASH_INVALID_BUFFER The compressed data is not a valid
+ *   seekable container, or a block needed for the range is corrupt
+ */
+SquashStatus
+squash_codec_decompress_range (SquashCodec* codec,
+                               uint64_t offset,
+                               size_t* decompressed_size,
+                               uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                               size_t compressed_size,
+                               const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                               SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+  SquashSeekableFooter footer;
+  uint8_t* block = NULL;
+  size_t block_allocated = 0;
+  size_t length, pos = 0;
+
+  assert (codec != NULL);
+  assert (decompressed_size != NULL);
+  assert (decompressed != NULL);
+  assert (compressed != NULL);
+
+  squash_options_hold (options);
+
+  if (SQUASH_UNLIKELY(squash_codec_get_impl (codec) == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    goto cleanup;
+  }
+
+  if (SQUASH_UNLIKELY(!squash_seekable_read_footer (&footer, compressed_size, compressed))) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  if (offset >= footer.uncompressed_size) {
+    *decompressed_size = 0;
+    goto cleanup;
+  }
+
+  const size_t total = (size_t) footer.uncompressed_size;
+  const size_t block_size = (size_t) footer.block_size;
+  const size_t start = (size_t) offset;
+
+  length = (*decompressed_size < (total - start)) ? *decompressed_size : (total - start);
+
+  for (size_t i = start / block_size ; pos < length ; i++) {
+    const size_t block_start = i * block_size;
+    const size_t block_length = ((total - block_start) < block_size) ? (total - block_start) : block_size;
+    const size_t skip = (pos == 0) ? (start - block_start) : 0;
+    const size_t wanted = ((block_length - skip) < (length - pos)) ? (block_length - skip) : (length - pos);
+
+    if (skip == 0 && wanted == block_length) {
+      res = squash_seekable_decompress_block (codec, &footer, i, decompressed + pos, block_length, compressed, options);
+    } else {
+      /* Only the first and last blocks of the range can be partial.
+         The footer's block size is capped at
+         SQUASH_SEEKABLE_MAX_BLOCK_SIZE, which bounds this. */
+      if (block_allocated < block_length) {
+        uint8_t* tmp = squash_realloc (block, block_length);
+        if (SQUASH_UNLIKELY(tmp == NULL)) {
+          res = squash_error (SQUASH_MEMORY);
+          goto cleanup;
+        }
+        block = tmp;
+        block_allocated = block_length;
+      }
+
+      res = squash_seekable_decompress_block (codec, &footer, i, block, block_length, compressed, options);
+      if (SQUASH_LIKELY(res == SQUASH_OK))
+        memcpy (decompressed + pos, block + skip, wanted);
+    }
+
+    if (SQUASH_UNLIKELY(res != SQUASH_OK))
+      goto cleanup;
+
+    pos += wanted;
+  }
+
+  *decompressed_size = length;
+
+ cleanup:
+
+  squash_free (block);
+  squash_options_release (options);
+
+  return res;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,72 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+
+#ifndef SQUASH_SEEKABLE_H
+#define SQUASH_SEEKABLE_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stddef.h>
+#include <stdint.h>
+
+SQUASH_BEGIN_DECLS
+
+#define SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE ((size_t) (256 * 1024))
+#define SQUASH_SEEKABLE_MAX_BLOCK_SIZE ((size_t) (64 * 1024 * 1024))
+
+SQUASH_NONNULL(1)
+SQUASH_API size_t                  squash_codec_get_max_compressed_size_seekable (SquashCodec* codec,
+                                                                                  size_t uncompressed_size,
+                                                                                  size_t block_size);
+SQUASH_NONNULL(1, 3)
+SQUASH_API size_t                  squash_codec_get_uncompressed_size_seekable   (SquashCodec* codec,
+                                                                                  size_t compressed_size,
+                                                                                  const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)]);
+SQUASH_NONNULL(1, 2, 3, 5)
+SQUASH_API SquashStatus            squash_codec_compress_seekable                (SquashCodec* codec,
+                                                                                  size_t* compressed_size,
+                                                                                  uint8_t compressed[SQUASH_ARRAY_PARAM(*compressed_size)],
+                                                                                  size_t uncompressed_size,
+                                                                                  const uint8_t uncompressed[SQUASH_ARRAY_PARAM(uncompressed_size)],
+                                                                                  size_t block_size,
+                                                                                  unsigned int threads,
+                                                                                  SquashOptions* options);
+SQUASH_NONNULL(1, 3, 4, 6)
+SQUASH_API SquashStatus            squash_codec_decompress_range                 (SquashCodec* codec,
+                                                                                  uint64_t offset,
+                                                                                  size_t* decompressed_size,
+                                                                                  uint8_t decompressed[SQUASH_ARRAY_PARAM(*decompressed_size)],
+                                                                                  size_t compressed_size,
+                                                                                  const uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_size)],
+                                                                                  SquashOptions* options);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_SEEKABLE_H */
@@ -0,0 +1,575 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+/* For clock_gettime */
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#endif
+
+/**
+ * @defgroup SquashSelect Codec selection
+ * @brief Pick a codec and level based on a sample of the data
+ *
+ * Which codec works best depends heavily on the data.  Rather than
+ * guessing, ::squash_select_codec compresses a representative sample
+ * with every candidate codec at every level it supports, discards
+ * those which don't meet the constraints in a
+ * @ref SquashSelectCriteria_ "SquashSelectCriteria", and returns the
+ * best of the rest.
+ *
+ * Trials are spread across several threads, but they are still
+ * expensive, so results are cached by the caller-supplied data class
+ * (for example, a column name).  Subsequent calls with the same data
+ * class and criteria return the cached choice without looking at the
+ * sample.
+ *
+ * @{
+ */
+
+/**
+ * @enum SquashSelectGoal
+ * @brief What to optimize for once the constraints are met
+ *
+ * @var SquashSelectGoal::SQUASH_SELECT_GOAL_RATIO
+ * @brief Highest compression ratio
+ * @var SquashSelectGoal::SQUASH_SELECT_GOAL_COMPRESS_SPEED
+ * @brief Fastest compression
+ * @var SquashSelectGoal::SQUASH_SELECT_GOAL_DECOMPRESS_SPEED
+ * @brief Fastest decompression
+ */
+
+/**
+ * @struct SquashSelectCriteria_
+ * @brief Constraints and goal for ::squash_select_codec
+ *
+ * Limits which are zero are ignored, so a zero-initialized structure
+ * simply selects the candidate with the highest compression ratio.
+ */
+
+/**
+ * @var SquashSelectCriteria_::goal
+ * @brief What to optimize for
+ */
+
+/**
+ * @var SquashSelectCriteria_::max_compress_time
+ * @brief Maximum time to compress one MiB of data, in seconds
+ */
+
+/**
+ * @var SquashSelectCriteria_::min_ratio
+ * @brief Minimum compression ratio (uncompressed size / compressed
+ *   size)
+ */
+
+/**
+ * @var SquashSelectCriteria_::min_decompress_speed
+ * @brief Minimum decompression speed, in MiB per second
+ */
+
+/**
+ * @var SquashSelectCriteria_::codecs
+ * @brief *NULL*-terminated list of codec names to consider, or *NULL*
+ *   for every codec
+ *
+ * When every codec is considered, those flagged
+ * @ref SQUASH_CODEC_INFO_DECOMPRESS_UNSAFE are skipped.
+ */
+
+/**
+ * @var SquashSelectCriteria_::threads
+ * @brief Maximum number of threads to use for trials, or 0 for one per
+ *   CPU
+ */
+
+/* Each trial is repeated until it has taken at least this long (in
+   seconds) so that small samples can still be timed meaningfully. */
+#ifndef SQUASH_SELECT_MIN_TRIAL_TIME
+#  define SQUASH_SELECT_MIN_TRIAL_TIME 0.005
+#endif
+
+#define SQUASH_SELECT_MIB ((double) (1024 * 1024))
+
+typedef struct SquashSelectCandidate_ {
+  SquashCodec* codec;
+  SquashCodecImpl* impl;
+  SquashOptions* options;
+
+  SquashStatus status;
+  double ratio;
+  double compress_time;
+  double decompress_speed;
+} SquashSelectCandidate;
+
+typedef struct SquashSelectTrials_ {
+  size_t sample_size;
+  const uint8_t* sample;
+
+  size_t n_candidates;
+  size_t allocated;
+  SquashSelectCandidate* candidates;
+} SquashSelectTrials;
+
+typedef struct SquashSelectCacheEntry_ {
+  struct SquashSelectCacheEntry_* next;
+
+  char* data_class;
+  char* codecs;
+  SquashSelectGoal goal;
+  double max_compress_time;
+  double min_ratio;
+  double min_decompress_speed;
+
+  SquashCodec* codec;
+  SquashOptions* options;
+} SquashSelectCacheEntry;
+
+SQUASH_MTX_DEFINE(select_cache)
+
+static SquashSelectCacheEntry* squash_select_cache = NULL;
+
+static double
+squash_select_now (void) {
+#if defined(_WIN32)
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency (&frequency);
+  QueryPerformanceCounter (&counter);
+  return (double) counter.QuadPart / (double) frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+#else
+  return (double) clock () / (double) CLOCKS_PER_SEC;
+#endif
+}
+
+/* The candidate codec names, joined into a single string so the
+   cache can compare them. */
+static char*
+squash_select_codecs_key (const char* const* codecs) {
+  size_t length = 0;
+
+  if (codecs == NULL)
+    return NULL;
+
+  for (const char* const* c = codecs ; *c != NULL ; c++)
+    length += strlen (*c) + 1;
+
+  char* key = squash_malloc (length + 1);
+  if (SQUASH_UNLIKELY(key == NULL))
+    return NULL;
+
+  char* p = key;
+  for (const char* const* c = codecs ; *c != NULL ; c++) {
+    const size_t l = strlen (*c);
+    memcpy (p, *c, l);
+    p[l] = '\n';
+    p += l + 1;
+  }
+  *p = '\0';
+
+  return key;
+}
+
+static bool
+squash_select_cache_entry_matches (const SquashSelectCacheEntry* entry,
+                                   const char* data_class,
+                                   const char* codecs,
+                                   const SquashSelectCriteria* criteria) {
+  return
+    strcmp (entry->data_class, data_class) == 0 &&
+    entry->goal == criteria->goal &&
+    entry->max_compress_time == criteria->max_compress_time &&
+    entry->min_ratio == criteria->min_ratio &&
+    entry->min_decompress_speed == criteria->min_decompress_speed &&
+    ((entry->codecs == NULL && codecs == NULL) ||
+     (entry->codecs != NULL && codecs != NULL && strcmp (entry->codecs, codecs) == 0));
+}
+
+static void
+squash_select_cache_entry_free (SquashSelectCacheEntry* entry) {
+  squash_free (entry->data_class);
+  squash_free (entry->codecs);
+  if (entry->options != NULL)
+    squash_object_unref (entry->options);
+  squash_free (entry);
+}
+
+static SquashStatus
+squash_select_trials_add (SquashSelectTrials* trials, SquashCodec* codec, SquashCodecImpl* impl, SquashOptions* options) {
+  if (trials->n_candidates == trials->allocated) {
+    const size_t allocated = (trials->allocated == 0) ? 32 : trials->allocated * 2;
+    SquashSelectCandidate* candidates = squash_realloc (trials->candidates, sizeof (SquashSelectCandidate) * allocated);
+    if (SQUASH_UNLIKELY(candidates == NULL))
+      return squash_error (SQUASH_MEMORY);
+    trials->candidates = candidates;
+    trials->allocated = allocated;
+  }
+
+  SquashSelectCandidate* candidate = &(trials->candidates[trials->n_candidates++]);
+  memset (candidate, 0, sizeof (SquashSelectCandidate));
+  candidate->codec = codec;
+  candidate->impl = impl;
+  candidate->options = options;
+  candidate->status = SQUASH_FAILED;
+
+  return SQUASH_OK;
+}
+
+/* Add a candidate for each level the codec supports, or a single one
+   with the default options if it doesn't have a level option. */
+static SquashStatus
+squash_select_trials_add_codec (SquashSelectTrials* trials, SquashCodec* codec) {
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  if (impl == NULL)
+    return SQUASH_OK;
+
+  const SquashOptionInfo* info = impl->options;
+  size_t level_idx = 0;
+  for ( ; info != NULL && info->name != NULL ; info++, level_idx++) {
+    if (strcmp (info->name, "level") == 0)
+      break;
+  }
+
+  if (info == NULL || info->name == NULL ||
+      (info->type != SQUASH_OPTION_TYPE_RANGE_INT && info->type != SQUASH_OPTION_TYPE_ENUM_INT))
+    return squash_select_trials_add (trials, codec, impl, NULL);
+
+  const size_t n_levels = (info->type == SQUASH_OPTION_TYPE_RANGE_INT) ?
+    (size_t) (info->info.range_int.max - info->info.range_int.min) + 1 :
+    info->info.enum_int.values_length;
+
+  for (size_t i = 0 ; i < n_levels ; i++) {
+    int level;
+
+    if (info->type == SQUASH_OPTION_TYPE_RANGE_INT) {
+      level = info->info.range_int.min + (int) i;
+      if (info->info.range_int.modulus > 1 && (level % info->info.range_int.modulus) != 0)
+        continue;
+    } else {
+      level = info->info.enum_int.values[i];
+    }
+
+    SquashOptions* options = squash_options_new (codec, NULL);
+    if (SQUASH_UNLIKELY(options == NULL))
+      return squash_error (SQUASH_MEMORY);
+    squash_object_ref (options);
+
+    SquashStatus res = squash_options_set_int_at (options, level_idx, level);
+    if (res == SQUASH_OK)
+      res = squash_select_trials_add (trials, codec, impl, options);
+    if (SQUASH_UNLIKELY(res != SQUASH_OK)) {
+      squash_object_unref (options);
+      if (res == SQUASH_MEMORY)
+        return res;
+    }
+  }
+
+  return SQUASH_OK;
+}
+
+static void
+squash_select_trials_add_codec_cb (SquashCodec* codec, void* user_data) {
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_DECOMPRESS_UNSAFE) == 0)
+    squash_select_trials_add_codec ((SquashSelectTrials*) user_data, codec);
+}
+
+static SquashStatus
+squash_select_trial (size_t index, void* user_data) {
+  SquashSelectTrials* trials = (SquashSelectTrials*) user_data;
+  SquashSelectCandidate* candidate = &(trials->candidates[index]);
+  const size_t compressed_allocated = squash_codec_get_max_compressed_size (candidate->codec, trials->sample_size);
+  uint8_t* compressed = squash_malloc (compressed_allocated);
+  uint8_t* decompressed = squash_malloc (trials->sample_size);
+  size_t compressed_size = 0;
+  size_t decompressed_size = 0;
+  size_t iterations;
+  double start, elapsed;
+  SquashStatus res = SQUASH_OK;
+
+  if (SQUASH_UNLIKELY(compressed == NULL || decompressed == NULL)) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
+  iterations = 0;
+  start = squash_select_now ();
+  do {
+    compressed_size = compressed_allocated;
+    res = squash_codec_compress_internal (candidate->codec, candidate->impl,
+                                          &compressed_size, compressed,
+                                          trials->sample_size, trials->sample,
+                                          candidate->options);
+    if (res != SQUASH_OK)
+      goto cleanup;
+    iterations++;
+    elapsed = squash_select_now () - start;
+  } while (elapsed < SQUASH_SELECT_MIN_TRIAL_TIME);
+
+  candidate->ratio = (double) trials->sample_size / (double) compressed_size;
+  candidate->compress_time = (elapsed / (double) iterations) / ((double) trials->sample_size / SQUASH_SELECT_MIB);
+
+  iterations = 0;
+  start = squash_select_now ();
+  do {
+    decompressed_size = trials->sample_size;
+    res = squash_codec_decompress_internal (candidate->codec, candidate->impl,
+                                            &decompressed_size, decompressed,
+                                            compressed_size, compressed,
+                                            candidate->options);
+    if (res != SQUASH_OK)
+      goto cleanup;
+    iterations++;
+    elapsed = squash_select_now () - start;
+  } while (elapsed < SQUASH_SELECT_MIN_TRIAL_TIME);
+
+  if (decompressed_size != trials->sample_size ||
+      memcmp (decompressed, trials->sample, trials->sample_size) != 0) {
+    res = squash_error (SQUASH_FAILED);
+    goto cleanup;
+  }
+
+  candidate->decompress_speed = ((double) trials->sample_size / SQUASH_SELECT_MIB) / (elapsed / (double) iterations);
+
+ cleanup:
+
+  candidate->status = res;
+
+  squash_free (compressed);
+  squash_free (decompressed);
+
+  /* A candidate failing doesn't stop the other trials. */
+  return SQUASH_OK;
+}
+
+static bool
+squash_select_candidate_acceptable (const SquashSelectCandidate* candidate, const SquashSelectCriteria* criteria) {
+  return
+    candidate->status == SQUASH_OK &&
+    (criteria->max_compress_time <= 0.0 || candidate->compress_time <= criteria->max_compress_time) &&
+    (criteria->min_ratio <= 0.0 || candidate->ratio >= criteria->min_ratio) &&
+    (criteria->min_decompress_speed <= 0.0 || candidate->decompress_speed >= criteria->min_decompress_speed);
+}
+
+static bool
+squash_select_candidate_better (const SquashSelectCandidate* a, const SquashSelectCandidate* b, SquashSelectGoal goal) {
+  switch (goal) {
+    case SQUASH_SELECT_GOAL_COMPRESS_SPEED:
+      return (a->compress_time != b->compress_time) ? (a->compress_time < b->compress_time) : (a->ratio > b->ratio);
+    case SQUASH_SELECT_GOAL_DECOMPRESS_SPEED:
+      return (a->decompress_speed != b->decompress_speed) ? (a->decompress_speed > b->decompress_speed) : (a->ratio > b->ratio);
+    case SQUASH_SELECT_GOAL_RATIO:
+    default:
+      return (a->ratio != b->ratio) ? (a->ratio > b->ratio) : (a->compress_time < b->compress_time);
+  }
+}
+
+/**
+ * @brief Choose a codec and options for the given data
+ *
+ * If @a data_class is not *NULL* and a previous call with the same
+ * data class and criteria succeeded, its result is returned
+ * immediately.  Otherwise every candidate codec is tried at every
+ * level on @a sample (see @ref SquashSelect), and the result is
+ * cached under @a data_class.
+ *
+ * On success, @a options receives a new reference to the chosen
+ * options which the caller must release with ::squash_object_unref,
+ * or *NULL* if the chosen codec should be used with its default
+ * options.  Options cached under a @a data_class are shared between
+ * callers, so they are frozen (see ::squash_options_freeze) and
+ * can't be modified.
+ *
+ * @param data_class Key used to cache the decision, or *NULL* to
+ *   disable caching
+ * @param sample_size Size of @a sample
+ * @param sample Representative sample of the data
+ * @param criteria Constraints and goal (or *NULL* for the highest
+ *   compression ratio)
+ * @param[out] codec Location to store the selected codec
+ * @param[out] options Location to store the selected options
+ * @return A status code
+ * @retval SQUASH_OK A codec was selected
+ * @retval SQUASH_NOT_FOUND No candidate met the constraints, or a
+ *   codec in SquashSelectCriteria_::codecs doesn't exist
+ * @retval SQUASH_BAD_PARAM @a sample is empty
+ */
+SquashStatus
+squash_select_codec (const char* data_class,
+                     size_t sample_size,
+                     const uint8_t sample[SQUASH_ARRAY_PARAM(sample_size)],
+                     const SquashSelectCriteria* criteria,
+                     SquashCodec** codec,
+                     SquashOptions** options) {
+  static const SquashSelectCriteria default_criteria = { SQUASH_SELECT_GOAL_RATIO, 0.0, 0.0, 0.0, NULL, 0 };
+  SquashSelectTrials trials = { 0, };
+  SquashSelectCandidate* best = NULL;
+  SquashStatus res = SQUASH_OK;
+  char* codecs_key = NULL;
+
+  assert (codec != NULL);
+  assert (options != NULL);
+
+  if (criteria == NULL)
+    criteria = &default_criteria;
+
+  if (SQUASH_UNLIKELY(sample_size == 0 || sample == NULL))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  if (criteria->codecs != NULL) {
+    codecs_key = squash_select_codecs_key (criteria->codecs);
+    if (SQUASH_UNLIKELY(codecs_key == NULL))
+      return squash_error (SQUASH_MEMORY);
+  }
+
+  if (data_class != NULL) {
+    SQUASH_MTX_LOCK(select_cache);
+    for (SquashSelectCacheEntry* entry = squash_select_cache ; entry != NULL ; entry = entry->next) {
+      if (squash_select_cache_entry_matches (entry, data_class, codecs_key, criteria)) {
+        *codec = entry->codec;
+        *options = (entry->options != NULL) ? squash_object_ref (entry->options) : NULL;
+        SQUASH_MTX_UNLOCK(select_cache);
+        squash_free (codecs_key);
+        return SQUASH_OK;
+      }
+    }
+    SQUASH_MTX_UNLOCK(select_cache);
+  }
+
+  trials.sample_size = sample_size;
+  trials.sample = sample;
+
+  if (criteria->codecs != NULL) {
+    for (const char* const* name = criteria->codecs ; *name != NULL ; name++) {
+      SquashCodec* candidate_codec = squash_get_codec (*name);
+      if (candidate_codec == NULL) {
+        res = squash_error (SQUASH_NOT_FOUND);
+        goto cleanup;
+      }
+      res = squash_select_trials_add_codec (&trials, candidate_codec);
+      if (SQUASH_UNLIKELY(res != SQUASH_OK))
+        goto cleanup;
+    }
+  } else {
+    squash_foreach_codec (squash_select_trials_add_codec_cb, &trials);
+  }
+
+  squash_parallel_for (trials.n_candidates, criteria->threads, squash_select_trial, &trials);
+
+  for (size_t i = 0 ; i < trials.n_candidates ; i++) {
+    SquashSelectCandidate* candidate = &(trials.candidates[i]);
+    if (squash_select_candidate_acceptable (candidate, criteria) &&
+        (best == NULL || squash_select_candidate_better (candidate, best, criteria->goal)))
+      best = candidate;
+  }
+
+  if (best == NULL) {
+    res = squash_error (SQUASH_NOT_FOUND);
+    goto cleanup;
+  }
+
+  /* Cached options are handed to every later caller with the same
+     data class, so nobody may modify them. */
+  if (data_class != NULL && best->options != NULL)
+    squash_options_freeze (best->options);
+
+  *codec = best->codec;
+  *options = (best->options != NULL) ? squash_object_ref (best->options) : NULL;
+
+  if (data_class != NULL) {
+    SquashSelectCacheEntry* entry = squash_malloc (sizeof (SquashSelectCacheEntry));
+    if (entry != NULL) {
+      entry->data_class = squash_strdup (data_class);
+      entry->codecs = codecs_key;
+      codecs_key = NULL;
+      entry->goal = criteria->goal;
+      entry->max_compress_time = criteria->max_compress_time;
+      entry->min_ratio = criteria->min_ratio;
+      entry->min_decompress_speed = criteria->min_decompress_speed;
+      entry->codec = best->codec;
+      entry->options = (best->options != NULL) ? squash_object_ref (best->options) : NULL;
+
+      if (SQUASH_UNLIKELY(entry->data_class == NULL)) {
+        squash_select_cache_entry_free (entry);
+      } else {
+        SQUASH_MTX_LOCK(select_cache);
+        entry->next = squash_select_cache;
+        squash_select_cache = entry;
+        SQUASH_MTX_UNLOCK(select_cache);
+      }
+    }
+  }
+
+ cleanup:
+
+  for (size_t i = 0 ; i < trials.n_candidates ; i++) {
+    if (trials.candidates[i].options != NULL)
+      squash_object_unref (trials.candidates[i].options);
+  }
+  squash_free (trials.candidates);
+  squash_free (codecs_key);
+
+  return res;
+}
+
+/**
+ * @brief Forget cached selections
+ *
+ * @param data_class Data class to forget, or *NULL* to clear the whole
+ *   cache
+ */
+void
+squash_select_clear_cache (const char* data_class) {
+  SquashSelectCacheEntry** prev;
+  SquashSelectCacheEntry* entry;
+
+  SQUASH_MTX_LOCK(select_cache);
+  prev = &squash_select_cache;
+  while ((entry = *prev) != NULL) {
+    if (data_class == NULL || strcmp (entry->data_class, data_class) == 0) {
+      *prev = entry->next;
+      squash_select_cache_entry_free (entry);
+    } else {
+      prev = &(entry->next);
+    }
+  }
+  SQUASH_MTX_UNLOCK(select_cache);
+}
+
+/**
+ * @}
+ */
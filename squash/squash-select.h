@@ -0,0 +1,70 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+#ifndef SQUASH_SELECT_H
+#define SQUASH_SELECT_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash/squash.h> can be included directly."
+#endif
+
+#include <squash/squash.h>
+#include <stddef.h>
+#include <stdint.h>
+
+SQUASH_BEGIN_DECLS
+
+typedef enum {
+  SQUASH_SELECT_GOAL_RATIO            = 0,
+  SQUASH_SELECT_GOAL_COMPRESS_SPEED   = 1,
+  SQUASH_SELECT_GOAL_DECOMPRESS_SPEED = 2
+} SquashSelectGoal;
+
+typedef struct SquashSelectCriteria_ SquashSelectCriteria;
+
+struct SquashSelectCriteria_ {
+  SquashSelectGoal goal;
+
+  double max_compress_time;
+  double min_ratio;
+  double min_decompress_speed;
+
+  const char* const* codecs;
+  unsigned int threads;
+};
+
+SQUASH_NONNULL(5, 6)
+SQUASH_API SquashStatus squash_select_codec       (const char* data_class,
+                                                   size_t sample_size,
+                                                   const uint8_t sample[SQUASH_ARRAY_PARAM(sample_size)],
+                                                   const SquashSelectCriteria* criteria,
+                                                   SquashCodec** codec,
+                                                   SquashOptions** options);
+SQUASH_API void         squash_select_clear_cache (const char* data_class);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_SELECT_H */
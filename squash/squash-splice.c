@@ -34,6 +34,9 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE
+#if !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
 
 #include <assert.h>
 #include "squash-internal.h"
@@ -47,7 +50,18 @@
 
 #include "squash/tinycthread/source/tinycthread.h"
 
+#if !defined(_WIN32)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#if defined(HAVE_SENDFILE)
+#  include <sys/sendfile.h>
+#endif
+
 #define SQUASH_MMAP_FAILED ((SquashStatus)(-127))
+#define SQUASH_PASSTHROUGH_FAILED ((SquashStatus)(-126))
 
 /**
  * @defgroup Splicing
@@ -94,6 +108,61 @@ squash_splice (SquashCodec* codec, SquashStreamType stream_type, FILE* fp_out, F
 }
 
 #if !defined(_WIN32)
+/* Decompress a mapped input file with a stream, growing the mapped
+   output file as necessary.  Unlike retrying a buffer-to-buffer
+   decompression with successively larger buffers, this never has to
+   decompress anything more than once. */
+static SquashStatus
+squash_splice_map_decompress_stream (SquashCodec* codec,
+                                     SquashOptions* options,
+                                     SquashMappedFile* mapped_in,
+                                     SquashMappedFile* mapped_out,
+                                     FILE* fp_out,
+                                     size_t output_size) {
+  SquashStatus res;
+  SquashStream* stream;
+
+  stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_FAILED);
+
+  stream->next_in = mapped_in->data;
+  stream->avail_in = mapped_in->size;
+
+  do {
+    if (stream->avail_out == 0) {
+      if (mapped_out->data != MAP_FAILED)
+        output_size <<= 1;
+
+      if (!squash_mapped_file_init (mapped_out, fp_out, output_size, true)) {
+        res = SQUASH_MMAP_FAILED;
+        break;
+      }
+
+      stream->next_out = mapped_out->data + stream->total_out;
+      stream->avail_out = mapped_out->size - stream->total_out;
+    }
+
+    if (stream->state < SQUASH_STREAM_STATE_FINISHING && stream->avail_in != 0) {
+      res = squash_stream_process (stream);
+      if (res == SQUASH_OK)
+        res = SQUASH_PROCESSING;
+    } else {
+      res = squash_stream_finish (stream);
+    }
+  } while (res == SQUASH_PROCESSING);
+
+  if (res == SQUASH_END_OF_STREAM)
+    res = SQUASH_OK;
+
+  if (res == SQUASH_OK)
+    mapped_out->size = stream->total_out;
+
+  squash_object_unref (stream);
+
+  return res;
+}
+
 static SquashStatus
 squash_splice_map (FILE* fp_in, FILE* fp_out, size_t size, SquashStreamType stream_type, SquashCodec* codec, SquashOptions* options) {
   SquashStatus res = SQUASH_MMAP_FAILED;
@@ -119,13 +188,22 @@ squash_splice_map (FILE* fp_in, FILE* fp_out, size_t size, SquashStreamType stre
       goto cleanup;
 
     const SquashCodecInfo codec_info = squash_codec_get_info (codec);
+    const SquashCodecImpl* impl = squash_codec_get_impl (codec);
     const bool knows_uncompressed = ((codec_info & SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE) == SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE);
 
-    size_t max_output_size = knows_uncompressed ?
-      squash_codec_get_uncompressed_size(codec, mapped_in.size, mapped_in.data) :
-      squash_npot (mapped_in.size) << 3;
+    /* For codecs which only provide a hint this may be wrong, but it
+       is still a much better first guess than the compressed size. */
+    size_t max_output_size = squash_codec_get_uncompressed_size(codec, mapped_in.size, mapped_in.data);
+    if (!knows_uncompressed && max_output_size == 0)
+      max_output_size = squash_npot (mapped_in.size) << 3;
 
-    do {
+    if (!knows_uncompressed && (impl->create_stream != NULL || impl->splice != NULL)) {
+      res = squash_splice_map_decompress_stream (codec, options, &mapped_in, &mapped_out, fp_out, max_output_size);
+      if (res == SQUASH_OK) {
+        squash_mapped_file_destroy (&mapped_in, true);
+        squash_mapped_file_destroy (&mapped_out, true);
+      }
+    } else do {
       if (!squash_mapped_file_init (&mapped_out, fp_out, max_output_size, true)) {
         res = SQUASH_MMAP_FAILED;
         goto cleanup;
@@ -162,72 +240,71 @@ squash_splice_stream (FILE* fp_in,
   size_t remaining = size;
   uint8_t* data = NULL;
   size_t data_size = 0;
-#if defined(SQUASH_MMAP_IO)
-  bool first_block = true;
-  SquashMappedFile map = squash_mapped_file_empty;
-
-  if (stream_type == SQUASH_STREAM_COMPRESS) {
-    file = squash_file_steal_with_options (fp_out, codec, options);
-    assert (file != NULL);
+#if !defined(_WIN32)
+  SquashMappedWindow window = squash_mapped_window_empty;
+  bool unmapped = false;
+
+  /* Compressing reads from the mapping, decompressing writes to it. */
+  if (squash_mapped_window_init (&window, (stream_type == SQUASH_STREAM_COMPRESS ? fp_in : fp_out), stream_type == SQUASH_STREAM_DECOMPRESS)) {
+    file = squash_file_steal_with_options (codec, (stream_type == SQUASH_STREAM_COMPRESS ? fp_out : fp_in), options);
+    if (SQUASH_UNLIKELY(file == NULL)) {
+      res = squash_error (SQUASH_FAILED);
+      goto cleanup;
+    }
 
+    res = SQUASH_OK;
     while (size == 0 || remaining != 0) {
-      const size_t req_size = (size == 0 || remaining > SQUASH_FILE_BUF_SIZE) ? SQUASH_FILE_BUF_SIZE : remaining;
-      if (!squash_mapped_file_init_full(&map, fp_in, req_size, true, false)) {
-        if (first_block)
-          goto nomap;
-        else {
-          break;
-        }
-      } else {
-        first_block = false;
-      }
+      uint8_t* chunk;
+      size_t chunk_size;
 
-      res = squash_file_write (file, map.size, map.data);
-      if (res != SQUASH_OK)
-        goto cleanup;
+      if (SQUASH_UNLIKELY(!squash_mapped_window_acquire (&window, &chunk, &chunk_size))) {
+        /* Couldn't map (or reserve space for) the next window; carry
+           on with stdio from where the mapping left off. */
+        unmapped = true;
+        break;
+      } else if (chunk_size == 0) {
+        break;
+      }
 
-      if (size != 0)
-        remaining -= map.size;
-      squash_mapped_file_destroy (&map, true);
-    }
-  } else { /* stream_type == SQUASH_STREAM_DECOMPRESS */
-    file = squash_file_steal_with_options (fp_in, codec, options);
-    assert (file != NULL);
+      if (size != 0 && chunk_size > remaining)
+        chunk_size = remaining;
 
-    while (size == 0 || remaining > 0) {
-      const size_t req_size = (size == 0 || remaining > SQUASH_FILE_BUF_SIZE) ? SQUASH_FILE_BUF_SIZE : remaining;
-      if (!squash_mapped_file_init_full(&map, fp_out, req_size, true, true)) {
-        if (first_block)
-          goto nomap;
-        else {
-          break;
-        }
+      if (stream_type == SQUASH_STREAM_COMPRESS) {
+        res = squash_file_write (file, chunk_size, chunk);
       } else {
-        first_block = false;
+        res = squash_file_read (file, &chunk_size, chunk);
+        if (res == SQUASH_PROCESSING)
+          res = SQUASH_OK;
       }
-
-      res = squash_file_read (file, &map.size, map.data);
       if (res < 0)
-        goto cleanup;
+        break;
+
+      squash_mapped_window_release (&window, chunk_size);
+      if (size != 0)
+        remaining -= chunk_size;
 
       if (res == SQUASH_END_OF_STREAM) {
-        assert (map.size == 0);
         res = SQUASH_OK;
-        squash_mapped_file_destroy (&map, true);
-        goto cleanup;
+        break;
       }
+    }
+
+    if (!unmapped)
+      goto cleanup;
 
-      squash_mapped_file_destroy (&map, true);
+    if (SQUASH_UNLIKELY(!squash_mapped_window_destroy (&window, true))) {
+      res = squash_error (SQUASH_IO);
+      goto cleanup;
     }
   }
+#endif /* !defined(_WIN32) */
 
- nomap:
-#endif /* defined(SQUASH_MMAP_IO) */
-
-  file = squash_file_steal_with_options (codec, (stream_type == SQUASH_STREAM_COMPRESS ? fp_out : fp_in), options);
-  if (SQUASH_UNLIKELY(file == NULL)) {
-    res = squash_error (SQUASH_FAILED);
-    goto cleanup;
+  if (file == NULL) {
+    file = squash_file_steal_with_options (codec, (stream_type == SQUASH_STREAM_COMPRESS ? fp_out : fp_in), options);
+    if (SQUASH_UNLIKELY(file == NULL)) {
+      res = squash_error (SQUASH_FAILED);
+      goto cleanup;
+    }
   }
 
   data = squash_malloc (SQUASH_FILE_BUF_SIZE);
@@ -289,8 +366,9 @@ squash_splice_stream (FILE* fp_in,
  cleanup:
 
   squash_file_free (file, NULL);
-#if defined(SQUASH_MMAP_IO)
-  squash_mapped_file_destroy (&map, false);
+#if !defined(_WIN32)
+  if (!squash_mapped_window_destroy (&window, res == SQUASH_OK) && res == SQUASH_OK)
+    res = squash_error (SQUASH_IO);
 #endif
   squash_free (data);
 
@@ -382,6 +460,125 @@ squash_file_splice (FILE* fp_in,
   return squash_splice_custom_with_options(codec, stream_type, squash_file_splice_write, squash_file_splice_read, &data, size, options);
 }
 
+#if !defined(_WIN32)
+typedef enum {
+  SQUASH_SPLICE_PASSTHROUGH_COPY_FILE_RANGE,
+  SQUASH_SPLICE_PASSTHROUGH_SENDFILE,
+  SQUASH_SPLICE_PASSTHROUGH_SPLICE,
+  SQUASH_SPLICE_PASSTHROUGH_NONE
+} SquashSplicePassthroughMethod;
+
+/* Copy @a size bytes (or everything, if 0) from fd_in to fd_out
+   without the data passing through user space, for codecs which
+   don't change it.  Each descriptor's file position is used (and
+   updated), so if the kernel can't do it (or stops being able to part
+   way through) the caller can finish the job the normal way;
+   SQUASH_PASSTHROUGH_FAILED means *copied bytes were transferred and
+   the rest is up to the caller. */
+static SquashStatus
+squash_splice_passthrough (int fd_out, int fd_in, size_t size, size_t* copied) {
+  struct stat st_in, st_out;
+  SquashSplicePassthroughMethod method;
+
+  *copied = 0;
+
+  if (fstat (fd_in, &st_in) != 0 || fstat (fd_out, &st_out) != 0)
+    return SQUASH_PASSTHROUGH_FAILED;
+
+  /* copy_file_range needs two regular files, sendfile an input it can
+     map, and splice a pipe on at least one side. */
+  if (S_ISREG(st_in.st_mode) && S_ISREG(st_out.st_mode))
+    method = SQUASH_SPLICE_PASSTHROUGH_COPY_FILE_RANGE;
+  else if (S_ISREG(st_in.st_mode) || S_ISBLK(st_in.st_mode))
+    method = SQUASH_SPLICE_PASSTHROUGH_SENDFILE;
+  else if (S_ISFIFO(st_in.st_mode) || S_ISFIFO(st_out.st_mode))
+    method = SQUASH_SPLICE_PASSTHROUGH_SPLICE;
+  else
+    return SQUASH_PASSTHROUGH_FAILED;
+
+  while (size == 0 || *copied < size) {
+    const size_t max_request = ((size_t) 1) << 30;
+    const size_t request = (size == 0 || (size - *copied) > max_request) ? max_request : (size - *copied);
+    ssize_t r = -1;
+
+    errno = ENOSYS;
+    switch (method) {
+      case SQUASH_SPLICE_PASSTHROUGH_COPY_FILE_RANGE:
+#if defined(HAVE_COPY_FILE_RANGE)
+        r = copy_file_range (fd_in, NULL, fd_out, NULL, request, 0);
+#endif
+        break;
+      case SQUASH_SPLICE_PASSTHROUGH_SENDFILE:
+#if defined(HAVE_SENDFILE)
+        r = sendfile (fd_out, fd_in, NULL, request);
+#endif
+        break;
+      case SQUASH_SPLICE_PASSTHROUGH_SPLICE:
+#if defined(HAVE_SPLICE)
+        r = splice (fd_in, NULL, fd_out, NULL, request, SPLICE_F_MOVE);
+#endif
+        break;
+      case SQUASH_SPLICE_PASSTHROUGH_NONE:
+      default:
+        return SQUASH_PASSTHROUGH_FAILED;
+    }
+
+    if (r > 0) {
+      *copied += (size_t) r;
+    } else if (r == 0) {
+      break;
+    } else if (errno == EINTR || errno == EAGAIN) {
+      continue;
+    } else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF) {
+      /* Not supported for this pair of descriptors; try the next
+         method which might be. */
+      if (method == SQUASH_SPLICE_PASSTHROUGH_COPY_FILE_RANGE)
+        method = SQUASH_SPLICE_PASSTHROUGH_SENDFILE;
+      else if (method == SQUASH_SPLICE_PASSTHROUGH_SENDFILE && (S_ISFIFO(st_in.st_mode) || S_ISFIFO(st_out.st_mode)))
+        method = SQUASH_SPLICE_PASSTHROUGH_SPLICE;
+      else
+        method = SQUASH_SPLICE_PASSTHROUGH_NONE;
+    } else {
+      return squash_error (SQUASH_IO);
+    }
+  }
+
+  return SQUASH_OK;
+}
+
+/* squash_splice_passthrough for stdio streams.  Only possible when we
+   can tell where the input stream really is, i.e., it is seekable;
+   data stdio has buffered from a pipe would be lost. */
+static SquashStatus
+squash_splice_passthrough_file (FILE* fp_out, FILE* fp_in, size_t size, size_t* copied) {
+  const int fd_in = fileno (fp_in);
+  const int fd_out = fileno (fp_out);
+
+  *copied = 0;
+
+  if (fd_in < 0 || fd_out < 0)
+    return SQUASH_PASSTHROUGH_FAILED;
+
+  const off_t in_pos = ftello (fp_in);
+  if (in_pos < 0 || lseek (fd_in, in_pos, SEEK_SET) != in_pos)
+    return SQUASH_PASSTHROUGH_FAILED;
+
+  if (SQUASH_FFLUSH_UNLOCKED(fp_out) != 0)
+    return squash_error (SQUASH_IO);
+
+  SquashStatus res = squash_splice_passthrough (fd_out, fd_in, size, copied);
+
+  /* Bring stdio back in sync with the descriptors. */
+  if (fseeko (fp_in, in_pos + (off_t) *copied, SEEK_SET) != 0 && res >= 0)
+    res = squash_error (SQUASH_IO);
+  const off_t out_pos = lseek (fd_out, 0, SEEK_CUR);
+  if (out_pos >= 0 && fseeko (fp_out, out_pos, SEEK_SET) != 0 && res >= 0)
+    res = squash_error (SQUASH_IO);
+
+  return res;
+}
+#endif /* !defined(_WIN32) */
+
 /**
  * @brief compress or decompress the contents of one file to another
  *
@@ -390,6 +587,10 @@ squash_file_splice (FILE* fp_in,
  * in order to reduce memory usage and increase performance, and so
  * should be preferred over writing similar code manually.
  *
+ * For codecs which don't change the data (like "copy"), the kernel
+ * is asked to move it directly between the files (using
+ * copy_file_range, sendfile, or splice) where possible.
+ *
  * @param fp_in the input *FILE* pointer
  * @param fp_out the output *FILE* pointer
  * @param size number of bytes (uncompressed) to transfer from @a
@@ -416,11 +617,29 @@ squash_splice_with_options (SquashCodec* codec,
 
   call_once (&squash_splice_detect_once, squash_splice_detect_enable);
 
-  squash_object_ref (options);
+  /* Stored frames are only understood by the buffer API */
+  if (SQUASH_UNLIKELY(squash_options_get_store_incompressible (options) != 0.0))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  squash_options_hold (options);
 
   SQUASH_FLOCKFILE(fp_in);
   SQUASH_FLOCKFILE(fp_out);
 
+#if !defined(_WIN32)
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_PASSTHROUGH) == SQUASH_CODEC_INFO_PASSTHROUGH) {
+    size_t copied;
+    res = squash_splice_passthrough_file (fp_out, fp_in, size, &copied);
+    if (res == SQUASH_PASSTHROUGH_FAILED) {
+      res = SQUASH_MMAP_FAILED;
+      if (size != 0)
+        size -= copied;
+    } else {
+      goto cleanup;
+    }
+  }
+#endif
+
   if (codec->impl.splice != NULL) {
     res = squash_file_splice (fp_in, fp_out, size, stream_type, codec, options);
   } else {
@@ -434,14 +653,672 @@ squash_splice_with_options (SquashCodec* codec,
       res = squash_splice_stream (fp_in, fp_out, size, stream_type, codec, options);
   }
 
+#if !defined(_WIN32)
+ cleanup:
+#endif
+
   SQUASH_FUNLOCKFILE(fp_in);
   SQUASH_FUNLOCKFILE(fp_out);
 
-  squash_object_unref (options);
+  squash_options_release (options);
 
   return res;
 }
 
+#if !defined(_WIN32)
+/* State for squash_splice_fd.  Input and output each get
+   SQUASH_SPLICE_FD_QUEUE_DEPTH buffers, carved out of a single
+   allocation so it can be registered with io_uring in one go.  Reads
+   are issued ahead of the codec and writes as soon as a buffer fills
+   up, so disk I/O overlaps with compression.  Without io_uring the
+   same code does each read or write synchronously. */
+
+typedef struct {
+  uint8_t* data;
+  /* Reads: bytes read so far.  Writes: bytes queued. */
+  size_t size;
+  /* Reads: bytes consumed.  Writes: bytes written so far. */
+  size_t pos;
+  size_t requested;
+  /* Offset of data[0] in the file, or -1 for the file position */
+  int64_t offset;
+  bool busy;
+  bool ready;
+} SquashSpliceFdChunk;
+
+struct SquashSpliceFdData {
+  int fd_in;
+  int fd_out;
+  SquashUring* ring;
+  uint8_t* buffer;
+  SquashStatus status;
+
+  bool in_seekable;
+  bool in_eof;
+  int64_t in_offset;
+  uint64_t in_consumed;
+  size_t in_limit;
+  unsigned int in_head;
+  unsigned int in_next;
+  unsigned int in_busy;
+
+  bool out_seekable;
+  int64_t out_offset;
+  unsigned int out_fill;
+  unsigned int out_busy;
+
+  SquashSpliceFdChunk in[SQUASH_SPLICE_FD_QUEUE_DEPTH];
+  SquashSpliceFdChunk out[SQUASH_SPLICE_FD_QUEUE_DEPTH];
+};
+
+/* Request IDs below the queue depth are reads, the next
+   SQUASH_SPLICE_FD_QUEUE_DEPTH are writes. */
+#define SQUASH_SPLICE_FD_CANCEL_ID UINT64_MAX
+
+static void squash_splice_fd_complete (struct SquashSpliceFdData* ctx, uint64_t id, int32_t result);
+
+/* Start (or continue, after a short transfer) the I/O for a chunk. */
+static void
+squash_splice_fd_queue (struct SquashSpliceFdData* ctx, uint64_t id) {
+  const bool is_write = id >= SQUASH_SPLICE_FD_QUEUE_DEPTH;
+  SquashSpliceFdChunk* chunk = is_write ? &(ctx->out[id - SQUASH_SPLICE_FD_QUEUE_DEPTH]) : &(ctx->in[id]);
+  const size_t done = is_write ? chunk->pos : chunk->size;
+  const size_t length = (is_write ? chunk->size : chunk->requested) - done;
+  const int64_t offset = (chunk->offset < 0) ? -1 : (chunk->offset + (int64_t) done);
+  const int fd = is_write ? ctx->fd_out : ctx->fd_in;
+  ssize_t r;
+
+  chunk->busy = true;
+  if (is_write)
+    ctx->out_busy++;
+  else
+    ctx->in_busy++;
+
+  if (ctx->ring != NULL) {
+    if (squash_uring_prep_rw (ctx->ring, is_write, fd, chunk->data + done, length, offset, id) &&
+        squash_uring_submit (ctx->ring))
+      return;
+
+    squash_splice_fd_complete (ctx, id, -EIO);
+    return;
+  }
+
+  if (is_write)
+    r = (offset < 0) ? write (fd, chunk->data + done, length) : pwrite (fd, chunk->data + done, length, (off_t) offset);
+  else
+    r = (offset < 0) ? read (fd, chunk->data + done, length) : pread (fd, chunk->data + done, length, (off_t) offset);
+
+  squash_splice_fd_complete (ctx, id, (r < 0) ? -errno : (int32_t) r);
+}
+
+static void
+squash_splice_fd_complete (struct SquashSpliceFdData* ctx, uint64_t id, int32_t result) {
+  if (id == SQUASH_SPLICE_FD_CANCEL_ID)
+    return;
+
+  const bool is_write = id >= SQUASH_SPLICE_FD_QUEUE_DEPTH;
+  SquashSpliceFdChunk* chunk = is_write ? &(ctx->out[id - SQUASH_SPLICE_FD_QUEUE_DEPTH]) : &(ctx->in[id]);
+
+  chunk->busy = false;
+  if (is_write)
+    ctx->out_busy--;
+  else
+    ctx->in_busy--;
+
+  if (result == -EINTR || result == -EAGAIN) {
+    squash_splice_fd_queue (ctx, id);
+    return;
+  }
+
+  if (!is_write && result == -ECANCELED) {
+    chunk->ready = true;
+    ctx->in_eof = true;
+    return;
+  }
+
+  if (result < 0 || (is_write && result == 0)) {
+    if (ctx->status >= 0)
+      ctx->status = squash_error (SQUASH_IO);
+    if (is_write) {
+      chunk->size = chunk->pos = 0;
+    } else {
+      chunk->ready = true;
+      ctx->in_eof = true;
+    }
+    return;
+  }
+
+  if (is_write) {
+    chunk->pos += (size_t) result;
+    if (chunk->pos < chunk->size)
+      squash_splice_fd_queue (ctx, id);
+    else
+      chunk->size = chunk->pos = 0;
+  } else {
+    chunk->size += (size_t) result;
+    if (result == 0) {
+      ctx->in_eof = true;
+    } else if (chunk->offset >= 0 && chunk->size < chunk->requested) {
+      squash_splice_fd_queue (ctx, id);
+      return;
+    } else if (chunk->offset < 0 && ctx->in_limit != SIZE_MAX) {
+      ctx->in_limit += chunk->requested - chunk->size;
+    }
+    chunk->ready = true;
+  }
+}
+
+static bool
+squash_splice_fd_reap (struct SquashSpliceFdData* ctx) {
+  uint64_t id;
+  int32_t result;
+
+  assert (ctx->ring != NULL);
+
+  if (!squash_uring_wait (ctx->ring, &id, &result)) {
+    if (ctx->status >= 0)
+      ctx->status = squash_error (SQUASH_IO);
+    return false;
+  }
+
+  squash_splice_fd_complete (ctx, id, result);
+
+  return true;
+}
+
+/* Issue reads for free input buffers.  Regular files get a read per
+   buffer at successive offsets; anything else (pipes, sockets) only
+   gets one read at a time since they are consumed in order.  Without
+   io_uring a read blocks, so only read when we have nothing else. */
+static void
+squash_splice_fd_fill (struct SquashSpliceFdData* ctx) {
+  const unsigned int max_busy = ctx->in_seekable ? SQUASH_SPLICE_FD_QUEUE_DEPTH : 1;
+
+  while (!ctx->in_eof && ctx->status >= 0 && ctx->in_busy < max_busy) {
+    SquashSpliceFdChunk* chunk = &(ctx->in[ctx->in_next]);
+    if (chunk->busy || chunk->ready)
+      break;
+    if (ctx->ring == NULL && ctx->in[ctx->in_head].ready)
+      break;
+
+    if (ctx->in_limit == 0) {
+      ctx->in_eof = true;
+      break;
+    }
+
+    chunk->requested = (ctx->in_limit < SQUASH_SPLICE_FD_BUF_SIZE) ? ctx->in_limit : SQUASH_SPLICE_FD_BUF_SIZE;
+    if (ctx->in_limit != SIZE_MAX)
+      ctx->in_limit -= chunk->requested;
+    chunk->size = chunk->pos = 0;
+    chunk->offset = ctx->in_seekable ? ctx->in_offset : -1;
+    if (ctx->in_seekable)
+      ctx->in_offset += (int64_t) chunk->requested;
+
+    const uint64_t id = ctx->in_next;
+    ctx->in_next = (ctx->in_next + 1) % SQUASH_SPLICE_FD_QUEUE_DEPTH;
+    squash_splice_fd_queue (ctx, id);
+  }
+}
+
+/* Wait until the input buffer at the head of the queue has data,
+   first releasing it if everything in it has been consumed.  Returns
+   NULL at the end of the input (or on error). */
+static SquashSpliceFdChunk*
+squash_splice_fd_input (struct SquashSpliceFdData* ctx) {
+  while (ctx->status >= 0) {
+    SquashSpliceFdChunk* chunk = &(ctx->in[ctx->in_head]);
+
+    if (chunk->ready) {
+      if (chunk->pos < chunk->size)
+        return chunk;
+      else if (chunk->size == 0)
+        return NULL;
+
+      chunk->ready = false;
+      ctx->in_head = (ctx->in_head + 1) % SQUASH_SPLICE_FD_QUEUE_DEPTH;
+      if (ctx->ring != NULL)
+        squash_splice_fd_fill (ctx);
+      continue;
+    }
+
+    if (!chunk->busy)
+      squash_splice_fd_fill (ctx);
+
+    if (chunk->busy) {
+      if (!squash_splice_fd_reap (ctx))
+        return NULL;
+    } else if (!chunk->ready) {
+      return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+/* The output buffer currently being filled, once any earlier write
+   from it has finished. */
+static SquashSpliceFdChunk*
+squash_splice_fd_output (struct SquashSpliceFdData* ctx) {
+  SquashSpliceFdChunk* chunk = &(ctx->out[ctx->out_fill]);
+
+  while (chunk->busy && ctx->status >= 0) {
+    if (!squash_splice_fd_reap (ctx))
+      break;
+  }
+
+  return (ctx->status < 0) ? NULL : chunk;
+}
+
+/* Write the current output buffer and move on to the next one. */
+static void
+squash_splice_fd_flush (struct SquashSpliceFdData* ctx) {
+  SquashSpliceFdChunk* chunk = &(ctx->out[ctx->out_fill]);
+
+  if (chunk->size == 0 || chunk->busy)
+    return;
+
+  /* Writes to anything other than a regular file have to happen in
+     order, so only one may be in flight. */
+  if (!ctx->out_seekable) {
+    while (ctx->out_busy != 0 && ctx->status >= 0) {
+      if (!squash_splice_fd_reap (ctx))
+        return;
+    }
+  }
+
+  chunk->pos = 0;
+  chunk->offset = ctx->out_seekable ? ctx->out_offset : -1;
+  if (ctx->out_seekable)
+    ctx->out_offset += (int64_t) chunk->size;
+
+  const uint64_t id = SQUASH_SPLICE_FD_QUEUE_DEPTH + ctx->out_fill;
+  ctx->out_fill = (ctx->out_fill + 1) % SQUASH_SPLICE_FD_QUEUE_DEPTH;
+  squash_splice_fd_queue (ctx, id);
+}
+
+static SquashStatus
+squash_splice_fd_read (size_t* data_size,
+                       uint8_t data[SQUASH_ARRAY_PARAM(*data_size)],
+                       void* user_data) {
+  struct SquashSpliceFdData* ctx = (struct SquashSpliceFdData*) user_data;
+  const size_t requested = *data_size;
+
+  *data_size = 0;
+  while (*data_size < requested) {
+    SquashSpliceFdChunk* chunk = squash_splice_fd_input (ctx);
+    if (chunk == NULL)
+      break;
+
+    const size_t length = ((chunk->size - chunk->pos) < (requested - *data_size)) ? (chunk->size - chunk->pos) : (requested - *data_size);
+    memcpy (data + *data_size, chunk->data + chunk->pos, length);
+    chunk->pos += length;
+    *data_size += length;
+    ctx->in_consumed += length;
+
+    /* Don't wait for more data from a pipe if we already have some */
+    if (!ctx->in_seekable)
+      break;
+  }
+
+  if (ctx->status < 0)
+    return ctx->status;
+
+  return (*data_size == 0) ? SQUASH_END_OF_STREAM : SQUASH_OK;
+}
+
+static SquashStatus
+squash_splice_fd_write (size_t* data_size,
+                        const uint8_t data[SQUASH_ARRAY_PARAM(*data_size)],
+                        void* user_data) {
+  struct SquashSpliceFdData* ctx = (struct SquashSpliceFdData*) user_data;
+  size_t written = 0;
+
+  while (written < *data_size) {
+    SquashSpliceFdChunk* chunk = squash_splice_fd_output (ctx);
+    if (chunk == NULL)
+      break;
+
+    const size_t length = ((SQUASH_SPLICE_FD_BUF_SIZE - chunk->size) < (*data_size - written)) ? (SQUASH_SPLICE_FD_BUF_SIZE - chunk->size) : (*data_size - written);
+    memcpy (chunk->data + chunk->size, data + written, length);
+    chunk->size += length;
+    written += length;
+
+    if (chunk->size == SQUASH_SPLICE_FD_BUF_SIZE)
+      squash_splice_fd_flush (ctx);
+  }
+
+  *data_size = written;
+
+  return (ctx->status < 0) ? ctx->status : SQUASH_OK;
+}
+
+/* Run a stream directly on the I/O buffers, so nothing is copied. */
+static SquashStatus
+squash_splice_fd_stream (struct SquashSpliceFdData* ctx,
+                         SquashCodec* codec,
+                         SquashStreamType stream_type,
+                         size_t size,
+                         SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+  const bool limit_output = (stream_type == SQUASH_STREAM_DECOMPRESS && size != 0);
+  size_t remaining = size;
+  bool eof = false;
+
+  SquashStream* stream = squash_codec_create_stream_with_options (codec, stream_type, options);
+  if (SQUASH_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_FAILED);
+
+  while (true) {
+    if (stream->avail_in == 0 && !eof) {
+      SquashSpliceFdChunk* chunk = squash_splice_fd_input (ctx);
+      if (chunk == NULL) {
+        if (ctx->status < 0) {
+          res = ctx->status;
+          break;
+        }
+        eof = true;
+      } else {
+        stream->next_in = chunk->data + chunk->pos;
+        stream->avail_in = chunk->size - chunk->pos;
+        ctx->in_consumed += stream->avail_in;
+        chunk->pos = chunk->size;
+      }
+    }
+
+    SquashSpliceFdChunk* out = squash_splice_fd_output (ctx);
+    if (out == NULL) {
+      res = ctx->status;
+      break;
+    }
+    stream->next_out = out->data + out->size;
+    stream->avail_out = SQUASH_SPLICE_FD_BUF_SIZE - out->size;
+    const size_t avail_out = stream->avail_out;
+
+    if (!eof)
+      res = squash_stream_process (stream);
+    else
+      res = squash_stream_finish (stream);
+
+    size_t produced = avail_out - stream->avail_out;
+    if (limit_output && produced >= remaining) {
+      produced = remaining;
+      res = SQUASH_END_OF_STREAM;
+    }
+    out->size += produced;
+    remaining -= produced;
+    if (out->size == SQUASH_SPLICE_FD_BUF_SIZE)
+      squash_splice_fd_flush (ctx);
+
+    if (res < 0 || res == SQUASH_END_OF_STREAM || (eof && res == SQUASH_OK))
+      break;
+  }
+
+  if (res == SQUASH_END_OF_STREAM)
+    res = SQUASH_OK;
+
+  /* Give back whatever the codec didn't use */
+  ctx->in_consumed -= stream->avail_in;
+
+  squash_object_unref (stream);
+
+  return res;
+}
+
+/* Setting up an io_uring instance and registering its buffers (which
+   pins them) is too expensive to do for every call, so instances are
+   kept, along with their buffers, in a small pool. */
+typedef struct {
+  SquashUring* ring;
+  uint8_t* buffer;
+} SquashSpliceFdRing;
+
+SQUASH_MTX_DEFINE(splice_fd_rings)
+
+static SquashSpliceFdRing squash_splice_fd_rings[SQUASH_SPLICE_FD_RING_POOL_SIZE];
+static size_t squash_splice_fd_rings_length = 0;
+
+#if defined(__GNUC__)
+__attribute__((__destructor__))
+static void
+squash_splice_fd_rings_destroy (void) {
+  for (size_t i = 0 ; i < squash_splice_fd_rings_length ; i++) {
+    squash_uring_free (squash_splice_fd_rings[i].ring);
+    squash_free (squash_splice_fd_rings[i].buffer);
+  }
+  squash_splice_fd_rings_length = 0;
+}
+#endif
+
+static SquashSpliceFdRing
+squash_splice_fd_ring_acquire (size_t buffer_size) {
+  SquashSpliceFdRing entry = { NULL, NULL };
+
+  SQUASH_MTX_LOCK(splice_fd_rings);
+  if (squash_splice_fd_rings_length != 0)
+    entry = squash_splice_fd_rings[--squash_splice_fd_rings_length];
+  SQUASH_MTX_UNLOCK(splice_fd_rings);
+
+  if (entry.ring != NULL)
+    return entry;
+
+  entry.buffer = squash_malloc (buffer_size);
+  if (SQUASH_UNLIKELY(entry.buffer == NULL))
+    return entry;
+
+  /* Room for every read, write, and cancellation at once */
+  entry.ring = squash_uring_new (SQUASH_SPLICE_FD_QUEUE_DEPTH * 4);
+  if (entry.ring != NULL)
+    squash_uring_register_buffer (entry.ring, entry.buffer, buffer_size);
+
+  return entry;
+}
+
+/* Only pass back rings which have no requests left in flight. */
+static void
+squash_splice_fd_ring_release (SquashSpliceFdRing entry, bool reusable) {
+  if (entry.ring != NULL && reusable) {
+    bool pooled = false;
+
+    SQUASH_MTX_LOCK(splice_fd_rings);
+    if (squash_splice_fd_rings_length < SQUASH_SPLICE_FD_RING_POOL_SIZE) {
+      squash_splice_fd_rings[squash_splice_fd_rings_length++] = entry;
+      pooled = true;
+    }
+    SQUASH_MTX_UNLOCK(splice_fd_rings);
+
+    if (pooled)
+      return;
+  }
+
+  if (entry.ring != NULL)
+    squash_uring_free (entry.ring);
+  squash_free (entry.buffer);
+}
+
+static bool
+squash_splice_fd_is_seekable (int fd, bool writing) {
+  struct stat st;
+
+  if (fstat (fd, &st) != 0 || (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)))
+    return false;
+
+  /* O_APPEND ignores the offset, so concurrent writes could land in
+     any order. */
+  if (writing && (fcntl (fd, F_GETFL) & O_APPEND) != 0)
+    return false;
+
+  return lseek (fd, 0, SEEK_CUR) >= 0;
+}
+
+/* Whether a seekable input fits in a single buffer, in which case
+   there is no I/O to overlap and io_uring isn't worth setting up. */
+static bool
+squash_splice_fd_is_small (int fd, int64_t offset) {
+  struct stat st;
+
+  return fstat (fd, &st) == 0 && S_ISREG(st.st_mode) && (st.st_size - offset) <= (off_t) SQUASH_SPLICE_FD_BUF_SIZE;
+}
+
+/**
+ * @brief compress or decompress the contents of one file descriptor
+ *   to another
+ *
+ * Like @ref squash_splice_with_options, but for file descriptors
+ * instead of *FILE* pointers, which avoids stdio's buffering
+ * entirely.  On Linux, io_uring is used (when available) to keep
+ * several reads and writes in flight while the codec works, so I/O
+ * and compression overlap; elsewhere the same buffers are used with
+ * regular reads and writes.  io_uring instances are reused between
+ * calls, and aren't used at all for inputs which fit in a single
+ * buffer.
+ *
+ * As with @ref squash_splice_with_options, data for codecs which
+ * don't change it is moved by the kernel where possible.
+ *
+ * Both descriptors may be regular files, pipes, or sockets.  For
+ * regular files the file position is left just after the data which
+ * was consumed (or written), as if read(2) and write(2) had been
+ * used.
+ *
+ * @param codec codec to use
+ * @param stream_type whether to compress or decompress the data
+ * @param fd_out the output file descriptor
+ * @param fd_in the input file descriptor
+ * @param size number of bytes (uncompressed) to transfer from @a
+ *   fd_in to @a fd_out, or 0 to transfer everything
+ * @param options options to pass to the codec
+ * @returns @ref SQUASH_OK on success, or a negative error code on
+ *   failure
+ */
+SquashStatus
+squash_splice_fd_with_options (SquashCodec* codec,
+                               SquashStreamType stream_type,
+                               int fd_out,
+                               int fd_in,
+                               size_t size,
+                               SquashOptions* options) {
+  SquashStatus res;
+  struct SquashSpliceFdData ctx;
+  SquashSpliceFdRing ring = { NULL, NULL };
+  int64_t in_start = 0;
+
+  assert (codec != NULL);
+  assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
+
+  if (SQUASH_UNLIKELY(fd_in < 0 || fd_out < 0))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  /* Stored frames are only understood by the buffer API */
+  if (SQUASH_UNLIKELY(squash_options_get_store_incompressible (options) != 0.0))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_PASSTHROUGH) == SQUASH_CODEC_INFO_PASSTHROUGH) {
+    size_t copied;
+    res = squash_splice_passthrough (fd_out, fd_in, size, &copied);
+    if (res != SQUASH_PASSTHROUGH_FAILED)
+      return res;
+    if (size != 0)
+      size -= copied;
+  }
+
+  memset (&ctx, 0, sizeof (ctx));
+  ctx.fd_in = fd_in;
+  ctx.fd_out = fd_out;
+  ctx.status = SQUASH_OK;
+  ctx.in_limit = (stream_type == SQUASH_STREAM_COMPRESS && size != 0) ? size : SIZE_MAX;
+
+  ctx.in_seekable = squash_splice_fd_is_seekable (fd_in, false);
+  if (ctx.in_seekable)
+    ctx.in_offset = in_start = (int64_t) lseek (fd_in, 0, SEEK_CUR);
+  ctx.out_seekable = squash_splice_fd_is_seekable (fd_out, true);
+  if (ctx.out_seekable)
+    ctx.out_offset = (int64_t) lseek (fd_out, 0, SEEK_CUR);
+
+  const size_t buffer_size = SQUASH_SPLICE_FD_BUF_SIZE * SQUASH_SPLICE_FD_QUEUE_DEPTH * 2;
+  if (ctx.in_seekable && squash_splice_fd_is_small (fd_in, in_start))
+    ring.buffer = squash_malloc (buffer_size);
+  else
+    ring = squash_splice_fd_ring_acquire (buffer_size);
+  if (SQUASH_UNLIKELY(ring.buffer == NULL))
+    return squash_error (SQUASH_MEMORY);
+  ctx.ring = ring.ring;
+  ctx.buffer = ring.buffer;
+
+  for (size_t i = 0 ; i < SQUASH_SPLICE_FD_QUEUE_DEPTH ; i++) {
+    ctx.in[i].data = ctx.buffer + (i * SQUASH_SPLICE_FD_BUF_SIZE);
+    ctx.out[i].data = ctx.buffer + ((SQUASH_SPLICE_FD_QUEUE_DEPTH + i) * SQUASH_SPLICE_FD_BUF_SIZE);
+  }
+
+  squash_options_hold (options);
+
+  if (codec->impl.splice == NULL && codec->impl.process_stream != NULL)
+    res = squash_splice_fd_stream (&ctx, codec, stream_type, size, options);
+  else
+    res = squash_splice_custom_with_options (codec, stream_type, squash_splice_fd_write, squash_splice_fd_read, &ctx, size, options);
+
+  squash_options_release (options);
+
+  if (res >= 0)
+    squash_splice_fd_flush (&ctx);
+
+  if (ctx.ring != NULL) {
+    /* A read from a pipe may never complete, so cancel any which are
+       still outstanding rather than waiting for them. */
+    if (!ctx.in_seekable) {
+      for (uint64_t i = 0 ; i < SQUASH_SPLICE_FD_QUEUE_DEPTH ; i++) {
+        if (ctx.in[i].busy)
+          squash_uring_prep_cancel (ctx.ring, i, SQUASH_SPLICE_FD_CANCEL_ID);
+      }
+    }
+
+    while (ctx.in_busy != 0 || ctx.out_busy != 0) {
+      if (!squash_splice_fd_reap (&ctx))
+        break;
+    }
+  }
+
+  if (res >= 0 && ctx.status < 0)
+    res = ctx.status;
+
+  if (ctx.in_seekable)
+    lseek (fd_in, (off_t) (in_start + (int64_t) ctx.in_consumed), SEEK_SET);
+  if (ctx.out_seekable)
+    lseek (fd_out, (off_t) ctx.out_offset, SEEK_SET);
+
+  squash_splice_fd_ring_release (ring, ctx.in_busy == 0 && ctx.out_busy == 0);
+
+  return res;
+}
+
+/**
+ * @brief compress or decompress the contents of one file descriptor
+ *   to another
+ *
+ * @param codec codec to use
+ * @param stream_type whether to compress or decompress the data
+ * @param fd_out the output file descriptor
+ * @param fd_in the input file descriptor
+ * @param size number of bytes (uncompressed) to transfer from @a
+ *   fd_in to @a fd_out, or 0 to transfer everything
+ * @param ... list of options (with a *NULL* sentinel)
+ * @returns @ref SQUASH_OK on success, or a negative error code on
+ *   failure
+ * @see squash_splice_fd_with_options
+ */
+SquashStatus
+squash_splice_fd (SquashCodec* codec, SquashStreamType stream_type, int fd_out, int fd_in, size_t size, ...) {
+  assert (codec != NULL);
+
+  SquashOptions* options = NULL;
+  va_list ap;
+  va_start (ap, size);
+  options = squash_options_newv (codec, ap);
+  va_end (ap);
+
+  return squash_splice_fd_with_options (codec, stream_type, fd_out, fd_in, size, options);
+}
+#endif /* !defined(_WIN32) */
+
 #define SQUASH_SPLICE_BUF_SIZE ((size_t) 512)
 
 #if !defined(SQUASH_SPLICE_BUF_SIZE)
@@ -526,11 +1403,16 @@ squash_splice_custom_with_options (SquashCodec* codec,
   const bool limit_input = (stream_type == SQUASH_STREAM_COMPRESS && size != 0);
   const bool limit_output = (stream_type == SQUASH_STREAM_DECOMPRESS && size != 0);
 
-  squash_object_ref (options);
+  if (SQUASH_UNLIKELY(squash_options_get_store_incompressible (options) != 0.0))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  squash_options_hold (options);
 
   if (codec->impl.splice != NULL) {
+    SquashMemoryScope scope = squash_memory_scope_enter (NULL, &(codec->memory));
+
     if (size == 0) {
-      res = codec->impl.splice (codec, options, stream_type, squash_file_splice_read, squash_file_splice_write, user_data);
+      res = codec->impl.splice (codec, options, stream_type, read_cb, write_cb, user_data);
     } else {
       /* We need to limit the amount of data input (for compression)
          and output (for decompression), so we some wrapper
@@ -549,6 +1431,8 @@ squash_splice_custom_with_options (SquashCodec* codec,
         res = SQUASH_OK;
       }
     }
+
+    squash_memory_scope_leave (scope);
   } else if (codec->impl.process_stream) {
     SquashStream* stream = squash_stream_new_with_options(codec, stream_type, options);
     if (SQUASH_UNLIKELY(stream == NULL))
@@ -716,7 +1600,7 @@ squash_splice_custom_with_options (SquashCodec* codec,
     squash_free (out_data);
   }
 
-  squash_object_unref (options);
+  squash_options_release (options);
 
   return res;
 }
@@ -71,6 +71,24 @@ SQUASH_API SquashStatus squash_splice_custom_with_options (SquashCodec* codec,
                                                            size_t size,
                                                            SquashOptions* options);
 
+#if !defined(_WIN32)
+SQUASH_SENTINEL
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_splice_fd                  (SquashCodec* codec,
+                                                           SquashStreamType stream_type,
+                                                           int fd_out,
+                                                           int fd_in,
+                                                           size_t size,
+                                                           ...);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus squash_splice_fd_with_options     (SquashCodec* codec,
+                                                           SquashStreamType stream_type,
+                                                           int fd_out,
+                                                           int fd_in,
+                                                           size_t size,
+                                                           SquashOptions* options);
+#endif
+
 SQUASH_END_DECLS
 
 #endif /* SQUASH_SPLICE_H */
@@ -130,6 +130,11 @@
  * possible @ref SQUASH_RANGE will be returned.
  */
 
+/**
+ * @var SquashStatus::SQUASH_CANCELLED
+ * @brief The operation was cancelled before it was started
+ */
+
 /**
  * @brief Get a string representation of a status code.
  *
@@ -171,6 +176,8 @@ squash_status_to_string (SquashStatus status) {
       return "I/O error";
     case SQUASH_RANGE:
       return "Attempted to convert value outside of valid range";
+    case SQUASH_CANCELLED:
+      return "Operation cancelled";
     default:
       return "Unknown.";
   }
@@ -51,7 +51,8 @@ typedef enum {
   SQUASH_NOT_FOUND             = -10,
   SQUASH_INVALID_BUFFER        = -11,
   SQUASH_IO                    = -12,
-  SQUASH_RANGE                 = -13
+  SQUASH_RANGE                 = -13,
+  SQUASH_CANCELLED             = -14
 } SquashStatus;
 
 SQUASH_API const char* squash_status_to_string (SquashStatus status);
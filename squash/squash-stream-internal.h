@@ -34,6 +34,26 @@
 
 SQUASH_BEGIN_DECLS
 
+#if defined(SQUASH_ENABLE_COROUTINES)
+#  include <ucontext.h>
+#endif
+
+#if !defined(SQUASH_STREAM_COROUTINE_STACK_SIZE)
+#  define SQUASH_STREAM_COROUTINE_STACK_SIZE ((size_t) (1024 * 1024))
+#endif
+
+#if defined(SQUASH_ENABLE_COROUTINES)
+struct SquashStreamPrivate_ {
+  ucontext_t caller;
+  ucontext_t coroutine;
+  void* stack;
+  bool started;
+  bool finished;
+
+  SquashOperation request;
+  SquashStatus result;
+};
+#else
 struct SquashStreamPrivate_ {
   thrd_t thread;
   bool finished;
@@ -46,6 +66,7 @@ struct SquashStreamPrivate_ {
   SquashStatus result;
   cnd_t result_cnd;
 };
+#endif
 
 #define SQUASH_OPERATION_INVALID ((SquashOperation) 0)
 #define SQUASH_STATUS_INVALID ((SquashStatus) 0)
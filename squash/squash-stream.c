@@ -24,6 +24,9 @@
  *   Evan Nemerson <evan@nemerson.com>
  */
 
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
 #include <assert.h>
 #include "squash-internal.h"
 #include <stdarg.h>
@@ -35,6 +38,13 @@
 
 #include "squash/tinycthread/source/tinycthread.h"
 
+#if defined(SQUASH_ENABLE_COROUTINES)
+#  include <sys/mman.h>
+#  if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#    define MAP_ANONYMOUS MAP_ANON
+#  endif
+#endif
+
 /**
  * @var SquashStream_::base_object
  * @brief Base object.
@@ -121,6 +131,15 @@
  *   necessary.
  */
 
+/**
+ * @var SquashStream_::allocator
+ * @brief Allocator for the codec's internal state, or *NULL*
+ *
+ * Plugins should route allocations made by the underlying library
+ * through this (see ::squash_allocator_malloc, which accepts *NULL*).
+ * It is set when the stream is created and must not be modified.
+ */
+
 /**
  * @defgroup SquashStream SquashStream
  * @brief Low-level compression and decompression streams.
@@ -189,10 +208,19 @@
  * @struct SquashStreamPrivate_
  * @brief Private data for streams
  *
- * Currently this is used exclusively for information for thread-based
- * plugins.
+ * Currently this is used exclusively for information for plugins
+ * which only implement the splice API.  Depending on how Squash was
+ * built, the splice function is run either in a separate thread or,
+ * when `SQUASH_ENABLE_COROUTINES` is defined, in a coroutine on the
+ * caller's thread.
  */
 
+#if defined(SQUASH_ENABLE_COROUTINES)
+/* makecontext can only portably pass int arguments, so the stream is
+   handed to the coroutine entry point through this variable instead. */
+static SQUASH_THREAD_LOCAL SquashStream* squash_stream_coroutine_stream = NULL;
+#endif
+
 /**
  * @brief Yield execution back to the main thread
  * @protected
@@ -215,6 +243,18 @@ squash_stream_yield (SquashStream* stream, SquashStatus status) {
   priv->request = SQUASH_OPERATION_INVALID;
   priv->result = status;
 
+#if defined(SQUASH_ENABLE_COROUTINES)
+  if (status < 0) {
+    priv->finished = true;
+    setcontext (&(priv->caller));
+    squash_assert_unreachable ();
+  }
+
+  swapcontext (&(priv->coroutine), &(priv->caller));
+  operation = priv->request;
+  assert (operation != SQUASH_OPERATION_INVALID);
+  return operation;
+#else
   cnd_signal (&(priv->result_cnd));
   mtx_unlock (&(priv->io_mtx));
   if (status < 0)
@@ -225,6 +265,7 @@ squash_stream_yield (SquashStream* stream, SquashStatus status) {
     cnd_wait (&(priv->request_cnd), &(priv->io_mtx));
   }
   return operation;
+#endif
 }
 
 static SquashStatus
@@ -305,6 +346,52 @@ squash_stream_write_cb (size_t* data_size,
   return (*data_size != 0) ? SQUASH_OK : SQUASH_FAILED;
 }
 
+#if defined(SQUASH_ENABLE_COROUTINES)
+static void
+squash_stream_coroutine_func (void) {
+  SquashStream* stream = squash_stream_coroutine_stream;
+  assert (stream != NULL);
+
+  SquashStreamPrivate* priv = stream->priv;
+  SquashCodec* codec = stream->codec;
+
+  assert (priv != NULL);
+  assert (codec != NULL);
+  assert (priv->request != SQUASH_OPERATION_INVALID);
+  priv->request = SQUASH_OPERATION_INVALID;
+
+  assert (codec->impl.splice != NULL);
+
+  priv->result = codec->impl.splice (codec, stream->options, stream->stream_type, squash_stream_read_cb, squash_stream_write_cb, stream);
+  if (priv->result == SQUASH_OK)
+    priv->result = SQUASH_END_OF_STREAM;
+
+  /* There is nothing to return to; the coroutine is never resumed
+     once it has finished. */
+  priv->finished = true;
+  setcontext (&(priv->caller));
+  squash_assert_unreachable ();
+}
+
+static SquashStatus
+squash_stream_send_to_thread (SquashStream* stream, SquashOperation operation) {
+  SquashStreamPrivate* priv = stream->priv;
+  SquashStatus result;
+
+  assert (!priv->finished);
+
+  priv->request = operation;
+  priv->started = true;
+  squash_stream_coroutine_stream = stream;
+  swapcontext (&(priv->caller), &(priv->coroutine));
+
+  result = priv->result;
+  priv->result = SQUASH_STATUS_INVALID;
+  assert (result != SQUASH_STATUS_INVALID);
+
+  return result;
+}
+#else
 static int
 squash_stream_thread_func (SquashStream* stream) {
   assert (stream != NULL);
@@ -327,6 +414,9 @@ squash_stream_thread_func (SquashStream* stream) {
 
   assert (codec->impl.splice != NULL);
 
+  /* The caller's scope doesn't extend to this thread */
+  squash_memory_scope_enter (stream->memory, &(codec->memory));
+
   priv->result = codec->impl.splice (codec, stream->options, stream->stream_type, squash_stream_read_cb, squash_stream_write_cb, stream);
   if (priv->result == SQUASH_OK)
     priv->result = SQUASH_END_OF_STREAM;
@@ -360,6 +450,124 @@ squash_stream_send_to_thread (SquashStream* stream, SquashOperation operation) {
 
   return result;
 }
+#endif /* defined(SQUASH_ENABLE_COROUTINES) */
+
+#if defined(SQUASH_ENABLE_COROUTINES)
+/* The coroutine's stack, with an inaccessible page below it so a
+   plugin which overflows it crashes instead of quietly scribbling on
+   whatever happens to be next to it. */
+static void*
+squash_stream_coroutine_stack_new (void) {
+  const size_t page_size = squash_get_page_size ();
+  void* mapping = mmap (NULL, SQUASH_STREAM_COROUTINE_STACK_SIZE + page_size,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (SQUASH_UNLIKELY(mapping == MAP_FAILED))
+    return NULL;
+
+  if (SQUASH_UNLIKELY(mprotect (mapping, page_size, PROT_NONE) != 0)) {
+    munmap (mapping, SQUASH_STREAM_COROUTINE_STACK_SIZE + page_size);
+    return NULL;
+  }
+
+  return ((uint8_t*) mapping) + page_size;
+}
+
+static void
+squash_stream_coroutine_stack_free (void* stack) {
+  const size_t page_size = squash_get_page_size ();
+
+  if (stack != NULL)
+    munmap (((uint8_t*) stack) - page_size, SQUASH_STREAM_COROUTINE_STACK_SIZE + page_size);
+}
+#endif
+
+static SquashStatus
+squash_stream_private_init (SquashStream* s) {
+  s->priv = squash_malloc (sizeof (SquashStreamPrivate));
+  if (SQUASH_UNLIKELY(s->priv == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+#if defined(SQUASH_ENABLE_COROUTINES)
+  s->priv->request = SQUASH_OPERATION_INVALID;
+  s->priv->result = SQUASH_STATUS_INVALID;
+  s->priv->started = false;
+  s->priv->finished = false;
+
+  /* The coroutine doesn't actually start running until the first
+     request is sent to it. */
+  s->priv->stack = squash_stream_coroutine_stack_new ();
+  if (SQUASH_UNLIKELY(s->priv->stack == NULL)) {
+    squash_free (s->priv);
+    s->priv = NULL;
+    return squash_error (SQUASH_MEMORY);
+  }
+
+  if (SQUASH_UNLIKELY(getcontext (&(s->priv->coroutine)) != 0)) {
+    squash_stream_coroutine_stack_free (s->priv->stack);
+    squash_free (s->priv);
+    s->priv = NULL;
+    return squash_error (SQUASH_FAILED);
+  }
+  s->priv->coroutine.uc_stack.ss_sp = s->priv->stack;
+  s->priv->coroutine.uc_stack.ss_size = SQUASH_STREAM_COROUTINE_STACK_SIZE;
+  s->priv->coroutine.uc_link = NULL;
+  makecontext (&(s->priv->coroutine), squash_stream_coroutine_func, 0);
+#else
+  mtx_init (&(s->priv->io_mtx), mtx_plain);
+  mtx_lock (&(s->priv->io_mtx));
+
+  s->priv->request = SQUASH_OPERATION_INVALID;
+  cnd_init (&(s->priv->request_cnd));
+
+  s->priv->result = SQUASH_STATUS_INVALID;
+  cnd_init (&(s->priv->result_cnd));
+
+  s->priv->finished = false;
+  if (SQUASH_UNLIKELY(thrd_create (&(s->priv->thread), (thrd_start_t) squash_stream_thread_func, s) != thrd_success)) {
+    mtx_unlock (&(s->priv->io_mtx));
+    cnd_destroy (&(s->priv->request_cnd));
+    cnd_destroy (&(s->priv->result_cnd));
+    mtx_destroy (&(s->priv->io_mtx));
+    squash_free (s->priv);
+    s->priv = NULL;
+    return squash_error (SQUASH_FAILED);
+  }
+
+  while (s->priv->result == SQUASH_STATUS_INVALID)
+    cnd_wait (&(s->priv->result_cnd), &(s->priv->io_mtx));
+  s->priv->result = SQUASH_STATUS_INVALID;
+#endif
+
+  return SQUASH_OK;
+}
+
+static void
+squash_stream_private_destroy (SquashStream* s) {
+  SquashStreamPrivate* priv = (SquashStreamPrivate*) s->priv;
+
+#if defined(SQUASH_ENABLE_COROUTINES)
+  /* If the coroutine was never started there is no need to run it
+     just to tell it to stop. */
+  if (priv->started && !priv->finished) {
+    squash_stream_send_to_thread (s, SQUASH_OPERATION_TERMINATE);
+  }
+  squash_stream_coroutine_stack_free (priv->stack);
+#else
+  if (!priv->finished) {
+    squash_stream_send_to_thread (s, SQUASH_OPERATION_TERMINATE);
+  }
+  cnd_destroy (&(priv->request_cnd));
+  cnd_destroy (&(priv->result_cnd));
+  mtx_destroy (&(priv->io_mtx));
+#endif
+
+  squash_free (s->priv);
+  s->priv = NULL;
+}
+
+/* Allocator for streams initialized on this thread, set only while
+   ::squash_stream_new_with_allocator is creating one. */
+static SQUASH_THREAD_LOCAL SquashAllocator* squash_stream_init_allocator = NULL;
 
 /**
  * @brief Initialize a stream.
@@ -408,31 +616,14 @@ squash_stream_init (void* stream,
   s->user_data = NULL;
   s->destroy_user_data = NULL;
 
-  if (codec->impl.create_stream == NULL && codec->impl.splice != NULL) {
-    s->priv = squash_malloc (sizeof (SquashStreamPrivate));
-
-    mtx_init (&(s->priv->io_mtx), mtx_plain);
-    mtx_lock (&(s->priv->io_mtx));
+  s->allocator = (squash_stream_init_allocator != NULL) ? squash_object_ref (squash_stream_init_allocator) : NULL;
+  s->memory = squash_memory_counter_ref (squash_memory_scope_get_stream ());
 
-    s->priv->request = SQUASH_OPERATION_INVALID;
-    cnd_init (&(s->priv->request_cnd));
-
-    s->priv->result = SQUASH_STATUS_INVALID;
-    cnd_init (&(s->priv->result_cnd));
-
-    s->priv->finished = false;
-#if !defined(NDEBUG)
-    int res =
-#endif
-      thrd_create (&(s->priv->thread), (thrd_start_t) squash_stream_thread_func, s);
-    assert (res == thrd_success);
-
-    while (s->priv->result == SQUASH_STATUS_INVALID)
-      cnd_wait (&(s->priv->result_cnd), &(s->priv->io_mtx));
-    s->priv->result = SQUASH_STATUS_INVALID;
-  } else {
-    s->priv = NULL;
-  }
+  /* If this fails priv is left NULL; squash_codec_create_stream
+     checks for that and gives up on the stream. */
+  s->priv = NULL;
+  if (codec->impl.create_stream == NULL && codec->impl.splice != NULL)
+    squash_stream_private_init (s);
 }
 
 /**
@@ -460,18 +651,8 @@ squash_stream_destroy (void* stream) {
 
   s = (SquashStream*) stream;
 
-  if (SQUASH_UNLIKELY(s->priv != NULL)) {
-    SquashStreamPrivate* priv = (SquashStreamPrivate*) s->priv;
-
-    if (!priv->finished) {
-      squash_stream_send_to_thread (s, SQUASH_OPERATION_TERMINATE);
-    }
-    cnd_destroy (&(priv->request_cnd));
-    cnd_destroy (&(priv->result_cnd));
-    mtx_destroy (&(priv->io_mtx));
-
-    squash_free (s->priv);
-  }
+  if (SQUASH_UNLIKELY(s->priv != NULL))
+    squash_stream_private_destroy (s);
 
   if (s->destroy_user_data != NULL && s->user_data != NULL) {
     s->destroy_user_data (s->user_data);
@@ -481,9 +662,71 @@ squash_stream_destroy (void* stream) {
     s->options = squash_object_unref (s->options);
   }
 
+  if (s->allocator != NULL) {
+    s->allocator = squash_object_unref (s->allocator);
+  }
+
+  squash_memory_counter_unref (s->memory);
+  s->memory = NULL;
+
   squash_object_destroy (stream);
 }
 
+/**
+ * @brief Reset a stream so it can be reused
+ *
+ * Return the stream to the state it was in immediately after it was
+ * created, with the same codec, type and options, discarding any
+ * pending input and output.  Where the plugin supports it, the
+ * underlying library context is reset in place instead of being
+ * destroyed and recreated, which is considerably cheaper for many
+ * codecs than creating a new stream.
+ *
+ * @param stream The stream
+ * @return A status code
+ * @retval SQUASH_INVALID_OPERATION The codec does not support
+ *   resetting streams
+ */
+SquashStatus
+squash_stream_reset (SquashStream* stream) {
+  SquashCodecImpl* impl;
+  SquashStatus res = SQUASH_OK;
+
+  assert (stream != NULL);
+
+  impl = squash_codec_get_impl (stream->codec);
+  assert (impl != NULL);
+
+  if (impl->create_stream != NULL && impl->reset_stream == NULL)
+    return squash_error (SQUASH_INVALID_OPERATION);
+
+  stream->next_in = NULL;
+  stream->avail_in = 0;
+  stream->total_in = 0;
+
+  stream->next_out = NULL;
+  stream->avail_out = 0;
+  stream->total_out = 0;
+
+  stream->state = SQUASH_STREAM_STATE_IDLE;
+
+  SquashMemoryScope scope = squash_memory_scope_enter (stream->memory, &(stream->codec->memory));
+
+  if (impl->create_stream != NULL) {
+    res = impl->reset_stream (stream);
+  } else if (impl->splice != NULL) {
+    if (stream->priv != NULL)
+      squash_stream_private_destroy (stream);
+    res = squash_stream_private_init (stream);
+  } else {
+    squash_buffer_stream_reset ((SquashBufferStream*) stream);
+  }
+
+  squash_memory_scope_leave (scope);
+
+  return res;
+}
+
 /**
  * @brief Create a new stream with an options instance
  *
@@ -499,6 +742,84 @@ squash_stream_new_with_options (SquashCodec* codec,
   return squash_codec_create_stream_with_options (codec, stream_type, options);
 }
 
+/**
+ * @brief Create a new stream which allocates from @a allocator
+ *
+ * The codec's internal state is allocated from @a allocator instead
+ * of the global allocator, for plugins which support it.  The stream
+ * holds a reference to the allocator until it is destroyed.
+ *
+ * @param codec Codec to use
+ * @param stream_type Stream type
+ * @param options Options, or *NULL* to use the defaults
+ * @param allocator Allocator, or *NULL* to use the global allocator
+ * @return A new stream, or *NULL* on failure
+ *
+ * @see SquashAllocator
+ */
+SquashStream*
+squash_stream_new_with_allocator (SquashCodec* codec,
+                                  SquashStreamType stream_type,
+                                  SquashOptions* options,
+                                  SquashAllocator* allocator) {
+  SquashStream* stream;
+
+  assert (codec != NULL);
+
+  /* Make sure the plugin is loaded first so that nothing it keeps
+     for the life of the process ends up in the allocator. */
+  if (squash_codec_get_impl (codec) == NULL)
+    return NULL;
+
+  if (allocator != NULL)
+    squash_object_ref (allocator);
+
+  SquashAllocator* previous = squash_stream_init_allocator;
+  squash_stream_init_allocator = allocator;
+  stream = squash_codec_create_stream_with_options (codec, stream_type, options);
+  squash_stream_init_allocator = previous;
+
+  if (allocator != NULL)
+    squash_object_unref (allocator);
+
+  return stream;
+}
+
+/**
+ * @brief Get the allocator used by a stream
+ *
+ * @param stream The stream
+ * @return The allocator, or *NULL* if the stream uses the global
+ *   allocator
+ */
+SquashAllocator*
+squash_stream_get_allocator (SquashStream* stream) {
+  assert (stream != NULL);
+
+  return stream->allocator;
+}
+
+/**
+ * @brief Get the amount of memory allocated by a stream
+ *
+ * This covers memory allocated on behalf of the stream while it was
+ * being created, processed, or reset.  Memory which outlives the
+ * stream (for example, caches kept by a plugin) remains charged to it
+ * until it is freed.
+ *
+ * @param stream The stream
+ * @param[out] usage Location to store the usage
+ * @return A status code
+ * @retval SQUASH_STATE Accounting is not enabled (see
+ *   ::squash_memory_enable_accounting)
+ */
+SquashStatus
+squash_stream_get_memory_usage (SquashStream* stream, SquashMemoryUsage* usage) {
+  assert (stream != NULL);
+
+  return squash_memory_counter_get_usage (stream->memory, usage);
+}
+
 /**
  * @brief Create a new stream with a variadic list of options.
  *
@@ -563,7 +884,7 @@ squash_stream_new (SquashCodec* codec,
 }
 
 static SquashStatus
-squash_stream_process_internal (SquashStream* stream, SquashOperation operation) {
+squash_stream_process_operation (SquashStream* stream, SquashOperation operation) {
   SquashCodec* codec;
   SquashCodecImpl* impl = NULL;
   SquashStatus res = SQUASH_OK;
@@ -625,6 +946,10 @@ squash_stream_process_internal (SquashStream* stream, SquashOperation operation)
     return squash_error (SQUASH_STATE);
   }
 
+  /* Setting up the coroutine (or thread) failed in squash_stream_reset */
+  if (SQUASH_UNLIKELY(impl->process_stream == NULL && impl->splice != NULL && stream->priv == NULL))
+    return squash_error (SQUASH_FAILED);
+
   const size_t avail_in = stream->avail_in;
   const size_t avail_out = stream->avail_out;
 
@@ -781,6 +1106,15 @@ squash_stream_process_internal (SquashStream* stream, SquashOperation operation)
   return res;
 }
 
+static SquashStatus
+squash_stream_process_internal (SquashStream* stream, SquashOperation operation) {
+  SquashMemoryScope scope = squash_memory_scope_enter (stream->memory, &(stream->codec->memory));
+  SquashStatus res = squash_stream_process_operation (stream, operation);
+  squash_memory_scope_leave (scope);
+
+  return res;
+}
+
 /**
  * @brief Process a stream.
  *
@@ -39,6 +39,7 @@
 SQUASH_BEGIN_DECLS
 
 typedef struct SquashStreamPrivate_ SquashStreamPrivate;
+typedef struct SquashMemoryCounter_ SquashMemoryCounter;
 
 typedef enum {
   SQUASH_STREAM_COMPRESS = 1,
@@ -79,6 +80,9 @@ struct SquashStream_ {
 
   void* user_data;
   SquashDestroyNotify destroy_user_data;
+
+  SquashAllocator* allocator;
+  SquashMemoryCounter* memory;
 };
 
 SQUASH_SENTINEL
@@ -99,6 +103,17 @@ SQUASH_NONNULL(1)
 SQUASH_API SquashStream*   squash_stream_new_with_options       (SquashCodec* codec,
                                                                  SquashStreamType stream_type,
                                                                  SquashOptions* options);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStream*   squash_stream_new_with_allocator     (SquashCodec* codec,
+                                                                 SquashStreamType stream_type,
+                                                                 SquashOptions* options,
+                                                                 SquashAllocator* allocator);
+
+SQUASH_NONNULL(1)
+SQUASH_API SquashAllocator* squash_stream_get_allocator         (SquashStream* stream);
+SQUASH_NONNULL(1, 2)
+SQUASH_API SquashStatus    squash_stream_get_memory_usage       (SquashStream* stream,
+                                                                 SquashMemoryUsage* usage);
 
 SQUASH_NONNULL(1)
 SQUASH_API SquashStatus    squash_stream_process                (SquashStream* stream);
@@ -106,6 +121,8 @@ SQUASH_NONNULL(1)
 SQUASH_API SquashStatus    squash_stream_flush                  (SquashStream* stream);
 SQUASH_NONNULL(1)
 SQUASH_API SquashStatus    squash_stream_finish                 (SquashStream* stream);
+SQUASH_NONNULL(1)
+SQUASH_API SquashStatus    squash_stream_reset                  (SquashStream* stream);
 
 SQUASH_NONNULL(1, 2)
 SQUASH_API void            squash_stream_init                   (void* stream,
@@ -66,6 +66,19 @@ struct SquashPlugin_ {
   SQUASH_TREE_ENTRY(SquashPlugin_) tree;
 };
 
+#ifndef SQUASH_CODEC_STREAM_POOL_SIZE
+#  define SQUASH_CODEC_STREAM_POOL_SIZE 8
+#endif
+
+/* Memory charged to a stream or codec when accounting is enabled */
+struct SquashMemoryCounter_ {
+  /* Live allocations, plus one for the owner */
+  volatile size_t ref_count;
+  volatile size_t current;
+  volatile size_t peak;
+  volatile size_t allocations;
+};
+
 struct SquashCodec_ {
   SquashPlugin* plugin;
 
@@ -76,6 +89,11 @@ struct SquashCodec_ {
   bool initialized;
   SquashCodecImpl impl;
 
+  SquashStream* stream_pool[SQUASH_CODEC_STREAM_POOL_SIZE];
+  size_t stream_pool_length;
+
+  SquashMemoryCounter memory;
+
   SQUASH_TREE_ENTRY(SquashCodec_) tree;
 };
 
@@ -85,6 +103,32 @@ typedef struct SquashCodecRef_ {
   SQUASH_TREE_ENTRY(SquashCodecRef_) tree;
 } SquashCodecRef;
 
+typedef struct SquashDictionaryDigest_ {
+  struct SquashDictionaryDigest_* next;
+
+  SquashCodec* codec;
+  int key;
+  void* digest;
+  SquashDestroyNotify destroy_notify;
+} SquashDictionaryDigest;
+
+struct SquashDictionary_ {
+  SquashObject base_object;
+
+  uint8_t* data;
+  size_t size;
+
+  SquashDictionaryDigest* volatile digests;
+};
+
+struct SquashAllocator_ {
+  SquashObject base_object;
+
+  SquashAllocatorFuncs funcs;
+  void* user_data;
+  SquashDestroyNotify destroy_user_data;
+};
+
 typedef struct SquashBuffer_ {
   uint8_t* data;
   size_t size;
@@ -44,6 +44,9 @@ typedef struct SquashCodec_      SquashCodec;
 typedef struct SquashCodecImpl_  SquashCodecImpl;
 typedef struct SquashPlugin_     SquashPlugin;
 typedef struct SquashFile_       SquashFile;
+typedef struct SquashDictionary_ SquashDictionary;
+typedef struct SquashAllocator_  SquashAllocator;
+typedef struct SquashMemoryUsage_ SquashMemoryUsage;
 
 SQUASH_END_DECLS
 
@@ -0,0 +1,72 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_URING_INTERNAL_H
+#define SQUASH_URING_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+SQUASH_BEGIN_DECLS
+
+/* A minimal io_uring instance, driven through the raw system calls
+   so we don't need liburing.  On systems without io_uring (or where
+   it has been disabled, e.g. by seccomp) squash_uring_new returns
+   NULL and callers fall back to plain read(2)/write(2). */
+typedef struct SquashUring_ SquashUring;
+
+SQUASH_INTERNAL
+SquashUring* squash_uring_new             (unsigned int entries);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+void         squash_uring_free            (SquashUring* ring);
+SQUASH_NONNULL(1, 2) SQUASH_INTERNAL
+bool         squash_uring_register_buffer (SquashUring* ring,
+                                           uint8_t* data,
+                                           size_t size);
+SQUASH_NONNULL(1, 4) SQUASH_INTERNAL
+bool         squash_uring_prep_rw         (SquashUring* ring,
+                                           bool write,
+                                           int fd,
+                                           uint8_t* data,
+                                           size_t size,
+                                           int64_t offset,
+                                           uint64_t user_data);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+bool         squash_uring_prep_cancel     (SquashUring* ring,
+                                           uint64_t target,
+                                           uint64_t user_data);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+bool         squash_uring_submit          (SquashUring* ring);
+SQUASH_NONNULL(1, 2, 3) SQUASH_INTERNAL
+bool         squash_uring_wait            (SquashUring* ring,
+                                           uint64_t* user_data,
+                                           int32_t* result);
+
+SQUASH_END_DECLS
+
+#endif /* SQUASH_URING_INTERNAL_H */
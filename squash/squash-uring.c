@@ -0,0 +1,429 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_LINUX_IO_URING_H)
+#  include <errno.h>
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#  if defined(__NR_io_uring_setup) && defined(__ATOMIC_ACQUIRE) && defined(IORING_FEAT_RW_CUR_POS)
+#    define SQUASH_URING_ENABLED
+#  endif
+#endif
+
+#if defined(SQUASH_URING_ENABLED)
+
+struct SquashUring_ {
+  int fd;
+  unsigned int queued;
+
+  uint8_t* fixed_data;
+  size_t fixed_size;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  unsigned int sq_entries;
+  unsigned int sq_mask;
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int* sq_array;
+
+  unsigned int cq_mask;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  struct io_uring_cqe* cqes;
+};
+
+static int
+squash_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+  return (int) syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * @brief Create an io_uring instance
+ *
+ * @param entries minimum number of submission queue entries
+ * @return the new instance, or *NULL* if io_uring is not available
+ *   (or has been disabled with the `SQUASH_IO_URING=no` environment
+ *   variable)
+ * @private
+ */
+SquashUring*
+squash_uring_new (unsigned int entries) {
+  struct io_uring_params params;
+  SquashUring* ring;
+
+  const char* ev = getenv ("SQUASH_IO_URING");
+  if (ev != NULL && strcmp (ev, "no") == 0)
+    return NULL;
+
+  memset (&params, 0, sizeof (params));
+  const int fd = (int) syscall (__NR_io_uring_setup, entries, &params);
+  if (fd < 0)
+    return NULL;
+
+  /* We rely on -1 meaning "the current file position" for pipes and
+     on IORING_OP_READ/WRITE, both of which arrived in 5.6 along with
+     this flag. */
+  if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+    close (fd);
+    return NULL;
+  }
+
+  ring = squash_malloc (sizeof (SquashUring));
+  if (SQUASH_UNLIKELY(ring == NULL)) {
+    close (fd);
+    return NULL;
+  }
+
+  memset (ring, 0, sizeof (SquashUring));
+  ring->fd = fd;
+  ring->sq_ring = ring->cq_ring = MAP_FAILED;
+  ring->sqes = MAP_FAILED;
+
+  ring->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof (unsigned int));
+  ring->cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof (struct io_uring_cqe));
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    if (ring->cq_ring_size > ring->sq_ring_size)
+      ring->sq_ring_size = ring->cq_ring_size;
+    ring->cq_ring_size = 0;
+  }
+
+  ring->sq_ring = mmap (NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto fail;
+
+  if (ring->cq_ring_size != 0) {
+    ring->cq_ring = mmap (NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+      goto fail;
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto fail;
+
+  uint8_t* sq = ring->sq_ring;
+  uint8_t* cq = (ring->cq_ring_size != 0) ? ring->cq_ring : ring->sq_ring;
+
+  ring->sq_entries = params.sq_entries;
+  ring->sq_mask = *((unsigned int*) (sq + params.sq_off.ring_mask));
+  ring->sq_head = (unsigned int*) (sq + params.sq_off.head);
+  ring->sq_tail = (unsigned int*) (sq + params.sq_off.tail);
+  ring->sq_array = (unsigned int*) (sq + params.sq_off.array);
+
+  ring->cq_mask = *((unsigned int*) (cq + params.cq_off.ring_mask));
+  ring->cq_head = (unsigned int*) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned int*) (cq + params.cq_off.tail);
+  ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+  return ring;
+
+ fail:
+
+  squash_uring_free (ring);
+  return NULL;
+}
+
+/**
+ * @brief Destroy an io_uring instance
+ *
+ * Any requests still in flight are cancelled by the kernel.
+ *
+ * @param ring the instance to destroy
+ * @private
+ */
+void
+squash_uring_free (SquashUring* ring) {
+  assert (ring != NULL);
+
+  if (ring->sqes != MAP_FAILED)
+    munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != MAP_FAILED)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring != MAP_FAILED)
+    munmap (ring->sq_ring, ring->sq_ring_size);
+  close (ring->fd);
+
+  squash_free (ring);
+}
+
+/**
+ * @brief Register a buffer with the kernel
+ *
+ * Requests for memory inside a registered buffer use the
+ * `*_FIXED` operations, which skip mapping the pages on every
+ * request.  Failure (typically because of `RLIMIT_MEMLOCK`) isn't
+ * fatal; requests just use the regular operations.
+ *
+ * @param ring the instance
+ * @param data start of the buffer
+ * @param size size of the buffer
+ * @return whether the buffer was registered
+ * @private
+ */
+bool
+squash_uring_register_buffer (SquashUring* ring, uint8_t* data, size_t size) {
+  assert (ring != NULL);
+  assert (data != NULL);
+  assert (ring->fixed_data == NULL);
+
+  struct iovec iov = { data, size };
+  if (syscall (__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+    return false;
+
+  ring->fixed_data = data;
+  ring->fixed_size = size;
+
+  return true;
+}
+
+/**
+ * @brief Queue a read or write
+ *
+ * The request isn't passed to the kernel until @ref
+ * squash_uring_submit or @ref squash_uring_wait is called.
+ *
+ * @param ring the instance
+ * @param write whether to write (instead of read)
+ * @param fd file descriptor
+ * @param data buffer to read into or write from
+ * @param size number of bytes
+ * @param offset offset in the file, or -1 to use (and update) the
+ *   file position
+ * @param user_data value returned by @ref squash_uring_wait once the
+ *   request completes
+ * @return whether the request was queued; false if the submission
+ *   queue is full
+ * @private
+ */
+bool
+squash_uring_prep_rw (SquashUring* ring, bool write, int fd, uint8_t* data, size_t size, int64_t offset, uint64_t user_data) {
+  assert (ring != NULL);
+  assert (data != NULL);
+  assert (size <= UINT32_MAX);
+
+  const unsigned int tail = *(ring->sq_tail);
+  const unsigned int head = __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+  if ((tail - head) >= ring->sq_entries)
+    return false;
+
+  const unsigned int idx = tail & ring->sq_mask;
+  const bool fixed =
+    ring->fixed_data != NULL && data >= ring->fixed_data && (data + size) <= (ring->fixed_data + ring->fixed_size);
+  struct io_uring_sqe* sqe = &(ring->sqes[idx]);
+
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+  if (write)
+    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  else
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->off = (uint64_t) offset;
+  sqe->addr = (uint64_t) (uintptr_t) data;
+  sqe->len = (uint32_t) size;
+  sqe->buf_index = 0;
+  sqe->user_data = user_data;
+
+  ring->sq_array[idx] = idx;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+
+  return true;
+}
+
+/**
+ * @brief Queue cancellation of a request
+ *
+ * The cancelled request still completes (usually with
+ * `-ECANCELED`), and so does the cancellation itself.
+ *
+ * @param ring the instance
+ * @param target user_data of the request to cancel
+ * @param user_data user_data for the cancellation
+ * @return whether the cancellation was queued
+ * @private
+ */
+bool
+squash_uring_prep_cancel (SquashUring* ring, uint64_t target, uint64_t user_data) {
+  assert (ring != NULL);
+
+  const unsigned int tail = *(ring->sq_tail);
+  const unsigned int head = __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+  if ((tail - head) >= ring->sq_entries)
+    return false;
+
+  const unsigned int idx = tail & ring->sq_mask;
+  struct io_uring_sqe* sqe = &(ring->sqes[idx]);
+
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+
+  ring->sq_array[idx] = idx;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+
+  return true;
+}
+
+/**
+ * @brief Pass queued requests to the kernel
+ *
+ * If the kernel doesn't accept everything right away, the rest is
+ * passed on by the next call to @ref squash_uring_wait.
+ *
+ * @param ring the instance
+ * @return whether the requests were submitted
+ * @private
+ */
+bool
+squash_uring_submit (SquashUring* ring) {
+  assert (ring != NULL);
+
+  while (ring->queued != 0) {
+    const int r = squash_uring_enter (ring->fd, ring->queued, 0, 0);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    } else if (r == 0) {
+      /* Retrying immediately would just spin; waiting submits them
+         once the kernel has made some progress. */
+      break;
+    }
+    ring->queued -= (unsigned int) r;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Wait for a request to complete
+ *
+ * Requests complete in no particular order.
+ *
+ * @param ring the instance
+ * @param[out] user_data the user_data of the completed request
+ * @param[out] result the number of bytes transferred, or a negated
+ *   errno value
+ * @return whether a request completed; false if something went
+ *   wrong with the ring itself
+ * @private
+ */
+bool
+squash_uring_wait (SquashUring* ring, uint64_t* user_data, int32_t* result) {
+  assert (ring != NULL);
+  assert (user_data != NULL);
+  assert (result != NULL);
+
+  while (true) {
+    const unsigned int head = *(ring->cq_head);
+    const unsigned int tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head != tail) {
+      const struct io_uring_cqe* cqe = &(ring->cqes[head & ring->cq_mask]);
+      *user_data = cqe->user_data;
+      *result = cqe->res;
+      __atomic_store_n (ring->cq_head, head + 1, __ATOMIC_RELEASE);
+      return true;
+    }
+
+    const int r = squash_uring_enter (ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    ring->queued -= (unsigned int) r;
+  }
+}
+
+#else /* !defined(SQUASH_URING_ENABLED) */
+
+SquashUring*
+squash_uring_new (unsigned int entries) {
+  return NULL;
+}
+
+void
+squash_uring_free (SquashUring* ring) {
+  squash_assert_unreachable ();
+}
+
+bool
+squash_uring_register_buffer (SquashUring* ring, uint8_t* data, size_t size) {
+  squash_assert_unreachable ();
+  return false;
+}
+
+bool
+squash_uring_prep_rw (SquashUring* ring, bool write, int fd, uint8_t* data, size_t size, int64_t offset, uint64_t user_data) {
+  squash_assert_unreachable ();
+  return false;
+}
+
+bool
+squash_uring_prep_cancel (SquashUring* ring, uint64_t target, uint64_t user_data) {
+  squash_assert_unreachable ();
+  return false;
+}
+
+bool
+squash_uring_submit (SquashUring* ring) {
+  squash_assert_unreachable ();
+  return false;
+}
+
+bool
+squash_uring_wait (SquashUring* ring, uint64_t* user_data, int32_t* result) {
+  squash_assert_unreachable ();
+  return false;
+}
+
+#endif /* defined(SQUASH_URING_ENABLED) */
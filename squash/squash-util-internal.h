@@ -40,6 +40,21 @@ SQUASH_INTERNAL
 size_t squash_npot               (size_t v);
 SQUASH_INTERNAL
 size_t squash_get_huge_page_size (void);
+SQUASH_INTERNAL
+unsigned int squash_get_cpu_count (void);
+
+SQUASH_NONNULL(1, 3) SQUASH_INTERNAL
+size_t squash_read_varuint64     (const uint8_t *p, size_t p_size, uint64_t *v);
+SQUASH_NONNULL(1) SQUASH_INTERNAL
+size_t squash_write_varuint64    (uint8_t *p, size_t p_size, uint64_t v);
+SQUASH_INTERNAL
+size_t squash_size_varuint64     (const uint64_t value);
+
+SQUASH_NONNULL(2) SQUASH_INTERNAL
+double squash_estimate_entropy   (size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)]);
+
+SQUASH_INTERNAL
+uint32_t squash_crc32c           (uint32_t crc, size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)]);
 
 SQUASH_END_DECLS
 
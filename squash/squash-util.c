@@ -66,6 +66,28 @@ squash_get_page_size (void) {
   return page_size;
 }
 
+unsigned int
+squash_get_cpu_count (void) {
+  static unsigned int cpu_count = 0;
+
+  if (SQUASH_UNLIKELY(cpu_count == 0)) {
+    unsigned int c = 0;
+
+#if defined(_WIN32)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    c = (unsigned int) si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    const long nprocs = sysconf (_SC_NPROCESSORS_ONLN);
+    c = SQUASH_UNLIKELY(nprocs < 1) ? 1 : ((unsigned int) nprocs);
+#endif
+
+    cpu_count = (c == 0) ? 1 : c;
+  }
+
+  return cpu_count;
+}
+
 size_t squash_huge_page_size = 0;
 once_flag squash_huge_page_size_once = ONCE_FLAG_INIT;
 
@@ -137,3 +159,222 @@ squash_npot (size_t v) {
   v++;
   return v;
 }
+
+size_t
+squash_read_varuint64 (const uint8_t *p, size_t p_size, uint64_t *v) {
+  uint64_t n = 0;
+  size_t i;
+
+  for (i = 0; i < 8 && i < p_size && *p > 0x7F; ++i) {
+    n = (n << 7) | (*p++ & 0x7F);
+  }
+
+  if (i == p_size) {
+    return 0;
+  }
+  else if (i == 8) {
+    n = (n << 8) | *p;
+  }
+  else {
+    n = (n << 7) | *p;
+  }
+
+  *v = n;
+
+  return i + 1;
+}
+
+size_t
+squash_write_varuint64 (uint8_t *p, size_t p_size, uint64_t v) {
+  uint8_t buf[10];
+  size_t i;
+  size_t j;
+
+  if (v & 0xFF00000000000000ULL) {
+    if (p_size < 9) {
+      return 0;
+    }
+
+    p[8] = (uint8_t) v;
+    v >>= 8;
+
+    i = 7;
+
+    for (j = 0; j < 8; ++j) {
+      p[i--] = (uint8_t) ((v & 0x7F) | 0x80);
+      v >>= 7;
+    }
+
+    return 9;
+  }
+
+  i = 0;
+
+  buf[i++] = (uint8_t) (v & 0x7F);
+  v >>= 7;
+
+  while (v > 0) {
+    buf[i++] = (uint8_t) ((v & 0x7F) | 0x80);
+    v >>= 7;
+  }
+
+  if (i > p_size) {
+    return 0;
+  }
+
+  for (j = 0; j < i; ++j) {
+    p[j] = buf[i - j - 1];
+  }
+
+  return i;
+}
+
+size_t
+squash_size_varuint64 (const uint64_t value) {
+  if (value & 0xFF00000000000000ULL)
+    return 9;
+
+  size_t required = 1;
+
+  for (size_t s = 7 ; s < 64 ; s += 7, required++)
+    if (value < (UINT64_C(1) << s))
+      break;
+
+  return required;
+}
+
+/* log2 without libm; only used on a few hundred values per estimate,
+   and only needs to be good to a few decimal places. */
+static double
+squash_log2 (double x) {
+  int exponent = 0;
+
+  assert (x > 0.0);
+
+  while (x >= 2.0) {
+    x *= 0.5;
+    exponent++;
+  }
+  while (x < 1.0) {
+    x *= 2.0;
+    exponent--;
+  }
+
+  /* ln(x) = 2 atanh((x - 1) / (x + 1)), with |y| <= 1/3 */
+  const double y = (x - 1.0) / (x + 1.0);
+  const double y2 = y * y;
+  const double ln = 2.0 * y * (1.0 + y2 * (1.0 / 3.0 + y2 * (1.0 / 5.0 + y2 * (1.0 / 7.0 + y2 * (1.0 / 9.0)))));
+
+  return (double) exponent + (ln * 1.4426950408889634);
+}
+
+#define SQUASH_ENTROPY_SAMPLE_WINDOWS ((size_t) 16)
+#define SQUASH_ENTROPY_SAMPLE_WINDOW_SIZE ((size_t) 256)
+
+static void
+squash_histogram_add (uint32_t histogram[4][256], size_t size, const uint8_t* data) {
+  size_t i = 0;
+
+  /* Four tables so consecutive bytes don't wait on each other's
+     increments */
+  for ( ; i + 4 <= size ; i += 4) {
+    histogram[0][data[i    ]]++;
+    histogram[1][data[i + 1]]++;
+    histogram[2][data[i + 2]]++;
+    histogram[3][data[i + 3]]++;
+  }
+  for ( ; i < size ; i++)
+    histogram[0][data[i]]++;
+}
+
+/**
+ * @brief Estimate the entropy of a buffer
+ * @private
+ *
+ * Large buffers are sampled at evenly spaced windows rather than
+ * read in full, so this is cheap regardless of the size of @a data.
+ *
+ * @param size Size of @a data
+ * @param data The data
+ * @return Order-0 entropy of the sample, in bits per byte
+ */
+double
+squash_estimate_entropy (size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)]) {
+  uint32_t histogram[4][256] = { { 0, } };
+  size_t sampled;
+
+  assert (data != NULL);
+
+  if (size == 0)
+    return 0.0;
+
+  if (size <= SQUASH_ENTROPY_SAMPLE_WINDOWS * SQUASH_ENTROPY_SAMPLE_WINDOW_SIZE) {
+    squash_histogram_add (histogram, size, data);
+    sampled = size;
+  } else {
+    const size_t stride = (size - SQUASH_ENTROPY_SAMPLE_WINDOW_SIZE) / (SQUASH_ENTROPY_SAMPLE_WINDOWS - 1);
+    for (size_t w = 0 ; w < SQUASH_ENTROPY_SAMPLE_WINDOWS ; w++)
+      squash_histogram_add (histogram, SQUASH_ENTROPY_SAMPLE_WINDOW_SIZE, data + (w * stride));
+    sampled = SQUASH_ENTROPY_SAMPLE_WINDOWS * SQUASH_ENTROPY_SAMPLE_WINDOW_SIZE;
+  }
+
+  /* H = log2(n) - (1/n) * sum (c * log2(c)) */
+  double sum = 0.0;
+  for (size_t b = 0 ; b < 256 ; b++) {
+    const uint32_t count = histogram[0][b] + histogram[1][b] + histogram[2][b] + histogram[3][b];
+    if (count > 1)
+      sum += (double) count * squash_log2 ((double) count);
+  }
+
+  return squash_log2 ((double) sampled) - (sum / (double) sampled);
+}
+
+/* CRC-32C (Castagnoli), slicing by four bytes at a time. */
+
+static uint32_t squash_crc32c_table[4][256];
+static once_flag squash_crc32c_once = ONCE_FLAG_INIT;
+
+static void
+squash_crc32c_init (void) {
+  for (uint32_t b = 0 ; b < 256 ; b++) {
+    uint32_t crc = b;
+    for (int k = 0 ; k < 8 ; k++)
+      crc = (crc >> 1) ^ ((crc & 1) ? UINT32_C(0x82F63B78) : 0);
+    squash_crc32c_table[0][b] = crc;
+  }
+
+  for (size_t b = 0 ; b < 256 ; b++)
+    for (size_t t = 1 ; t < 4 ; t++)
+      squash_crc32c_table[t][b] = (squash_crc32c_table[t - 1][b] >> 8) ^ squash_crc32c_table[0][squash_crc32c_table[t - 1][b] & 0xff];
+}
+
+/**
+ * @brief Compute the CRC-32C of a buffer
+ * @private
+ *
+ * @param crc CRC of the preceding data, or 0 to start a new checksum
+ * @param size Size of @a data
+ * @param data The data
+ * @return The updated CRC
+ */
+uint32_t
+squash_crc32c (uint32_t crc, size_t size, const uint8_t data[SQUASH_ARRAY_PARAM(size)]) {
+  size_t i = 0;
+
+  call_once (&squash_crc32c_once, squash_crc32c_init);
+
+  crc = ~crc;
+  for ( ; i + 4 <= size ; i += 4) {
+    crc ^= ((uint32_t) data[i]) | (((uint32_t) data[i + 1]) << 8) |
+      (((uint32_t) data[i + 2]) << 16) | (((uint32_t) data[i + 3]) << 24);
+    crc =
+      squash_crc32c_table[3][ crc        & 0xff] ^
+      squash_crc32c_table[2][(crc >>  8) & 0xff] ^
+      squash_crc32c_table[1][(crc >> 16) & 0xff] ^
+      squash_crc32c_table[0][ crc >> 24        ];
+  }
+  for ( ; i < size ; i++)
+    crc = (crc >> 8) ^ squash_crc32c_table[0][(crc ^ data[i]) & 0xff];
+
+  return ~crc;
+}
@@ -136,14 +136,22 @@
 #include <squash/squash-status.h>
 #include <squash/squash-types.h>
 #include <squash/squash-object.h>
+#include <squash/squash-dictionary.h>
 #include <squash/squash-options.h>
 #include <squash/squash-stream.h>
 #include <squash/squash-file.h>
 #include <squash/squash-license.h>
 #include <squash/squash-codec.h>
+#include <squash/squash-parallel.h>
+#include <squash/squash-seekable.h>
+#include <squash/squash-batch.h>
+#include <squash/squash-job.h>
+#include <squash/squash-iovec.h>
+#include <squash/squash-select.h>
 #include <squash/squash-splice.h>
 #include <squash/squash-plugin.h>
 #include <squash/squash-memory.h>
+#include <squash/squash-allocator.h>
 #include <squash/squash-context.h>
 
 #undef SQUASH_H_INSIDE
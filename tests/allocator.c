@@ -0,0 +1,238 @@
+#include "test-squash.h"
+
+typedef struct {
+  SquashAllocator* arena;
+  size_t allocations;
+} CountingAllocator;
+
+static void*
+counting_malloc (void* user_data, size_t size) {
+  CountingAllocator* counter = (CountingAllocator*) user_data;
+  counter->allocations++;
+  return squash_allocator_malloc (counter->arena, size);
+}
+
+static void*
+counting_realloc (void* user_data, void* ptr, size_t size) {
+  CountingAllocator* counter = (CountingAllocator*) user_data;
+  counter->allocations++;
+  return squash_allocator_realloc (counter->arena, ptr, size);
+}
+
+static void
+counting_free (void* user_data, void* ptr) {
+  CountingAllocator* counter = (CountingAllocator*) user_data;
+  squash_allocator_free (counter->arena, ptr);
+}
+
+static const SquashAllocatorFuncs counting_funcs = {
+  counting_malloc,
+  counting_realloc,
+  counting_free,
+  NULL
+};
+
+static SquashStatus
+process_with_allocator (SquashCodec* codec,
+                        SquashStreamType stream_type,
+                        SquashAllocator* allocator,
+                        size_t* output_length,
+                        uint8_t* output,
+                        size_t input_length,
+                        const uint8_t* input) {
+  SquashStream* stream = squash_stream_new_with_allocator (codec, stream_type, NULL, allocator);
+  munit_assert_not_null(stream);
+  munit_assert_ptr_equal(squash_stream_get_allocator (stream), allocator);
+
+  SquashStatus res;
+
+  stream->next_in = input;
+  stream->avail_in = input_length;
+  stream->next_out = output;
+  stream->avail_out = *output_length;
+
+  do {
+    res = squash_stream_process (stream);
+  } while (res == SQUASH_PROCESSING);
+
+  if (res == SQUASH_OK) {
+    do {
+      res = squash_stream_finish (stream);
+    } while (res == SQUASH_PROCESSING);
+  }
+
+  if (res == SQUASH_END_OF_STREAM)
+    res = SQUASH_OK;
+
+  if (res == SQUASH_OK)
+    *output_length = stream->total_out;
+
+  squash_object_unref (stream);
+
+  return res;
+}
+
+static MunitResult
+squash_test_allocator_stream(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  CountingAllocator counter = { squash_allocator_new_arena (4096), 0 };
+  munit_assert_not_null(counter.arena);
+  squash_object_ref (counter.arena);
+
+  SquashAllocator* allocator = squash_allocator_new (&counting_funcs, &counter, NULL);
+  munit_assert_not_null(allocator);
+  squash_object_ref (allocator);
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  size_t decompressed_length = LOREM_IPSUM_LENGTH;
+  uint8_t* decompressed = munit_malloc (decompressed_length);
+
+  for (int round = 0 ; round < 2 ; round++) {
+    SquashStatus res;
+
+    compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+    res = process_with_allocator (codec, SQUASH_STREAM_COMPRESS, allocator,
+                                  &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM);
+    SQUASH_ASSERT_OK(res);
+
+    decompressed_length = LOREM_IPSUM_LENGTH;
+    res = process_with_allocator (codec, SQUASH_STREAM_DECOMPRESS, allocator,
+                                  &decompressed_length, decompressed, compressed_length, compressed);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+    munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+    /* Every stream is gone, so everything can be released at once. */
+    squash_allocator_reset (counter.arena);
+  }
+
+  /* These plugins hand us allocation callbacks for all of their codecs */
+  const char* plugin = squash_plugin_get_name (squash_codec_get_plugin (codec));
+  if (strcmp (plugin, "zlib") == 0 || strcmp (plugin, "zlib-ng") == 0 || strcmp (plugin, "miniz") == 0 ||
+      strcmp (plugin, "bzip2") == 0 || strcmp (plugin, "lzma") == 0 || strcmp (plugin, "brotli") == 0)
+    munit_assert_size(counter.allocations, >, 0);
+
+  free (compressed);
+  free (decompressed);
+  squash_object_unref (allocator);
+  squash_object_unref (counter.arena);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_allocator_arena(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashAllocator* arena = squash_allocator_new_arena (256);
+  munit_assert_not_null(arena);
+  squash_object_ref (arena);
+
+  uint8_t* a = squash_allocator_malloc (arena, 32);
+  munit_assert_not_null(a);
+  munit_assert_size((uintptr_t) a % 16, ==, 0);
+  memset (a, 'a', 32);
+
+  /* The most recent allocation grows in place */
+  uint8_t* b = squash_allocator_malloc (arena, 16);
+  munit_assert_not_null(b);
+  memset (b, 'b', 16);
+  munit_assert_ptr_equal(squash_allocator_realloc (arena, b, 64), b);
+
+  /* ... and is given back when freed */
+  squash_allocator_free (arena, b);
+  munit_assert_ptr_equal(squash_allocator_malloc (arena, 16), b);
+
+  /* Anything else moves, keeping its contents */
+  uint8_t* c = squash_allocator_realloc (arena, a, 64);
+  munit_assert_not_null(c);
+  munit_assert_ptr_not_equal(c, a);
+  for (size_t i = 0 ; i < 32 ; i++)
+    munit_assert_uint8(c[i], ==, 'a');
+
+  /* The old location is reused by an allocation of the same size */
+  munit_assert_ptr_equal(squash_allocator_malloc (arena, 32), a);
+
+  /* Larger than a block */
+  uint8_t* d = squash_allocator_calloc (arena, 1, 1024);
+  munit_assert_not_null(d);
+  for (size_t i = 0 ; i < 1024 ; i++)
+    munit_assert_uint8(d[i], ==, 0);
+
+  squash_allocator_reset (arena);
+
+  uint8_t* e = squash_allocator_malloc (arena, 8);
+  munit_assert_not_null(e);
+
+  squash_object_unref (arena);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_allocator_reset(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* Only for this test (munit forks for each one) */
+  squash_memory_enable_accounting ();
+
+  SquashAllocator* arena = squash_allocator_new_arena (0);
+  munit_assert_not_null(arena);
+  squash_object_ref (arena);
+
+  SquashStream* stream = squash_stream_new_with_allocator (codec, SQUASH_STREAM_COMPRESS, NULL, arena);
+  munit_assert_not_null(stream);
+
+  const size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  SquashMemoryUsage usage;
+  size_t baseline = 0;
+
+  /* Plugins which tear down and recreate their state on reset must
+     not make the arena grow with every round. */
+  for (int round = 0 ; round < 8 ; round++) {
+    SquashStatus res = squash_stream_reset (stream);
+    if (res == SQUASH_INVALID_OPERATION)
+      break;
+    SQUASH_ASSERT_OK(res);
+
+    stream->next_in = (const uint8_t*) LOREM_IPSUM;
+    stream->avail_in = LOREM_IPSUM_LENGTH;
+    stream->next_out = compressed;
+    stream->avail_out = compressed_length;
+
+    do {
+      res = squash_stream_finish (stream);
+    } while (res == SQUASH_PROCESSING);
+    SQUASH_ASSERT_OK(res);
+
+    SQUASH_ASSERT_OK(squash_memory_get_usage (&usage));
+    if (round == 1)
+      baseline = usage.current;
+    else if (round > 1)
+      munit_assert_size(usage.current, <=, baseline);
+  }
+
+  free (compressed);
+  squash_object_unref (stream);
+  squash_object_unref (arena);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_allocator_tests[] = {
+  { (char*) "/arena", squash_test_allocator_arena, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+  { (char*) "/stream", squash_test_allocator_stream, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/reset", squash_test_allocator_reset, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_allocator = {
+  (char*) "/allocator",
+  squash_allocator_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
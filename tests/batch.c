@@ -0,0 +1,97 @@
+#include "test-squash.h"
+
+#define SQUASH_TEST_BATCH_ITEMS 37
+
+static MunitResult
+squash_test_batch_buffer(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashBatchItem compress_items[SQUASH_TEST_BATCH_ITEMS];
+  SquashBatchItem decompress_items[SQUASH_TEST_BATCH_ITEMS];
+  size_t lengths[SQUASH_TEST_BATCH_ITEMS];
+  SquashStatus res;
+
+  for (size_t i = 0 ; i < SQUASH_TEST_BATCH_ITEMS ; i++) {
+    const size_t offset = (size_t) munit_rand_int_range (0, LOREM_IPSUM_LENGTH - 1024);
+    lengths[i] = (size_t) munit_rand_int_range (64, 1024);
+
+    compress_items[i].input = LOREM_IPSUM + offset;
+    compress_items[i].input_size = lengths[i];
+    compress_items[i].output_size = squash_codec_get_max_compressed_size (codec, lengths[i]);
+    compress_items[i].output = munit_malloc (compress_items[i].output_size);
+  }
+
+  res = squash_codec_compress_batch (codec, SQUASH_TEST_BATCH_ITEMS, compress_items, 4, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  for (size_t i = 0 ; i < SQUASH_TEST_BATCH_ITEMS ; i++) {
+    SQUASH_ASSERT_OK(compress_items[i].status);
+
+    decompress_items[i].input = compress_items[i].output;
+    decompress_items[i].input_size = compress_items[i].output_size;
+    decompress_items[i].output_size = lengths[i];
+    decompress_items[i].output = munit_malloc (lengths[i]);
+  }
+
+  res = squash_codec_decompress_batch (codec, SQUASH_TEST_BATCH_ITEMS, decompress_items, 1, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  for (size_t i = 0 ; i < SQUASH_TEST_BATCH_ITEMS ; i++) {
+    SQUASH_ASSERT_OK(decompress_items[i].status);
+    munit_assert_size (decompress_items[i].output_size, ==, lengths[i]);
+    munit_assert_memory_equal (lengths[i], decompress_items[i].output, compress_items[i].input);
+
+    free (compress_items[i].output);
+    free (decompress_items[i].output);
+  }
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_batch_status(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashBatchItem items[3];
+  uint8_t tiny[1];
+  SquashStatus res;
+
+  for (size_t i = 0 ; i < 3 ; i++) {
+    items[i].input = LOREM_IPSUM;
+    items[i].input_size = LOREM_IPSUM_LENGTH;
+    items[i].output_size = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+    items[i].output = munit_malloc (items[i].output_size);
+  }
+
+  /* Only the middle item should fail. */
+  free (items[1].output);
+  items[1].output = tiny;
+  items[1].output_size = sizeof (tiny);
+
+  res = squash_codec_compress_batch (codec, 3, items, 0, NULL);
+  munit_assert_int (res, <, 0);
+  munit_assert_int (items[1].status, ==, res);
+  SQUASH_ASSERT_OK(items[0].status);
+  SQUASH_ASSERT_OK(items[2].status);
+
+  free (items[0].output);
+  free (items[2].output);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_batch_tests[] = {
+  { (char*) "/buffer", squash_test_batch_buffer, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/status", squash_test_batch_status, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_batch = {
+  (char*) "/batch",
+  squash_batch_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
@@ -66,8 +66,139 @@ squash_test_single_byte(MUNIT_UNUSED const MunitParameter params[], void* user_d
   return MUNIT_OK;
 }
 
+static MunitResult
+squash_test_uncompressed_size(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (compressed_length);
+
+  SquashStatus res = squash_codec_compress (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, (uint8_t*) LOREM_IPSUM, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  /* Codecs which only provide a hint may not know the size, but if
+     they claim to it had better be right for our own output. */
+  const size_t uncompressed_length = squash_codec_get_uncompressed_size (codec, compressed_length, compressed);
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE) == SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE) {
+    munit_assert_size(uncompressed_length, ==, LOREM_IPSUM_LENGTH);
+  } else if (uncompressed_length != 0) {
+    munit_assert_size(uncompressed_length, ==, LOREM_IPSUM_LENGTH);
+    munit_assert_int((int) (squash_codec_get_info (codec) & SQUASH_CODEC_INFO_SIZE_HINT), ==, SQUASH_CODEC_INFO_SIZE_HINT);
+  }
+
+  free (compressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_frozen_options(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options == NULL)
+    return MUNIT_SKIP;
+
+  munit_assert_ptr_equal(squash_options_freeze (options), options);
+  munit_assert_true(squash_options_is_frozen (options));
+  munit_assert_uint(squash_object_get_ref_count (options), ==, 1);
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  for (size_t i = 0 ; info[i].name != NULL ; i++) {
+    if (info[i].type == SQUASH_OPTION_TYPE_RANGE_INT || info[i].type == SQUASH_OPTION_TYPE_INT) {
+      SQUASH_ASSERT_STATUS(squash_options_set_int_at (options, i, info[i].default_value.int_value), SQUASH_STATE);
+      break;
+    }
+  }
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  size_t decompressed_length = LOREM_IPSUM_LENGTH;
+  uint8_t* compressed = munit_malloc (compressed_length);
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+
+  SquashStatus res = squash_codec_compress_with_options (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, (uint8_t*) LOREM_IPSUM, options);
+  SQUASH_ASSERT_OK(res);
+  res = squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  munit_assert_uint(squash_object_get_ref_count (options), ==, 1);
+
+  free (compressed);
+  free (decompressed);
+  squash_object_unref (options);
+
+  return MUNIT_OK;
+}
+
 #if defined(SQUASH_TEST_DATA_DIR)
 
+static MunitResult
+squash_test_store_incompressible(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options == NULL)
+    return MUNIT_SKIP;
+  squash_object_ref (options);
+
+  SQUASH_ASSERT_STATUS(squash_options_set_store_incompressible (options, 9.0), SQUASH_RANGE);
+  SQUASH_ASSERT_OK(squash_options_set_store_incompressible (options, 7.0));
+
+  const size_t random_length = 8192;
+  uint8_t* random_data = munit_malloc (random_length);
+  munit_rand_memory (random_length, random_data);
+
+  const size_t compressed_length_max = squash_codec_get_max_compressed_size (codec, random_length) + 1;
+  size_t compressed_length = compressed_length_max;
+  size_t decompressed_length = random_length;
+  uint8_t* compressed = munit_malloc (compressed_length);
+  uint8_t* decompressed = munit_malloc (random_length);
+
+  /* Random data is stored verbatim behind a one byte header */
+  SquashStatus res = squash_codec_compress_with_options (codec, &compressed_length, compressed, random_length, random_data, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(compressed_length, ==, random_length + 1);
+  res = squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, random_length);
+  munit_assert_memory_equal(random_length, decompressed, random_data);
+
+  /* Text goes through the codec */
+  compressed_length = compressed_length_max;
+  decompressed_length = random_length;
+  res = squash_codec_compress_with_options (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, (uint8_t*) LOREM_IPSUM, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_uint8(compressed[0], ==, 0);
+  res = squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  /* The receiver doesn't need the sender's options */
+  decompressed_length = random_length;
+  res = squash_codec_decompress_framed (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  decompressed_length = random_length;
+  compressed[0] = 0x7f;
+  res = squash_codec_decompress_framed (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_BUFFER);
+
+  free (random_data);
+  free (compressed);
+  free (decompressed);
+  squash_object_unref (options);
+
+  return MUNIT_OK;
+}
+
 static MunitResult
 squash_test_endianness(MUNIT_UNUSED const MunitParameter params[], void* user_data, bool le) {
   munit_assert_not_null(user_data);
@@ -125,6 +256,9 @@ squash_test_endianness_le(MUNIT_UNUSED const MunitParameter params[], void* user
 MunitTest squash_buffer_tests[] = {
   { (char*) "/basic", squash_test_basic, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/single-byte", squash_test_single_byte, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/uncompressed-size", squash_test_uncompressed_size, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/frozen-options", squash_test_frozen_options, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/store-incompressible", squash_test_store_incompressible, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
 #if defined(SQUASH_TEST_DATA_DIR)
   { (char*) "/endianness", squash_test_endianness_le, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   /* { (char*) "/endianness/be", squash_test_endianness_be, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER }, */
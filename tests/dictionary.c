@@ -0,0 +1,154 @@
+#include "test-squash.h"
+
+#include "../squash/tinycthread/source/tinycthread.h"
+
+static MunitResult
+squash_test_dictionary_basic(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options == NULL)
+    return MUNIT_SKIP;
+  squash_object_ref (options);
+
+  /* Use the first half of the text as a dictionary for the second. */
+  const size_t dictionary_length = LOREM_IPSUM_LENGTH / 2;
+  const uint8_t* uncompressed = (const uint8_t*) LOREM_IPSUM + dictionary_length;
+  const size_t uncompressed_length = LOREM_IPSUM_LENGTH - dictionary_length;
+
+  SquashDictionary* dictionary = squash_dictionary_new (dictionary_length, (const uint8_t*) LOREM_IPSUM);
+  munit_assert_not_null(dictionary);
+  squash_object_ref (dictionary);
+
+  SquashStatus res = squash_options_set_dictionary (options, "dictionary", dictionary);
+  if (res != SQUASH_OK) {
+    squash_object_unref (dictionary);
+    squash_object_unref (options);
+    return MUNIT_SKIP;
+  }
+  munit_assert_ptr_equal(squash_options_get_dictionary (options, codec, "dictionary"), dictionary);
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  size_t decompressed_length = uncompressed_length;
+  uint8_t* decompressed = munit_malloc (decompressed_length);
+
+  res = squash_codec_compress_with_options (codec, &compressed_length, compressed, uncompressed_length, uncompressed, options);
+  if (strcmp (squash_codec_get_name (codec), "gzip") == 0) {
+    /* gzip has no way to record a dictionary, so it must refuse one */
+    munit_assert_int(res, !=, SQUASH_OK);
+    free (compressed);
+    free (decompressed);
+    squash_object_unref (dictionary);
+    squash_object_unref (options);
+    return MUNIT_OK;
+  }
+  SQUASH_ASSERT_OK(res);
+
+  res = squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+
+  /* Compress a second time to exercise the cached digest. */
+  compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  res = squash_codec_compress_with_options (codec, &compressed_length, compressed, uncompressed_length, uncompressed, options);
+  SQUASH_ASSERT_OK(res);
+
+  decompressed_length = uncompressed_length;
+  res = squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+
+  /* Without the dictionary the data should not survive the trip. */
+  decompressed_length = uncompressed_length;
+  memset (decompressed, 0, uncompressed_length);
+  res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  munit_assert(res != SQUASH_OK ||
+               decompressed_length != uncompressed_length ||
+               memcmp (decompressed, uncompressed, uncompressed_length) != 0);
+
+  free (compressed);
+  free (decompressed);
+  squash_object_unref (dictionary);
+  squash_object_unref (options);
+
+  return MUNIT_OK;
+}
+
+#define SQUASH_TEST_DIGEST_THREADS 8
+
+typedef struct {
+  SquashDictionary* dictionary;
+  SquashCodec* codec;
+  void* digest;
+} SquashTestDigestThread;
+
+static void*
+squash_test_digest_create (SquashDictionary* dictionary, SquashCodec* codec, int key) {
+  uint8_t* digest = malloc (squash_dictionary_get_size (dictionary));
+  if (digest != NULL)
+    memcpy (digest, squash_dictionary_get_data (dictionary), squash_dictionary_get_size (dictionary));
+  return digest;
+}
+
+static int
+squash_test_digest_thread_func (void* user_data) {
+  SquashTestDigestThread* data = (SquashTestDigestThread*) user_data;
+
+  data->digest = squash_dictionary_get_digest (data->dictionary, data->codec, 7, squash_test_digest_create, free);
+
+  return 0;
+}
+
+static MunitResult
+squash_test_dictionary_digest_threads(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashCodec* codec = squash_get_codec ("copy");
+  if (codec == NULL)
+    return MUNIT_SKIP;
+
+  SquashDictionary* dictionary = squash_dictionary_new (LOREM_IPSUM_LENGTH, (const uint8_t*) LOREM_IPSUM);
+  munit_assert_not_null(dictionary);
+  squash_object_ref (dictionary);
+
+  SquashTestDigestThread data[SQUASH_TEST_DIGEST_THREADS];
+  thrd_t threads[SQUASH_TEST_DIGEST_THREADS];
+
+  for (size_t i = 0 ; i < SQUASH_TEST_DIGEST_THREADS ; i++) {
+    data[i].dictionary = dictionary;
+    data[i].codec = codec;
+    data[i].digest = NULL;
+    munit_assert_int(thrd_create (&(threads[i]), squash_test_digest_thread_func, &(data[i])), ==, thrd_success);
+  }
+
+  for (size_t i = 0 ; i < SQUASH_TEST_DIGEST_THREADS ; i++)
+    thrd_join (threads[i], NULL);
+
+  /* Everyone must end up with the same digest, no matter who won the
+     race to create it. */
+  munit_assert_not_null(data[0].digest);
+  for (size_t i = 1 ; i < SQUASH_TEST_DIGEST_THREADS ; i++)
+    munit_assert_ptr_equal(data[i].digest, data[0].digest);
+  munit_assert_ptr_equal(squash_dictionary_get_digest (dictionary, codec, 7, squash_test_digest_create, free), data[0].digest);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, data[0].digest, LOREM_IPSUM);
+
+  squash_object_unref (dictionary);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_dictionary_tests[] = {
+  { (char*) "/basic", squash_test_dictionary_basic, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/digest-threads", squash_test_dictionary_digest_threads, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_dictionary = {
+  (char*) "/dictionary",
+  squash_dictionary_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
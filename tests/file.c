@@ -246,11 +246,468 @@ squash_test_printf(const MunitParameter params[], void* user_data) {
   return MUNIT_OK;
 }
 
+static void
+squash_test_seek_check (SquashFile* file) {
+  uint8_t decompressed[LOREM_IPSUM_LENGTH];
+  size_t length;
+  SquashStatus res;
+
+  length = 64;
+  res = squash_file_read (file, &length, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (length, ==, 64);
+  munit_assert_memory_equal(64, decompressed, LOREM_IPSUM);
+  munit_assert_int64 (squash_file_tell (file), ==, 64);
+
+  for (int i = 0 ; i < 16 ; i++) {
+    const size_t offset = (size_t) munit_rand_int_range (0, (int) LOREM_IPSUM_LENGTH - 1);
+    const size_t wanted = (size_t) munit_rand_int_range (1, (int) (LOREM_IPSUM_LENGTH - offset));
+
+    res = squash_file_seek (file, (int64_t) offset, SEEK_SET);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) offset);
+
+    length = wanted;
+    res = squash_file_read (file, &length, decompressed);
+    SQUASH_ASSERT_NO_ERROR(res);
+    munit_assert_size (length, ==, wanted);
+    munit_assert_memory_equal(wanted, decompressed, LOREM_IPSUM + offset);
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) (offset + wanted));
+
+    /* pread doesn't move the position */
+    const size_t pread_offset = (size_t) munit_rand_int_range (0, (int) LOREM_IPSUM_LENGTH - 1);
+    length = LOREM_IPSUM_LENGTH;
+    res = squash_file_pread (file, pread_offset, &length, decompressed);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size (length, ==, LOREM_IPSUM_LENGTH - pread_offset);
+    munit_assert_memory_equal(length, decompressed, LOREM_IPSUM + pread_offset);
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) (offset + wanted));
+  }
+
+  res = squash_file_seek (file, -10, SEEK_END);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_int64 (squash_file_tell (file), ==, (int64_t) LOREM_IPSUM_LENGTH - 10);
+
+  length = sizeof (decompressed);
+  res = squash_file_read (file, &length, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (length, ==, 10);
+  munit_assert_memory_equal(10, decompressed, LOREM_IPSUM + LOREM_IPSUM_LENGTH - 10);
+
+  res = squash_file_seek (file, -1, SEEK_SET);
+  SQUASH_ASSERT_STATUS(res, SQUASH_BAD_PARAM);
+}
+
+static MunitResult
+squash_test_seek(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+  SquashStatus res;
+
+  /* Native format */
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_write (file, LOREM_IPSUM_LENGTH, (uint8_t*) LOREM_IPSUM);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_seek (file, 0, SEEK_SET);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_OPERATION);
+  squash_file_free (file, NULL);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  squash_test_seek_check (file);
+  squash_file_free (file, NULL);
+
+  /* Seekable container */
+  FILE* fp = tmpfile ();
+  munit_assert_not_null (fp);
+
+  size_t compressed_length = squash_codec_get_max_compressed_size_seekable (data->codec, LOREM_IPSUM_LENGTH, 256);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  res = squash_codec_compress_seekable (data->codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, 256, 1, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (fwrite (compressed, 1, compressed_length, fp), ==, compressed_length);
+  free (compressed);
+
+  fflush (fp);
+  rewind (fp);
+
+  file = squash_file_steal (data->codec, fp, NULL);
+  munit_assert_not_null (file);
+  squash_test_seek_check (file);
+  squash_file_close (file);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_seek_frames(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+  SquashStatus res;
+
+  /* Large enough to span several native frames or blocks for codecs
+     which have them, some of which don't record their size. */
+  const size_t uncompressed_length = (1024 * 1024 * 3) / 2;
+  uint8_t* uncompressed = squash_test_mixed_data (uncompressed_length);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_write (file, uncompressed_length, uncompressed);
+  SQUASH_ASSERT_OK(res);
+  squash_file_free (file, NULL);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+
+  const size_t chunk_length = 4096;
+  uint8_t* decompressed = munit_malloc (chunk_length);
+  size_t length;
+  size_t offset = 0;
+
+  /* Seeking to where we already are, or forwards, just carries on. */
+  for (int i = 0 ; i < 8 ; i++) {
+    res = squash_file_seek (file, 0, SEEK_CUR);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) offset);
+
+    offset += (size_t) munit_rand_int_range (0, (int) ((uncompressed_length - chunk_length) / 16));
+    res = squash_file_seek (file, (int64_t) offset, SEEK_SET);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) offset);
+
+    length = chunk_length;
+    res = squash_file_read (file, &length, decompressed);
+    SQUASH_ASSERT_NO_ERROR(res);
+    munit_assert_size (length, ==, chunk_length);
+    munit_assert_memory_equal(chunk_length, decompressed, uncompressed + offset);
+    offset += chunk_length;
+  }
+
+  /* Backwards, and reads which cross frame boundaries */
+  for (int i = 0 ; i < 8 ; i++) {
+    offset = (size_t) munit_rand_int_range (0, (int) (uncompressed_length - chunk_length));
+    res = squash_file_seek (file, (int64_t) offset, SEEK_SET);
+    SQUASH_ASSERT_OK(res);
+
+    length = chunk_length;
+    res = squash_file_read (file, &length, decompressed);
+    SQUASH_ASSERT_NO_ERROR(res);
+    munit_assert_size (length, ==, chunk_length);
+    munit_assert_memory_equal(chunk_length, decompressed, uncompressed + offset);
+
+    offset = (size_t) munit_rand_int_range (0, (int) (uncompressed_length - chunk_length));
+    length = chunk_length;
+    res = squash_file_pread (file, offset, &length, decompressed);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size (length, ==, chunk_length);
+    munit_assert_memory_equal(chunk_length, decompressed, uncompressed + offset);
+  }
+
+  res = squash_file_seek (file, -((int64_t) chunk_length), SEEK_END);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_int64 (squash_file_tell (file), ==, (int64_t) (uncompressed_length - chunk_length));
+  munit_assert_false (squash_file_eof (file));
+
+  length = chunk_length;
+  res = squash_file_read (file, &length, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (length, ==, chunk_length);
+  munit_assert_memory_equal(chunk_length, decompressed, uncompressed + uncompressed_length - chunk_length);
+
+  length = chunk_length;
+  res = squash_file_read (file, &length, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (length, ==, 0);
+
+  squash_file_free (file, NULL);
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_read_ahead(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+  SquashStatus res;
+
+  /* Enough for several read-ahead buffers */
+  const size_t uncompressed_length = (1024 * 1024 * 5) / 2;
+  uint8_t* uncompressed = squash_test_mixed_data (uncompressed_length);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_read_ahead (file, 2);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_write (file, uncompressed_length, uncompressed);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_OPERATION);
+  squash_file_free (file, NULL);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_write (file, uncompressed_length, uncompressed);
+  SQUASH_ASSERT_OK(res);
+  squash_file_free (file, NULL);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_read_ahead (file, 2);
+  SQUASH_ASSERT_OK(res);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+  size_t total_read = 0;
+  do {
+    size_t bytes_read = (size_t) munit_rand_int_range (1, 512 * 1024);
+    if (bytes_read > (uncompressed_length - total_read))
+      bytes_read = uncompressed_length - total_read;
+    res = squash_file_read (file, &bytes_read, decompressed + total_read);
+    SQUASH_ASSERT_NO_ERROR(res);
+    total_read += bytes_read;
+    munit_assert_size (total_read, <=, uncompressed_length);
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) total_read);
+  } while (total_read < uncompressed_length);
+
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+
+  size_t bytes_read = 1;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_STATUS(res, SQUASH_END_OF_STREAM);
+  munit_assert_size (bytes_read, ==, 0);
+  munit_assert_true (squash_file_eof (file));
+
+  res = squash_file_set_read_ahead (file, 4);
+  SQUASH_ASSERT_STATUS(res, SQUASH_STATE);
+
+  /* Seeking throws away whatever was read ahead */
+  res = squash_file_seek (file, 1000, SEEK_SET);
+  SQUASH_ASSERT_OK(res);
+  bytes_read = 4096;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (bytes_read, ==, 4096);
+  munit_assert_memory_equal(bytes_read, decompressed, uncompressed + 1000);
+
+  /* ... but a seek which fails leaves it, and the position, alone */
+  res = squash_file_seek (file, -((int64_t) uncompressed_length), SEEK_CUR);
+  SQUASH_ASSERT_STATUS(res, SQUASH_BAD_PARAM);
+  res = squash_file_seek (file, 0, 42);
+  SQUASH_ASSERT_STATUS(res, SQUASH_BAD_PARAM);
+  munit_assert_int64 (squash_file_tell (file), ==, 1000 + 4096);
+  bytes_read = uncompressed_length;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (bytes_read, ==, uncompressed_length - (1000 + 4096));
+  munit_assert_memory_equal(bytes_read, decompressed, uncompressed + (1000 + 4096));
+
+  squash_file_free (file, NULL);
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_write_behind(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+  SquashStatus res;
+
+  const size_t uncompressed_length = (1024 * 1024 * 5) / 2;
+  uint8_t* uncompressed = squash_test_mixed_data (uncompressed_length);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_write_behind (file, 2);
+  SQUASH_ASSERT_OK(res);
+
+  const bool can_flush = (squash_codec_get_info (data->codec) & SQUASH_CODEC_INFO_CAN_FLUSH) == SQUASH_CODEC_INFO_CAN_FLUSH;
+  size_t total_written = 0;
+  while (total_written < uncompressed_length) {
+    size_t length = (size_t) munit_rand_int_range (1, 512 * 1024);
+    if (length > (uncompressed_length - total_written))
+      length = uncompressed_length - total_written;
+
+    res = squash_file_write (file, length, uncompressed + total_written);
+    SQUASH_ASSERT_OK(res);
+    total_written += length;
+    munit_assert_int64 (squash_file_tell (file), ==, (int64_t) total_written);
+
+    if (can_flush && total_written > (uncompressed_length / 2) && (total_written - length) <= (uncompressed_length / 2)) {
+      res = squash_file_flush (file);
+      SQUASH_ASSERT_OK(res);
+    }
+  }
+
+  size_t length = 1;
+  res = squash_file_read (file, &length, uncompressed);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_OPERATION);
+
+  res = squash_file_free (file, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  length = uncompressed_length;
+  res = squash_file_read (file, &length, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+  squash_file_free (file, NULL);
+
+#if defined(SQUASH_TEST_DATA_DIR) && !defined(_WIN32)
+  /* Errors from the worker are reported by the next call; here the
+     underlying FILE* is read-only. */
+  FILE* ro = fopen (SQUASH_TEST_DATA_DIR "/lipsum.le.copy", "rb");
+  if (ro != NULL) {
+    file = squash_file_steal (data->codec, ro, NULL);
+    munit_assert_not_null (file);
+    res = squash_file_set_write_behind (file, 2);
+    SQUASH_ASSERT_OK(res);
+    res = squash_file_write (file, 1, uncompressed);
+    SQUASH_ASSERT_OK(res);
+    /* Depending on timing, this may or may not see the error */
+    squash_file_write (file, uncompressed_length - 1, uncompressed + 1);
+    res = squash_file_close (file);
+    munit_assert_int (res, <, 0);
+  }
+#endif
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_buffer(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+  SquashStatus res;
+
+  const size_t uncompressed_length = 64 * 1024;
+  uint8_t* uncompressed = squash_test_mixed_data (uncompressed_length);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_buffer (file, 4096, 3);
+  SQUASH_ASSERT_STATUS(res, SQUASH_BAD_PARAM);
+  res = squash_file_set_buffer (file, 4000, 4096);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_write (file, uncompressed_length, uncompressed);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_set_buffer (file, 0, 0);
+  SQUASH_ASSERT_STATUS(res, SQUASH_STATE);
+  res = squash_file_free (file, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_buffer (file, 1000, 0);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_set_read_ahead (file, 2);
+  SQUASH_ASSERT_OK(res);
+  size_t total_read = 0;
+  do {
+    size_t bytes_read = (size_t) munit_rand_int_range (1, 8 * 1024);
+    if (bytes_read > (uncompressed_length - total_read))
+      bytes_read = uncompressed_length - total_read;
+    res = squash_file_read (file, &bytes_read, decompressed + total_read);
+    SQUASH_ASSERT_NO_ERROR(res);
+    total_read += bytes_read;
+  } while (total_read < uncompressed_length && res != SQUASH_END_OF_STREAM);
+  munit_assert_size (total_read, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+  squash_file_free (file, NULL);
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_buffer_pool(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashCodec* codec = squash_get_codec ("copy");
+  if (codec == NULL)
+    return MUNIT_SKIP;
+
+  SquashMemoryUsage before, usage;
+  SquashStatus res;
+  uint8_t data[LOREM_IPSUM_LENGTH];
+  size_t length;
+
+  FILE* fp = tmpfile ();
+  munit_assert_not_null (fp);
+
+  /* Only for this test (munit forks for each one) */
+  squash_memory_enable_accounting ();
+  SQUASH_ASSERT_OK(squash_memory_get_usage (&before));
+
+  SquashFile* file = squash_file_steal (codec, fp, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_write_behind (file, 4);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_write (file, LOREM_IPSUM_LENGTH, LOREM_IPSUM);
+  SQUASH_ASSERT_OK(res);
+  res = squash_file_free (file, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  fflush (fp);
+  rewind (fp);
+
+  file = squash_file_steal (codec, fp, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_read_ahead (file, 4);
+  SQUASH_ASSERT_OK(res);
+  length = sizeof (data);
+  res = squash_file_read (file, &length, data);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(length, data, LOREM_IPSUM);
+  res = squash_file_free (file, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  /* Once the last file is gone the pooled buffers should be too */
+  SQUASH_ASSERT_OK(squash_memory_get_usage (&usage));
+  munit_assert_size (usage.current, <, before.current + (1024 * 1024));
+
+  fclose (fp);
+
+  return MUNIT_OK;
+}
+
 MunitTest squash_file_tests[] = {
   { (char*) "/io", squash_test_io, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/splice/full", squash_test_splice_full, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/splice/partial", squash_test_splice_partial, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/printf", squash_test_printf, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/seek", squash_test_seek, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/seek/frames", squash_test_seek_frames, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/read-ahead", squash_test_read_ahead, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/write-behind", squash_test_write_behind, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/buffer", squash_test_buffer, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/buffer-pool", squash_test_buffer_pool, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
@@ -0,0 +1,81 @@
+#include "test-squash.h"
+
+#define SQUASH_TEST_IOVEC_SEGMENTS 7
+
+/* Split a buffer into segments of random (possibly zero) length. */
+static void
+squash_test_iovec_split (size_t iovcnt, SquashIOVec iov[], uint8_t* data, size_t data_length) {
+  size_t pos = 0;
+
+  for (size_t i = 0 ; i < iovcnt ; i++) {
+    const size_t remaining = data_length - pos;
+    size_t l = (i == iovcnt - 1) ? remaining : (size_t) munit_rand_int_range (0, (int) (remaining / 2));
+
+    iov[i].iov_base = data + pos;
+    iov[i].iov_len = l;
+    pos += l;
+  }
+}
+
+static MunitResult
+squash_test_iovec_basic(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashIOVec uncompressed_iov[SQUASH_TEST_IOVEC_SEGMENTS];
+  SquashIOVec compressed_iov[SQUASH_TEST_IOVEC_SEGMENTS];
+  SquashIOVec decompressed_iov[SQUASH_TEST_IOVEC_SEGMENTS];
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+  size_t compressed_length = 0;
+  size_t decompressed_length = 0;
+  SquashStatus res;
+
+  squash_test_iovec_split (SQUASH_TEST_IOVEC_SEGMENTS, uncompressed_iov, (uint8_t*) LOREM_IPSUM, LOREM_IPSUM_LENGTH);
+  squash_test_iovec_split (SQUASH_TEST_IOVEC_SEGMENTS, compressed_iov, compressed, max_compressed_length);
+
+  res = squash_codec_compressv (codec, &compressed_length,
+                                SQUASH_TEST_IOVEC_SEGMENTS, compressed_iov,
+                                SQUASH_TEST_IOVEC_SEGMENTS, uncompressed_iov,
+                                NULL);
+  SQUASH_ASSERT_OK(res);
+
+  /* The segments were consecutive, so the regular API should be able
+     to decompress the result. */
+  decompressed_length = LOREM_IPSUM_LENGTH;
+  res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  memset (decompressed, 0, LOREM_IPSUM_LENGTH);
+  squash_test_iovec_split (SQUASH_TEST_IOVEC_SEGMENTS, compressed_iov, compressed, compressed_length);
+  squash_test_iovec_split (SQUASH_TEST_IOVEC_SEGMENTS, decompressed_iov, decompressed, LOREM_IPSUM_LENGTH);
+
+  res = squash_codec_decompressv (codec, &decompressed_length,
+                                  SQUASH_TEST_IOVEC_SEGMENTS, decompressed_iov,
+                                  SQUASH_TEST_IOVEC_SEGMENTS, compressed_iov,
+                                  NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_iovec_tests[] = {
+  { (char*) "/basic", squash_test_iovec_basic, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_iovec = {
+  (char*) "/iovec",
+  squash_iovec_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
@@ -0,0 +1,159 @@
+#include "test-squash.h"
+
+#if !defined(_WIN32)
+#  include <poll.h>
+#endif
+
+#define N_JOBS 32
+
+static MunitResult
+squash_test_job_buffer(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashJobQueue* queue = squash_job_queue_new (4, 8);
+  munit_assert_not_null(queue);
+  squash_object_ref (queue);
+
+  const size_t compressed_size_max = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  SquashJob compress_jobs[N_JOBS] = { { 0, }, };
+  SquashJob decompress_jobs[N_JOBS] = { { 0, }, };
+  uint8_t* compressed = munit_calloc (N_JOBS, compressed_size_max);
+  uint8_t* decompressed = munit_calloc (N_JOBS, LOREM_IPSUM_LENGTH);
+
+  for (size_t i = 0 ; i < N_JOBS ; i++) {
+    SquashJob* job = &(compress_jobs[i]);
+    job->codec = codec;
+    job->stream_type = SQUASH_STREAM_COMPRESS;
+    job->input = (const uint8_t*) LOREM_IPSUM;
+    job->input_size = LOREM_IPSUM_LENGTH;
+    job->output = compressed + (i * compressed_size_max);
+    job->output_size = compressed_size_max;
+    job->user_data = &(decompress_jobs[i]);
+  }
+
+  /* There are more jobs than the queue holds, so reap whenever it
+     fills up, decompressing each result as soon as it arrives. */
+  size_t submitted = 0;
+  size_t reaped = 0;
+  while (reaped < N_JOBS * 2) {
+    if (submitted < N_JOBS) {
+      const SquashStatus res = squash_job_queue_submit (queue, &(compress_jobs[submitted]), false);
+      if (res == SQUASH_OK) {
+        submitted++;
+        continue;
+      }
+      SQUASH_ASSERT_STATUS(res, SQUASH_BUFFER_FULL);
+    }
+
+    SquashJob* job = squash_job_queue_reap (queue, true);
+    munit_assert_not_null(job);
+    SQUASH_ASSERT_OK(job->status);
+    reaped++;
+
+    if (job->stream_type == SQUASH_STREAM_COMPRESS) {
+      SquashJob* next = (SquashJob*) job->user_data;
+      const size_t i = (size_t) (next - decompress_jobs);
+      next->codec = codec;
+      next->stream_type = SQUASH_STREAM_DECOMPRESS;
+      next->input = job->output;
+      next->input_size = job->output_size;
+      next->output = decompressed + (i * LOREM_IPSUM_LENGTH);
+      next->output_size = LOREM_IPSUM_LENGTH;
+      SQUASH_ASSERT_OK(squash_job_queue_submit (queue, next, false));
+    } else {
+      munit_assert_size(job->output_size, ==, LOREM_IPSUM_LENGTH);
+      munit_assert_memory_equal(LOREM_IPSUM_LENGTH, job->output, LOREM_IPSUM);
+    }
+  }
+  munit_assert_null(squash_job_queue_reap (queue, false));
+  munit_assert_size(reaped, ==, N_JOBS * 2);
+
+  squash_object_unref (queue);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_job_queue(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashCodec* codec = squash_get_codec ("copy");
+  if (codec == NULL)
+    return MUNIT_SKIP;
+
+  SquashJobQueue* queue = squash_job_queue_new (1, 4);
+  munit_assert_not_null(queue);
+  squash_object_ref (queue);
+
+  SquashJob jobs[5] = { { 0, }, };
+  uint8_t output[5][LOREM_IPSUM_LENGTH];
+
+  SquashJob invalid = { 0, };
+  SQUASH_ASSERT_STATUS(squash_job_queue_submit (queue, &invalid, false), SQUASH_BAD_PARAM);
+
+  for (size_t i = 0 ; i < 5 ; i++) {
+    jobs[i].codec = codec;
+    jobs[i].stream_type = SQUASH_STREAM_COMPRESS;
+    jobs[i].input = (const uint8_t*) LOREM_IPSUM;
+    jobs[i].input_size = LOREM_IPSUM_LENGTH;
+    jobs[i].output = output[i];
+    jobs[i].output_size = sizeof (output[i]);
+  }
+
+  for (size_t i = 0 ; i < 4 ; i++)
+    SQUASH_ASSERT_OK(squash_job_queue_submit (queue, &(jobs[i]), false));
+
+  /* Full until something is reaped, however fast the worker is */
+  SQUASH_ASSERT_STATUS(squash_job_queue_submit (queue, &(jobs[4]), false), SQUASH_BUFFER_FULL);
+
+  /* The worker may or may not have reached the last job yet */
+  const SquashStatus cancelled = squash_job_queue_cancel (queue, &(jobs[3]));
+  munit_assert(cancelled == SQUASH_OK || cancelled == SQUASH_STATE);
+
+#if !defined(_WIN32)
+  const int fd = squash_job_queue_get_fd (queue);
+  munit_assert_int(fd, >=, 0);
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  munit_assert_int(poll (&pfd, 1, 10000), ==, 1);
+#endif
+
+  for (size_t i = 0 ; i < 4 ; i++) {
+    SquashJob* job = squash_job_queue_reap (queue, true);
+    munit_assert_not_null(job);
+    if (job == &(jobs[3]) && cancelled == SQUASH_OK) {
+      SQUASH_ASSERT_STATUS(job->status, SQUASH_CANCELLED);
+    } else {
+      SQUASH_ASSERT_OK(job->status);
+      munit_assert_size(job->output_size, ==, LOREM_IPSUM_LENGTH);
+    }
+  }
+  munit_assert_null(squash_job_queue_reap (queue, true));
+  SQUASH_ASSERT_STATUS(squash_job_queue_cancel (queue, &(jobs[0])), SQUASH_STATE);
+
+#if !defined(_WIN32)
+  munit_assert_int(poll (&pfd, 1, 0), ==, 0);
+#endif
+
+  SQUASH_ASSERT_OK(squash_job_queue_submit (queue, &(jobs[4]), false));
+  munit_assert_ptr_equal(squash_job_queue_reap (queue, true), &(jobs[4]));
+  SQUASH_ASSERT_OK(jobs[4].status);
+
+  squash_object_unref (queue);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_job_tests[] = {
+  { (char*) "/buffer", squash_test_job_buffer, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/queue", squash_test_job_queue, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_job = {
+  (char*) "/job",
+  squash_job_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
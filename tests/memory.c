@@ -0,0 +1,81 @@
+#include "test-squash.h"
+
+static MunitResult
+squash_test_memory_accounting(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+  SquashMemoryUsage before, usage;
+  SquashStatus res;
+
+  /* munit runs each test in its own process, so turning accounting
+     on here leaves the rest of the suite on the default path. */
+  squash_memory_enable_accounting ();
+
+  SQUASH_ASSERT_OK(squash_codec_get_memory_usage (codec, &before));
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (compressed_length);
+
+  SquashStream* stream = squash_stream_new (codec, SQUASH_STREAM_COMPRESS, NULL);
+  munit_assert_not_null(stream);
+
+  stream->next_in = LOREM_IPSUM;
+  stream->avail_in = LOREM_IPSUM_LENGTH;
+  stream->next_out = compressed;
+  stream->avail_out = compressed_length;
+
+  do {
+    res = squash_stream_process (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  do {
+    res = squash_stream_finish (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  SQUASH_ASSERT_OK(squash_stream_get_memory_usage (stream, &usage));
+  munit_assert_size(usage.peak, >=, usage.current);
+
+  /* These plugins allocate their state through Squash */
+  const char* plugin = squash_plugin_get_name (squash_codec_get_plugin (codec));
+  const bool tracked =
+    strcmp (plugin, "zlib") == 0 || strcmp (plugin, "zlib-ng") == 0 || strcmp (plugin, "miniz") == 0 ||
+    strcmp (plugin, "bzip2") == 0 || strcmp (plugin, "lzma") == 0 || strcmp (plugin, "brotli") == 0;
+  if (tracked) {
+    munit_assert_size(usage.current, >, 0);
+    munit_assert_size(usage.allocations, >, 0);
+
+    SQUASH_ASSERT_OK(squash_codec_get_memory_usage (codec, &usage));
+    munit_assert_size(usage.current, >, before.current);
+    munit_assert_size(usage.peak, >=, usage.current);
+  }
+
+  squash_object_unref (stream);
+
+  /* Everything the stream allocated has been given back */
+  if (tracked) {
+    SQUASH_ASSERT_OK(squash_codec_get_memory_usage (codec, &usage));
+    munit_assert_size(usage.current, ==, before.current);
+  }
+
+  SQUASH_ASSERT_OK(squash_memory_get_usage (&usage));
+  munit_assert_size(usage.peak, >=, usage.current);
+
+  free (compressed);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_memory_tests[] = {
+  { (char*) "/accounting", squash_test_memory_accounting, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_memory = {
+  (char*) "/memory",
+  squash_memory_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
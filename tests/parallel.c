@@ -0,0 +1,139 @@
+#include "test-squash.h"
+
+static MunitResult
+squash_test_parallel_buffer(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  if (strcmp ("lz4-raw", squash_codec_get_name (codec)) == 0)
+    return MUNIT_SKIP;
+
+  /* Small blocks, so we end up with several of them, and a short
+     final block. */
+  const size_t block_size = 1000;
+  size_t compressed_length = squash_codec_get_max_compressed_size_parallel (codec, LOREM_IPSUM_LENGTH, block_size);
+  size_t decompressed_length = LOREM_IPSUM_LENGTH;
+  uint8_t* compressed = munit_malloc (compressed_length);
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+  SquashStatus res;
+
+  munit_assert_size (compressed_length, >, 0);
+
+  res = squash_codec_compress_parallel (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, block_size, 4, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  munit_assert_size (squash_codec_get_uncompressed_size_parallel (codec, compressed_length, compressed), ==, LOREM_IPSUM_LENGTH);
+
+  res = squash_codec_decompress_parallel (codec, &decompressed_length, decompressed, compressed_length, compressed, 4, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  decompressed_length = LOREM_IPSUM_LENGTH - 1;
+  res = squash_codec_decompress_parallel (codec, &decompressed_length, decompressed, compressed_length, compressed, 4, NULL);
+  SQUASH_ASSERT_STATUS(res, SQUASH_BUFFER_FULL);
+
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_parallel_small(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* Output buffer smaller than the maximum, so the temporary buffer
+     path is exercised. */
+  size_t max_compressed_length = squash_codec_get_max_compressed_size_parallel (codec, LOREM_IPSUM_LENGTH, 512);
+  size_t compressed_length = max_compressed_length;
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  SquashStatus res;
+
+  res = squash_codec_compress_parallel (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, 512, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  const size_t exact_length = compressed_length;
+  res = squash_codec_compress_parallel (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, 512, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (compressed_length, ==, exact_length);
+
+  compressed_length = exact_length - 1;
+  res = squash_codec_compress_parallel (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, 512, 0, NULL);
+  SQUASH_ASSERT_STATUS(res, SQUASH_BUFFER_FULL);
+
+  free (compressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_parallel_native(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* Large enough for several bzip2 blocks at level 1. */
+  const size_t uncompressed_length = 512 * 1024;
+  uint8_t* uncompressed = munit_malloc (uncompressed_length);
+  for (size_t pos = 0 ; pos < uncompressed_length ; ) {
+    const size_t offset = (size_t) munit_rand_int_range (0, (int) LOREM_IPSUM_LENGTH - 1);
+    size_t length = (size_t) munit_rand_int_range (1, (int) (LOREM_IPSUM_LENGTH - offset));
+    if (length > uncompressed_length - pos)
+      length = uncompressed_length - pos;
+    memcpy (uncompressed + pos, LOREM_IPSUM + offset, length);
+    pos += length;
+  }
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options != NULL) {
+    squash_object_ref (options);
+    squash_options_parse_option (options, "level", "1");
+    /* Make sure xz writes more than one block. */
+    if (strcmp ("xz", squash_codec_get_name (codec)) == 0) {
+      SQUASH_ASSERT_OK(squash_options_parse_option (options, "threads", "2"));
+      SQUASH_ASSERT_OK(squash_options_parse_option (options, "block-size", "65536"));
+    }
+  }
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  SquashStatus res;
+
+  res = squash_codec_compress_with_options (codec, &compressed_length, compressed, uncompressed_length, uncompressed, options);
+  SQUASH_ASSERT_OK(res);
+
+  size_t decompressed_length = uncompressed_length;
+  uint8_t* decompressed = munit_malloc (decompressed_length);
+  res = squash_codec_decompress_native_parallel (codec, &decompressed_length, decompressed, compressed_length, compressed, 4, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+
+  decompressed_length = uncompressed_length - 1;
+  res = squash_codec_decompress_native_parallel (codec, &decompressed_length, decompressed, compressed_length, compressed, 4, NULL);
+  munit_assert_int (res, !=, SQUASH_OK);
+
+  if (options != NULL)
+    squash_object_unref (options);
+  free (compressed);
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_parallel_tests[] = {
+  { (char*) "/buffer", squash_test_parallel_buffer, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/small", squash_test_parallel_small, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/native", squash_test_parallel_native, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_parallel = {
+  (char*) "/parallel",
+  squash_parallel_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
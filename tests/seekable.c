@@ -0,0 +1,137 @@
+#include "test-squash.h"
+
+static MunitResult
+squash_test_seekable_range(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* Small blocks, so ranges span several of them. */
+  const size_t block_size = 256;
+  size_t compressed_length = squash_codec_get_max_compressed_size_seekable (codec, LOREM_IPSUM_LENGTH, block_size);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+  size_t decompressed_length;
+  SquashStatus res;
+
+  res = squash_codec_compress_seekable (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, block_size, 4, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  munit_assert_size (squash_codec_get_uncompressed_size_seekable (codec, compressed_length, compressed), ==, LOREM_IPSUM_LENGTH);
+
+  decompressed_length = LOREM_IPSUM_LENGTH;
+  res = squash_codec_decompress_range (codec, 0, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  for (int i = 0 ; i < 32 ; i++) {
+    const size_t offset = (size_t) munit_rand_int_range (0, (int) LOREM_IPSUM_LENGTH - 1);
+    const size_t length = (size_t) munit_rand_int_range (1, (int) (LOREM_IPSUM_LENGTH - offset));
+
+    decompressed_length = length;
+    res = squash_codec_decompress_range (codec, offset, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size (decompressed_length, ==, length);
+    munit_assert_memory_equal(length, decompressed, LOREM_IPSUM + offset);
+  }
+
+  /* Reading past the end is short, not an error. */
+  decompressed_length = 100;
+  res = squash_codec_decompress_range (codec, LOREM_IPSUM_LENGTH - 10, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, 10);
+  munit_assert_memory_equal(10, decompressed, LOREM_IPSUM + LOREM_IPSUM_LENGTH - 10);
+
+  decompressed_length = 100;
+  res = squash_codec_decompress_range (codec, LOREM_IPSUM_LENGTH + 1, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, 0);
+
+  /* Corrupting the first block only affects ranges which include it. */
+  compressed[4] ^= 0xff;
+
+  decompressed_length = 16;
+  res = squash_codec_decompress_range (codec, 0, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_BUFFER);
+
+  decompressed_length = 16;
+  res = squash_codec_decompress_range (codec, block_size * 2, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_memory_equal(16, decompressed, LOREM_IPSUM + (block_size * 2));
+
+  free (compressed);
+  free (decompressed);
+
+  /* Blocks which compress very well, at the default block size */
+  const size_t zeros_length = (SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE * 2) + 1000;
+  uint8_t* zeros = munit_calloc (zeros_length, 1);
+  compressed_length = squash_codec_get_max_compressed_size_seekable (codec, zeros_length, 0);
+  compressed = munit_malloc (compressed_length);
+  decompressed = munit_malloc (zeros_length);
+
+  res = squash_codec_compress_seekable (codec, &compressed_length, compressed, zeros_length, zeros, 0, 1, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  memset (decompressed, 0xff, zeros_length);
+  decompressed_length = SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE;
+  res = squash_codec_decompress_range (codec, 1000, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, SQUASH_SEEKABLE_DEFAULT_BLOCK_SIZE);
+  munit_assert_memory_equal(decompressed_length, decompressed, zeros);
+
+  free (zeros);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_seekable_bad_footer(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* One block, so the sizes in the footer can be inflated without
+     changing the number of blocks. */
+  size_t compressed_length = squash_codec_get_max_compressed_size_seekable (codec, LOREM_IPSUM_LENGTH, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  uint8_t decompressed[16];
+  size_t decompressed_length;
+  SquashStatus res;
+
+  res = squash_codec_compress_seekable (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, LOREM_IPSUM_LENGTH, 1, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  /* The footer is the uncompressed size, block size, block count
+     (64-bit LE each), index CRC and magic. */
+  uint8_t* footer = compressed + compressed_length - 32;
+  const uint64_t huge = UINT64_C(1) << 40;
+  for (size_t i = 0 ; i < 8 ; i++) {
+    footer[i] = (uint8_t) (huge >> (i * 8));
+    footer[8 + i] = (uint8_t) (huge >> (i * 8));
+  }
+
+  /* A partial block must not make us allocate whatever the footer
+     claims. */
+  decompressed_length = sizeof (decompressed);
+  res = squash_codec_decompress_range (codec, 1, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_BUFFER);
+
+  free (compressed);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_seekable_tests[] = {
+  { (char*) "/range", squash_test_seekable_range, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/bad-footer", squash_test_seekable_bad_footer, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_seekable = {
+  (char*) "/seekable",
+  squash_seekable_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
@@ -0,0 +1,74 @@
+#include "test-squash.h"
+
+static MunitResult
+squash_test_select_basic(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  const char* const codecs[] = { "copy", "gzip", NULL };
+  SquashSelectCriteria criteria = { SQUASH_SELECT_GOAL_RATIO, 0.0, 0.0, 0.0, codecs, 0 };
+  SquashCodec* codec = NULL;
+  SquashOptions* options = NULL;
+  SquashStatus res;
+
+  if (squash_get_codec ("copy") == NULL || squash_get_codec ("gzip") == NULL)
+    return MUNIT_SKIP;
+
+  res = squash_select_codec (NULL, LOREM_IPSUM_LENGTH, (const uint8_t*) LOREM_IPSUM, &criteria, &codec, &options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_string_equal(squash_codec_get_name (codec), "gzip");
+  munit_assert_not_null(options);
+  squash_object_unref (options);
+
+  /* copy never compresses, so it can't meet any ratio above 1. */
+  criteria.codecs = codecs;
+  criteria.min_ratio = 1000.0;
+  res = squash_select_codec (NULL, LOREM_IPSUM_LENGTH, (const uint8_t*) LOREM_IPSUM, &criteria, &codec, &options);
+  SQUASH_ASSERT_STATUS(res, SQUASH_NOT_FOUND);
+
+  criteria.min_ratio = 0.0;
+  criteria.goal = SQUASH_SELECT_GOAL_DECOMPRESS_SPEED;
+  res = squash_select_codec ("test", LOREM_IPSUM_LENGTH, (const uint8_t*) LOREM_IPSUM, &criteria, &codec, &options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_string_equal(squash_codec_get_name (codec), "copy");
+  munit_assert_null(options);
+
+  /* The decision is cached, so the sample is ignored. */
+  codec = NULL;
+  res = squash_select_codec ("test", 1, (const uint8_t*) "x", &criteria, &codec, &options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_string_equal(squash_codec_get_name (codec), "copy");
+
+  /* Cached options are shared with later callers, so they must not
+     be modifiable. */
+  criteria.goal = SQUASH_SELECT_GOAL_RATIO;
+  res = squash_select_codec ("test-ratio", LOREM_IPSUM_LENGTH, (const uint8_t*) LOREM_IPSUM, &criteria, &codec, &options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_string_equal(squash_codec_get_name (codec), "gzip");
+  munit_assert_not_null(options);
+  munit_assert_true(squash_options_is_frozen (options));
+  const int level = squash_options_get_int (options, codec, "level");
+  res = squash_options_set_int (options, "level", (level == 1) ? 2 : 1);
+  SQUASH_ASSERT_STATUS(res, SQUASH_STATE);
+  squash_object_unref (options);
+
+  res = squash_select_codec ("test-ratio", 1, (const uint8_t*) "x", &criteria, &codec, &options);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_not_null(options);
+  munit_assert_int(squash_options_get_int (options, codec, "level"), ==, level);
+  squash_object_unref (options);
+
+  squash_select_clear_cache (NULL);
+
+  return MUNIT_OK;
+}
+
+MunitTest squash_select_tests[] = {
+  { (char*) "/basic", squash_test_select_basic, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+MunitSuite squash_test_suite_select = {
+  (char*) "/select",
+  squash_select_tests,
+  NULL,
+  1,
+  MUNIT_SUITE_OPTION_NONE
+};
@@ -1,5 +1,16 @@
+#if defined(_POSIX_C_SOURCE) && (_POSIX_C_SOURCE < 200112L)
+#  undef _POSIX_C_SOURCE
+#endif
+#if !defined(_POSIX_C_SOURCE)
+#  define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "test-squash.h"
 
+#if !defined(_WIN32)
+#  include <unistd.h>
+#endif
+
 struct SpliceBuffers {
   SquashStreamType stream_type;
 
@@ -113,8 +124,334 @@ squash_test_custom(MUNIT_UNUSED const MunitParameter params[], void* user_data)
   return MUNIT_OK;
 }
 
+#if !defined(_WIN32)
+static MunitResult
+squash_test_fd(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+  SquashStatus res;
+
+  if (strcmp (squash_codec_get_name (codec), "density") == 0)
+    return MUNIT_SKIP;
+
+  /* Several I/O buffers' worth, not a multiple of the buffer size */
+  const size_t uncompressed_length = (1024 * 1024) + 12345;
+  uint8_t* uncompressed = squash_test_mixed_data (uncompressed_length);
+
+  FILE* input = tmpfile ();
+  FILE* compressed = tmpfile ();
+  FILE* decompressed = tmpfile ();
+  munit_assert_not_null (input);
+  munit_assert_not_null (compressed);
+  munit_assert_not_null (decompressed);
+
+  munit_assert_size (fwrite (uncompressed, 1, uncompressed_length, input), ==, uncompressed_length);
+  fflush (input);
+  munit_assert_int (lseek (fileno (input), 0, SEEK_SET), ==, 0);
+
+  res = squash_splice_fd (codec, SQUASH_STREAM_COMPRESS, fileno (compressed), fileno (input), 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) lseek (fileno (input), 0, SEEK_CUR), ==, (int64_t) uncompressed_length);
+
+  munit_assert_int (lseek (fileno (compressed), 0, SEEK_SET), ==, 0);
+  res = squash_splice_fd (codec, SQUASH_STREAM_DECOMPRESS, fileno (decompressed), fileno (compressed), 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) lseek (fileno (decompressed), 0, SEEK_CUR), ==, (int64_t) uncompressed_length);
+
+  uint8_t* output = munit_malloc (uncompressed_length);
+  munit_assert_int (lseek (fileno (decompressed), 0, SEEK_SET), ==, 0);
+  size_t total_read = 0;
+  while (total_read < uncompressed_length) {
+    const ssize_t r = read (fileno (decompressed), output + total_read, uncompressed_length - total_read);
+    munit_assert_int64 ((int64_t) r, >, 0);
+    total_read += (size_t) r;
+  }
+  munit_assert_memory_equal (uncompressed_length, output, uncompressed);
+
+  /* A pipe can't be read ahead with offsets */
+  int pipefd[2];
+  munit_assert_int (pipe (pipefd), ==, 0);
+  munit_assert_int64 ((int64_t) write (pipefd[1], LOREM_IPSUM, LOREM_IPSUM_LENGTH), ==, (int64_t) LOREM_IPSUM_LENGTH);
+  close (pipefd[1]);
+
+  munit_assert_int (ftruncate (fileno (compressed), 0), ==, 0);
+  munit_assert_int (lseek (fileno (compressed), 0, SEEK_SET), ==, 0);
+  res = squash_splice_fd (codec, SQUASH_STREAM_COMPRESS, fileno (compressed), pipefd[0], 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  close (pipefd[0]);
+
+  munit_assert_int (lseek (fileno (compressed), 0, SEEK_SET), ==, 0);
+  munit_assert_int (ftruncate (fileno (decompressed), 0), ==, 0);
+  munit_assert_int (lseek (fileno (decompressed), 0, SEEK_SET), ==, 0);
+  res = squash_splice_fd (codec, SQUASH_STREAM_DECOMPRESS, fileno (decompressed), fileno (compressed), 100, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) lseek (fileno (decompressed), 0, SEEK_CUR), ==, 100);
+  munit_assert_int64 ((int64_t) pread (fileno (decompressed), output, 100, 0), ==, 100);
+  munit_assert_memory_equal (100, output, LOREM_IPSUM);
+
+  fclose (input);
+  fclose (compressed);
+  fclose (decompressed);
+  free (output);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_passthrough(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashCodec* codec = squash_get_codec ("copy");
+  SquashStatus res;
+  char buf[LOREM_IPSUM_LENGTH];
+
+  munit_assert_not_null (codec);
+
+  FILE* input = tmpfile ();
+  FILE* output = tmpfile ();
+  munit_assert_not_null (input);
+  munit_assert_not_null (output);
+
+  munit_assert_size (fwrite (LOREM_IPSUM, 1, LOREM_IPSUM_LENGTH, input), ==, LOREM_IPSUM_LENGTH);
+  rewind (input);
+
+  /* Leave stdio with data buffered on both sides */
+  munit_assert_size (fread (buf, 1, 10, input), ==, 10);
+  munit_assert_size (fwrite ("header", 1, 6, output), ==, 6);
+
+  res = squash_splice (codec, SQUASH_STREAM_COMPRESS, output, input, 100, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (input), ==, 110);
+  munit_assert_int64 ((int64_t) ftello (output), ==, 106);
+
+  res = squash_splice (codec, SQUASH_STREAM_DECOMPRESS, output, input, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (input), ==, (int64_t) LOREM_IPSUM_LENGTH);
+  munit_assert_int64 ((int64_t) ftello (output), ==, (int64_t) (LOREM_IPSUM_LENGTH - 4));
+
+  rewind (output);
+  munit_assert_size (fread (buf, 1, 6, output), ==, 6);
+  munit_assert_memory_equal (6, buf, "header");
+  munit_assert_size (fread (buf, 1, LOREM_IPSUM_LENGTH - 10, output), ==, LOREM_IPSUM_LENGTH - 10);
+  munit_assert_memory_equal (LOREM_IPSUM_LENGTH - 10, buf, LOREM_IPSUM + 10);
+  munit_assert_size (fread (buf, 1, 1, output), ==, 0);
+
+  fclose (input);
+  fclose (output);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_mmap(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+  SquashStatus res;
+
+  if (strcmp (squash_codec_get_name (codec), "density") == 0)
+    return MUNIT_SKIP;
+
+  const size_t uncompressed_length = (1024 * 1024) + 12345;
+  uint8_t* uncompressed = squash_test_mixed_data (uncompressed_length);
+
+  munit_assert_int (setenv ("SQUASH_MMAP_IO", "yes", 1), ==, 0);
+
+  FILE* input = tmpfile ();
+  FILE* compressed = tmpfile ();
+  FILE* decompressed = tmpfile ();
+  munit_assert_not_null (input);
+  munit_assert_not_null (compressed);
+  munit_assert_not_null (decompressed);
+
+  /* Start part way into the input and output files */
+  munit_assert_size (fwrite ("header", 1, 6, input), ==, 6);
+  munit_assert_size (fwrite (uncompressed, 1, uncompressed_length, input), ==, uncompressed_length);
+  munit_assert_int (fseeko (input, 6, SEEK_SET), ==, 0);
+  munit_assert_size (fwrite ("xx", 1, 2, decompressed), ==, 2);
+
+  res = squash_splice (codec, SQUASH_STREAM_COMPRESS, compressed, input, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (input), ==, (int64_t) (uncompressed_length + 6));
+
+  const off_t compressed_length = ftello (compressed);
+  rewind (compressed);
+  res = squash_splice (codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) (uncompressed_length + 2));
+
+  /* Nothing may be left over from extending the output for the map */
+  munit_assert_int (fseeko (decompressed, 0, SEEK_END), ==, 0);
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) (uncompressed_length + 2));
+
+  uint8_t* output = munit_malloc (uncompressed_length);
+  munit_assert_int (fseeko (decompressed, 2, SEEK_SET), ==, 0);
+  munit_assert_size (fread (output, 1, uncompressed_length, decompressed), ==, uncompressed_length);
+  munit_assert_memory_equal (uncompressed_length, output, uncompressed);
+
+  /* Reading through a SquashFile maps the compressed data, too */
+  rewind (compressed);
+  SquashFile* file = squash_file_steal (codec, compressed, NULL);
+  munit_assert_not_null (file);
+  size_t total_read = 0;
+  do {
+    size_t output_size = uncompressed_length - total_read;
+    if (output_size > 65536)
+      output_size = 65536;
+    res = squash_file_read (file, &output_size, output + total_read);
+    munit_assert_int (res, >=, 0);
+    total_read += output_size;
+  } while (total_read < uncompressed_length && res != SQUASH_END_OF_STREAM);
+  munit_assert_size (total_read, ==, uncompressed_length);
+  munit_assert_memory_equal (uncompressed_length, output, uncompressed);
+
+  FILE* fp = NULL;
+  SQUASH_ASSERT_OK (squash_file_free (file, &fp));
+  munit_assert_ptr_equal (fp, compressed);
+  munit_assert_int64 ((int64_t) ftello (compressed), <=, (int64_t) compressed_length);
+
+  munit_assert_int (unsetenv ("SQUASH_MMAP_IO"), ==, 0);
+
+  fclose (input);
+  fclose (compressed);
+  fclose (decompressed);
+  free (output);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_mmap_existing(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+  SquashStatus res;
+
+  if (strcmp (squash_codec_get_name (codec), "density") == 0)
+    return MUNIT_SKIP;
+
+  munit_assert_int (setenv ("SQUASH_MMAP_IO", "yes", 1), ==, 0);
+
+  FILE* compressed = tmpfile ();
+  FILE* decompressed = tmpfile ();
+  munit_assert_not_null (compressed);
+  munit_assert_not_null (decompressed);
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed_data = munit_malloc (compressed_length);
+  res = squash_codec_compress (codec, &compressed_length, compressed_data, LOREM_IPSUM_LENGTH, LOREM_IPSUM, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_size (fwrite (compressed_data, 1, compressed_length, compressed), ==, compressed_length);
+  rewind (compressed);
+
+  /* Overwriting the start of a larger file must leave the rest */
+  const size_t existing_length = LOREM_IPSUM_LENGTH * 3;
+  uint8_t* existing = munit_malloc (existing_length);
+  memset (existing, 'x', existing_length);
+  munit_assert_size (fwrite (existing, 1, existing_length, decompressed), ==, existing_length);
+  rewind (decompressed);
+
+  res = squash_splice (codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) LOREM_IPSUM_LENGTH);
+
+  munit_assert_int (fseeko (decompressed, 0, SEEK_END), ==, 0);
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) existing_length);
+
+  uint8_t* output = munit_malloc (existing_length);
+  rewind (decompressed);
+  munit_assert_size (fread (output, 1, existing_length, decompressed), ==, existing_length);
+  munit_assert_memory_equal (LOREM_IPSUM_LENGTH, output, LOREM_IPSUM);
+  munit_assert_memory_equal (existing_length - LOREM_IPSUM_LENGTH, output + LOREM_IPSUM_LENGTH, existing);
+
+  munit_assert_int (unsetenv ("SQUASH_MMAP_IO"), ==, 0);
+
+  fclose (compressed);
+  fclose (decompressed);
+  free (compressed_data);
+  free (existing);
+  free (output);
+
+  return MUNIT_OK;
+}
+
+static uint8_t
+squash_test_mmap_window_byte (size_t pos) {
+  /* Compressible, but not periodic in anything resembling a page */
+  return (LOREM_IPSUM)[(pos + (pos / 4099)) % LOREM_IPSUM_LENGTH];
+}
+
+static MunitResult
+squash_test_mmap_window(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashCodec* codec = squash_get_codec ("gzip");
+  if (codec == NULL)
+    return MUNIT_SKIP;
+
+  SquashStatus res;
+
+  /* More than one whole mapping window (SQUASH_MMAP_IO_WINDOW_SIZE),
+     and not a multiple of the page size */
+  const size_t uncompressed_length = (65 * 1024 * 1024) + 12345;
+  const size_t chunk_length = 1024 * 1024;
+  uint8_t* chunk = munit_malloc (chunk_length);
+
+  munit_assert_int (setenv ("SQUASH_MMAP_IO", "yes", 1), ==, 0);
+
+  FILE* input = tmpfile ();
+  FILE* compressed = tmpfile ();
+  FILE* decompressed = tmpfile ();
+  munit_assert_not_null (input);
+  munit_assert_not_null (compressed);
+  munit_assert_not_null (decompressed);
+
+  for (size_t pos = 0 ; pos < uncompressed_length ; pos += chunk_length) {
+    const size_t length = ((uncompressed_length - pos) < chunk_length) ? (uncompressed_length - pos) : chunk_length;
+    for (size_t i = 0 ; i < length ; i++)
+      chunk[i] = squash_test_mmap_window_byte (pos + i);
+    munit_assert_size (fwrite (chunk, 1, length, input), ==, length);
+  }
+  rewind (input);
+
+  res = squash_splice (codec, SQUASH_STREAM_COMPRESS, compressed, input, 0, "level", "1", NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (input), ==, (int64_t) uncompressed_length);
+
+  rewind (compressed);
+  res = squash_splice (codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) uncompressed_length);
+
+  munit_assert_int (fseeko (decompressed, 0, SEEK_END), ==, 0);
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) uncompressed_length);
+
+  rewind (decompressed);
+  for (size_t pos = 0 ; pos < uncompressed_length ; pos += chunk_length) {
+    const size_t length = ((uncompressed_length - pos) < chunk_length) ? (uncompressed_length - pos) : chunk_length;
+    munit_assert_size (fread (chunk, 1, length, decompressed), ==, length);
+    for (size_t i = 0 ; i < length ; i++) {
+      if (chunk[i] != squash_test_mmap_window_byte (pos + i))
+        munit_errorf ("Mismatch at offset %zu", pos + i);
+    }
+  }
+
+  munit_assert_int (unsetenv ("SQUASH_MMAP_IO"), ==, 0);
+
+  fclose (input);
+  fclose (compressed);
+  fclose (decompressed);
+  free (chunk);
+
+  return MUNIT_OK;
+}
+#endif
+
 MunitTest squash_splice_tests[] = {
   { (char*) "/custom", squash_test_custom, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+#if !defined(_WIN32)
+  { (char*) "/fd", squash_test_fd, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/mmap", squash_test_mmap, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/mmap/existing", squash_test_mmap_existing, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/mmap/window", squash_test_mmap_window, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+  { (char*) "/passthrough", squash_test_passthrough, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+#endif
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
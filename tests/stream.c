@@ -223,10 +223,154 @@ squash_test_stream_single_byte(MUNIT_UNUSED const MunitParameter params[], void*
   return MUNIT_OK;
 }
 
+static size_t
+compress_all_with_stream (SquashStream* stream, size_t compressed_length, uint8_t compressed[SQUASH_ARRAY_PARAM(compressed_length)]) {
+  SquashStatus res;
+
+  stream->next_in = (const uint8_t*) LOREM_IPSUM;
+  stream->avail_in = LOREM_IPSUM_LENGTH;
+  stream->next_out = compressed;
+  stream->avail_out = compressed_length;
+
+  do {
+    res = squash_stream_process (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  do {
+    res = squash_stream_finish (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  return stream->total_out;
+}
+
+static MunitResult
+squash_test_stream_reset(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* recompressed = munit_malloc (max_compressed_length);
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+  size_t compressed_length, recompressed_length;
+  SquashStatus res;
+  SquashStream* stream;
+
+  stream = squash_codec_create_stream (codec, SQUASH_STREAM_COMPRESS, NULL);
+  munit_assert_not_null (stream);
+
+  compressed_length = compress_all_with_stream (stream, max_compressed_length, compressed);
+
+  res = squash_stream_reset (stream);
+  if (res == SQUASH_INVALID_OPERATION) {
+    squash_object_unref (stream);
+    free (compressed);
+    free (recompressed);
+    free (decompressed);
+    return MUNIT_SKIP;
+  }
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (stream->total_in, ==, 0);
+  munit_assert_size (stream->total_out, ==, 0);
+
+  recompressed_length = compress_all_with_stream (stream, max_compressed_length, recompressed);
+  munit_assert_size (recompressed_length, ==, compressed_length);
+  munit_assert_memory_equal (compressed_length, recompressed, compressed);
+
+  squash_object_unref (stream);
+
+  stream = squash_codec_create_stream (codec, SQUASH_STREAM_DECOMPRESS, NULL);
+  munit_assert_not_null (stream);
+
+  for (int i = 0 ; i < 2 ; i++) {
+    stream->next_in = compressed;
+    stream->avail_in = compressed_length;
+    stream->next_out = decompressed;
+    stream->avail_out = LOREM_IPSUM_LENGTH;
+
+    do {
+      res = squash_stream_process (stream);
+    } while (res == SQUASH_PROCESSING);
+
+    if (res == SQUASH_OK) {
+      do {
+        res = squash_stream_finish (stream);
+      } while (res == SQUASH_PROCESSING);
+    }
+
+    munit_assert_true (res == SQUASH_OK || res == SQUASH_END_OF_STREAM);
+    munit_assert_size (stream->total_out, ==, LOREM_IPSUM_LENGTH);
+    munit_assert_memory_equal (LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+    SQUASH_ASSERT_OK(squash_stream_reset (stream));
+  }
+
+  squash_object_unref (stream);
+
+  free (compressed);
+  free (recompressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_stream_pool_options(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  SquashCodec* codec = squash_get_codec ("gzip");
+  if (codec == NULL)
+    return MUNIT_SKIP;
+
+  /* Text-like, so the level makes a difference */
+  const size_t uncompressed_length = 65536;
+  uint8_t* uncompressed = munit_malloc (uncompressed_length);
+  for (size_t pos = 0 ; pos < uncompressed_length ; ) {
+    const size_t offset = (size_t) munit_rand_int_range (0, (int) (LOREM_IPSUM_LENGTH - 16));
+    const size_t length = (size_t) munit_rand_int_range (4, 16);
+    for (size_t i = 0 ; i < length && pos < uncompressed_length ; i++)
+      uncompressed[pos++] = (LOREM_IPSUM)[offset + i];
+  }
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  size_t compressed_length, expected_length;
+
+  /* Scattered input goes through a (pooled) stream */
+  const SquashIOVec input[] = {
+    { uncompressed, uncompressed_length / 2 },
+    { uncompressed + (uncompressed_length / 2), uncompressed_length - (uncompressed_length / 2) }
+  };
+  const SquashIOVec output[] = { { compressed, max_compressed_length } };
+
+  SQUASH_ASSERT_OK (squash_codec_compressv (codec, &expected_length, 1, output, 2, input, "level", "9", NULL));
+
+  SquashOptions* options = squash_options_new (codec, "level", "1", NULL);
+  munit_assert_not_null (options);
+  squash_object_ref (options);
+
+  SQUASH_ASSERT_OK (squash_codec_compressv_with_options (codec, &compressed_length, 1, output, 2, input, options));
+  munit_assert_size (compressed_length, !=, expected_length);
+
+  /* The pooled stream was set up for level 1, so it must not be
+     handed out now */
+  SQUASH_ASSERT_OK (squash_options_set_int (options, "level", 9));
+  SQUASH_ASSERT_OK (squash_codec_compressv_with_options (codec, &compressed_length, 1, output, 2, input, options));
+  munit_assert_size (compressed_length, ==, expected_length);
+
+  squash_object_unref (options);
+  free (compressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
 MunitTest squash_stream_tests[] = {
   { (char*) "/compress", squash_test_stream_compress, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/decompress", squash_test_stream_decompress, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/single-byte", squash_test_stream_single_byte, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/reset", squash_test_stream_reset, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/pool-options", squash_test_stream_pool_options, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
@@ -6,15 +6,25 @@
 #include "munit/munit.h"
 
 void* squash_test_get_codec(MUNIT_UNUSED const MunitParameter params[], void* user_data);
+uint8_t* squash_test_mixed_data(size_t size);
 
 #define SQUASH_CODEC_PARAMETER ((MunitParameterEnum*)(uintptr_t) 0xdeadbeef)
 
+MunitSuite squash_test_suite_allocator;
+MunitSuite squash_test_suite_batch;
 MunitSuite squash_test_suite_buffer;
 MunitSuite squash_test_suite_bounds;
+MunitSuite squash_test_suite_dictionary;
 MunitSuite squash_test_suite_file;
 MunitSuite squash_test_suite_flush;
 MunitSuite squash_test_suite_interop;
+MunitSuite squash_test_suite_iovec;
+MunitSuite squash_test_suite_job;
+MunitSuite squash_test_suite_memory;
+MunitSuite squash_test_suite_parallel;
 MunitSuite squash_test_suite_random;
+MunitSuite squash_test_suite_seekable;
+MunitSuite squash_test_suite_select;
 MunitSuite squash_test_suite_splice;
 MunitSuite squash_test_suite_stream;
 MunitSuite squash_test_suite_threads;
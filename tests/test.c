@@ -49,6 +49,22 @@ squash_test_get_codec(MUNIT_UNUSED const MunitParameter params[], void* user_dat
   return squash_get_codec (munit_parameters_get (params, "codec"));
 }
 
+/* Alternate random and text segments, so the data is neither
+   incompressible nor too compressible for codecs which have to guess
+   the decompressed size.  Free the result with free(). */
+uint8_t*
+squash_test_mixed_data(size_t size) {
+  uint8_t* data = munit_malloc (size);
+
+  munit_rand_memory (size, data);
+  for (size_t pos = 0 ; pos < size ; pos += LOREM_IPSUM_LENGTH * 2) {
+    const size_t length = ((size - pos) < LOREM_IPSUM_LENGTH) ? (size - pos) : LOREM_IPSUM_LENGTH;
+    memcpy (data + pos, LOREM_IPSUM, length);
+  }
+
+  return data;
+}
+
 static size_t codec_list_l = 0;
 
 MunitParameterEnum* squash_codec_parameter = (MunitParameterEnum[]) {
@@ -93,12 +109,21 @@ squash_suite_set_params (MunitSuite* suite) {
 int
 main(int argc, char* const argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
   MunitSuite test_suites[] = {
+    squash_test_suite_allocator,
+    squash_test_suite_batch,
     squash_test_suite_buffer,
     squash_test_suite_bounds,
+    squash_test_suite_dictionary,
     squash_test_suite_file,
     squash_test_suite_flush,
     squash_test_suite_interop,
+    squash_test_suite_iovec,
+    squash_test_suite_job,
+    squash_test_suite_memory,
+    squash_test_suite_parallel,
     squash_test_suite_random,
+    squash_test_suite_seekable,
+    squash_test_suite_select,
     squash_test_suite_splice,
     squash_test_suite_stream,
     squash_test_suite_threads,
@@ -0,0 +1,1372 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "parg/parg.h"
+#include "../squash/tinycthread/source/tinycthread.h"
+
+#include <squash/squash.h>
+
+#if !defined(EXIT_SUCCESS)
+#define EXIT_SUCCESS (0)
+#endif
+
+#if !defined(EXIT_FAILURE)
+#define EXIT_FAILURE (-1)
+#endif
+
+typedef enum {
+  BENCHMARK_FORMAT_TEXT,
+  BENCHMARK_FORMAT_CSV,
+  BENCHMARK_FORMAT_JSON
+} BenchmarkFormat;
+
+/* How the overhead benchmark passes options to the codec. */
+typedef enum {
+  BENCHMARK_CALL_VARIADIC,
+  BENCHMARK_CALL_OPTIONS,
+  BENCHMARK_CALL_FROZEN
+} BenchmarkCallMode;
+
+static const char* const benchmark_call_mode_names[] = {
+  "variadic",
+  "options",
+  "frozen"
+};
+
+typedef struct {
+  char* name;
+  uint8_t* data;
+  size_t size;
+} BenchmarkFile;
+
+typedef struct {
+  size_t length;
+  size_t allocated;
+  double* values;
+} BenchmarkTimes;
+
+/* State for one thread running a codec in a loop.  Each thread gets
+   its own output buffer; the input is shared. */
+typedef struct {
+  SquashCodec* codec;
+  SquashOptions* options;
+  SquashStreamType direction;
+  const char* level;
+  const uint8_t* input;
+  size_t input_size;
+  uint8_t* output;
+  size_t output_allocated;
+  double min_time;
+
+  SquashStatus status;
+  double elapsed;
+  BenchmarkTimes times;
+} BenchmarkWorker;
+
+typedef struct {
+  double mb_per_s;
+  double calls_per_s;
+  double p50;
+  double p90;
+  double p99;
+} BenchmarkMeasurement;
+
+typedef struct {
+  FILE* output;
+  BenchmarkFormat format;
+  bool overhead;
+  bool file_open;
+  bool splice;
+  size_t rows;
+} BenchmarkReport;
+
+typedef struct {
+  size_t length;
+  SquashCodec** codecs;
+} BenchmarkCodecList;
+
+#if defined(__GNUC__)
+__attribute__((__noreturn__))
+#endif
+static void
+print_help_and_exit (int argc, char** argv, int exit_code) {
+  fprintf (stderr, "Usage: %s [OPTION]... CORPUS...\n", argv[0]);
+  fprintf (stderr, "Benchmark codecs on every file in the CORPUS directories (or files).\n");
+  fprintf (stderr, "\n");
+  fprintf (stderr, "Options:\n");
+  fprintf (stderr, "\t-c, --codec codec       Only benchmark the specified codec.  May be\n");
+  fprintf (stderr, "\t                        passed multiple times; default is every codec.\n");
+  fprintf (stderr, "\t-t, --threads N         Number of threads to run concurrently.  May be\n");
+  fprintf (stderr, "\t                        passed multiple times; default is 1.\n");
+  fprintf (stderr, "\t-T, --time seconds      Minimum time spent on each measurement\n");
+  fprintf (stderr, "\t                        (default 0.5).\n");
+  fprintf (stderr, "\t-f, --format format     Output format: text, csv, or json.\n");
+  fprintf (stderr, "\t-o, --output file       Write results to file instead of stdout.\n");
+  fprintf (stderr, "\t-O, --overhead          Measure per-call overhead on a tiny buffer with\n");
+  fprintf (stderr, "\t                        variadic, regular, and frozen options instead.\n");
+  fprintf (stderr, "\t                        No corpus is needed.\n");
+  fprintf (stderr, "\t-F, --file-open         Measure opening, reading, and closing a small\n");
+  fprintf (stderr, "\t                        compressed file with several buffer sizes\n");
+  fprintf (stderr, "\t                        instead.  No corpus is needed.\n");
+  fprintf (stderr, "\t-S, --splice            Measure squash_splice between files on disk,\n");
+  fprintf (stderr, "\t                        through stdio and memory-mapped I/O, instead.\n");
+  fprintf (stderr, "\t-V, --version           Print version number and exit\n");
+  fprintf (stderr, "\t-h, --help              Print this help screen and exit.\n");
+
+  exit (exit_code);
+}
+
+#if defined(__GNUC__)
+__attribute__((__noreturn__))
+#endif
+static void
+print_version_and_exit (int argc, char** argv, int exit_code) {
+  const unsigned int libversion = squash_version ();
+  fprintf (stdout, "squash-benchmark version %d.%d.%d (library version %d.%d.%d)\n",
+           SQUASH_VERSION_MAJOR, SQUASH_VERSION_MINOR, SQUASH_VERSION_REVISION,
+           SQUASH_VERSION_EXTRACT_MAJOR(libversion),
+           SQUASH_VERSION_EXTRACT_MINOR(libversion),
+           SQUASH_VERSION_EXTRACT_REVISION(libversion));
+
+  exit (exit_code);
+}
+
+static double
+benchmark_now (void) {
+#if defined(_WIN32)
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency (&frequency);
+  QueryPerformanceCounter (&counter);
+  return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+#endif
+}
+
+/* Peak resident set size, in KiB.  On Linux the high-water mark can
+   be reset between measurements; elsewhere it is the peak for the
+   whole process. */
+static void
+benchmark_peak_rss_reset (void) {
+#if defined(__linux__)
+  FILE* fp = fopen ("/proc/self/clear_refs", "w");
+  if (fp != NULL) {
+    fputs ("5", fp);
+    fclose (fp);
+  }
+#endif
+}
+
+static long
+benchmark_peak_rss (void) {
+#if defined(__linux__)
+  char line[256];
+  FILE* fp = fopen ("/proc/self/status", "r");
+  if (fp != NULL) {
+    while (fgets (line, sizeof (line), fp) != NULL) {
+      if (strncmp (line, "VmHWM:", 6) == 0) {
+        fclose (fp);
+        return strtol (line + 6, NULL, 10);
+      }
+    }
+    fclose (fp);
+  }
+#endif
+
+#if defined(_WIN32)
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+#  if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;
+#  else
+  return usage.ru_maxrss;
+#  endif
+#endif
+}
+
+static void
+benchmark_times_append (BenchmarkTimes* times, double value) {
+  if (times->length == times->allocated) {
+    times->allocated = (times->allocated == 0) ? 1024 : times->allocated * 2;
+    times->values = realloc (times->values, sizeof (double) * times->allocated);
+    if (times->values == NULL) {
+      fputs ("Out of memory\n", stderr);
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  times->values[times->length++] = value;
+}
+
+static int
+benchmark_times_compare (const void* a, const void* b) {
+  const double da = *((const double*) a);
+  const double db = *((const double*) b);
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static double
+benchmark_times_percentile (const BenchmarkTimes* times, double percentile) {
+  if (times->length == 0)
+    return 0.0;
+
+  size_t idx = (size_t) (percentile * (double) (times->length - 1) + 0.5);
+  return times->values[idx];
+}
+
+static int
+benchmark_worker_run (void* user_data) {
+  BenchmarkWorker* worker = (BenchmarkWorker*) user_data;
+  const double start = benchmark_now ();
+  double now = start;
+
+  do {
+    size_t output_size = worker->output_allocated;
+    const double call_start = now;
+
+    if (worker->direction == SQUASH_STREAM_COMPRESS && worker->options == NULL)
+      worker->status = squash_codec_compress (worker->codec,
+                                              &output_size, worker->output,
+                                              worker->input_size, worker->input,
+                                              (worker->level != NULL) ? "level" : NULL, worker->level, NULL);
+    else if (worker->direction == SQUASH_STREAM_COMPRESS)
+      worker->status = squash_codec_compress_with_options (worker->codec,
+                                                           &output_size, worker->output,
+                                                           worker->input_size, worker->input,
+                                                           worker->options);
+    else
+      worker->status = squash_codec_decompress_with_options (worker->codec,
+                                                             &output_size, worker->output,
+                                                             worker->input_size, worker->input,
+                                                             worker->options);
+
+    now = benchmark_now ();
+    if (worker->status != SQUASH_OK)
+      break;
+
+    benchmark_times_append (&(worker->times), now - call_start);
+  } while ((now - start) < worker->min_time);
+
+  worker->elapsed = now - start;
+
+  return 0;
+}
+
+/* Run the operation on @a threads threads at once.  Throughput is the
+   sum of each thread's throughput, latency percentiles are over every
+   call on every thread. */
+static SquashStatus
+benchmark_measure (SquashCodec* codec,
+                   SquashOptions* options,
+                   const char* level,
+                   SquashStreamType direction,
+                   size_t input_size,
+                   const uint8_t* input,
+                   size_t output_allocated,
+                   size_t uncompressed_size,
+                   unsigned int threads,
+                   double min_time,
+                   BenchmarkMeasurement* measurement) {
+  SquashStatus res = SQUASH_OK;
+  BenchmarkWorker* workers = calloc (threads, sizeof (BenchmarkWorker));
+  thrd_t* thread_ids = calloc (threads, sizeof (thrd_t));
+  BenchmarkTimes all = { 0, 0, NULL };
+  unsigned int started = 0;
+
+  if (workers == NULL || thread_ids == NULL) {
+    res = SQUASH_MEMORY;
+    goto cleanup;
+  }
+
+  for (unsigned int i = 0 ; i < threads ; i++) {
+    BenchmarkWorker* worker = workers + i;
+    worker->codec = codec;
+    worker->options = options;
+    worker->level = level;
+    worker->direction = direction;
+    worker->input = input;
+    worker->input_size = input_size;
+    worker->output_allocated = output_allocated;
+    worker->output = malloc (output_allocated);
+    worker->min_time = min_time;
+    if (worker->output == NULL) {
+      res = SQUASH_MEMORY;
+      goto cleanup;
+    }
+  }
+
+  if (threads == 1) {
+    benchmark_worker_run (workers);
+    started = 1;
+  } else {
+    for ( ; started < threads ; started++) {
+      if (thrd_create (thread_ids + started, benchmark_worker_run, workers + started) != thrd_success) {
+        res = SQUASH_FAILED;
+        break;
+      }
+    }
+
+    for (unsigned int i = 0 ; i < started ; i++)
+      thrd_join (thread_ids[i], NULL);
+  }
+
+  if (res != SQUASH_OK)
+    goto cleanup;
+
+  measurement->mb_per_s = 0.0;
+  measurement->calls_per_s = 0.0;
+  for (unsigned int i = 0 ; i < started ; i++) {
+    BenchmarkWorker* worker = workers + i;
+
+    if (worker->status != SQUASH_OK) {
+      res = worker->status;
+      goto cleanup;
+    }
+
+    measurement->mb_per_s +=
+      (((double) uncompressed_size * (double) worker->times.length) / worker->elapsed) / (1024.0 * 1024.0);
+    measurement->calls_per_s += (double) worker->times.length / worker->elapsed;
+
+    for (size_t j = 0 ; j < worker->times.length ; j++)
+      benchmark_times_append (&all, worker->times.values[j]);
+  }
+
+  qsort (all.values, all.length, sizeof (double), benchmark_times_compare);
+  measurement->p50 = benchmark_times_percentile (&all, 0.50) * 1000000.0;
+  measurement->p90 = benchmark_times_percentile (&all, 0.90) * 1000000.0;
+  measurement->p99 = benchmark_times_percentile (&all, 0.99) * 1000000.0;
+
+ cleanup:
+
+  if (workers != NULL) {
+    for (unsigned int i = 0 ; i < threads ; i++) {
+      free (workers[i].output);
+      free (workers[i].times.values);
+    }
+  }
+  free (workers);
+  free (thread_ids);
+  free (all.values);
+
+  return res;
+}
+
+static void
+benchmark_report_quoted (BenchmarkReport* report, const char* str) {
+  FILE* output = report->output;
+
+  if (report->format == BENCHMARK_FORMAT_CSV) {
+    fputc ('"', output);
+    for ( ; *str != '\0' ; str++) {
+      if (*str == '"')
+        fputc ('"', output);
+      fputc (*str, output);
+    }
+    fputc ('"', output);
+  } else {
+    fputc ('"', output);
+    for ( ; *str != '\0' ; str++) {
+      const unsigned char c = (unsigned char) *str;
+      if (c == '"' || c == '\\')
+        fprintf (output, "\\%c", c);
+      else if (c < 0x20)
+        fprintf (output, "\\u%04x", c);
+      else
+        fputc (c, output);
+    }
+    fputc ('"', output);
+  }
+}
+
+static void
+benchmark_report_begin (BenchmarkReport* report) {
+  if (report->overhead && report->format != BENCHMARK_FORMAT_JSON) {
+    if (report->format == BENCHMARK_FORMAT_TEXT)
+      fprintf (report->output, "%-20s %3s %-9s %12s %10s %10s\n",
+               "codec", "thr", "options", "calls/s", "p50 ns", "p99 ns");
+    else
+      fputs ("plugin,codec,threads,options,calls_per_s,p50_ns,p99_ns\n", report->output);
+    return;
+  }
+
+  if (report->file_open && report->format != BENCHMARK_FORMAT_JSON) {
+    if (report->format == BENCHMARK_FORMAT_TEXT)
+      fprintf (report->output, "%-20s %10s %12s %10s %10s %10s\n",
+               "codec", "buffer", "calls/s", "p50 us", "p99 us", "peak KiB");
+    else
+      fputs ("plugin,codec,buffer_size,calls_per_s,p50_us,p99_us,peak_rss_kib\n", report->output);
+    return;
+  }
+
+  if (report->splice && report->format != BENCHMARK_FORMAT_JSON) {
+    if (report->format == BENCHMARK_FORMAT_TEXT)
+      fprintf (report->output, "%-24s %-20s %-5s %12s %10s %10s %10s %10s %10s\n",
+               "file", "codec", "io", "size", "comp MB/s", "p50 us", "dec MB/s", "p50 us", "peak KiB");
+    else
+      fputs ("file,plugin,codec,io,size,compress_mb_s,compress_p50_us,decompress_mb_s,decompress_p50_us,peak_rss_kib\n", report->output);
+    return;
+  }
+
+  switch (report->format) {
+    case BENCHMARK_FORMAT_TEXT:
+      fprintf (report->output, "%-24s %-20s %5s %3s %12s %7s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+               "file", "codec", "level", "thr", "size", "ratio",
+               "comp MB/s", "p50 us", "p90 us", "p99 us",
+               "dec MB/s", "p50 us", "p90 us", "p99 us", "peak KiB");
+      break;
+    case BENCHMARK_FORMAT_CSV:
+      fputs ("file,plugin,codec,level,threads,size,compressed_size,ratio,"
+             "compress_mb_s,compress_p50_us,compress_p90_us,compress_p99_us,"
+             "decompress_mb_s,decompress_p50_us,decompress_p90_us,decompress_p99_us,"
+             "peak_rss_kib\n", report->output);
+      break;
+    case BENCHMARK_FORMAT_JSON:
+      fputs ("[", report->output);
+      break;
+  }
+}
+
+static void
+benchmark_report_row (BenchmarkReport* report,
+                      const BenchmarkFile* file,
+                      SquashCodec* codec,
+                      int level,
+                      unsigned int threads,
+                      size_t compressed_size,
+                      const BenchmarkMeasurement* compress,
+                      const BenchmarkMeasurement* decompress,
+                      long peak_rss) {
+  FILE* output = report->output;
+  const char* plugin_name = squash_plugin_get_name (squash_codec_get_plugin (codec));
+  const char* codec_name = squash_codec_get_name (codec);
+  const double ratio = (double) file->size / (double) compressed_size;
+
+  switch (report->format) {
+    case BENCHMARK_FORMAT_TEXT:
+      {
+        char full_name[128];
+        snprintf (full_name, sizeof (full_name), "%s:%s", plugin_name, codec_name);
+        fprintf (output, "%-24s %-20s ", file->name, full_name);
+        if (level < 0)
+          fprintf (output, "%5s", "-");
+        else
+          fprintf (output, "%5d", level);
+        fprintf (output, " %3u %12lu %7.3f %10.2f %10.1f %10.1f %10.1f %10.2f %10.1f %10.1f %10.1f %10ld\n",
+                 threads, (unsigned long) file->size, ratio,
+                 compress->mb_per_s, compress->p50, compress->p90, compress->p99,
+                 decompress->mb_per_s, decompress->p50, decompress->p90, decompress->p99,
+                 peak_rss);
+      }
+      break;
+    case BENCHMARK_FORMAT_CSV:
+      benchmark_report_quoted (report, file->name);
+      fprintf (output, ",%s,%s,", plugin_name, codec_name);
+      if (level >= 0)
+        fprintf (output, "%d", level);
+      fprintf (output, ",%u,%lu,%lu,%f,%f,%f,%f,%f,%f,%f,%f,%f,%ld\n",
+               threads, (unsigned long) file->size, (unsigned long) compressed_size, ratio,
+               compress->mb_per_s, compress->p50, compress->p90, compress->p99,
+               decompress->mb_per_s, decompress->p50, decompress->p90, decompress->p99,
+               peak_rss);
+      break;
+    case BENCHMARK_FORMAT_JSON:
+      fputs ((report->rows == 0) ? "\n  { \"file\": " : ",\n  { \"file\": ", output);
+      benchmark_report_quoted (report, file->name);
+      fprintf (output, ", \"plugin\": \"%s\", \"codec\": \"%s\", \"level\": ", plugin_name, codec_name);
+      if (level < 0)
+        fputs ("null", output);
+      else
+        fprintf (output, "%d", level);
+      fprintf (output, ", \"threads\": %u, \"size\": %lu, \"compressed_size\": %lu, \"ratio\": %f, "
+               "\"compress\": { \"mb_s\": %f, \"p50_us\": %f, \"p90_us\": %f, \"p99_us\": %f }, "
+               "\"decompress\": { \"mb_s\": %f, \"p50_us\": %f, \"p90_us\": %f, \"p99_us\": %f }, "
+               "\"peak_rss_kib\": %ld }",
+               threads, (unsigned long) file->size, (unsigned long) compressed_size, ratio,
+               compress->mb_per_s, compress->p50, compress->p90, compress->p99,
+               decompress->mb_per_s, decompress->p50, decompress->p90, decompress->p99,
+               peak_rss);
+      break;
+  }
+
+  fflush (output);
+  report->rows++;
+}
+
+static void
+benchmark_report_overhead_row (BenchmarkReport* report,
+                               SquashCodec* codec,
+                               unsigned int threads,
+                               BenchmarkCallMode mode,
+                               const BenchmarkMeasurement* measurement) {
+  FILE* output = report->output;
+  const char* plugin_name = squash_plugin_get_name (squash_codec_get_plugin (codec));
+  const char* codec_name = squash_codec_get_name (codec);
+
+  switch (report->format) {
+    case BENCHMARK_FORMAT_TEXT:
+      {
+        char full_name[128];
+        snprintf (full_name, sizeof (full_name), "%s:%s", plugin_name, codec_name);
+        fprintf (output, "%-20s %3u %-9s %12.0f %10.0f %10.0f\n",
+                 full_name, threads, benchmark_call_mode_names[mode],
+                 measurement->calls_per_s, measurement->p50 * 1000.0, measurement->p99 * 1000.0);
+      }
+      break;
+    case BENCHMARK_FORMAT_CSV:
+      fprintf (output, "%s,%s,%u,%s,%f,%f,%f\n",
+               plugin_name, codec_name, threads, benchmark_call_mode_names[mode],
+               measurement->calls_per_s, measurement->p50 * 1000.0, measurement->p99 * 1000.0);
+      break;
+    case BENCHMARK_FORMAT_JSON:
+      fprintf (output, "%s\n  { \"plugin\": \"%s\", \"codec\": \"%s\", \"threads\": %u, \"options\": \"%s\", "
+               "\"calls_per_s\": %f, \"p50_ns\": %f, \"p99_ns\": %f }",
+               (report->rows == 0) ? "" : ",",
+               plugin_name, codec_name, threads, benchmark_call_mode_names[mode],
+               measurement->calls_per_s, measurement->p50 * 1000.0, measurement->p99 * 1000.0);
+      break;
+  }
+
+  fflush (output);
+  report->rows++;
+}
+
+/* Per-call overhead: compress a tiny buffer with the codec's default
+   level, passing the options as variadic arguments (which creates and
+   destroys a SquashOptions each call), as regular options, and as
+   frozen options. */
+static bool
+benchmark_overhead (BenchmarkReport* report,
+                    SquashCodec* codec,
+                    const unsigned int* threads,
+                    size_t threads_length,
+                    double min_time) {
+  static const uint8_t input[] =
+    "Lorem ipsum dolor sit amet, consectetur adipiscing elit posuere.";
+  char level[16] = { 0, };
+  bool success = true;
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  for ( ; info != NULL && info->name != NULL ; info++) {
+    if (strcmp (info->name, "level") == 0 &&
+        (info->type == SQUASH_OPTION_TYPE_RANGE_INT || info->type == SQUASH_OPTION_TYPE_ENUM_INT)) {
+      snprintf (level, sizeof (level), "%d", info->default_value.int_value);
+      break;
+    }
+  }
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  SquashOptions* frozen = squash_options_new (codec, NULL);
+  if (options != NULL)
+    squash_object_ref (options);
+  if (frozen != NULL)
+    squash_options_freeze (frozen);
+
+  for (size_t t = 0 ; t < threads_length && success ; t++) {
+    for (int mode = BENCHMARK_CALL_VARIADIC ; mode <= BENCHMARK_CALL_FROZEN ; mode++) {
+      BenchmarkMeasurement measurement;
+      SquashOptions* mode_options =
+        (mode == BENCHMARK_CALL_VARIADIC) ? NULL : ((mode == BENCHMARK_CALL_OPTIONS) ? options : frozen);
+
+      SquashStatus res = benchmark_measure (codec, mode_options, (level[0] != '\0') ? level : NULL,
+                                            SQUASH_STREAM_COMPRESS,
+                                            sizeof (input), input,
+                                            squash_codec_get_max_compressed_size (codec, sizeof (input)),
+                                            sizeof (input),
+                                            threads[t], min_time, &measurement);
+      if (res != SQUASH_OK) {
+        fprintf (stderr, "%s failed: %s\n", squash_codec_get_name (codec), squash_status_to_string (res));
+        success = false;
+        break;
+      }
+
+      benchmark_report_overhead_row (report, codec, threads[t], (BenchmarkCallMode) mode, &measurement);
+    }
+  }
+
+  if (options != NULL)
+    squash_object_unref (options);
+  if (frozen != NULL)
+    squash_object_unref (frozen);
+
+  return success;
+}
+
+static void
+benchmark_report_file_open_row (BenchmarkReport* report,
+                                SquashCodec* codec,
+                                size_t buffer_size,
+                                const BenchmarkMeasurement* measurement,
+                                long peak_rss) {
+  FILE* output = report->output;
+  const char* plugin_name = squash_plugin_get_name (squash_codec_get_plugin (codec));
+  const char* codec_name = squash_codec_get_name (codec);
+
+  switch (report->format) {
+    case BENCHMARK_FORMAT_TEXT:
+      {
+        char full_name[128];
+        snprintf (full_name, sizeof (full_name), "%s:%s", plugin_name, codec_name);
+        fprintf (output, "%-20s ", full_name);
+        if (buffer_size == 0)
+          fprintf (output, "%10s", "default");
+        else
+          fprintf (output, "%10lu", (unsigned long) buffer_size);
+        fprintf (output, " %12.0f %10.1f %10.1f %10ld\n",
+                 measurement->calls_per_s, measurement->p50, measurement->p99, peak_rss);
+      }
+      break;
+    case BENCHMARK_FORMAT_CSV:
+      fprintf (output, "%s,%s,%lu,%f,%f,%f,%ld\n",
+               plugin_name, codec_name, (unsigned long) buffer_size,
+               measurement->calls_per_s, measurement->p50, measurement->p99, peak_rss);
+      break;
+    case BENCHMARK_FORMAT_JSON:
+      fprintf (output, "%s\n  { \"plugin\": \"%s\", \"codec\": \"%s\", \"buffer_size\": %lu, "
+               "\"calls_per_s\": %f, \"p50_us\": %f, \"p99_us\": %f, \"peak_rss_kib\": %ld }",
+               (report->rows == 0) ? "" : ",",
+               plugin_name, codec_name, (unsigned long) buffer_size,
+               measurement->calls_per_s, measurement->p50, measurement->p99, peak_rss);
+      break;
+  }
+
+  fflush (output);
+  report->rows++;
+}
+
+/* Open/close overhead: repeatedly wrap a small compressed file in a
+   SquashFile, read it all, and free the SquashFile again, with a few
+   different buffer sizes (0 is the library default).  This is what
+   applications processing lots of small files do, and is dominated
+   by setting up the stream and buffer rather than by the codec. */
+static bool
+benchmark_file_open (BenchmarkReport* report,
+                     SquashCodec* codec,
+                     double min_time) {
+  static const size_t buffer_sizes[] = { 4096, 64 * 1024, 0 };
+  static const char lorem[] =
+    "Lorem ipsum dolor sit amet, consectetur adipiscing elit posuere.";
+  uint8_t input[4096];
+  uint8_t output[sizeof (input)];
+  SquashStatus res = SQUASH_OK;
+  bool success = false;
+  SquashFile* file;
+
+  for (size_t i = 0 ; i < sizeof (input) ; i++)
+    input[i] = (uint8_t) lorem[i % (sizeof (lorem) - 1)];
+
+  FILE* fp = tmpfile ();
+  if (fp == NULL) {
+    perror ("Unable to create temporary file");
+    return false;
+  }
+
+  file = squash_file_steal (codec, fp, NULL);
+  if (file == NULL) {
+    res = SQUASH_FAILED;
+  } else {
+    res = squash_file_write (file, sizeof (input), input);
+    const SquashStatus free_res = squash_file_free (file, NULL);
+    if (res == SQUASH_OK)
+      res = free_res;
+  }
+  if (res != SQUASH_OK) {
+    fprintf (stderr, "%s failed to compress: %s\n", squash_codec_get_name (codec), squash_status_to_string (res));
+    goto cleanup;
+  }
+
+  for (size_t b = 0 ; b < sizeof (buffer_sizes) / sizeof (buffer_sizes[0]) ; b++) {
+    BenchmarkTimes times = { 0, 0, NULL };
+    BenchmarkMeasurement measurement;
+
+    benchmark_peak_rss_reset ();
+
+    const double start = benchmark_now ();
+    double now = start;
+    do {
+      const double call_start = now;
+      size_t output_size = sizeof (output);
+
+      rewind (fp);
+      file = squash_file_steal (codec, fp, NULL);
+      if (file == NULL) {
+        res = SQUASH_FAILED;
+        break;
+      }
+      res = squash_file_set_buffer (file, buffer_sizes[b], 0);
+      if (res == SQUASH_OK)
+        res = squash_file_read (file, &output_size, output);
+      squash_file_free (file, NULL);
+
+      now = benchmark_now ();
+      if (res < 0)
+        break;
+      if (output_size != sizeof (input) || memcmp (output, input, sizeof (input)) != 0) {
+        res = SQUASH_FAILED;
+        break;
+      }
+
+      benchmark_times_append (&times, now - call_start);
+    } while ((now - start) < min_time);
+
+    if (res < 0) {
+      fprintf (stderr, "%s failed: %s\n", squash_codec_get_name (codec), squash_status_to_string (res));
+      free (times.values);
+      goto cleanup;
+    }
+
+    qsort (times.values, times.length, sizeof (double), benchmark_times_compare);
+    measurement.mb_per_s = (((double) sizeof (input) * (double) times.length) / (now - start)) / (1024.0 * 1024.0);
+    measurement.calls_per_s = (double) times.length / (now - start);
+    measurement.p50 = benchmark_times_percentile (&times, 0.50) * 1000000.0;
+    measurement.p90 = benchmark_times_percentile (&times, 0.90) * 1000000.0;
+    measurement.p99 = benchmark_times_percentile (&times, 0.99) * 1000000.0;
+    free (times.values);
+
+    benchmark_report_file_open_row (report, codec, buffer_sizes[b], &measurement, benchmark_peak_rss ());
+  }
+
+  success = true;
+
+ cleanup:
+
+  fclose (fp);
+
+  return success;
+}
+
+static void
+benchmark_report_splice_row (BenchmarkReport* report,
+                             const BenchmarkFile* file,
+                             SquashCodec* codec,
+                             const char* io,
+                             const BenchmarkMeasurement* compress,
+                             const BenchmarkMeasurement* decompress,
+                             long peak_rss) {
+  FILE* output = report->output;
+  const char* plugin_name = squash_plugin_get_name (squash_codec_get_plugin (codec));
+  const char* codec_name = squash_codec_get_name (codec);
+
+  switch (report->format) {
+    case BENCHMARK_FORMAT_TEXT:
+      {
+        char full_name[128];
+        snprintf (full_name, sizeof (full_name), "%s:%s", plugin_name, codec_name);
+        fprintf (output, "%-24s %-20s %-5s %12lu %10.2f %10.1f %10.2f %10.1f %10ld\n",
+                 file->name, full_name, io, (unsigned long) file->size,
+                 compress->mb_per_s, compress->p50, decompress->mb_per_s, decompress->p50, peak_rss);
+      }
+      break;
+    case BENCHMARK_FORMAT_CSV:
+      benchmark_report_quoted (report, file->name);
+      fprintf (output, ",%s,%s,%s,%lu,%f,%f,%f,%f,%ld\n",
+               plugin_name, codec_name, io, (unsigned long) file->size,
+               compress->mb_per_s, compress->p50, decompress->mb_per_s, decompress->p50, peak_rss);
+      break;
+    case BENCHMARK_FORMAT_JSON:
+      fputs ((report->rows == 0) ? "\n  { \"file\": " : ",\n  { \"file\": ", output);
+      benchmark_report_quoted (report, file->name);
+      fprintf (output, ", \"plugin\": \"%s\", \"codec\": \"%s\", \"io\": \"%s\", \"size\": %lu, "
+               "\"compress\": { \"mb_s\": %f, \"p50_us\": %f }, "
+               "\"decompress\": { \"mb_s\": %f, \"p50_us\": %f }, \"peak_rss_kib\": %ld }",
+               plugin_name, codec_name, io, (unsigned long) file->size,
+               compress->mb_per_s, compress->p50, decompress->mb_per_s, decompress->p50, peak_rss);
+      break;
+  }
+
+  fflush (output);
+  report->rows++;
+}
+
+/* Splice from the start of fp_in to the start of fp_out until at
+   least min_time has passed. */
+static SquashStatus
+benchmark_splice_measure (SquashCodec* codec,
+                          SquashStreamType direction,
+                          FILE* fp_out,
+                          FILE* fp_in,
+                          size_t uncompressed_size,
+                          double min_time,
+                          BenchmarkMeasurement* measurement) {
+  BenchmarkTimes times = { 0, 0, NULL };
+  SquashStatus res = SQUASH_OK;
+
+  const double start = benchmark_now ();
+  double now = start;
+  do {
+    const double call_start = now;
+
+    rewind (fp_in);
+    rewind (fp_out);
+    res = squash_splice (codec, direction, fp_out, fp_in, 0, NULL);
+    if (res == SQUASH_OK && fflush (fp_out) != 0)
+      res = SQUASH_IO;
+
+    now = benchmark_now ();
+    if (res != SQUASH_OK)
+      break;
+
+    benchmark_times_append (&times, now - call_start);
+  } while ((now - start) < min_time);
+
+  if (res == SQUASH_OK) {
+    qsort (times.values, times.length, sizeof (double), benchmark_times_compare);
+    measurement->mb_per_s = (((double) uncompressed_size * (double) times.length) / (now - start)) / (1024.0 * 1024.0);
+    measurement->calls_per_s = (double) times.length / (now - start);
+    measurement->p50 = benchmark_times_percentile (&times, 0.50) * 1000000.0;
+    measurement->p90 = benchmark_times_percentile (&times, 0.90) * 1000000.0;
+    measurement->p99 = benchmark_times_percentile (&times, 0.99) * 1000000.0;
+  }
+
+  free (times.values);
+
+  return res;
+}
+
+/* File to file throughput: compress a corpus file into a temporary
+   file and decompress it into another with squash_splice, once with
+   regular stdio buffers and once with the library's sliding mmap
+   window (SQUASH_MMAP_IO=yes).  Unlike the in-memory benchmark this
+   includes the cost of getting data in and out of the page cache. */
+static bool
+benchmark_splice (BenchmarkReport* report,
+                  const BenchmarkFile* file,
+                  SquashCodec* codec,
+                  double min_time) {
+  static const char* const io_modes[] = { "stdio", "mmap" };
+  bool success = false;
+  uint8_t* check = NULL;
+
+  FILE* input = tmpfile ();
+  FILE* compressed = tmpfile ();
+  FILE* decompressed = tmpfile ();
+  if (input == NULL || compressed == NULL || decompressed == NULL) {
+    perror ("Unable to create temporary file");
+    goto cleanup;
+  }
+
+  if (fwrite (file->data, 1, file->size, input) != file->size || fflush (input) != 0) {
+    perror ("Unable to write temporary file");
+    goto cleanup;
+  }
+
+  check = malloc (file->size);
+  if (check == NULL) {
+    fputs ("Out of memory\n", stderr);
+    goto cleanup;
+  }
+
+  for (size_t m = 0 ; m < sizeof (io_modes) / sizeof (io_modes[0]) ; m++) {
+    BenchmarkMeasurement compress_measurement;
+    BenchmarkMeasurement decompress_measurement;
+    SquashStatus res;
+
+#if defined(_WIN32)
+    if (m != 0)
+      break;
+#else
+    setenv ("SQUASH_MMAP_IO", (m == 0) ? "no" : "yes", 1);
+#endif
+
+    benchmark_peak_rss_reset ();
+
+    res = benchmark_splice_measure (codec, SQUASH_STREAM_COMPRESS, compressed, input, file->size, min_time, &compress_measurement);
+    if (res == SQUASH_OK)
+      res = benchmark_splice_measure (codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, file->size, min_time, &decompress_measurement);
+    if (res != SQUASH_OK) {
+      fprintf (stderr, "%s: %s failed: %s\n", file->name, squash_codec_get_name (codec), squash_status_to_string (res));
+      goto cleanup;
+    }
+
+    rewind (decompressed);
+    if (fread (check, 1, file->size, decompressed) != file->size || memcmp (check, file->data, file->size) != 0) {
+      fprintf (stderr, "%s: %s round trip produced different data\n", file->name, squash_codec_get_name (codec));
+      goto cleanup;
+    }
+
+    benchmark_report_splice_row (report, file, codec, io_modes[m],
+                                 &compress_measurement, &decompress_measurement,
+                                 benchmark_peak_rss ());
+  }
+
+  success = true;
+
+ cleanup:
+
+#if !defined(_WIN32)
+  unsetenv ("SQUASH_MMAP_IO");
+#endif
+  if (input != NULL)
+    fclose (input);
+  if (compressed != NULL)
+    fclose (compressed);
+  if (decompressed != NULL)
+    fclose (decompressed);
+  free (check);
+
+  return success;
+}
+
+static void
+benchmark_report_end (BenchmarkReport* report) {
+  if (report->format == BENCHMARK_FORMAT_JSON)
+    fputs ((report->rows == 0) ? "]\n" : "\n]\n", report->output);
+}
+
+/* Benchmark a single file with a single configuration of a codec. */
+static bool
+benchmark_file_with_options (BenchmarkReport* report,
+                             const BenchmarkFile* file,
+                             SquashCodec* codec,
+                             SquashOptions* options,
+                             int level,
+                             const unsigned int* threads,
+                             size_t threads_length,
+                             double min_time) {
+  SquashStatus res;
+  bool success = false;
+  size_t compressed_allocated = squash_codec_get_max_compressed_size (codec, file->size);
+  size_t compressed_size = compressed_allocated;
+  size_t decompressed_size = file->size;
+  uint8_t* compressed = malloc (compressed_allocated);
+  uint8_t* decompressed = malloc (file->size);
+
+  if (compressed == NULL || decompressed == NULL) {
+    fputs ("Out of memory\n", stderr);
+    goto cleanup;
+  }
+
+  /* Make sure the round trip works before timing anything. */
+  res = squash_codec_compress_with_options (codec, &compressed_size, compressed, file->size, file->data, options);
+  if (res != SQUASH_OK) {
+    fprintf (stderr, "%s: %s failed to compress: %s\n", file->name, squash_codec_get_name (codec), squash_status_to_string (res));
+    goto cleanup;
+  }
+
+  res = squash_codec_decompress_with_options (codec, &decompressed_size, decompressed, compressed_size, compressed, options);
+  if (res != SQUASH_OK) {
+    fprintf (stderr, "%s: %s failed to decompress: %s\n", file->name, squash_codec_get_name (codec), squash_status_to_string (res));
+    goto cleanup;
+  } else if (decompressed_size != file->size || memcmp (decompressed, file->data, file->size) != 0) {
+    fprintf (stderr, "%s: %s round trip produced different data\n", file->name, squash_codec_get_name (codec));
+    goto cleanup;
+  }
+
+  for (size_t t = 0 ; t < threads_length ; t++) {
+    BenchmarkMeasurement compress_measurement;
+    BenchmarkMeasurement decompress_measurement;
+
+    benchmark_peak_rss_reset ();
+
+    res = benchmark_measure (codec, options, NULL, SQUASH_STREAM_COMPRESS,
+                             file->size, file->data, compressed_allocated, file->size,
+                             threads[t], min_time, &compress_measurement);
+    if (res == SQUASH_OK)
+      res = benchmark_measure (codec, options, NULL, SQUASH_STREAM_DECOMPRESS,
+                               compressed_size, compressed, file->size, file->size,
+                               threads[t], min_time, &decompress_measurement);
+    if (res != SQUASH_OK) {
+      fprintf (stderr, "%s: %s failed: %s\n", file->name, squash_codec_get_name (codec), squash_status_to_string (res));
+      goto cleanup;
+    }
+
+    benchmark_report_row (report, file, codec, level, threads[t], compressed_size,
+                          &compress_measurement, &decompress_measurement,
+                          benchmark_peak_rss ());
+  }
+
+  success = true;
+
+ cleanup:
+
+  free (compressed);
+  free (decompressed);
+
+  return success;
+}
+
+/* Run every level the codec supports, or just the defaults if it
+   doesn't have a "level" option. */
+static bool
+benchmark_file_with_codec (BenchmarkReport* report,
+                           const BenchmarkFile* file,
+                           SquashCodec* codec,
+                           const unsigned int* threads,
+                           size_t threads_length,
+                           double min_time) {
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  bool success = true;
+
+  for ( ; info != NULL && info->name != NULL ; info++) {
+    if (strcmp (info->name, "level") == 0)
+      break;
+  }
+
+  if (info == NULL || info->name == NULL ||
+      (info->type != SQUASH_OPTION_TYPE_RANGE_INT && info->type != SQUASH_OPTION_TYPE_ENUM_INT)) {
+    return benchmark_file_with_options (report, file, codec, NULL, -1, threads, threads_length, min_time);
+  }
+
+  size_t levels_length;
+  if (info->type == SQUASH_OPTION_TYPE_RANGE_INT)
+    levels_length = (size_t) (info->info.range_int.max - info->info.range_int.min) + 1;
+  else
+    levels_length = info->info.enum_int.values_length;
+
+  for (size_t i = 0 ; i < levels_length ; i++) {
+    int level;
+
+    if (info->type == SQUASH_OPTION_TYPE_RANGE_INT) {
+      level = info->info.range_int.min + (int) i;
+      if (info->info.range_int.modulus > 1 && (level % info->info.range_int.modulus) != 0)
+        continue;
+    } else {
+      level = info->info.enum_int.values[i];
+    }
+
+    SquashOptions* options = squash_options_new (codec, NULL);
+    if (options == NULL)
+      return false;
+    squash_object_ref (options);
+
+    if (squash_options_set_int (options, "level", level) == SQUASH_OK)
+      success = benchmark_file_with_options (report, file, codec, options, level, threads, threads_length, min_time) && success;
+
+    squash_object_unref (options);
+  }
+
+  return success;
+}
+
+static bool
+benchmark_file_load (BenchmarkFile* file, const char* filename) {
+  FILE* fp = fopen (filename, "rb");
+  long size;
+
+  if (fp == NULL) {
+    perror (filename);
+    return false;
+  }
+
+  if (fseek (fp, 0, SEEK_END) != 0 || (size = ftell (fp)) < 0 || fseek (fp, 0, SEEK_SET) != 0) {
+    perror (filename);
+    fclose (fp);
+    return false;
+  }
+
+  file->name = strdup (filename);
+  file->size = (size_t) size;
+  file->data = malloc (file->size);
+  if (file->name == NULL || file->data == NULL ||
+      fread (file->data, 1, file->size, fp) != file->size) {
+    fprintf (stderr, "%s: unable to read file\n", filename);
+    free (file->name);
+    free (file->data);
+    fclose (fp);
+    return false;
+  }
+
+  fclose (fp);
+  return true;
+}
+
+static void
+benchmark_corpus_add (BenchmarkFile** files, size_t* files_length, const char* filename) {
+  BenchmarkFile file;
+
+  if (!benchmark_file_load (&file, filename))
+    return;
+
+  if (file.size == 0) {
+    free (file.name);
+    free (file.data);
+    return;
+  }
+
+  *files = realloc (*files, sizeof (BenchmarkFile) * (*files_length + 1));
+  if (*files == NULL) {
+    fputs ("Out of memory\n", stderr);
+    exit (EXIT_FAILURE);
+  }
+  (*files)[(*files_length)++] = file;
+}
+
+static int
+benchmark_file_compare (const void* a, const void* b) {
+  return strcmp (((const BenchmarkFile*) a)->name, ((const BenchmarkFile*) b)->name);
+}
+
+/* Add @a path to the corpus.  Directories contribute every regular
+   file directly inside them. */
+static void
+benchmark_corpus_load (BenchmarkFile** files, size_t* files_length, const char* path) {
+#if defined(_WIN32)
+  WIN32_FIND_DATAA data;
+  char* pattern = malloc (strlen (path) + 3);
+  sprintf (pattern, "%s\\*", path);
+  HANDLE h = FindFirstFileA (pattern, &data);
+  free (pattern);
+
+  if (h == INVALID_HANDLE_VALUE) {
+    benchmark_corpus_add (files, files_length, path);
+    return;
+  }
+
+  do {
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+      char* filename = malloc (strlen (path) + strlen (data.cFileName) + 2);
+      sprintf (filename, "%s\\%s", path, data.cFileName);
+      benchmark_corpus_add (files, files_length, filename);
+      free (filename);
+    }
+  } while (FindNextFileA (h, &data));
+
+  FindClose (h);
+#else
+  struct stat st;
+  if (stat (path, &st) != 0) {
+    perror (path);
+    return;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    benchmark_corpus_add (files, files_length, path);
+    return;
+  }
+
+  DIR* dir = opendir (path);
+  if (dir == NULL) {
+    perror (path);
+    return;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir (dir)) != NULL) {
+    char* filename = malloc (strlen (path) + strlen (entry->d_name) + 2);
+    sprintf (filename, "%s/%s", path, entry->d_name);
+    if (stat (filename, &st) == 0 && S_ISREG(st.st_mode))
+      benchmark_corpus_add (files, files_length, filename);
+    free (filename);
+  }
+
+  closedir (dir);
+#endif
+}
+
+static void
+benchmark_codec_list_add (SquashCodec* codec, void* data) {
+  BenchmarkCodecList* list = (BenchmarkCodecList*) data;
+
+  list->codecs = realloc (list->codecs, sizeof (SquashCodec*) * (list->length + 1));
+  if (list->codecs == NULL) {
+    fputs ("Out of memory\n", stderr);
+    exit (EXIT_FAILURE);
+  }
+  list->codecs[list->length++] = codec;
+}
+
+static int
+benchmark_codec_compare (const void* a, const void* b) {
+  SquashCodec* ca = *((SquashCodec* const*) a);
+  SquashCodec* cb = *((SquashCodec* const*) b);
+  int r = strcmp (squash_plugin_get_name (squash_codec_get_plugin (ca)), squash_plugin_get_name (squash_codec_get_plugin (cb)));
+  return (r != 0) ? r : strcmp (squash_codec_get_name (ca), squash_codec_get_name (cb));
+}
+
+int main (int argc, char** argv) {
+  BenchmarkCodecList codecs = { 0, NULL };
+  BenchmarkFile* files = NULL;
+  size_t files_length = 0;
+  unsigned int* threads = NULL;
+  size_t threads_length = 0;
+  double min_time = 0.5;
+  BenchmarkReport report = { stdout, BENCHMARK_FORMAT_TEXT, false, false, false, 0 };
+  const char* output_name = NULL;
+  int retval = EXIT_SUCCESS;
+  int opt;
+  struct parg_state ps;
+  int optend;
+  const struct parg_option benchmark_options[] = {
+    {"codec", PARG_REQARG, NULL, 'c'},
+    {"threads", PARG_REQARG, NULL, 't'},
+    {"time", PARG_REQARG, NULL, 'T'},
+    {"format", PARG_REQARG, NULL, 'f'},
+    {"output", PARG_REQARG, NULL, 'o'},
+    {"overhead", PARG_NOARG, NULL, 'O'},
+    {"file-open", PARG_NOARG, NULL, 'F'},
+    {"splice", PARG_NOARG, NULL, 'S'},
+    {"version", PARG_NOARG, NULL, 'V'},
+    {"help", PARG_NOARG, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  optend = parg_reorder (argc, argv, "c:t:T:f:o:OFSVh", benchmark_options);
+
+  parg_init(&ps);
+
+  while ( (opt = parg_getopt_long (&ps, optend, argv, "c:t:T:f:o:OFSVh", benchmark_options, NULL)) != -1 ) {
+    switch ( opt ) {
+      case 'c':
+        {
+          SquashCodec* codec = squash_get_codec (ps.optarg);
+          if ( codec == NULL ) {
+            fprintf (stderr, "Unable to find codec '%s'\n", ps.optarg);
+            retval = EXIT_FAILURE;
+            goto cleanup;
+          }
+          benchmark_codec_list_add (codec, &codecs);
+        }
+        break;
+      case 't':
+        {
+          const long n = strtol (ps.optarg, NULL, 0);
+          if ( n < 1 ) {
+            fprintf (stderr, "Invalid thread count '%s'\n", ps.optarg);
+            retval = EXIT_FAILURE;
+            goto cleanup;
+          }
+          threads = realloc (threads, sizeof (unsigned int) * (threads_length + 1));
+          threads[threads_length++] = (unsigned int) n;
+        }
+        break;
+      case 'T':
+        min_time = strtod (ps.optarg, NULL);
+        break;
+      case 'f':
+        if ( strcmp (ps.optarg, "text") == 0 ) {
+          report.format = BENCHMARK_FORMAT_TEXT;
+        } else if ( strcmp (ps.optarg, "csv") == 0 ) {
+          report.format = BENCHMARK_FORMAT_CSV;
+        } else if ( strcmp (ps.optarg, "json") == 0 ) {
+          report.format = BENCHMARK_FORMAT_JSON;
+        } else {
+          fprintf (stderr, "Unknown format '%s'\n", ps.optarg);
+          retval = EXIT_FAILURE;
+          goto cleanup;
+        }
+        break;
+      case 'o':
+        output_name = ps.optarg;
+        break;
+      case 'O':
+        report.overhead = true;
+        break;
+      case 'F':
+        report.file_open = true;
+        break;
+      case 'S':
+        report.splice = true;
+        break;
+      case 'h':
+        print_help_and_exit (argc, argv, EXIT_SUCCESS);
+        break;
+      case 'V':
+        print_version_and_exit (argc, argv, EXIT_SUCCESS);
+        break;
+      default:
+        print_help_and_exit (argc, argv, EXIT_FAILURE);
+        break;
+    }
+  }
+
+  if ( ps.optind >= argc && !report.overhead && !report.file_open ) {
+    fprintf (stderr, "You must provide at least one corpus directory or file.\n");
+    retval = EXIT_FAILURE;
+    goto cleanup;
+  }
+
+  for ( ; ps.optind < argc ; ps.optind++)
+    benchmark_corpus_load (&files, &files_length, argv[ps.optind]);
+
+  if ( files_length == 0 && !report.overhead && !report.file_open ) {
+    fprintf (stderr, "No input files found.\n");
+    retval = EXIT_FAILURE;
+    goto cleanup;
+  }
+  if ( files_length != 0 )
+    qsort (files, files_length, sizeof (BenchmarkFile), benchmark_file_compare);
+
+  if ( codecs.length == 0 ) {
+    squash_foreach_codec (benchmark_codec_list_add, &codecs);
+    qsort (codecs.codecs, codecs.length, sizeof (SquashCodec*), benchmark_codec_compare);
+  }
+
+  if ( threads_length == 0 ) {
+    threads = malloc (sizeof (unsigned int));
+    threads[threads_length++] = 1;
+  }
+
+  if ( output_name != NULL ) {
+    report.output = fopen (output_name, "w");
+    if ( report.output == NULL ) {
+      perror ("Unable to open output file");
+      retval = EXIT_FAILURE;
+      goto cleanup;
+    }
+  }
+
+  benchmark_report_begin (&report);
+
+  if (report.overhead) {
+    for (size_t c = 0 ; c < codecs.length ; c++) {
+      if (!benchmark_overhead (&report, codecs.codecs[c], threads, threads_length, min_time))
+        retval = EXIT_FAILURE;
+    }
+  } else if (report.file_open) {
+    for (size_t c = 0 ; c < codecs.length ; c++) {
+      if (!benchmark_file_open (&report, codecs.codecs[c], min_time))
+        retval = EXIT_FAILURE;
+    }
+  } else if (report.splice) {
+    for (size_t f = 0 ; f < files_length ; f++) {
+      for (size_t c = 0 ; c < codecs.length ; c++) {
+        if (!benchmark_splice (&report, files + f, codecs.codecs[c], min_time))
+          retval = EXIT_FAILURE;
+      }
+    }
+  } else for (size_t f = 0 ; f < files_length ; f++) {
+    for (size_t c = 0 ; c < codecs.length ; c++) {
+      if (!benchmark_file_with_codec (&report, files + f, codecs.codecs[c], threads, threads_length, min_time))
+        retval = EXIT_FAILURE;
+    }
+  }
+
+  benchmark_report_end (&report);
+
+ cleanup:
+
+  if (report.output != NULL && report.output != stdout)
+    fclose (report.output);
+
+  for (size_t f = 0 ; f < files_length ; f++) {
+    free (files[f].name);
+    free (files[f].data);
+  }
+  free (files);
+  free (codecs.codecs);
+  free (threads);
+
+  return retval;
+}